@@ -36,6 +36,19 @@ static uint32_t package_sent = 0;
 static uint8_t ble_command;
 static bool command_received = false;
 
+// package being filled by the streaming sink, same layout as the packages of pack_sweep_data
+static uint8_t stream_package[BLE_NUS_MAX_DATA_LEN];
+static uint16_t stream_size;
+
+// encoders of the staged sweep and of the streaming sink, the packages carry the coded stream of sweepCodec.c
+static SweepEncoder package_encoder;
+static SweepEncoder stream_encoder;
+
+static bool ble_stream_begin(SweepSink *sink, MetaData const *meta);
+static bool ble_stream_point(SweepSink *sink, uint32_t freq, uint16_t real, uint16_t imag);
+static bool ble_stream_end(SweepSink *sink, MetaData *meta, bool success);
+static void ble_stream_send(void);
+
 /*
 This function will check the connection.
 */
@@ -150,61 +163,123 @@ void ble_unstage_sweep(void)
   meta_data_ptr = NULL;
 }
 
+/* This function fills the next package of the staged sweep. The first byte is BLE_PACKAGE_CODED, the rest
+ * is the next part of the sweep coded with sweepCodec.c, so a package holds many more points than the
+ * 8 bytes each they would take raw. The coded stream runs on from package to package, start_freq 0
+ * starts a new one. stop_freq is the number of points coded so far, the last package may be empty.
+ */
 PackageInfo pack_sweep_data(uint16_t start_freq, MetaData *meta_data, uint32_t *freq, int16_t *real, int16_t *imag)
 {
 	PackageInfo package_info = {
 		.ptr = package,
 		.start_freq = start_freq,
 		.stop_freq = start_freq,
-		.package_size = 0
+		.package_size = 1
 	};
 	
-	for (uint16_t i=0; i < start_freq; i++)
+	if (start_freq == 0)
 	{
-		freq++;
-		real++;
-		imag++;
+		sweepCodec_initEncoder(&package_encoder);
 	}
 	
-	static uint16_t current_size; 
-	static uint8_t *data_ptr, *package_ptr;
+	package[0] = BLE_PACKAGE_CODED;
 	
-	package_ptr = package_info.ptr;
-	package_ptr++;
-	for (package_info.package_size=1; package_info.package_size+8 < BLE_NUS_MAX_DATA_LEN && package_info.stop_freq < meta_data->numPoints;)
+	// the bytes left from the last package go first, then points are coded until the package is full
+	package_info.package_size += sweepCodec_take(&package_encoder, &package[package_info.package_size], BLE_NUS_MAX_DATA_LEN - package_info.package_size);
+	while (package_info.package_size < BLE_NUS_MAX_DATA_LEN && package_info.stop_freq < meta_data->numPoints)
 	{
-		data_ptr = (uint8_t *)freq;
-		for (current_size=package_info.package_size; package_info.package_size < current_size+4; package_info.package_size++) {
-			*package_ptr = *data_ptr;
-			data_ptr++;
-			package_ptr++;
-		}
-		
-		
-		data_ptr = (uint8_t *)real;
-		for (current_size=package_info.package_size; package_info.package_size < current_size+2; package_info.package_size++) {
-			*package_ptr = *data_ptr;
-			data_ptr++;
-			package_ptr++;
-		}
+		sweepCodec_encode(&package_encoder, freq[package_info.stop_freq], real[package_info.stop_freq], imag[package_info.stop_freq]);
+		package_info.stop_freq++;
 		
+		package_info.package_size += sweepCodec_take(&package_encoder, &package[package_info.package_size], BLE_NUS_MAX_DATA_LEN - package_info.package_size);
+	}
+	
+	// code the last block once every point is in
+	if (package_info.stop_freq >= meta_data->numPoints && sweepCodec_finish(&package_encoder))
+	{
+		package_info.package_size += sweepCodec_take(&package_encoder, &package[package_info.package_size], BLE_NUS_MAX_DATA_LEN - package_info.package_size);
+	}
+	
+	return package_info;
+}
+
+
+/* This function sets up a sink that sends the points of a sweep over BLE as they are measured.
+ * The metadata goes first, then packages in the same format as pack_sweep_data, each sent as
+ * soon as it is full, so the sweep never has to be staged in RAM.
+ */
+void ble_stream_sweep_init(SweepSink *sink)
+{
+	sink->begin = ble_stream_begin;
+	sink->point = ble_stream_point;
+	sink->end = ble_stream_end;
+	sink->context = &stream_encoder;
+	sink->count = 0;
+}
+
+static bool ble_stream_begin(SweepSink *sink, MetaData const *meta)
+{
+	if (ble_check_connection() == BLE_CON_DEAD)
+	{
+		return false;
+	}
+	
+	// numPoints is the number of points expected
+	MetaData meta_data = *meta;
+	send_meta_data_ble(&meta_data);
+	
+	sweepCodec_initEncoder(&stream_encoder);
+	stream_package[0] = BLE_PACKAGE_CODED;
+	stream_size = 1;
+	return true;
+}
+
+static bool ble_stream_point(SweepSink *sink, uint32_t freq, uint16_t real, uint16_t imag)
+{
+	if (ble_check_connection() == BLE_CON_DEAD)
+	{
+		return false;
+	}
+	
+	if (!sweepCodec_encode(&stream_encoder, freq, (int16_t)real, (int16_t)imag))
+	{
+		return false;
+	}
+	
+	ble_stream_send();
+	return true;
+}
+
+static bool ble_stream_end(SweepSink *sink, MetaData *meta, bool success)
+{
+	// code the last block, then send what is left in the last package
+	if (ble_check_connection() == BLE_CON_ALIVE && sweepCodec_finish(&stream_encoder))
+	{
+		ble_stream_send();
 		
-		data_ptr = (uint8_t *)imag;
-		for (current_size=package_info.package_size; package_info.package_size < current_size+2; package_info.package_size++) {
-			*package_ptr = *data_ptr;
-			data_ptr++;
-			package_ptr++;
+		if (stream_size > 1)
+		{
+			send_package_ble(stream_package, stream_size);
 		}
-		
-		freq++;
-		real++;
-		imag++;
-		package_info.stop_freq++;
 	}
-	*package_info.ptr = package_info.stop_freq - package_info.start_freq;
-	return package_info;
+	stream_size = 1;
+	
+	NRF_LOG_INFO("Streamed %d points", sink->count);
+	return true;
 }
 
+// moves the coded bytes into the stream package, sending each package once it is full
+static void ble_stream_send(void)
+{
+	stream_size += sweepCodec_take(&stream_encoder, &stream_package[stream_size], BLE_NUS_MAX_DATA_LEN - stream_size);
+	
+	while (stream_size == BLE_NUS_MAX_DATA_LEN)
+	{
+		send_package_ble(stream_package, stream_size);
+		stream_size = 1;
+		stream_size += sweepCodec_take(&stream_encoder, &stream_package[stream_size], BLE_NUS_MAX_DATA_LEN - stream_size);
+	}
+}
 
 void send_meta_data_ble(MetaData *meta_data)
 {
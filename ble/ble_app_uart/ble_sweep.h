@@ -40,6 +40,7 @@ Description: A header file contains fucntions and parameters for transfering swe
 #include "nrf_log_default_backends.h"
 
 #include "sweep.h"
+#include "sweepCodec.h"
 
 
 #define APP_BLE_CONN_CFG_TAG            1                                           /**< A tag identifying the SoftDevice BLE configuration. */
@@ -70,6 +71,8 @@ Description: A header file contains fucntions and parameters for transfering swe
 #define BLE_CON_ALIVE					1
 
 #define BLE_TRANSFER_IN_PROGRESS		1
+#define BLE_PACKAGE_CODED               0xFF                                        /**< First byte of a package of coded points (sweepCodec.c), 0 is metadata. */
+
 #define BLE_TRANSFER_COMPLETE 			0
 
 #ifdef BLE_DEV
@@ -90,6 +93,7 @@ bool ble_stage_sweep(uint32_t *freq, int16_t *real, int16_t *imag, MetaData *met
 void ble_unstage_sweep(void);
 void send_package_ble(uint8_t *package, uint16_t package_size);
 PackageInfo pack_sweep_data(uint16_t start_freq, MetaData *meta_data, uint32_t *freq, int16_t *real, int16_t *imag);
+void ble_stream_sweep_init(SweepSink *sink);
 uint8_t ble_check_connection(void);
 bool ble_check_command(void);
 uint8_t ble_command_handler(void);
@@ -19,7 +19,7 @@
 typedef struct sweepData
 {
 	uint32_t time;
-	uint16_t temp;
+	int16_t temp;
 	uint32_t numPoints;
 } MetaData;
 
@@ -44,4 +44,15 @@ typedef struct sweepParams
 	// sweep metaData
 	MetaData metadata;
 } Sweep;
+
+// struct to hold a sweep sink, where the points of a sweep go as they are measured
+// (same as SweepSink in prototypeCode/AD5933.h)
+typedef struct sweepSink
+{
+  bool (*begin)(struct sweepSink * sink, MetaData const * metadata);
+  bool (*point)(struct sweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag);
+  bool (*end)(struct sweepSink * sink, MetaData * metadata, bool success);
+  void * context;      // state of the sink
+  uint32_t count;      // number of points the sink has taken
+} SweepSink;
 #endif
@@ -6,15 +6,41 @@ Description: A script for connecting ble.
 '''
 
 import asyncio
+import os
+import sys
 from bleak import BleakScanner
 from bleak import BleakClient
 from bleak.backends.device import BLEDevice
 from meta import MetaData
 from nordic import UUID_NORDIC_RX, UUID_NORDIC_TX, save_sweep
 
+# the decoder of the coded sweeps is shared with the USB test program
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'testProgram'))
+from sweepCodec import SweepDecoder
+
+PACKAGE_CODED = 0xFF # first byte of a package of coded points
 
 sweep = []
 meta_data = MetaData()
+decoder = SweepDecoder(0)
+
+def start_sweep():
+    '''
+        Starts decoding a new sweep once its meta data is in.
+    '''
+    global decoder
+    decoder = SweepDecoder(meta_data.n_freq)
+
+def append_coded(raw_data):
+    '''
+        Decodes a package of coded points, the points of every block it finishes go to the sweep.
+    '''
+    for freq, real, imag in decoder.feed(raw_data[1:]):
+        sweep.append({
+            'freq': freq,
+            'real': real,
+            'imag': imag
+        })
 
 def meta_callback(sender, raw_data):
     '''
@@ -24,7 +50,8 @@ def meta_callback(sender, raw_data):
     if message_type == 0: # Meta Data
         meta_data.n_freq = int.from_bytes(raw_data[1:5], byteorder='little', signed=False)
         meta_data.time = int.from_bytes(raw_data[5:9], byteorder='little', signed=False)
-        meta_data.temperature = int.from_bytes(raw_data[9:11], byteorder='little', signed=False)
+        meta_data.temperature = int.from_bytes(raw_data[9:11], byteorder='little', signed=True)
+        start_sweep()
 
 
 def sweep_callback(sender, raw_data):
@@ -32,6 +59,9 @@ def sweep_callback(sender, raw_data):
         Callback funtion for processing sweep data.
     '''
     message_type = raw_data[0]
+    if message_type == PACKAGE_CODED:
+        append_coded(raw_data)
+        return
     freq_got = int(message_type)
     for i in range(freq_got):
         base_index = i*8
@@ -55,7 +85,12 @@ def uart_data_received(sender, raw_data):
         print(f'Meta Data recieved')
         meta_data.n_freq = int.from_bytes(raw_data[1:5], byteorder='little', signed=False)
         meta_data.time = int.from_bytes(raw_data[5:9], byteorder='little', signed=False)
-        meta_data.temperature = int.from_bytes(raw_data[9:11], byteorder='little', signed=False)
+        meta_data.temperature = int.from_bytes(raw_data[9:11], byteorder='little', signed=True)
+        start_sweep()
+
+    elif message_type == PACKAGE_CODED:
+        print(f'Coded package of {len(raw_data) - 1} bytes')
+        append_coded(raw_data)
 
     else:
         freq_got = int(message_type)
@@ -7,25 +7,245 @@
  *
  */
 
+#include <string.h>
+
 #include "AD5933.h"
+#include "sweepSink.h"
+#include "twiManager.h"
+#ifdef AD5933_PPI_POLL
+#include "twiPoll.h"
+#endif
+#ifndef AD5933_SIM
 #include "usbManager.h"
+#endif
+
+// timer used to wake the CPU when the sweep engine has work to do
+APP_TIMER_DEF(m_sweep_timer);
+
+// timer used to wake the CPU if a TWI transfer does not finish
+APP_TIMER_DEF(m_twi_timer);
+
+// TWI traffic since the last AD5933_ResetTwiStats
+static TwiStats m_twi_stats;
+
+// use the fast acquisition path (coalesced data reads, CONTROL1 only increments)
+static bool m_fast_path = true;
+
+// sleep in __WFE while a TWI transfer is on the bus instead of spinning
+static bool m_twi_sleep = true;
+
+// how the sweep engine reads the status and data of each point (AD5933_BACKEND_)
+static uint8_t m_backend = AD5933_BACKEND_CPU;
+#ifdef AD5933_PPI_POLL
+static bool m_poll_ready = false;
+#endif
+
+// range and gain settings for auto ranging, from the most to the least signal at the DFT.
+// the scale is the relative size of the codes (x10), so a code can be predicted at another setting
+#define AUTO_RANGE_LEVELS 6
+static const uint8_t m_level_range[AUTO_RANGE_LEVELS] = {RANGE1, RANGE2, RANGE1, RANGE2, RANGE3, RANGE4};
+static const uint8_t m_level_gain[AUTO_RANGE_LEVELS]  = {GAIN5,  GAIN5,  GAIN1,  GAIN1,  GAIN1,  GAIN1};
+static const uint8_t m_level_scale[AUTO_RANGE_LEVELS] = {50,     25,     10,     5,      2,      1};
+
+// register the AD5933 address pointer is known to point to, POINTER_UNKNOWN if not known
+#define POINTER_UNKNOWN 0x00
+static uint8_t m_pointer = POINTER_UNKNOWN;
+
+// copy of the configuration registers CONTROL1 - NUM_CYCLES as they were last written, so writes
+// that would not change them can be skipped. Bit n of m_shadow_valid is set if register
+// SHADOW_BASE + n is known. A reset or a failed transfer clears them all
+#define SHADOW_BASE CONTROL1_REG
+#define SHADOW_SIZE (NUM_CYCLES_REG + 2 - CONTROL1_REG)
+static uint8_t m_shadow[SHADOW_SIZE];
+static uint16_t m_shadow_valid = 0;
+
+// pointer and shadow registers of the AD5933 on each mux channel, kept here while another channel
+// is selected. m_pointer and m_shadow belong to the selected AD5933
+typedef struct ad5933Channel
+{
+  uint8_t pointer;
+  uint8_t shadow[SHADOW_SIZE];
+  uint16_t shadowValid;
+} AD5933Channel;
+static AD5933Channel m_channels[MUX_CHANNELS];
+
+// the AD5933s are behind a TCA9548A mux, and the mux channel selected (MUX_NO_CHANNEL if none is or a select failed)
+static bool m_mux = false;
+static uint8_t m_channel = MUX_NO_CHANNEL;
+
+static void AD5933_TimerHandler(void * p_context);
+static void AD5933_Wait(SweepEngine * engine, uint32_t us);
+static bool AD5933_WaitElapsed(SweepEngine * engine);
+static uint32_t AD5933_Ticks(uint32_t us);
+static void AD5933_StartTimer(uint32_t ticks);
+static void AD5933_StartTemp(SweepEngine * engine);
+static void AD5933_FinishTemp(SweepEngine * engine);
+static void AD5933_SweepFinish(SweepEngine * engine, uint8_t state);
+static void AD5933_Accumulate(SweepEngine * engine, uint16_t * data);
+static void AD5933_Average(SweepEngine * engine, uint16_t * data);
+static int16_t AD5933_AverageSamples(int16_t * samples, uint8_t count, uint8_t average);
+static int16_t AD5933_DataCode(uint16_t * data, uint8_t index);
+static void AD5933_SetLevel(SweepEngine * engine, uint8_t level);
+static uint8_t AD5933_FindLevel(uint8_t range, uint8_t gain);
+static bool AD5933_AutoRange(SweepEngine * engine, uint16_t * data);
+static bool AD5933_RetryRead(SweepEngine * engine);
+static bool AD5933_RetryCommand(SweepEngine * engine, uint8_t command);
+static bool AD5933_Resync(SweepEngine * engine);
+static bool AD5933_Configure(SweepEngine * engine, Sweep * sweep);
+static void AD5933_WaitPoint(SweepEngine * engine, uint32_t us);
+static bool AD5933_PollDone(SweepEngine * engine);
+static bool AD5933_FinishPoll(SweepEngine * engine, uint8_t * status, uint16_t * data);
+static bool AD5933_PointCommand(SweepEngine * engine, uint8_t command);
+static uint32_t AD5933_TwiTimeout(uint8_t numbytes);
+static bool AD5933_TwiWait(uint8_t numbytes);
+static void AD5933_TwiTimerHandler(void * p_context);
+static bool AD5933_ShadowMatch(uint8_t const * data, uint8_t numbytes, uint8_t reg);
+static void AD5933_ShadowStore(uint8_t const * data, uint8_t numbytes, uint8_t reg);
+static bool AD5933_ShadowIdle(void);
+static bool AD5933_WriteConfig(uint8_t * buff, uint8_t numbytes, uint8_t reg);
+static bool AD5933_TwiTx(uint8_t * data, uint8_t numbytes);
+static bool AD5933_MuxTx(uint8_t control);
+static bool AD5933_MuxRx(uint8_t * control);
+#ifdef AD5933_PPI_POLL
+static bool AD5933_TwiXfer(nrf_drv_twi_xfer_desc_t const * xfer, uint8_t numbytes);
+#endif
+static bool AD5933_TwiRx(uint8_t * buff, uint8_t numbytes);
+
+// Creates the timers used by the sweep engine and the TWI transfers. app_timer must be initialized first (usbManager_init does this)
+// Return value:
+//  false if a timer could not be created
+//  true  if success
+bool AD5933_Init(void)
+{
+  // nothing is known about the registers until they are written
+  AD5933_InvalidateShadow();
+
+  if (app_timer_create(&m_sweep_timer, APP_TIMER_MODE_SINGLE_SHOT, AD5933_TimerHandler) != NRF_SUCCESS) return false;
+  return app_timer_create(&m_twi_timer, APP_TIMER_MODE_SINGLE_SHOT, AD5933_TwiTimerHandler) == NRF_SUCCESS;
+}
 
 // sweeps given sweep parameters and saves sweep data to arrays from the input arguments
+// This blocks until the sweep is done, use AD5933_SweepBegin and AD5933_SweepPoll to sweep in the background
 // Arguments: 
 //	* sweep: pointer to the sweep struct
 //	* freq:  pointer to the arrary to store frequency data
 //	* real:  pointer to the array to store real impedance
 //	* imag:  pointer to the array to store imaginary impedance
 // Return value:
+//  false if error with the sweep
+//  true  if sweep completed successfully
+bool AD5933_Sweep(Sweep * sweep, uint32_t * freq, uint16_t * real, uint16_t * imag)
+{
+  SweepEngine engine;
+
+  if (!AD5933_SweepBegin(&engine, sweep, freq, real, imag)) return false;
+
+  // sleep until the engine timer fires, then let the engine take its next step
+  while (AD5933_SweepPoll(&engine) < SWEEP_COMPLETE)
+  {
+    __WFE();
+  }
+
+  return AD5933_SweepComplete(&engine);
+}
+
+// Configures the AD5933 and starts settling at the start frequency. Returns without waiting,
+// call AD5933_SweepPoll whenever the CPU wakes up until it returns SWEEP_COMPLETE or SWEEP_ERROR
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+//	* sweep:  pointer to the sweep struct
+//	* freq:   pointer to the arrary to store frequency data
+//	* real:   pointer to the array to store real impedance
+//	* imag:   pointer to the array to store imaginary impedance
+// Return value:
 //  false if error with starting sweep
 //  true  if sweep started successfully
-bool AD5933_Sweep(Sweep * sweep, uint32_t * freq, uint16_t * real, uint16_t * imag)
+bool AD5933_SweepBegin(SweepEngine * engine, Sweep * sweep, uint32_t * freq, uint16_t * real, uint16_t * imag)
+{
+  // make sure there is somewhere to put the data
+  if (freq == NULL || real == NULL || imag == NULL)
+  {
+    engine->state = SWEEP_IDLE;
+    return false;
+  }
+
+  // the arrays hold one point per step
+  sweepSink_initRam(&engine->ramSink, &engine->ram, freq, real, imag, (uint32_t) sweep->steps + 1);
+
+  return AD5933_SweepBeginSink(engine, sweep, &engine->ramSink);
+}
+
+// Same as AD5933_SweepBegin, but each point is given to a sink as soon as it is measured instead of
+// being stored in arrays. The caller starts and ends the sink (sweepSink_begin and sweepSink_end)
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+//	* sweep:  pointer to the sweep struct
+//	* sink:   pointer to the sink to give the points to
+// Return value:
+//  false if error with starting sweep
+//  true  if sweep started successfully
+bool AD5933_SweepBeginSink(SweepEngine * engine, Sweep * sweep, SweepSink * sink)
+{
+  engine->sweep = sweep;
+  engine->sink  = sink;
+  engine->state = SWEEP_IDLE;
+  engine->keepPowered = false;
+  engine->tempPending = false;
+  engine->polling = false;
+
+  if (sink == NULL || sweep->repeats > AVERAGE_MAX_REPEATS) return false;
+
+  // count the TWI traffic of this sweep
+  AD5933_ResetTwiStats();
+  engine->remeasures = 0;
+
+  // start at the range and gain of the sweep, auto ranging moves from there
+  engine->range = sweep->range;
+  engine->gain  = sweep->gain;
+  if (sweep->autoRange) AD5933_SetLevel(engine, AD5933_FindLevel(sweep->range, sweep->gain));
+
+  // set up the AD5933, the writes are tried again once the bus is recovered if one fails
+  for (uint8_t retry = 0; !AD5933_Configure(engine, sweep); retry++)
+  {
+    if (retry >= TWI_POINT_RETRIES) return false;
+
+    m_twi_stats.retries += 1;
+    if (!twiManager_recover()) return false;
+  }
+
+  // reset current sweep values
+  sweep->currentStep = 0;
+  sweep->currentFrequency = sweep->start;
+  engine->repeat = 0;
+  engine->tries = 0;
+  engine->retries = 0;
+
+  // give the output 100 ms to settle, this should be more than enough settling time
+  engine->state = SWEEP_SETTLING;
+  AD5933_Wait(engine, SWEEP_SETTLE_MS * 1000);
+
+  // measure the temperature while the output settles, so it costs no time
+  AD5933_StartTemp(engine);
+
+  return true;
+}
+
+// Writes the setup of a sweep and initializes the AD5933 with the start frequency
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+//	* sweep:  pointer to the sweep struct
+// Return value:
+//  false if I2C error
+//  true  if no error
+static bool AD5933_Configure(SweepEngine * engine, Sweep * sweep)
 {
   // set the range, gain, clock source, and reset the AD5933
   // Although reseting the AD5933 puts it in standby mode (according to the datasheet), 
   // sending a reset command along with a no operation command will put the AD5933
   // in no operation mode upon reset instead of standby mode
-  if (!AD5933_SetControl(STANDBY, sweep->range, sweep->gain, sweep->clockSource, 1)) return false;
+  // The reset is skipped if the shadow registers show the AD5933 was left powered down or in
+  // standby, then only the registers that differ from the last sweep are written
+  if (!AD5933_SetControl(STANDBY, engine->range, engine->gain, sweep->clockSource, !AD5933_ShadowIdle())) return false;
 
   // set the start frequency
   if (!AD5933_SetStart(sweep->start, sweep->clockFrequency)) return false;
@@ -40,82 +260,950 @@ bool AD5933_Sweep(Sweep * sweep, uint32_t * freq, uint16_t * real, uint16_t * im
   if (!AD5933_SetCycles(sweep->cycles, sweep->cyclesMultiplier)) return false;
 
   // initialize sweep with start frequency (AD5933 should already be in standby mode from the reset earlier)
-  if (!AD5933_SetControl(INIT_START_FREQ, sweep->range, sweep->gain, sweep->clockSource, 0)) return false;
+  return AD5933_SetControl(INIT_START_FREQ, engine->range, engine->gain, sweep->clockSource, 0);
+}
+
+// Starts another sweep right after one that finished with keepPowered set, without resetting
+// the AD5933 or powering down its output. Only the registers that differ from the previous
+// sweep are written (see AD5933_WriteConfig), and the settle time is shorter.
+// The points go to the same sink as the previous sweep, after its points
+// Arguments: 
+//	* engine: pointer to the engine that ran the previous sweep
+//	* sweep:  pointer to the sweep struct, must not be the struct of the previous sweep
+// Return value:
+//  false if error with starting sweep
+//  true  if sweep started successfully
+bool AD5933_SweepChain(SweepEngine * engine, Sweep * sweep)
+{
+  Sweep * previous = engine->sweep;
+
+  engine->sweep = sweep;
+  engine->state = SWEEP_IDLE;
+
+  if (sweep->repeats > AVERAGE_MAX_REPEATS) return false;
+
+  // auto ranging carries on from the setting of the last point, the next frequency is close by
+  if (!sweep->autoRange)
+  {
+    engine->range = sweep->range;
+    engine->gain  = sweep->gain;
+  }
+  else if (!previous->autoRange)
+  {
+    AD5933_SetLevel(engine, AD5933_FindLevel(sweep->range, sweep->gain));
+  }
+
+  // back to standby, CONTROL2 (clock source) stays the same
+  if (!AD5933_SetCommand(STANDBY, engine->range, engine->gain)) return false;
+
+  // only the registers that changed are written
+  if (!AD5933_SetStart(sweep->start, sweep->clockFrequency)) return false;
+  if (!AD5933_SetDelta(sweep->delta, sweep->clockFrequency)) return false;
+  if (!AD5933_SetSteps(sweep->steps)) return false;
+  if (!AD5933_SetCycles(sweep->cycles, sweep->cyclesMultiplier)) return false;
+
+  // initialize sweep with start frequency
+  if (!AD5933_SetCommand(INIT_START_FREQ, engine->range, engine->gain)) return false;
+
+  // reset current sweep values
+  sweep->currentStep = 0;
+  sweep->currentFrequency = sweep->start;
+  engine->repeat = 0;
+  engine->tries = 0;
+  engine->retries = 0;
+
+  // the output was never turned off so it only needs a short time to settle at the new start
+  engine->state = SWEEP_SETTLING;
+  AD5933_Wait(engine, SWEEP_CHAIN_SETTLE_MS * 1000);
+
+  return true;
+}
+
+// Runs the next step of a sweep started with AD5933_SweepBegin if its wait has elapsed.
+// Each call does at most one point worth of TWI transactions and never delays
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+// Return value:
+//  the SWEEP_ state of the engine
+uint8_t AD5933_SweepPoll(SweepEngine * engine)
+{
+  // only a settling or measuring sweep has work to do
+  if (!AD5933_SweepRunning(engine)) return engine->state;
+
+  // read the temperature measured during the settle time once it is ready
+  if (engine->tempPending && app_timer_cnt_diff_compute(app_timer_cnt_get(), engine->waitStart) >= engine->tempTicks)
+  {
+    AD5933_FinishTemp(engine);
+  }
+
+  // not time for the next step yet, a PPI poll that is done ends the wait early
+  if (!AD5933_WaitElapsed(engine) && !AD5933_PollDone(engine)) return engine->state;
+
+  Sweep * sweep = engine->sweep;
+
+  // the start frequency has settled, start the frequency sweep
+  if (engine->state == SWEEP_SETTLING)
+  {
+    if (!AD5933_RetryCommand(engine, START_SWEEP))
+    {
+      AD5933_SweepFinish(engine, SWEEP_ERROR);
+      return engine->state;
+    }
+
+#ifdef DEBUG_TWI
+    NRF_LOG_INFO("Sweep start success");
+    NRF_LOG_FLUSH();
+#endif
+
+    // sleep until the first point should be ready
+    engine->state = SWEEP_MEASURING;
+    AD5933_WaitPoint(engine, AD5933_PointTime(sweep, sweep->currentFrequency));
+    return engine->state;
+  }
 
-  // delay 100 ms, this should be more than enough settling time
-  nrf_delay_ms(100);
+  uint8_t AD5933_status; // stores the AD5933 status
+  uint16_t data[2];      // buffer to hold the impedance data
+  bool polled = engine->polling; // the PPI poll has read the status and data
+
+  // check if the measurement is done, a failed read is tried again once the bus is recovered
+  if (!(polled ? AD5933_FinishPoll(engine, &AD5933_status, data) : AD5933_ReadStatus(&AD5933_status)))
+  {
+    if (!AD5933_RetryRead(engine)) AD5933_SweepFinish(engine, SWEEP_ERROR);
+    return engine->state;
+  }
+
+  // measurement later than predicted, check again shortly
+  if ((AD5933_status & STATUS_DATA) != STATUS_DATA)
+  {
+    AD5933_WaitPoint(engine, SWEEP_REPOLL_US);
+    return engine->state;
+  }
+
+  // read the impedance data, the data stays valid until the next command so a failed read can be tried again
+  if (!polled && !AD5933_ReadData(data))
+  {
+#ifdef DEBUG_TWI
+    NRF_LOG_INFO("Read Data Fail");
+    NRF_LOG_FLUSH();
+#endif
+    if (!AD5933_RetryRead(engine)) AD5933_SweepFinish(engine, SWEEP_ERROR);
+    return engine->state;
+  }
+
+  // stop if the AD5933 gives more points than were asked for
+  if (sweep->currentStep > sweep->steps)
+  {
+    AD5933_SweepFinish(engine, SWEEP_ERROR);
+    return engine->state;
+  }
 
-  // start the frequency sweep
-  if (!AD5933_SetControl(START_SWEEP, sweep->range, sweep->gain, sweep->clockSource, 0)) return false;
+  // measure the point again at another range or gain if it saturated or was too small,
+  // this is decided on the first measurement so the repeats all use the same setting
+  if (sweep->autoRange && engine->repeat == 0 && AD5933_AutoRange(engine, data))
+  {
+    // one CONTROL1 write changes the setting and repeats the point
+    if (!AD5933_RetryCommand(engine, REPEAT_FREQ))
+    {
+      AD5933_SweepFinish(engine, SWEEP_ERROR);
+      return engine->state;
+    }
+
+    AD5933_WaitPoint(engine, AD5933_PointTime(sweep, sweep->currentFrequency));
+    return engine->state;
+  }
+
+  // measure the point again until it has been measured sweep->repeats times, then average
+  if (sweep->repeats > 1)
+  {
+    AD5933_Accumulate(engine, data);
+
+    if (engine->repeat < sweep->repeats)
+    {
+      if (!AD5933_RetryCommand(engine, REPEAT_FREQ))
+      {
+        AD5933_SweepFinish(engine, SWEEP_ERROR);
+        return engine->state;
+      }
+
+      // sleep until the repeat should be ready
+      AD5933_WaitPoint(engine, AD5933_PointTime(sweep, sweep->currentFrequency));
+      return engine->state;
+    }
+
+    AD5933_Average(engine, data);
+  }
 
 #ifdef DEBUG_TWI
-  NRF_LOG_INFO("Sweep start success");
+  NRF_LOG_INFO("Freq: %d Real: %d Imag: %d", sweep->currentFrequency, data[0], data[1]);
   NRF_LOG_FLUSH();
 #endif
 
-  // reset current sweep values
+  // record the setting of the point with its frequency
+  uint32_t freq = sweep->currentFrequency;
+  if (sweep->autoRange) freq |= (uint32_t) POINT_SETTING(engine->range, engine->gain) << POINT_SETTING_SHIFT;
+  engine->tries = 0;
+  engine->retries = 0;
+
+  // give the point to the sink
+  if (!sweepSink_point(engine->sink, freq, data[0], data[1]))
+  {
+    AD5933_SweepFinish(engine, SWEEP_ERROR);
+    return engine->state;
+  }
+
+  // update sweep status
+  sweep->currentStep += 1;
+  sweep->currentFrequency += sweep->delta;
+
+  // the AD5933 sets the done bit along with the data bit of the last point
+  if ((AD5933_status & STATUS_DONE) == STATUS_DONE)
+  {
+    AD5933_SweepFinish(engine, SWEEP_COMPLETE);
+    return engine->state;
+  }
+
+  // increment the sweep, if the increment fails the sweep is started again at the next point
+  if (!AD5933_PointCommand(engine, INCREMENT_FREQ))
+  {
+    if (!AD5933_Resync(engine)) AD5933_SweepFinish(engine, SWEEP_ERROR);
+    return engine->state;
+  }
+
+  // sleep until the next point should be ready
+  AD5933_WaitPoint(engine, AD5933_PointTime(sweep, sweep->currentFrequency));
+  return engine->state;
+}
+
+// Finishes a sweep after AD5933_SweepPoll returned SWEEP_COMPLETE or SWEEP_ERROR and returns the engine to idle
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+// Return value:
+//  false if the sweep failed
+//  true  if the sweep completed successfully
+bool AD5933_SweepComplete(SweepEngine * engine)
+{
+  bool success = (engine->state == SWEEP_COMPLETE);
+
+  // stop a sweep that is still running
+  if (AD5933_SweepRunning(engine)) AD5933_SweepFinish(engine, SWEEP_ERROR);
+
+  engine->state = SWEEP_IDLE;
+
+  return success;
+}
+
+// Checks if the engine is in the middle of a sweep
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+// Return value:
+//  true if the sweep is settling or measuring
+bool AD5933_SweepRunning(SweepEngine * engine)
+{
+  return (engine->state == SWEEP_SETTLING) || (engine->state == SWEEP_MEASURING);
+}
+
+// Predicts how long the AD5933 takes to measure one point after a START_SWEEP, INCREMENT_FREQ or REPEAT_FREQ:
+// the settling cycles of the output at freq followed by the 1024 sample DFT
+// Arguments: 
+//	* sweep: pointer to the sweep struct (cycles, cyclesMultiplier and clockFrequency are used)
+//	freq:    the frequency of the point in Hz
+// Return value:
+//  the time until the point's data is ready in us
+uint32_t AD5933_PointTime(Sweep * sweep, uint32_t freq)
+{
+  uint32_t multiplier;
+
+  switch (sweep->cyclesMultiplier)
+  {
+    case TIMES2: multiplier = 2; break;
+    case TIMES4: multiplier = 4; break;
+    default:     multiplier = 1; break;
+  }
+
+  // settling time, rounded up
+  uint64_t settle = 0;
+  if (freq != 0) settle = ((uint64_t) sweep->cycles * multiplier * 1000000 + freq - 1) / freq;
+
+  // DFT time, rounded up
+  uint64_t dft = ((uint64_t) DFT_SAMPLES * ADC_CLK_DIV * 1000000 + sweep->clockFrequency - 1) / sweep->clockFrequency;
+
+  return (uint32_t) (settle + dft);
+}
+
+// Selects between the fast acquisition path and the original register by register path
+// The fast path reads the status with a single receive byte when the pointer is already at STATUS_REG,
+// reads both data registers with one 4 byte block read, and only writes CONTROL1 to increment
+// Arguments: 
+//	enable: true to use the fast path
+void AD5933_SetFastPath(bool enable)
+{
+  m_fast_path = enable;
+}
+
+// Selects between sleeping in __WFE and spinning while a TWI transfer is on the bus
+// Spinning keeps the CPU running for the whole transfer, it is only kept to compare against
+// Arguments: 
+//	enable: true to sleep
+void AD5933_SetTwiSleep(bool enable)
+{
+  m_twi_sleep = enable;
+}
+
+// Forgets the shadow copy of the configuration registers, so the next sweep resets the AD5933 and
+// writes all of them. Call this if the AD5933 lost power or its registers were changed some other way
+void AD5933_InvalidateShadow(void)
+{
+  m_shadow_valid = 0;
+
+  for (uint8_t i = 0; i < MUX_CHANNELS; i++) m_channels[i].shadowValid = 0;
+}
+
+// Selects how the sweep engine reads the status and data of each point. AD5933_BACKEND_PPI lets a
+// TIMER and PPI start the reads so the CPU only wakes when a point has been read, it needs
+// AD5933_PPI_POLL defined and the TWI driver running (twiManager_init)
+// Arguments: 
+//	backend: AD5933_BACKEND_CPU or AD5933_BACKEND_PPI
+// Return value:
+//  false if the backend is not available
+//  true  if success
+bool AD5933_SetBackend(uint8_t backend)
+{
+#ifdef AD5933_PPI_POLL
+  if (backend == AD5933_BACKEND_PPI && !m_poll_ready)
+  {
+    m_poll_ready = twiPoll_init();
+    if (!m_poll_ready) return false;
+  }
+#else
+  if (backend == AD5933_BACKEND_PPI) return false;
+#endif
+
+  m_backend = backend;
+  return true;
+}
+
+// Gets how the sweep engine reads the status and data of each point
+// Return value:
+//  AD5933_BACKEND_CPU or AD5933_BACKEND_PPI
+uint8_t AD5933_GetBackend(void)
+{
+  return m_backend;
+}
+
+// Tells the driver the AD5933s sit behind a TCA9548A mux, one on each channel. Call this before
+// twiManager_init, the bus speeds are then probed on the mux (see AD5933_Probe)
+// Arguments: 
+//	enable: true if there is a mux
+void AD5933_UseMux(bool enable)
+{
+  m_mux = enable;
+  m_channel = MUX_NO_CHANNEL;
+}
+
+// Routes the bus to the AD5933 on a channel of the TCA9548A mux. The pointer and shadow registers of
+// the AD5933 that was selected are put away and those of the new one are brought back, so each
+// AD5933 keeps its own. The mux is only written when the channel changes
+// Arguments: 
+//	channel: the mux channel (0 - MUX_CHANNELS - 1)
+// Return value:
+//  false if the channel is out of range or I2C error (no channel is selected then)
+//  true  if success
+bool AD5933_SelectChannel(uint8_t channel)
+{
+  if (!m_mux || channel >= MUX_CHANNELS) return false;
+
+  // the bus already goes to the channel
+  if (channel == m_channel) return true;
+
+  // put away the state of the selected AD5933
+  if (m_channel != MUX_NO_CHANNEL)
+  {
+    m_channels[m_channel].pointer = m_pointer;
+    m_channels[m_channel].shadowValid = m_shadow_valid;
+    memcpy(m_channels[m_channel].shadow, m_shadow, SHADOW_SIZE);
+  }
+
+  // nothing is known about the AD5933s until a channel is selected
+  m_channel = MUX_NO_CHANNEL;
+  m_pointer = POINTER_UNKNOWN;
+  m_shadow_valid = 0;
+
+  if (!AD5933_MuxTx(1 << channel)) return false;
+
+  m_pointer = m_channels[channel].pointer;
+  m_shadow_valid = m_channels[channel].shadowValid;
+  memcpy(m_shadow, m_channels[channel].shadow, SHADOW_SIZE);
+  m_channel = channel;
+
+  return true;
+}
+
+// Clears the TWI counters. AD5933_SweepBegin does this at the start of every sweep
+void AD5933_ResetTwiStats(void)
+{
+  memset(&m_twi_stats, 0, sizeof(m_twi_stats));
+}
+
+// Gets the TWI traffic since the counters were last cleared (for a sweep, the traffic of that sweep)
+// Arguments: 
+//	* stats: pointer to the struct to copy the counters to
+void AD5933_GetTwiStats(TwiStats * stats)
+{
+  *stats = m_twi_stats;
+}
+
+// Checks if AD5933_SweepPoll has work to do for an engine, so a caller running several engines only
+// talks to the AD5933s that need it
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+// Return value:
+//  true if the engine is running and its wait, temperature measurement or PPI poll is over
+bool AD5933_SweepDue(SweepEngine * engine)
+{
+  if (!AD5933_SweepRunning(engine)) return false;
+
+  if (engine->tempPending && app_timer_cnt_diff_compute(app_timer_cnt_get(), engine->waitStart) >= engine->tempTicks) return true;
+
+  return AD5933_WaitElapsed(engine) || AD5933_PollDone(engine);
+}
+
+// Gets how long until AD5933_SweepPoll has work to do for an engine
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+// Return value:
+//  the number of app_timer ticks left, 0 if the engine is due or not running
+uint32_t AD5933_SweepTicksLeft(SweepEngine * engine)
+{
+  if (!AD5933_SweepRunning(engine) || AD5933_PollDone(engine)) return 0;
+
+  uint32_t elapsed = app_timer_cnt_diff_compute(app_timer_cnt_get(), engine->waitStart);
+  uint32_t deadline = engine->waitTicks;
+
+  if (engine->tempPending && engine->tempTicks < deadline) deadline = engine->tempTicks;
+
+  return (elapsed < deadline) ? deadline - elapsed : 0;
+}
+
+// (Re)starts the sweep timer to wake the CPU when an engine is due. There is one sweep timer, so a
+// caller running several engines calls this for the engine with the fewest ticks left after polling them
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+void AD5933_SweepWake(SweepEngine * engine)
+{
+  if (!AD5933_SweepRunning(engine)) return;
+
+  AD5933_StartTimer(AD5933_SweepTicksLeft(engine));
+}
+
+// Puts the AD5933 in power down mode and ends the sweep with the given state
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+//	state:    SWEEP_COMPLETE or SWEEP_ERROR
+static void AD5933_SweepFinish(SweepEngine * engine, uint8_t state)
+{
+  Sweep * sweep = engine->sweep;
+
+  app_timer_stop(m_sweep_timer);
+
+#ifdef AD5933_PPI_POLL
+  // the bus must be free before the power down command
+  if (engine->polling && twiPoll_cancel()) AD5933_TwiWait(POLL_BYTES + 2);
+  engine->polling = false;
+#endif
+
+  // sweep is done, put the AD5933 in power down mode unless another sweep will be chained
+  if (state != SWEEP_COMPLETE || !engine->keepPowered)
+  {
+    AD5933_SetControl(POWER_DOWN, engine->range, engine->gain, sweep->clockSource, 0);
+  }
+
+  // save how many points were actually measured
+  sweep->metadata.numPoints = sweep->currentStep;
+
+  // reset sweep counters
   sweep->currentStep = 0;
   sweep->currentFrequency = sweep->start;
 
-  // start getting the data from the sweep
-  bool i2c_stats = true; // track twi success
-  uint8_t AD5933_status; // stores the AD5933 status
-	
-	uint16_t data[2]; // buffer to hold the impedance data
-
-  // read the AD5933 status
-  i2c_stats = AD5933_ReadStatus(&AD5933_status);
-
-  // read impedance data until sweep is complete or twi fail
-  while (((AD5933_status & STATUS_DONE) != STATUS_DONE) && i2c_stats)
-  {
-    // wait till measurement is done
-    do{
-			nrf_delay_ms(10);
-      i2c_stats = AD5933_ReadStatus(&AD5933_status);
-    } while (((AD5933_status & STATUS_DATA) != STATUS_DATA) && i2c_stats);
-
-    // read the impedance data
-    i2c_stats = AD5933_ReadData(data);
-		
-		if (!i2c_stats)
-		{
-#ifdef DEBUG_TWI
-			NRF_LOG_INFO("Read Data Fail");
-			NRF_LOG_FLUSH();
-#endif
-		}
-		else
-		{
-#ifdef DEBUG_TWI
-			NRF_LOG_INFO("Freq: %d Real: %d Imag: %d", sweep->currentFrequency, data[0], data[1]);
-			NRF_LOG_FLUSH();
-#endif
-		}
-		
-		// put the data into the given arrays
-		freq[sweep->currentStep] = sweep->currentFrequency;
-		real[sweep->currentStep] = data[0];
-		imag[sweep->currentStep] = data[1];
+  engine->state = state;
+}
+
+// Adds a measurement of the current point to the sums and samples of the engine
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+//	* data:   the real and imaginary data registers as read (big endian)
+static void AD5933_Accumulate(SweepEngine * engine, uint16_t * data)
+{
+  if (engine->repeat == 0)
+  {
+    engine->sum[0] = 0;
+    engine->sum[1] = 0;
+  }
+
+  for (uint8_t i = 0; i < 2; i++)
+  {
+    int16_t code = AD5933_DataCode(data, i);
+
+    engine->sum[i] += code;
+    engine->samples[i][engine->repeat] = code;
+  }
+
+  engine->repeat += 1;
+}
+
+// Replaces data with the average of the measurements of the current point, ready for the next point
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+//	* data:   buffer to store the averaged data registers (big endian, the same as AD5933_ReadData)
+static void AD5933_Average(SweepEngine * engine, uint16_t * data)
+{
+  uint8_t * bytes = (uint8_t *) data;
+  uint8_t count = engine->repeat;
+
+  for (uint8_t i = 0; i < 2; i++)
+  {
+    int32_t code;
+
+    if (engine->sweep->average == AVERAGE_MEAN)
+    {
+      // round half away from zero
+      int32_t sum = engine->sum[i];
+      code = (sum + (sum < 0 ? -(count / 2) : (count / 2))) / count;
+    }
+    else
+    {
+      code = AD5933_AverageSamples(engine->samples[i], count, engine->sweep->average);
+    }
+
+    bytes[2 * i]     = (code >> 8) & 0xFF;
+    bytes[2 * i + 1] = code & 0xFF;
+  }
+
+  engine->repeat = 0;
+}
+
+// Sorts the samples and returns their median or trimmed mean
+// Arguments: 
+//	* samples: the codes to average, sorted in place
+//	count:     the number of codes
+//	average:   AVERAGE_MEDIAN or AVERAGE_TRIMMED
+// Return value:
+//  the average code
+static int16_t AD5933_AverageSamples(int16_t * samples, uint8_t count, uint8_t average)
+{
+  // insertion sort, there are at most AVERAGE_MAX_REPEATS samples
+  for (uint8_t i = 1; i < count; i++)
+  {
+    int16_t sample = samples[i];
+    uint8_t j = i;
+
+    while (j > 0 && samples[j - 1] > sample)
+    {
+      samples[j] = samples[j - 1];
+      j--;
+    }
+    samples[j] = sample;
+  }
+
+  // the middle sample, or the mean of the two middle samples
+  if (average == AVERAGE_MEDIAN)
+  {
+    if (count & 1) return samples[count / 2];
+
+    int32_t sum = (int32_t) samples[count / 2 - 1] + samples[count / 2];
+    return (int16_t) ((sum + (sum < 0 ? -1 : 1)) / 2);
+  }
+
+  // the mean without the lowest and highest quarter of the samples
+  uint8_t trim = count / 4;
+  int32_t sum = 0;
+
+  for (uint8_t i = trim; i < count - trim; i++) sum += samples[i];
+
+  uint8_t kept = count - 2 * trim;
+  return (int16_t) ((sum + (sum < 0 ? -(kept / 2) : (kept / 2))) / kept);
+}
+
+// Converts a data register as read (big endian) to its code
+// Arguments: 
+//	* data: the real and imaginary data registers as read
+//	index:  0 for real, 1 for imaginary
+// Return value:
+//  the 16 bit two's complement code
+static int16_t AD5933_DataCode(uint16_t * data, uint8_t index)
+{
+  uint8_t * bytes = (uint8_t *) &data[index];
+
+  return (int16_t) ((bytes[0] << 8) | bytes[1]);
+}
+
+// Sets the range and gain of the engine to an auto range level
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+//	level:    index into the auto range settings
+static void AD5933_SetLevel(SweepEngine * engine, uint8_t level)
+{
+  engine->level = level;
+  engine->range = m_level_range[level];
+  engine->gain  = m_level_gain[level];
+}
+
+// Finds the auto range level of a range and gain
+// Return value:
+//  the index of the setting, or the RANGE1 GAIN1 level if the setting is not one of the levels
+static uint8_t AD5933_FindLevel(uint8_t range, uint8_t gain)
+{
+  for (uint8_t level = 0; level < AUTO_RANGE_LEVELS; level++)
+  {
+    if (m_level_range[level] == range && m_level_gain[level] == gain) return level;
+  }
+
+  return 2;
+}
+
+// Picks the range and gain for the current point from a measurement of it. A saturated point moves to
+// the next setting with less signal. A small point moves to the setting with the most signal
+// that keeps its predicted codes under AUTO_RANGE_TARGET
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+//	* data:   the real and imaginary data registers as read
+// Return value:
+//  true if the setting changed and the point should be measured again
+static bool AD5933_AutoRange(SweepEngine * engine, uint16_t * data)
+{
+  if (engine->tries >= AUTO_RANGE_TRIES) return false;
+
+  // the largest of the real and imaginary codes
+  int32_t real = AD5933_DataCode(data, 0);
+  int32_t imag = AD5933_DataCode(data, 1);
+  if (real < 0) real = -real;
+  if (imag < 0) imag = -imag;
+  int32_t peak = (real > imag) ? real : imag;
+
+  uint8_t level = engine->level;
+
+  if (peak >= AUTO_RANGE_HIGH)
+  {
+    // saturated, the real size is unknown so only go down one setting
+    if (level + 1 < AUTO_RANGE_LEVELS) level += 1;
+  }
+  else if (peak < AUTO_RANGE_LOW)
+  {
+    // go up to the most signal the point can take
+    while (level > 0 && peak * m_level_scale[level - 1] <= (int32_t) AUTO_RANGE_TARGET * m_level_scale[engine->level]) level -= 1;
+  }
+
+  if (level == engine->level) return false;
+
+  AD5933_SetLevel(engine, level);
+  engine->tries += 1;
+  engine->remeasures += 1;
+
+  return true;
+}
+
+// Recovers the bus after a status or data read of the current point failed and polls the point again
+// shortly. The AD5933 keeps measuring on its own, so the sweep carries on where it was
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+// Return value:
+//  false if the point has been retried TWI_POINT_RETRIES times or the bus could not be recovered
+//  true  if the read will be tried again
+static bool AD5933_RetryRead(SweepEngine * engine)
+{
+  if (engine->retries >= TWI_POINT_RETRIES) return false;
+
+  engine->retries += 1;
+  m_twi_stats.retries += 1;
+
+  if (!twiManager_recover()) return false;
+
+  AD5933_Wait(engine, SWEEP_REPOLL_US);
+  return true;
+}
+
+// Sends START_SWEEP or REPEAT_FREQ for the current point, recovering the bus and sending it again if the
+// transfer fails. Either only restarts the measurement of the point, so it does no harm if a failed
+// transfer reached the AD5933 anyway. INCREMENT_FREQ is not sent again, see AD5933_Resync
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+//	command:  START_SWEEP or REPEAT_FREQ
+// Return value:
+//  false if the command failed TWI_POINT_RETRIES + 1 times or the bus could not be recovered
+//  true  if the AD5933 got the command
+static bool AD5933_RetryCommand(SweepEngine * engine, uint8_t command)
+{
+  if (AD5933_PointCommand(engine, command)) return true;
+
+  for (uint8_t retry = 0; retry < TWI_POINT_RETRIES; retry++)
+  {
+    m_twi_stats.retries += 1;
+
+    if (!twiManager_recover()) return false;
+    if (AD5933_PointCommand(engine, command)) return true;
+  }
+
+  return false;
+}
+
+// Starts the sweep again at the next point after an INCREMENT_FREQ failed. The AD5933 may or may not have
+// got the increment, and the recovery can take longer than a point so the data bit does not tell, sending
+// it again could skip a point. Instead the start frequency is moved to the next point and the steps left
+// are measured as a new sweep, after a short settle like a chained sweep (AD5933_SweepChain)
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+// Return value:
+//  false if the bus could not be recovered or the registers written TWI_POINT_RETRIES times
+//  true  if the sweep is settling at the next point
+static bool AD5933_Resync(SweepEngine * engine)
+{
+  Sweep * sweep = engine->sweep;
+
+  for (uint8_t retry = 0; retry < TWI_POINT_RETRIES; retry++)
+  {
+    m_twi_stats.retries += 1;
+
+    if (!twiManager_recover()) continue;
+
+    if (AD5933_SetCommand(STANDBY, engine->range, engine->gain) &&
+        AD5933_SetStart(sweep->currentFrequency, sweep->clockFrequency) &&
+        AD5933_SetSteps(sweep->steps - sweep->currentStep) &&
+        AD5933_SetCommand(INIT_START_FREQ, engine->range, engine->gain))
+    {
+      engine->state = SWEEP_SETTLING;
+      AD5933_Wait(engine, SWEEP_CHAIN_SETTLE_MS * 1000);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Waits us microseconds for the status and data of the current point. With AD5933_BACKEND_PPI a
+// poll is armed to read them at the end of the wait, and the sweep timer is only a watchdog that
+// wakes the CPU if the poll never finishes
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+//	us:       the number of microseconds to wait
+static void AD5933_WaitPoint(SweepEngine * engine, uint32_t us)
+{
+#ifdef AD5933_PPI_POLL
+  // the block read of the poll starts at the pointer
+  if (m_backend == AD5933_BACKEND_PPI && AD5933_SetPointer(STATUS_REG) && twiPoll_arm(us, engine->poll))
+  {
+    engine->polling = true;
+    engine->waitStart = app_timer_cnt_get();
+    engine->waitTicks = AD5933_Ticks(us) + AD5933_TwiTimeout(POLL_BYTES + 2);
+
+    AD5933_StartTimer(engine->waitTicks);
+    return;
+  }
+#endif
+
+  AD5933_Wait(engine, us);
+}
+
+// Checks if the PPI poll of the current point has finished
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+// Return value:
+//  true if a poll was armed and is done
+static bool AD5933_PollDone(SweepEngine * engine)
+{
+#ifdef AD5933_PPI_POLL
+  return engine->polling && twiPoll_done();
+#else
+  UNUSED_PARAMETER(engine);
+  return false;
+#endif
+}
+
+// Takes the status and data of the current point from the PPI poll
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+//	* status: pointer to store the status
+//	* data:   buffer to store the real and imaginary data (raw bytes, as AD5933_ReadData)
+// Return value:
+//  false if the poll failed or did not finish before the watchdog
+//  true  if success
+static bool AD5933_FinishPoll(SweepEngine * engine, uint8_t * status, uint16_t * data)
+{
+#ifdef AD5933_PPI_POLL
+  engine->polling = false;
+  app_timer_stop(m_sweep_timer);
+
+  // the watchdog can run out while the transfer is still on the bus
+  if (twiPoll_cancel()) AD5933_TwiWait(POLL_BYTES + 2);
+
+  // count the transaction, the block read command and the read each have an address byte
+  m_twi_stats.transactions += 1;
+  m_twi_stats.bytes += POLL_BYTES + 4;
+
+  if (!m_xfer_done || twi_error)
+  {
+    m_pointer = POINTER_UNKNOWN;
+    m_shadow_valid = 0;
+    return false;
+  }
+
+  // a block read leaves the pointer where it was
+  m_pointer = STATUS_REG;
+
+  *status = engine->poll[0];
+  memcpy(data, &engine->poll[REAL_REG - STATUS_REG], 4);
+
+  return true;
+#else
+  UNUSED_PARAMETER(engine);
+  UNUSED_PARAMETER(status);
+  UNUSED_PARAMETER(data);
+  return false;
+#endif
+}
+
+// Sends START_SWEEP, REPEAT_FREQ or INCREMENT_FREQ for the current point. With AD5933_BACKEND_PPI the
+// pointer is moved back to STATUS_REG in the same transfer (a repeated start), ready for the next poll
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+//	command:  the control function of the AD5933
+// Return value:
+//  false if I2C error
+//  true  if no error
+static bool AD5933_PointCommand(SweepEngine * engine, uint8_t command)
+{
+  Sweep * sweep = engine->sweep;
+
+#ifdef AD5933_PPI_POLL
+  if (m_backend == AD5933_BACKEND_PPI)
+  {
+    uint8_t control[2] = {CONTROL1_REG, (command << 4) | ((engine->range << 1) | engine->gain)};
+    uint8_t pointer[2] = {SET_POINTER, STATUS_REG};
+    nrf_drv_twi_xfer_desc_t xfer = NRF_DRV_TWI_XFER_DESC_TXTX(AD5933_ADDR, control, sizeof(control), pointer, sizeof(pointer));
+
+    if (!AD5933_TwiXfer(&xfer, sizeof(control) + sizeof(pointer))) return false;
+
+    AD5933_ShadowStore(&control[1], 1, CONTROL1_REG);
+    m_pointer = STATUS_REG;
+    return true;
+  }
+#endif
+
+  // CONTROL2 does not change so the fast path only writes CONTROL1 to increment
+  if (command == START_SWEEP || (command == INCREMENT_FREQ && !m_fast_path))
+  {
+    return AD5933_SetControl(command, engine->range, engine->gain, sweep->clockSource, 0);
+  }
+
+  return AD5933_SetCommand(command, engine->range, engine->gain);
+}
+
+// Starts a wait of us microseconds. The sweep timer wakes the CPU when it is over
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+//	us:       the number of microseconds to wait, rounded up to app_timer ticks
+static void AD5933_Wait(SweepEngine * engine, uint32_t us)
+{
+  engine->waitStart = app_timer_cnt_get();
+  engine->waitTicks = AD5933_Ticks(us);
+
+  AD5933_StartTimer(engine->waitTicks);
+}
+
+// Converts microseconds to app_timer ticks, rounded up
+static uint32_t AD5933_Ticks(uint32_t us)
+{
+  return (uint32_t) (((uint64_t) us * (APP_TIMER_CLOCK_FREQ / (APP_TIMER_CONFIG_RTC_FREQUENCY + 1)) + 999999) / 1000000);
+}
+
+// (Re)starts the sweep timer to wake the CPU in ticks app_timer ticks
+static void AD5933_StartTimer(uint32_t ticks)
+{
+  // app_timer cannot time anything shorter than APP_TIMER_MIN_TIMEOUT_TICKS
+  if (ticks < APP_TIMER_MIN_TIMEOUT_TICKS) ticks = APP_TIMER_MIN_TIMEOUT_TICKS;
+
+  app_timer_stop(m_sweep_timer);
+  app_timer_start(m_sweep_timer, ticks, NULL);
+}
+
+// Starts a temperature measurement at the beginning of the settle wait and wakes the CPU when it
+// should be ready. The settle wait itself is unchanged
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+static void AD5933_StartTemp(SweepEngine * engine)
+{
+  // a sweep whose temperature can not be read does not keep a temperature from before
+  engine->sweep->metadata.temp = TEMP_UNKNOWN;
+
+  // the output keeps settling while the temperature is measured
+  engine->tempPending = AD5933_SetCommand(MEASURE_TEMP, engine->range, engine->gain);
+  if (!engine->tempPending) return;
+
+  engine->tempTicks = AD5933_Ticks(TEMP_CONVERT_US);
+  AD5933_StartTimer(engine->tempTicks);
+}
+
+// Reads the temperature started by AD5933_StartTemp into the sweep metadata, then sleeps for the
+// rest of the settle wait. If the temperature is not ready it is checked again shortly, unless
+// the settle wait is almost over. A temperature that can not be read is left TEMP_UNKNOWN
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+static void AD5933_FinishTemp(SweepEngine * engine)
+{
+  uint8_t status;
+  int temp;
+  uint32_t elapsed = app_timer_cnt_diff_compute(app_timer_cnt_get(), engine->waitStart);
+  uint32_t repoll = AD5933_Ticks(SWEEP_REPOLL_US);
+
+  if (AD5933_ReadStatus(&status) && (status & STATUS_TEMP) == STATUS_TEMP)
+  {
+    if (AD5933_ReadTemp(&temp)) engine->sweep->metadata.temp = (int16_t) temp;
+    engine->tempPending = false;
+  }
+  else if (elapsed + repoll < engine->waitTicks)
+  {
+    engine->tempTicks = elapsed + repoll;
+    AD5933_StartTimer(repoll);
+    return;
+  }
+  else
+  {
+    // no time left to wait for it, the temperature stays TEMP_UNKNOWN
+    engine->tempPending = false;
+  }
+
+  // sleep for the rest of the settle wait, counting the time the reads took
+  elapsed = app_timer_cnt_diff_compute(app_timer_cnt_get(), engine->waitStart);
+  if (elapsed < engine->waitTicks) AD5933_StartTimer(engine->waitTicks - elapsed);
+}
 
-    // increment the sweep
-    i2c_stats = AD5933_SetControl(INCREMENT_FREQ, sweep->range, sweep->gain, sweep->clockSource, 0);
-    // update sweep status
-    sweep->currentStep += 1;
-    sweep->currentFrequency += sweep->delta;
+// Checks if the wait started by AD5933_Wait is over
+// Arguments: 
+//	* engine: pointer to the engine that tracks the sweep
+// Return value:
+//  true if the wait is over
+static bool AD5933_WaitElapsed(SweepEngine * engine)
+{
+  return app_timer_cnt_diff_compute(app_timer_cnt_get(), engine->waitStart) >= engine->waitTicks;
+}
 
-    // check if the sweep is complete
-    i2c_stats = AD5933_ReadStatus(&AD5933_status);
-  }
+// Sweep timer handler. The interrupt wakes the CPU so the main loop can call AD5933_SweepPoll
+static void AD5933_TimerHandler(void * p_context)
+{
+  UNUSED_PARAMETER(p_context);
+}
 
-  // sweep is done, put the AD5933 in power down mode
-  i2c_stats = AD5933_SetControl(POWER_DOWN, sweep->range, sweep->gain, sweep->clockSource, 0);
-  // reset sweep counters
-  sweep->currentStep = 0;
-  sweep->currentFrequency = sweep->start;
+// calculates the 24 bit frequency code (freq / (clkFreq / CLK_DIV) * 2^27) rounded to the nearest code
+// Arguments: 
+//	freq    - The frequency in Hz (0 - 100kHz)
+//	clkFreq - The frequency of the AD5933 system clock
+// Return value:
+//  the frequency code
+uint32_t AD5933_FreqCode(uint32_t freq, uint32_t clkFreq)
+{
+  // the default clock uses the precalculated scale, a multiply and a shift
+  if (clkFreq == CLK_FREQ) return AD5933_FREQ_CODE(freq);
 
-  // sweep success
-  return true;
+  // any other clock needs a 64 bit division
+  return (uint32_t) (((((uint64_t) freq * CLK_DIV) << 27) + clkFreq / 2) / clkFreq);
 }
 
 // sets the start frequency of the frequency sweep
@@ -133,10 +1221,10 @@ bool AD5933_SetStart(uint32_t start, uint32_t clkFreq)
   uint8_t buff[3];
 
   // calculate start frequency code
-  start = ((float) start / (clkFreq / CLK_DIV)) * pow(2, 27);
+  start = AD5933_FreqCode(start, clkFreq);
 
-  // cut code into 3 uint8_ts (most significant 4 bits not needed)
-  buff[0] = (start >> 16) & 0x0F;
+  // cut code into 3 uint8_ts
+  buff[0] = (start >> 16) & 0xFF;
   buff[1] = (start >> 8) & 0xFF;
   buff[2] = start & 0xFF;
 
@@ -146,7 +1234,7 @@ bool AD5933_SetStart(uint32_t start, uint32_t clkFreq)
 #endif
 
   // write the buffer to the start frequency register
-  if (!AD5933_WriteBytes(buff, 3, START_FREQ_REG)) return false;
+  if (!AD5933_WriteConfig(buff, 3, START_FREQ_REG)) return false;
 
   return true;
 }
@@ -166,10 +1254,10 @@ bool AD5933_SetDelta(uint32_t delta, uint32_t clkFreq)
   uint8_t buff[3];
 
   // calculate delta frequency code
-  delta = ((float) delta / (clkFreq / CLK_DIV)) * pow(2, 27);
+  delta = AD5933_FreqCode(delta, clkFreq);
 
-  // cut code into 3 uint8_ts (most significant 4 bits not needed)
-  buff[0] = (delta >> 16) & 0x0F;
+  // cut code into 3 uint8_ts
+  buff[0] = (delta >> 16) & 0xFF;
   buff[1] = (delta >> 8) & 0xFF;
   buff[2] = delta & 0xFF;
 
@@ -179,7 +1267,7 @@ bool AD5933_SetDelta(uint32_t delta, uint32_t clkFreq)
 #endif
 
   // write the buffer to the delta frequency register
-  if (!AD5933_WriteBytes(buff, 3, DELTA_FREQ_REG)) return false;
+  if (!AD5933_WriteConfig(buff, 3, DELTA_FREQ_REG)) return false;
 
   return true;
 }
@@ -208,7 +1296,7 @@ bool AD5933_SetSteps(uint16_t steps)
 #endif
 
   // write the buffer to the number of steps register
-  if (!AD5933_WriteBytes(buff, 2, NUM_STEPS_REG)) return false;
+  if (!AD5933_WriteConfig(buff, 2, NUM_STEPS_REG)) return false;
 
   return true;
 }
@@ -229,7 +1317,8 @@ bool AD5933_SetCycles(uint16_t cycles, uint8_t multiplier)
   uint8_t buff[2];
 
   // assign bytes to buffer
-  buff[0] = ((cycles >> 8) & 0x01) | multiplier;
+  // the multiplier is bits D10-D9, above the ninth bit of cycles
+  buff[0] = ((cycles >> 8) & 0x01) | (multiplier << 1);
   buff[1] = cycles & 0xFF;
 
 #ifdef DEBUG_TWI_ALL
@@ -238,7 +1327,7 @@ bool AD5933_SetCycles(uint16_t cycles, uint8_t multiplier)
 #endif
 
   // write the buffer to the time cycles register
-  if (!AD5933_WriteBytes(buff, 2, NUM_CYCLES_REG)) return false;
+  if (!AD5933_WriteConfig(buff, 2, NUM_CYCLES_REG)) return false;
 
   // success
   return true;
@@ -260,7 +1349,8 @@ bool AD5933_SetControl(uint8_t command, uint8_t range, uint8_t gain, uint8_t clo
   uint8_t buff[2];
 
   // combine the commands
-  buff[0] = (command << 4) | ((range << 2) | gain);
+  // the range is bits 2:1 and the PGA gain is bit 0
+  buff[0] = (command << 4) | ((range << 1) | gain);
   buff[1] = (reset << 4) | (clock << 3);
 
 #ifdef DEBUG_TWI_ALL
@@ -269,9 +1359,29 @@ bool AD5933_SetControl(uint8_t command, uint8_t range, uint8_t gain, uint8_t clo
 #endif
 
   // write to each register one at a time (the datasheet specifies that a block write command cannot be used)
-  // check for error
+  // check for error. CONTROL1 is always written since the command is an action, CONTROL2 only if it changed
   if (!AD5933_Write(buff[0], CONTROL1_REG)) return false;
-  return AD5933_Write(buff[1], CONTROL2_REG);
+  if (!reset) return AD5933_WriteConfig(&buff[1], 1, CONTROL2_REG);
+  if (!AD5933_Write(buff[1], CONTROL2_REG)) return false;
+
+  // a reset leaves the registers in a state the shadow does not know, only the selected AD5933 is
+  // reset so the shadows the other mux channels keep stay valid
+  m_shadow_valid = 0;
+  return true;
+}
+
+// sets only the first control register of the AD5933. Use for commands that do not change
+// the clock source or reset bits in CONTROL2, like INCREMENT_FREQ and REPEAT_FREQ
+// Arguments: 
+//  command - the control function of the AD5933
+//	range   - output excitation voltage range
+//	gain		- PGA gain of the response signal
+// Return value:
+//  false if I2C error
+//  true if no error
+bool AD5933_SetCommand(uint8_t command, uint8_t range, uint8_t gain)
+{
+  return AD5933_Write((command << 4) | ((range << 1) | gain), CONTROL1_REG);
 }
 
 // reads the status of the AD5933 and puts the data into buff
@@ -286,7 +1396,15 @@ bool AD5933_ReadStatus(uint8_t * buff)
   bool status;
 
   // read the status byte
-  status = AD5933_ReadBytes(buff, 1, STATUS_REG);
+  if (m_fast_path)
+  {
+    // the pointer stays at STATUS_REG between polls so only a receive byte is needed
+    status = AD5933_SetPointer(STATUS_REG) && AD5933_ReadByte(buff);
+  }
+  else
+  {
+    status = AD5933_ReadBytes(buff, 1, STATUS_REG);
+  }
 
 #ifdef DEBUG_TWI_ALL
   NRF_LOG_INFO("Read 0x%x from register 0x%x", buff[0], STATUS_REG);
@@ -297,6 +1415,20 @@ bool AD5933_ReadStatus(uint8_t * buff)
   return status;
 }
 
+// Checks the bus works with a read from the first device on it: the control register of the mux
+// if the AD5933s are behind one (AD5933_UseMux), otherwise the status of the AD5933
+// Return value:
+//  false if I2C error
+//  true if no error
+bool AD5933_Probe(void)
+{
+  uint8_t buff;
+
+  if (m_mux) return AD5933_MuxRx(&buff);
+
+  return AD5933_ReadStatus(&buff);
+}
+
 // reads the temperature register of the AD5933 and converts it to celcius. Must first send a Measure Temperature command via AD5933_SetControl
 // Arguments: 
 //  * temp - the pointer to the integer that will store the temperature in Celcius
@@ -309,27 +1441,21 @@ bool AD5933_ReadTemp(int * temp)
   uint8_t buff[2];
 
   // read the temperature register
-  AD5933_ReadBytes(buff, 2, TEMP_REG);
+  if (!AD5933_ReadBytes(buff, 2, TEMP_REG)) return false;
 
 #ifdef DEBUG_TWI_ALL
   NRF_LOG_INFO("Read 0x%x%x from register 0x%x", buff[0], buff[1], TEMP_REG);
   NRF_LOG_FLUSH();
 #endif
 
-  // check if temp is negative
-  if ((buff[0] & 0x20))
-  {
-    *temp = -1;
-  }
-  else
-  {
-    // put the data into a 16 bit unsigned int
-    uint16_t num = buff[0];
-    num = (num << 8) | buff[1];
+  // the temperature is 14 bit two's complement in 1/32 degrees
+  int16_t code = ((buff[0] & 0x3F) << 8) | buff[1];
+
+  // sign extend negative temperatures (bit 13 set)
+  if (code & 0x2000) code -= 0x4000;
+
+  *temp = code / 32;
 
-    // calculate
-    *temp = num / 32;
-  }
   return true;
 }
 
@@ -341,6 +1467,9 @@ bool AD5933_ReadTemp(int * temp)
 //  true if no error
 bool AD5933_ReadData(uint16_t * data)
 {
+  // the real and imaginary registers are next to each other, the fast path reads both in one block read
+  if (m_fast_path) return AD5933_ReadBytes((uint8_t *) data, 4, REAL_REG);
+
   // read the data from the data register
   if (!AD5933_ReadBytes((uint8_t *) data, 2, REAL_REG)) return false;
   if (!AD5933_ReadBytes((uint8_t *) &data[1], 2, IMAG_REG)) return false;
@@ -387,11 +1516,14 @@ bool AD5933_WriteBytes(uint8_t * buff, uint8_t numbytes, uint8_t reg)
   // block 2 bytes from the temperature register
   if (!AD5933_BlockWrite(buff, numbytes)) return false;
 
+  AD5933_ShadowStore(buff, numbytes, reg);
+
   // success
   return true;
 }
 
 // Sets the internal pointer of the AD5933. Usually do this before block read or write
+// The write is skipped if the pointer is already known to point to reg
 // Arguments: 
 //  reg - The register to point to
 // Return value:
@@ -399,8 +1531,8 @@ bool AD5933_WriteBytes(uint8_t * buff, uint8_t numbytes, uint8_t reg)
 //  true if no error
 bool AD5933_SetPointer(uint8_t reg)
 {
-  // stores error code
-  ret_code_t err_code;
+  // the pointer is already there
+  if (m_pointer == reg) return true;
 
   // set data buffer
   uint8_t buff[2] = {SET_POINTER, reg};
@@ -411,17 +1543,9 @@ bool AD5933_SetPointer(uint8_t reg)
 #endif
 
   // send the data
-  m_xfer_done = false;
-  err_code = nrf_drv_twi_tx(&m_twi, AD5933_ADDR, buff, sizeof(buff), false);
-
-  // check for error
-  APP_ERROR_CHECK(err_code);
-
-  // wait for transfer to be done
-  while (m_xfer_done == false);
+  if (!AD5933_TwiTx(buff, sizeof(buff))) return false;
 
-  // check if fail
-  if (twi_error || (err_code != NRF_SUCCESS)) return false;
+  m_pointer = reg;
 
   // success
   return true;
@@ -435,9 +1559,6 @@ bool AD5933_SetPointer(uint8_t reg)
 //  true if no error
 bool AD5933_Write(uint8_t data, uint8_t reg)
 {
-  // stores error code
-  ret_code_t err_code;
-
   // set data buffer
   uint8_t buff[2] = {reg, data};
 
@@ -446,20 +1567,13 @@ bool AD5933_Write(uint8_t data, uint8_t reg)
   NRF_LOG_FLUSH();
 #endif
 
-  // send the data
-  m_xfer_done = false;
-  err_code = nrf_drv_twi_tx(&m_twi, AD5933_ADDR, buff, sizeof(buff), false);
-
-  // check for error
-  APP_ERROR_CHECK(err_code);
+  // writing a register moves the pointer to it
+  m_pointer = POINTER_UNKNOWN;
 
-  // wait for transfer to be done
-  while (m_xfer_done == false);
-
-  // check if fail
-  if (twi_error || (err_code != NRF_SUCCESS)) return false;
+  // send the data
+  if (!AD5933_TwiTx(buff, sizeof(buff))) return false;
 
-  // success
+  AD5933_ShadowStore(&data, 1, reg);
   return true;
 }
 
@@ -472,9 +1586,6 @@ bool AD5933_Write(uint8_t data, uint8_t reg)
 //  true if no error
 bool AD5933_BlockWrite(uint8_t * buff, uint8_t numbytes)
 {
-  // stores error code
-  ret_code_t err_code;
-
   // check if numbytes greater than 32
   if (numbytes > 30)
   {
@@ -499,21 +1610,11 @@ bool AD5933_BlockWrite(uint8_t * buff, uint8_t numbytes)
     data[i + 2] = buff[i];
   }
 
-  // send the data
-  m_xfer_done = false;
-  err_code = nrf_drv_twi_tx(&m_twi, AD5933_ADDR, data, numbytes + 2, false);
-
-  // check for error
-  APP_ERROR_CHECK(err_code);
-
-  // wait for transfer to be done
-  while (m_xfer_done == false);
+  // the pointer moves during block writes
+  m_pointer = POINTER_UNKNOWN;
 
-  // check if fail
-  if (twi_error || (err_code != NRF_SUCCESS)) return false;
-
-  // success
-  return true;	
+  // send the data
+  return AD5933_TwiTx(data, numbytes + 2);
 }
 
 // Read one byte from the location of the internal pointer (set the pointer with AD6933_setPointer)
@@ -524,29 +1625,13 @@ bool AD5933_BlockWrite(uint8_t * buff, uint8_t numbytes)
 //  true if no error
 bool AD5933_ReadByte(uint8_t * buff)
 {
-  // stores error code
-  ret_code_t err_code;
-
 #ifdef DEBUG_TWI_ALL
   NRF_LOG_INFO("Reading a byte from pointer");
   NRF_LOG_FLUSH();
 #endif
 
   // read byte from AD5933
-  m_xfer_done = false;
-  err_code = nrf_drv_twi_rx(&m_twi, AD5933_ADDR, buff, 1);
-
-  // check for error
-  APP_ERROR_CHECK(err_code);
-
-  // wait for transfer to be done
-  while (m_xfer_done == false);
-
-  // check if fail
-  if (twi_error || (err_code != NRF_SUCCESS)) return false;
-
-  // success
-  return true;
+  return AD5933_TwiRx(buff, 1);
 }
 
 // Read numbytes from the location of the internal pointer (set the pointer with AD6933_setPointer)
@@ -558,9 +1643,6 @@ bool AD5933_ReadByte(uint8_t * buff)
 //  true if no error
 bool AD5933_BlockRead(uint8_t * buff, uint8_t numbytes)
 {
-  // stores error code
-  ret_code_t err_code;
-
   // set data buffer
   uint8_t data[2] = {BLOCK_READ, numbytes};
 
@@ -569,32 +1651,326 @@ bool AD5933_BlockRead(uint8_t * buff, uint8_t numbytes)
   NRF_LOG_FLUSH();
 #endif
 
+  // a block read leaves the pointer where it was, a failed transfer makes it unknown (AD5933_TwiTx/AD5933_TwiRx)
+
   // send the data to initiate block read
+  if (!AD5933_TwiTx(data, sizeof(data))) return false;
+
+  // now read numbytes from the AD5933
+  return AD5933_TwiRx(buff, numbytes);
+}
+
+// Sends numbytes to the AD5933 and waits for the transfer to finish. All AD5933 writes go through here
+// Arguments:
+//  data     - Pointer to the bytes to send
+//  numbytes - Number of bytes to send
+// Return value:
+//  false if I2C error
+//  true if no error
+static bool AD5933_TwiTx(uint8_t * data, uint8_t numbytes)
+{
+  // stores error code
+  ret_code_t err_code;
+
+  // count the transaction, the address byte is on the bus too
+  m_twi_stats.transactions += 1;
+  m_twi_stats.bytes += numbytes + 1;
+
+  // send the data
   m_xfer_done = false;
-  err_code = nrf_drv_twi_tx(&m_twi, AD5933_ADDR, data, sizeof(data), false);
+  err_code = nrf_drv_twi_tx(&m_twi, AD5933_ADDR, data, numbytes, false);
 
   // check for error
   APP_ERROR_CHECK(err_code);
 
-  // wait for transfer to be done
-  while (m_xfer_done == false);
+  // check if fail, the AD5933 pointer and registers are unknown after a failed transfer
+  if (!AD5933_TwiWait(numbytes) || twi_error)
+  {
+    m_pointer = POINTER_UNKNOWN;
+    m_shadow_valid = 0;
+    return false;
+  }
 
-  // check if fail
-  if (twi_error || (err_code != NRF_SUCCESS)) return false;
+  // success
+  return true;
+}
 
-  // now read numbytes from the AD5933
+// Writes the control register of the TCA9548A mux and waits for the transfer to finish
+// Arguments:
+//  control - the channels to connect, bit n for channel n
+// Return value:
+//  false if I2C error
+//  true if no error
+static bool AD5933_MuxTx(uint8_t control)
+{
+  // stores error code
+  ret_code_t err_code;
+
+  // count the transaction, the address byte is on the bus too
+  m_twi_stats.transactions += 1;
+  m_twi_stats.bytes += 2;
+
+  // send the data
+  m_xfer_done = false;
+  err_code = nrf_drv_twi_tx(&m_twi, MUX_ADDR, &control, 1, false);
+
+  // check for error
+  APP_ERROR_CHECK(err_code);
+
+  return AD5933_TwiWait(1) && !twi_error;
+}
+
+// Reads the control register of the TCA9548A mux and waits for the transfer to finish
+// Arguments:
+//  * control - pointer to store the channels that are connected
+// Return value:
+//  false if I2C error
+//  true if no error
+static bool AD5933_MuxRx(uint8_t * control)
+{
+  // stores error code
+  ret_code_t err_code;
+
+  // count the transaction, the address byte is on the bus too
+  m_twi_stats.transactions += 1;
+  m_twi_stats.bytes += 2;
+
+  // read from the mux
+  m_xfer_done = false;
+  err_code = nrf_drv_twi_rx(&m_twi, MUX_ADDR, control, 1);
+
+  // check for error
+  APP_ERROR_CHECK(err_code);
+
+  return AD5933_TwiWait(1) && !twi_error;
+}
+
+// Reads numbytes from the AD5933 and waits for the transfer to finish. All TWI reads go through here
+// Arguments:
+//  buff     - Pointer to the array to store the read bytes
+//  numbytes - Number of bytes to read
+// Return value:
+//  false if I2C error
+//  true if no error
+static bool AD5933_TwiRx(uint8_t * buff, uint8_t numbytes)
+{
+  // stores error code
+  ret_code_t err_code;
+
+  // count the transaction, the address byte is on the bus too
+  m_twi_stats.transactions += 1;
+  m_twi_stats.bytes += numbytes + 1;
+
+  // read from AD5933
   m_xfer_done = false;
   err_code = nrf_drv_twi_rx(&m_twi, AD5933_ADDR, buff, numbytes);
 
   // check for error
   APP_ERROR_CHECK(err_code);
 
-  // wait for transfer to be done
-  while (m_xfer_done == false);
+  // check if fail, the AD5933 pointer and registers are unknown after a failed transfer
+  if (!AD5933_TwiWait(numbytes) || twi_error)
+  {
+    m_pointer = POINTER_UNKNOWN;
+    m_shadow_valid = 0;
+    return false;
+  }
+
+  // success
+  return true;
+}
+
+#ifdef AD5933_PPI_POLL
+// Runs a transfer with two parts joined by a repeated start (TXRX or TXTX) and waits for it to finish
+// Arguments:
+//  * xfer   - the transfer
+//  numbytes - Number of data bytes of both parts
+// Return value:
+//  false if I2C error
+//  true if no error
+static bool AD5933_TwiXfer(nrf_drv_twi_xfer_desc_t const * xfer, uint8_t numbytes)
+{
+  // stores error code
+  ret_code_t err_code;
+
+  // count the transaction, each part has an address byte
+  m_twi_stats.transactions += 1;
+  m_twi_stats.bytes += numbytes + 2;
+
+  m_xfer_done = false;
+  err_code = nrf_drv_twi_xfer(&m_twi, xfer, 0);
+
+  // check for error
+  APP_ERROR_CHECK(err_code);
 
-  // check if fail
-  if (twi_error || (err_code != NRF_SUCCESS)) return false;
+  // check if fail, the AD5933 pointer and registers are unknown after a failed transfer
+  if (!AD5933_TwiWait(numbytes + 1) || twi_error)
+  {
+    m_pointer = POINTER_UNKNOWN;
+    m_shadow_valid = 0;
+    return false;
+  }
 
   // success
   return true;
 }
+#endif
+
+// Gets how long a transfer may take before it is abandoned, twice its time on the bus plus TWI_TIMEOUT_US
+// Arguments:
+//  numbytes - Number of data bytes of the transfer
+// Returns:
+//  the timeout in app_timer ticks
+static uint32_t AD5933_TwiTimeout(uint8_t numbytes)
+{
+  // start, address + data bytes with their ack bits, and stop
+  uint32_t bits = 1 + (numbytes + 1) * 9 + 1;
+  uint32_t frequency = twiManager_getFrequency();
+  uint32_t busUs = (bits * 1000000 + frequency - 1) / frequency;
+
+  return AD5933_Ticks(2 * busUs + TWI_TIMEOUT_US);
+}
+
+// Waits for the transfer started by AD5933_TwiTx or AD5933_TwiRx to finish. The CPU sleeps in __WFE until
+// twi_handler sets m_xfer_done, m_twi_timer wakes it if the transfer never finishes (the AD5933 holding
+// SDA low or the bus not coming back). A transfer that times out is aborted by restarting the TWI driver
+// Arguments:
+//  numbytes - Number of data bytes of the transfer
+// Return value:
+//  false if the transfer timed out
+//  true if the transfer finished
+static bool AD5933_TwiWait(uint8_t numbytes)
+{
+  uint32_t timeout = AD5933_TwiTimeout(numbytes);
+  uint32_t start = app_timer_cnt_get();
+  uint32_t elapsed = 0;
+
+  if (m_twi_sleep)
+  {
+    // the timer only has to wake the CPU, the deadline is checked against the counter
+    uint32_t ticks = timeout;
+    if (ticks < APP_TIMER_MIN_TIMEOUT_TICKS) ticks = APP_TIMER_MIN_TIMEOUT_TICKS;
+    APP_ERROR_CHECK(app_timer_start(m_twi_timer, ticks, NULL));
+  }
+
+  while (!m_xfer_done && elapsed < timeout)
+  {
+    // the TWI interrupt sets the event register if it fires between the check and __WFE,
+    // so the CPU can not miss the end of the transfer
+    if (m_twi_sleep)
+    {
+      __WFE();
+      m_twi_stats.sleeps += 1;
+    }
+
+    elapsed = app_timer_cnt_diff_compute(app_timer_cnt_get(), start);
+  }
+
+  elapsed = app_timer_cnt_diff_compute(app_timer_cnt_get(), start);
+
+  if (m_twi_sleep)
+  {
+    app_timer_stop(m_twi_timer);
+    m_twi_stats.sleepTicks += elapsed;
+  }
+  else
+  {
+    m_twi_stats.spinTicks += elapsed;
+  }
+
+  if (m_xfer_done) return true;
+
+  // abort the transfer, the driver is idle again after a restart
+  nrf_drv_twi_disable(&m_twi);
+  nrf_drv_twi_enable(&m_twi);
+  m_twi_stats.timeouts += 1;
+
+#ifdef DEBUG_TWI
+  NRF_LOG_INFO("TWI transfer timed out");
+  NRF_LOG_FLUSH();
+#endif
+
+  return false;
+}
+
+// Wakes the CPU when a TWI transfer has taken too long, AD5933_TwiWait checks the deadline
+static void AD5933_TwiTimerHandler(void * p_context)
+{
+  UNUSED_PARAMETER(p_context);
+}
+
+// Checks if the shadow registers show that registers reg to reg + numbytes - 1 already hold data
+// Arguments:
+//  data     - Pointer to the bytes that would be written
+//  numbytes - Number of bytes that would be written
+//  reg      - The first register that would be written
+// Returns:
+//  false if any of the registers is unknown or different
+//  true if the write would not change the registers
+static bool AD5933_ShadowMatch(uint8_t const * data, uint8_t numbytes, uint8_t reg)
+{
+  if (reg < SHADOW_BASE || reg + numbytes > SHADOW_BASE + SHADOW_SIZE) return false;
+
+  for (uint8_t i = 0; i < numbytes; i++)
+  {
+    uint8_t index = reg - SHADOW_BASE + i;
+
+    if (!(m_shadow_valid & (1 << index)) || m_shadow[index] != data[i]) return false;
+  }
+
+  return true;
+}
+
+// Records a successful write in the shadow registers. Writes outside CONTROL1 - NUM_CYCLES are ignored
+// Arguments:
+//  data     - Pointer to the bytes that were written
+//  numbytes - Number of bytes that were written
+//  reg      - The first register that was written
+static void AD5933_ShadowStore(uint8_t const * data, uint8_t numbytes, uint8_t reg)
+{
+  for (uint8_t i = 0; i < numbytes; i++)
+  {
+    if (reg + i < SHADOW_BASE || reg + i >= SHADOW_BASE + SHADOW_SIZE) continue;
+
+    uint8_t index = reg - SHADOW_BASE + i;
+
+    m_shadow[index] = data[i];
+    m_shadow_valid |= 1 << index;
+  }
+}
+
+// Checks if the shadow registers show the AD5933 was last put in power down or standby mode,
+// so a sweep can start without resetting it. The datasheet keeps the frequency, step and settling
+// registers through power down mode
+// Returns:
+//  true if the AD5933 is known to be idle
+static bool AD5933_ShadowIdle(void)
+{
+  uint8_t index = CONTROL1_REG - SHADOW_BASE;
+
+  if (!(m_shadow_valid & (1 << index))) return false;
+
+  uint8_t command = m_shadow[index] >> 4;
+  return command == POWER_DOWN || command == STANDBY;
+}
+
+// Writes numbytes to the configuration registers starting at reg, unless the shadow registers
+// show they already hold them. Skipped writes are counted in the TWI stats
+// Arguments:
+//  buff     - Pointer to the bytes to write
+//  numbytes - Number of bytes to write
+//  reg      - The first register to write
+// Return value:
+//  false if I2C error
+//  true if no error
+static bool AD5933_WriteConfig(uint8_t * buff, uint8_t numbytes, uint8_t reg)
+{
+  if (AD5933_ShadowMatch(buff, numbytes, reg))
+  {
+    m_twi_stats.skippedWrites += 1;
+    return true;
+  }
+
+  if (numbytes == 1) return AD5933_Write(buff[0], reg);
+  return AD5933_WriteBytes(buff, numbytes, reg);
+}
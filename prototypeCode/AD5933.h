@@ -10,19 +10,24 @@
 #ifndef INC_AD5933_H_
 #define INC_AD5933_H_
 
+// AD5933_SIM builds the driver on a host against the simulated TWI bus in hostSim
+#ifdef AD5933_SIM
+#include "twiSim.h"
+#else
 #include "nrf_delay.h"
 #include "nrf_drv_twi.h"
+#include "app_timer.h"
 #include "app_usbd_core.h"
 #include "app_usbd.h"
 #include "app_usbd_string_desc.h"
 #include "app_usbd_cdc_acm.h"
 #include "app_usbd_serial_num.h"
+#endif
 #ifdef DEBUG_TWI
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
 #include "nrf_log_default_backends.h"
 #endif
-#include <math.h>
 
 // Clock Frequency (for calculations)
 // Internal clock is 16.776 MHz
@@ -31,17 +36,33 @@
 
 // Clock Frequency Divider for Calculations
 // If using the AD5934, define AD5934 at compile
+// FREQ_CODE_FRAC is the number of fraction bits of FREQ_CODE_SCALE, picked so that
+// frequency codes for 0 - 100 kHz round exactly the same as the 64 bit division
 #ifdef AD5934
 #define CLK_DIV 16
+#define FREQ_CODE_FRAC 30
 #endif
 #ifndef AD5934
 #define CLK_DIV 4
+#define FREQ_CODE_FRAC 32
 #endif
 
+// frequency code per Hz (2^27 * CLK_DIV / CLK_FREQ) with FREQ_CODE_FRAC fraction bits
+#define FREQ_CODE_SCALE ((((uint64_t) CLK_DIV << (27 + FREQ_CODE_FRAC)) + CLK_FREQ / 2) / CLK_FREQ)
+
+// 24 bit frequency code of freq (Hz, 0 - 100 kHz) for CLK_FREQ, a constant if freq is a constant
+#define AD5933_FREQ_CODE(freq) ((uint32_t) (((uint64_t) (freq) * FREQ_CODE_SCALE + ((uint64_t) 1 << (FREQ_CODE_FRAC - 1))) >> FREQ_CODE_FRAC))
+
 // Device address (shifted right)
 
 #define AD5933_ADDR     0x0D
 
+// TCA9548A I2C multiplexer, every AD5933 has the same address so each one sits on its own mux channel
+
+#define MUX_ADDR        0x70 // A2 - A0 tied low
+#define MUX_CHANNELS    8
+#define MUX_NO_CHANNEL  0xFF // no channel selected, a single AD5933 without a mux
+
 // Register definitions
 
 #define CONTROL1_REG    0x80
@@ -101,17 +122,67 @@
 #define BLOCK_READ      0xA1
 #define BLOCK_WRITE     0xA0
 
-// get external variables from main
+// Sweep engine states
+#define SWEEP_IDLE      0x00
+#define SWEEP_SETTLING  0x01
+#define SWEEP_MEASURING 0x02
+#define SWEEP_COMPLETE  0x03
+#define SWEEP_ERROR     0x04
+
+// Sweep engine backends, how the status and data of each point are read
+#define AD5933_BACKEND_CPU 0x00 // the CPU reads them when the sweep timer wakes it
+#define AD5933_BACKEND_PPI 0x01 // a TIMER starts the reads through PPI, the CPU wakes once they are done (AD5933_PPI_POLL)
+
+// STATUS_REG up to the imaginary data, read in one block by AD5933_BACKEND_PPI
+#define POLL_BYTES (IMAG_REG + 2 - STATUS_REG)
+
+// Sweep engine timing
+#define SWEEP_SETTLE_MS   100 // time given to settle at the start frequency (ms)
+#define SWEEP_CHAIN_SETTLE_MS 10 // settle time when the output stayed on from a chained sweep (ms)
+#define SWEEP_REPOLL_US   500 // time between status polls when the data is later than predicted (us)
+#define TEMP_CONVERT_US   800 // time the AD5933 takes to measure its temperature (us)
+#define TEMP_UNKNOWN      INT16_MIN // metadata.temp of a sweep whose temperature could not be measured
+
+// TWI timing
+#define TWI_TIMEOUT_US    1000 // time allowed on top of twice the bus time before a transfer is abandoned (us)
+
+// the ADC samples at MCLK / 16 and the DFT is done over 1024 samples
+#define DFT_SAMPLES       1024
+#define ADC_CLK_DIV       16
+
+// How the repeated measurements of a point are averaged
+#define AVERAGE_MEAN        0x00 // mean of all the repeats
+#define AVERAGE_MEDIAN      0x01 // median of the repeats
+#define AVERAGE_TRIMMED     0x02 // mean of the repeats without the lowest and highest quarter
+#define AVERAGE_MAX_REPEATS 32   // most repeats of a point
+
+// Automatic range and gain selection
+#define AUTO_RANGE_HIGH     30000 // a real or imaginary code this large is treated as saturated
+#define AUTO_RANGE_LOW      4000  // a point whose largest code is below this is measured again with more signal
+#define AUTO_RANGE_TARGET   20000 // largest code a point is moved up to
+#define AUTO_RANGE_TRIES    4     // most times a point is measured again at another setting
+
+// with autoRange the setting used for each point is kept in the top byte of its frequency:
+// bit 7 set, the range in bits 2:1 and the gain in bit 0 (the same bits as CONTROL1). It goes to the
+// sinks and coded streams, the raw USB points (usbManager_initSink) only carry the frequency
+#define POINT_FREQ_MASK       0x00FFFFFF
+#define POINT_SETTING_SHIFT   24
+#define POINT_SETTING_USED    0x80
+#define POINT_SETTING(range, gain) (POINT_SETTING_USED | ((range) << 1) | (gain))
+
+// get external variables from main and twiManager
 extern const nrf_drv_twi_t m_twi;
 extern volatile bool m_xfer_done;
 extern volatile bool twi_error;
+#ifndef AD5933_SIM
 extern const app_usbd_cdc_acm_t m_app_cdc_acm;
+#endif
 
 // struct to hold sweep metadata
 typedef struct sweepData
 {
 	uint32_t time;
-	uint16_t temp;
+	int16_t temp;         // AD5933 temperature in Celsius at the start of the sweep, TEMP_UNKNOWN if it was not measured
 	uint32_t numPoints;
 } MetaData;
 
@@ -128,6 +199,9 @@ typedef struct sweepParams
   uint8_t clockSource;      // the source of the AD599's system clock
   uint32_t clockFrequency;  // the frequency of the clock for the AD5933
   uint8_t gain;          // the PGA gain of the input frequency
+  uint8_t repeats;          // the number of measurements averaged at each point (0 or 1 for no averaging)
+  uint8_t average;          // how the measurements of each point are averaged (AVERAGE_)
+  bool autoRange;           // pick the range and gain of each point, starting from range and gain
 
   // sweep information
   uint16_t currentStep;      // the current step the sweep is on
@@ -138,16 +212,99 @@ typedef struct sweepParams
 	MetaData metadata;
 } Sweep;
 
+// struct to hold TWI traffic counters
+typedef struct twiStats
+{
+  uint32_t transactions; // number of TWI transfers (each has its own start, address and stop)
+  uint32_t bytes;        // number of bytes on the bus, including the address byte of each transfer
+  uint32_t skippedWrites; // number of register writes skipped because the register already held the value
+  uint32_t retries;      // number of failed point reads and commands that were retried after recovering the bus
+  uint32_t timeouts;     // number of transfers abandoned because they did not finish in time
+  uint32_t sleeps;       // number of times the CPU slept in __WFE waiting for a transfer
+  uint32_t sleepTicks;   // app_timer ticks spent asleep waiting for transfers
+  uint32_t spinTicks;    // app_timer ticks spent spinning waiting for transfers (AD5933_SetTwiSleep(false))
+} TwiStats;
+
+// struct to hold a sweep sink, where the points of a sweep go as they are measured (see sweepSink.h)
+// begin is called before the first point with the expected number of points in metadata->numPoints,
+// end is called after the last point with the final metadata. Either can be NULL
+typedef struct sweepSink
+{
+  bool (*begin)(struct sweepSink * sink, MetaData const * metadata);
+  bool (*point)(struct sweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag);
+  bool (*end)(struct sweepSink * sink, MetaData * metadata, bool success);
+  void * context;      // state of the sink
+  uint32_t count;      // number of points the sink has taken
+} SweepSink;
+
+// struct to hold the arrays of a sink that keeps the points in RAM
+typedef struct sweepRam
+{
+  uint32_t * freq;     // array to store frequency data
+  uint16_t * real;     // array to store real impedance
+  uint16_t * imag;     // array to store imaginary impedance
+  uint32_t capacity;   // length of the arrays
+} SweepRam;
+
+// struct to hold the state of a non-blocking sweep
+typedef struct sweepEngine
+{
+  Sweep * sweep;       // the sweep being executed
+  SweepSink * sink;    // where the measured points go
+  SweepSink ramSink;   // sink used when the sweep is given arrays
+  SweepRam ram;        // arrays of ramSink
+  uint8_t state;       // the SWEEP_ state of the engine
+  uint8_t range;       // the output range the AD5933 is set to
+  uint8_t gain;        // the PGA gain the AD5933 is set to
+  uint8_t level;       // index of range and gain in the auto range settings
+  uint8_t tries;       // number of times the current point was measured again at another setting
+  uint16_t remeasures; // number of times points were measured again at another setting
+  uint8_t retries;     // number of times a read of the current point failed and was retried
+  uint8_t repeat;      // the number of measurements taken at the current point
+  int32_t sum[2];      // sum of the real and imaginary codes measured at the current point
+  int16_t samples[2][AVERAGE_MAX_REPEATS]; // real and imaginary codes measured at the current point
+  bool keepPowered;    // leave the output on after a successful sweep so another can be chained
+  bool polling;        // a PPI poll of the status and data is armed (AD5933_BACKEND_PPI)
+  uint8_t poll[POLL_BYTES]; // STATUS_REG up to the imaginary data, as read by the PPI poll
+  bool tempPending;    // a temperature measurement was started during the settle time
+  uint32_t tempTicks;  // number of app_timer ticks after waitStart the temperature is ready
+  uint32_t waitStart;  // app_timer tick count when the current wait started
+  uint32_t waitTicks;  // number of app_timer ticks to wait before the next step
+} SweepEngine;
+
 // AD5933 user control functions
+bool AD5933_Init(void);
 bool AD5933_Sweep(Sweep * sweep, uint32_t * freq, uint16_t * real, uint16_t * imag);
+bool AD5933_SweepBegin(SweepEngine * engine, Sweep * sweep, uint32_t * freq, uint16_t * real, uint16_t * imag);
+bool AD5933_SweepBeginSink(SweepEngine * engine, Sweep * sweep, SweepSink * sink);
+bool AD5933_SweepChain(SweepEngine * engine, Sweep * sweep);
+uint8_t AD5933_SweepPoll(SweepEngine * engine);
+bool AD5933_SweepComplete(SweepEngine * engine);
+bool AD5933_SweepRunning(SweepEngine * engine);
+uint32_t AD5933_PointTime(Sweep * sweep, uint32_t freq);
+void AD5933_SetFastPath(bool enable);
+void AD5933_SetTwiSleep(bool enable);
+bool AD5933_SetBackend(uint8_t backend);
+uint8_t AD5933_GetBackend(void);
+void AD5933_UseMux(bool enable);
+bool AD5933_SelectChannel(uint8_t channel);
+bool AD5933_SweepDue(SweepEngine * engine);
+uint32_t AD5933_SweepTicksLeft(SweepEngine * engine);
+void AD5933_SweepWake(SweepEngine * engine);
+void AD5933_InvalidateShadow(void);
+void AD5933_ResetTwiStats(void);
+void AD5933_GetTwiStats(TwiStats * stats);
 
 // AD5933 control helper functions
+uint32_t AD5933_FreqCode(uint32_t freq, uint32_t clkFreq);
 bool AD5933_SetStart(uint32_t start, uint32_t clkFreq);
 bool AD5933_SetDelta(uint32_t delta, uint32_t clkFreq);
 bool AD5933_SetSteps(uint16_t steps);
 bool AD5933_SetCycles(uint16_t cycles, uint8_t multiplier);
 bool AD5933_SetControl(uint8_t command, uint8_t range, uint8_t gain, uint8_t clock, uint8_t reset);
+bool AD5933_SetCommand(uint8_t command, uint8_t range, uint8_t gain);
 bool AD5933_ReadStatus(uint8_t * buff);
+bool AD5933_Probe(void);
 bool AD5933_ReadTemp(int * temp);
 bool AD5933_ReadData(uint16_t * buff);
 
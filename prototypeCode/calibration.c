@@ -0,0 +1,427 @@
+/*
+ *  calibration.c
+ *
+ *  Turns the raw DFT codes of the AD5933 into calibrated impedance on the device. A sweep against a
+ *  known resistor is reduced, as it is measured, to a short table of gain and system phase points that
+ *  are interpolated linearly between, the same gain factor and system phase as calc_gain_factor and
+ *  calc_impedance in the python tools, but kept for every frequency so any later sweep can be converted.
+ *
+ *  The table keeps only as many points as it needs: a new point is added when the line from the last
+ *  point can no longer pass within CAL_GAIN_TOLERANCE_PPM and CAL_PHASE_TOLERANCE of every point
+ *  measured since (a swinging door), so a smooth system response needs a handful of points.
+ *
+ *  A calibrated point is |Z| in ohms with CAL_Z_FRAC fraction bits and the phase in 0.01 degree,
+ *  measured phase minus system phase like calc_impedance.
+ *
+ */
+
+#include <float.h>
+
+#include "calibration.h"
+
+static bool calibration_begin(SweepSink * sink, MetaData const * metadata);
+static bool calibration_point(SweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag);
+static bool calibration_end(SweepSink * sink, MetaData * metadata, bool success);
+static void calibration_convert(CalTable const * table, uint32_t freq, uint32_t dft, int32_t dftPhase, uint32_t * magnitude, int16_t * phase);
+static bool calibration_addPoint(CalBuilder * builder, CalPoint const * point);
+static bool calibration_addKnot(CalBuilder * builder);
+static bool calibration_narrow(float * low, float * high, float value, float tolerance, float base, float span);
+static uint32_t calibration_scale(uint32_t freq, uint8_t range, uint8_t gain);
+static int16_t calibration_code(uint16_t raw);
+
+// size of each output range in 200 mV p-p, indexed by the range bits (2 V, 200 mV, 400 mV, 1 V)
+static const uint8_t m_range_scale[4] = {10, 1, 2, 5};
+
+// --- Table building functions ---
+
+// Sets up a sink that builds a calibration table from a sweep against a known resistor. The table is
+// only valid if the sink ended successfully, it is emptied if the sweep fails or the table runs out of points
+// Arguments:
+//  * sink      - pointer to the sink to set up
+//  * builder   - pointer to the state of the sink, must stay valid while the sink is used
+//  * table     - pointer to the table to build
+//  resistance  - the calibration resistance (ohms)
+//  range       - the output range of the sweep, points measured at another range (auto range) are scaled to it
+//  gain        - the PGA gain of the sweep
+void calibration_initSink(SweepSink * sink, CalBuilder * builder, CalTable * table, uint32_t resistance, uint8_t range, uint8_t gain)
+{
+  table->resistance = resistance;
+  table->range      = range;
+  table->gain       = gain;
+  table->numPoints  = 0;
+
+  builder->table = table;
+  builder->full  = false;
+
+  sink->begin   = calibration_begin;
+  sink->point   = calibration_point;
+  sink->end     = calibration_end;
+  sink->context = builder;
+}
+
+// Checks that a table can be used to convert sweeps, for tables loaded from flash
+// Arguments:
+//  * table - pointer to the table
+// Return value:
+//  false if the table is empty or broken
+//  true  if the table can be used
+bool calibration_valid(CalTable const * table)
+{
+  if (table->numPoints == 0 || table->numPoints > CAL_MAX_POINTS || table->range > 0x03) return false;
+
+  // the points must go up in frequency for the lookup
+  for (uint8_t i = 1; i < table->numPoints; i++)
+  {
+    if (table->points[i].freq <= table->points[i - 1].freq) return false;
+  }
+
+  return true;
+}
+
+// --- Conversion functions ---
+
+// Finds the gain and system phase at a frequency, interpolated from the points around it. Frequencies
+// outside the table get the gain and phase of the closest end
+// Arguments:
+//  * table - pointer to the table
+//  freq    - the frequency (Hz)
+//  * gain  - pointer to store the gain (ohm codes)
+//  * phase - pointer to store the system phase (0.01 degree)
+// Return value:
+//  false if the table is empty
+//  true  if success
+bool calibration_lookup(CalTable const * table, uint32_t freq, uint64_t * gain, int32_t * phase)
+{
+  CalPoint const * points = table->points;
+  uint8_t last = table->numPoints - 1;
+
+  if (table->numPoints == 0) return false;
+
+  if (freq <= points[0].freq)
+  {
+    *gain  = points[0].gain;
+    *phase = points[0].phase;
+    return true;
+  }
+
+  if (freq >= points[last].freq)
+  {
+    *gain  = points[last].gain;
+    *phase = points[last].phase;
+    return true;
+  }
+
+  // find the points either side of freq, points[low].freq < freq < points[high].freq
+  uint8_t low = 0;
+  uint8_t high = last;
+  while (high - low > 1)
+  {
+    uint8_t mid = (low + high) / 2;
+
+    if (points[mid].freq <= freq) low = mid;
+    else high = mid;
+  }
+
+  // how far freq is from the low point to the high point with 16 fraction bits
+  int64_t t = ((uint64_t) (freq - points[low].freq) << 16) / (points[high].freq - points[low].freq);
+
+  *gain  = points[low].gain + ((((int64_t) points[high].gain - (int64_t) points[low].gain) * t) >> 16);
+  *phase = points[low].phase + (int32_t) ((((int64_t) points[high].phase - points[low].phase) * t) >> 16);
+
+  return true;
+}
+
+// Converts a point to calibrated impedance. A point with no signal gets the largest magnitude
+// Arguments:
+//  * table     - pointer to the table
+//  freq        - frequency of the point, with the setting it was measured at if there is one (POINT_SETTING)
+//                a point without a setting is taken to be measured at the range and gain of the table
+//  real        - the real data register as read
+//  imag        - the imaginary data register as read
+//  * magnitude - pointer to store |Z| (ohms with CAL_Z_FRAC fraction bits)
+//  * phase     - pointer to store the phase of Z (0.01 degree, -18000 to 18000)
+// Return value:
+//  false if the table is empty
+//  true  if success
+bool calibration_apply(CalTable const * table, uint32_t freq, uint16_t real, uint16_t imag, uint32_t * magnitude, int16_t * phase)
+{
+  uint32_t dft;
+  int32_t p;
+
+  if (table->numPoints == 0) return false;
+
+  cordic_vector(calibration_code(real), calibration_code(imag), &dft, &p);
+
+  calibration_convert(table, freq, dft, p, magnitude, phase);
+
+  return true;
+}
+
+// Converts the points of a sweep to calibrated impedance (see calibration_apply). The magnitude and
+// phase of every point are found in one pass by cordic_sweep, then calibrated in place
+// Arguments:
+//  * table     - pointer to the table
+//  * freq      - pointer to the frequencies of the points
+//  * real      - pointer to the real data of the points
+//  * imag      - pointer to the imaginary data of the points
+//  numPoints   - the number of points
+//  * magnitude - pointer to the array to store |Z|, numPoints long
+//  * phase     - pointer to the array to store the phase of Z, numPoints long
+// Return value:
+//  the number of points converted, 0 if the table is empty
+uint32_t calibration_applySweep(CalTable const * table, uint32_t const * freq, uint16_t const * real, uint16_t const * imag, uint32_t numPoints, uint32_t * magnitude, int16_t * phase)
+{
+  if (table->numPoints == 0) return 0;
+
+  cordic_sweep(real, imag, numPoints, magnitude, phase);
+
+  for (uint32_t i = 0; i < numPoints; i++)
+  {
+    calibration_convert(table, freq[i], magnitude[i], phase[i], &magnitude[i], &phase[i]);
+  }
+
+  return numPoints;
+}
+
+// --- Sink functions ---
+
+// Empties the table before the first point
+static bool calibration_begin(SweepSink * sink, MetaData const * metadata)
+{
+  UNUSED_PARAMETER(metadata);
+
+  CalBuilder * builder = (CalBuilder *) sink->context;
+
+  builder->table->numPoints = 0;
+  builder->full = false;
+
+  return true;
+}
+
+// Works out the gain and system phase of a point and adds it to the table
+static bool calibration_point(SweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag)
+{
+  CalBuilder * builder = (CalBuilder *) sink->context;
+  CalTable * table = builder->table;
+  CalPoint point;
+  uint32_t dft;
+
+  cordic_vector(calibration_code(real), calibration_code(imag), &dft, &point.phase);
+
+  // the resistor is not connected
+  if (dft == 0) return false;
+
+  // gain = resistance * |DFT|, scaled to the range and gain of the table
+  point.freq = freq & POINT_FREQ_MASK;
+  point.gain = ((uint64_t) table->resistance * dft >> CORDIC_MAG_FRAC) * calibration_scale(0, table->range, table->gain) / calibration_scale(freq, table->range, table->gain);
+
+  // unwrap the phase so the line between points does not jump a turn
+  if (table->numPoints > 0)
+  {
+    while (point.phase - builder->last.phase > 180 * CAL_PHASE_SCALE) point.phase -= 360 * CAL_PHASE_SCALE;
+    while (point.phase - builder->last.phase < -180 * CAL_PHASE_SCALE) point.phase += 360 * CAL_PHASE_SCALE;
+  }
+
+  return calibration_addPoint(builder, &point);
+}
+
+// Adds the end of the last line to the table
+static bool calibration_end(SweepSink * sink, MetaData * metadata, bool success)
+{
+  UNUSED_PARAMETER(metadata);
+
+  CalBuilder * builder = (CalBuilder *) sink->context;
+  CalTable * table = builder->table;
+
+  if (success && table->numPoints > 0 && builder->last.freq != table->points[table->numPoints - 1].freq)
+  {
+    calibration_addKnot(builder);
+  }
+
+  if (!success || builder->full || table->numPoints == 0)
+  {
+    table->numPoints = 0;
+    return false;
+  }
+
+  return true;
+}
+
+// --- Helper functions ---
+
+// Calibrates the magnitude and phase of a point, a point with no signal gets the largest magnitude
+// Arguments:
+//  * table     - pointer to the table, must not be empty
+//  freq        - frequency of the point, with its setting if there is one
+//  dft         - |DFT| of the point (codes with CORDIC_MAG_FRAC fraction bits)
+//  dftPhase    - the phase of the point (0.01 degree)
+//  * magnitude - pointer to store |Z|, can be the same as for dft
+//  * phase     - pointer to store the phase of Z
+static void calibration_convert(CalTable const * table, uint32_t freq, uint32_t dft, int32_t dftPhase, uint32_t * magnitude, int16_t * phase)
+{
+  uint64_t gain;
+  int32_t systemPhase;
+
+  if (dft == 0)
+  {
+    *magnitude = UINT32_MAX;
+    *phase = 0;
+    return;
+  }
+
+  calibration_lookup(table, freq & POINT_FREQ_MASK, &gain, &systemPhase);
+
+  // a point measured with more signal than the table has a larger gain the same way
+  gain = gain * calibration_scale(freq, table->range, table->gain) / calibration_scale(0, table->range, table->gain);
+
+  // |Z| = gain / |DFT|
+  uint64_t z = (gain >> (64 - CAL_Z_FRAC - CORDIC_MAG_FRAC)) ? UINT64_MAX : ((gain << (CAL_Z_FRAC + CORDIC_MAG_FRAC)) + dft / 2) / dft;
+
+  *magnitude = (z > UINT32_MAX) ? UINT32_MAX : (uint32_t) z;
+
+  // wrap the phase back into -180 to 180 degrees
+  int32_t p = (dftPhase - systemPhase) % (360 * CAL_PHASE_SCALE);
+  if (p > 180 * CAL_PHASE_SCALE) p -= 360 * CAL_PHASE_SCALE;
+  else if (p < -180 * CAL_PHASE_SCALE) p += 360 * CAL_PHASE_SCALE;
+
+  *phase = (int16_t) p;
+}
+
+// Adds a measured point to the table, the line from the last table point is kept going while it
+// can pass close enough to every point measured since
+// Return value:
+//  false if the frequencies did not go up or the table is full
+//  true  if success
+static bool calibration_addPoint(CalBuilder * builder, CalPoint const * point)
+{
+  CalTable * table = builder->table;
+
+  // the first point starts the table as it is
+  if (table->numPoints == 0)
+  {
+    table->points[0] = *point;
+    table->numPoints = 1;
+
+    builder->last = *point;
+    builder->low[0]  = -FLT_MAX;
+    builder->low[1]  = -FLT_MAX;
+    builder->high[0] = FLT_MAX;
+    builder->high[1] = FLT_MAX;
+
+    return true;
+  }
+
+  if (point->freq <= builder->last.freq) return false;
+
+  CalPoint * knot = &table->points[table->numPoints - 1];
+  float gainTolerance = (float) point->gain * CAL_GAIN_TOLERANCE_PPM / 1000000.0f;
+
+  float low[2]  = {builder->low[0], builder->low[1]};
+  float high[2] = {builder->high[0], builder->high[1]};
+
+  bool fits = calibration_narrow(&low[0], &high[0], (float) point->gain, gainTolerance, (float) knot->gain, (float) (point->freq - knot->freq))
+           && calibration_narrow(&low[1], &high[1], (float) point->phase, CAL_PHASE_TOLERANCE, (float) knot->phase, (float) (point->freq - knot->freq));
+
+  // end the line at the last point and start a new one from there
+  if (!fits)
+  {
+    if (!calibration_addKnot(builder)) return false;
+
+    knot = &table->points[table->numPoints - 1];
+
+    low[0]  = -FLT_MAX;
+    low[1]  = -FLT_MAX;
+    high[0] = FLT_MAX;
+    high[1] = FLT_MAX;
+
+    calibration_narrow(&low[0], &high[0], (float) point->gain, gainTolerance, (float) knot->gain, (float) (point->freq - knot->freq));
+    calibration_narrow(&low[1], &high[1], (float) point->phase, CAL_PHASE_TOLERANCE, (float) knot->phase, (float) (point->freq - knot->freq));
+  }
+
+  builder->low[0]  = low[0];
+  builder->low[1]  = low[1];
+  builder->high[0] = high[0];
+  builder->high[1] = high[1];
+  builder->last = *point;
+
+  return true;
+}
+
+// Adds a table point at the frequency of the last measured point, on the line through the middle of the slopes that fit
+// Return value:
+//  false if the table is full
+//  true  if success
+static bool calibration_addKnot(CalBuilder * builder)
+{
+  CalTable * table = builder->table;
+
+  if (table->numPoints >= CAL_MAX_POINTS)
+  {
+    builder->full = true;
+    return false;
+  }
+
+  CalPoint const * knot = &table->points[table->numPoints - 1];
+  CalPoint * next = &table->points[table->numPoints];
+  float span = (float) (builder->last.freq - knot->freq);
+
+  next->freq  = builder->last.freq;
+  next->gain  = (uint64_t) ((int64_t) knot->gain + (int64_t) ((builder->low[0] + builder->high[0]) / 2 * span + 0.5f));
+  next->phase = knot->phase + (int32_t) ((builder->low[1] + builder->high[1]) / 2 * span + (builder->low[1] + builder->high[1] < 0 ? -0.5f : 0.5f));
+
+  table->numPoints += 1;
+
+  return true;
+}
+
+// Narrows the slopes of a line from a table point to those that pass within tolerance of a point
+// Arguments:
+//  * low, * high - the slopes that fit so far, narrowed in place
+//  value         - the value of the point
+//  tolerance     - how far the line can pass from value
+//  base          - the value of the table point
+//  span          - how far the point is from the table point (Hz)
+// Return value:
+//  false if no slope fits, low and high are left as they are
+//  true  if success
+static bool calibration_narrow(float * low, float * high, float value, float tolerance, float base, float span)
+{
+  float newLow  = (value - tolerance - base) / span;
+  float newHigh = (value + tolerance - base) / span;
+
+  if (newLow < *low) newLow = *low;
+  if (newHigh > *high) newHigh = *high;
+
+  if (newLow > newHigh) return false;
+
+  *low = newLow;
+  *high = newHigh;
+
+  return true;
+}
+
+// Returns the size of the signal a point was measured with, in 200 mV p-p times the PGA gain
+// Arguments:
+//  freq  - frequency of the point, with the setting it was measured at if there is one (POINT_SETTING)
+//  range - the output range to use if the point has no setting
+//  gain  - the PGA gain to use if the point has no setting
+static uint32_t calibration_scale(uint32_t freq, uint8_t range, uint8_t gain)
+{
+  uint8_t setting = freq >> POINT_SETTING_SHIFT;
+
+  if (setting & POINT_SETTING_USED)
+  {
+    range = (setting >> 1) & 0x03;
+    gain  = setting & 0x01;
+  }
+
+  return m_range_scale[range & 0x03] * ((gain == GAIN5) ? 5 : 1);
+}
+
+// Returns the 16 bit two's complement code of a data register as read (big endian)
+static int16_t calibration_code(uint16_t raw)
+{
+  uint8_t * bytes = (uint8_t *) &raw;
+
+  return (int16_t) ((bytes[0] << 8) | bytes[1]);
+}
@@ -0,0 +1,63 @@
+/*
+ *  calibration.h
+ *
+ *  Header file for calibration.c
+ *
+ */
+
+#ifndef INC_CALIBRATION_H_
+#define INC_CALIBRATION_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "AD5933.h"
+#include "sweepSink.h"
+#include "cordic.h"
+
+// defines
+#define CAL_MAX_POINTS         64   // most calibration points in a table
+#define CAL_GAIN_TOLERANCE_PPM 1000 // largest error of the interpolated gain at a measured point (parts per million)
+#define CAL_PHASE_TOLERANCE    5    // largest error of the interpolated system phase at a measured point (0.01 degree)
+#define CAL_Z_FRAC             8    // fraction bits of a calibrated |Z| (ohms)
+#define CAL_PHASE_SCALE        CORDIC_PHASE_SCALE // a calibrated phase is in 1 / CAL_PHASE_SCALE degrees
+
+// struct to hold one point of a calibration table
+typedef struct calPoint
+{
+  uint32_t freq;  // the frequency (Hz)
+  uint64_t gain;  // the calibration resistance times the DFT magnitude at freq (ohm codes), |Z| = gain / magnitude
+  int32_t phase;  // the system phase at freq (0.01 degree), unwrapped so neighbouring points are less than 180 degrees apart
+} CalPoint;
+
+// struct to hold a calibration table, the gain and system phase between its points are interpolated linearly
+typedef struct calTable
+{
+  uint32_t resistance; // the calibration resistance (ohms)
+  uint8_t range;       // the output range the table was measured at
+  uint8_t gain;        // the PGA gain the table was measured at
+  uint8_t numPoints;   // the number of points, 0 if the table is empty
+  CalPoint points[CAL_MAX_POINTS];
+} CalTable;
+
+// struct to hold the state of a sink that builds a calibration table from a sweep against a known resistor
+typedef struct calBuilder
+{
+  CalTable * table;   // the table being built
+  CalPoint last;      // the last point measured
+  float low[2];       // lowest gain and phase slopes from the last table point that fit every point since it
+  float high[2];      // highest gain and phase slopes from the last table point that fit every point since it
+  bool full;          // the table ran out of points
+} CalBuilder;
+
+// table building functions
+void calibration_initSink(SweepSink * sink, CalBuilder * builder, CalTable * table, uint32_t resistance, uint8_t range, uint8_t gain);
+bool calibration_valid(CalTable const * table);
+
+// conversion functions
+bool calibration_lookup(CalTable const * table, uint32_t freq, uint64_t * gain, int32_t * phase);
+bool calibration_apply(CalTable const * table, uint32_t freq, uint16_t real, uint16_t imag, uint32_t * magnitude, int16_t * phase);
+uint32_t calibration_applySweep(CalTable const * table, uint32_t const * freq, uint16_t const * real, uint16_t const * imag, uint32_t numPoints, uint32_t * magnitude, int16_t * phase);
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ *  cordic.c
+ *
+ *  Converts the real and imaginary DFT codes of the AD5933 to magnitude and phase without sqrt, atan or
+ *  floating point. Each point is rotated onto the positive real axis by CORDIC_ITERATIONS shift and add
+ *  steps: the angle rotated through is the phase, and the length left on the axis is the magnitude times
+ *  the fixed CORDIC gain, which one multiply takes out.
+ *
+ *  Angles are kept as binary angles, a full turn is 2^32, so they wrap on their own.
+ *
+ *  On the Cortex-M4 (or with CORDIC_UNROLLED defined) the rotations are unrolled, so every shift is a
+ *  constant the barrel shifter folds into the add or subtract it feeds, and the angles become constants.
+ *  Elsewhere the portable loop is used, which shifts by a register.
+ *
+ */
+
+#include "cordic.h"
+
+// atan(2^-i) as a binary angle
+static const uint32_t m_atan[CORDIC_ITERATIONS] =
+{
+  536870912, 316933406, 167458907, 85004756, 42667331, 21354465, 10679838, 5340245,
+  2670163, 1335087, 667544, 333772, 166886, 83443, 41722, 20861
+};
+
+// 1 / CORDIC gain after CORDIC_ITERATIONS rotations, with 31 fraction bits
+#define CORDIC_INV_GAIN 1304065748
+
+// half a turn as a binary angle
+#define CORDIC_HALF_TURN 0x80000000u
+
+// One rotation of x and y by atan(2^-i), towards the real axis. The direction is picked with a sign mask
+// rather than a branch, the sign of y is a coin toss so a branch would often be mispredicted
+#define CORDIC_ROTATE(i)                                            \
+  do                                                                \
+  {                                                                 \
+    int32_t dx = x >> (i);                                          \
+    int32_t dy = y >> (i);                                          \
+    int32_t sign = y >> 31; /* 0 to turn clockwise, -1 to turn anticlockwise */ \
+                                                                    \
+    x += (dy ^ sign) - sign;                                        \
+    y -= (dx ^ sign) - sign;                                        \
+    angle += (m_atan[i] ^ (uint32_t) sign) - (uint32_t) sign;       \
+  } while (0)
+
+// --- Conversion functions ---
+
+// Finds the magnitude and phase of a point
+// Arguments:
+//  real        - the real code of the point
+//  imag        - the imaginary code of the point
+//  * magnitude - pointer to store the magnitude (codes with CORDIC_MAG_FRAC fraction bits)
+//  * phase     - pointer to store the phase (1 / CORDIC_PHASE_SCALE degree, -180 to 180 degrees), 0 if there is no signal
+void cordic_vector(int16_t real, int16_t imag, uint32_t * magnitude, int32_t * phase)
+{
+  int32_t x = (int32_t) real << CORDIC_SHIFT;
+  int32_t y = (int32_t) imag << CORDIC_SHIFT;
+  uint32_t angle = 0;
+
+  if (x == 0 && y == 0)
+  {
+    *magnitude = 0;
+    *phase = 0;
+    return;
+  }
+
+  // the rotations only reach about 100 degrees, so start the left half plane half a turn round
+  if (x < 0)
+  {
+    x = -x;
+    y = -y;
+    angle = CORDIC_HALF_TURN;
+  }
+
+  // rotate towards the real axis by a smaller angle each time, adding up the angle turned
+#ifdef CORDIC_UNROLLED
+  CORDIC_ROTATE(0);  CORDIC_ROTATE(1);  CORDIC_ROTATE(2);  CORDIC_ROTATE(3);
+  CORDIC_ROTATE(4);  CORDIC_ROTATE(5);  CORDIC_ROTATE(6);  CORDIC_ROTATE(7);
+  CORDIC_ROTATE(8);  CORDIC_ROTATE(9);  CORDIC_ROTATE(10); CORDIC_ROTATE(11);
+  CORDIC_ROTATE(12); CORDIC_ROTATE(13); CORDIC_ROTATE(14); CORDIC_ROTATE(15);
+#else
+  for (uint8_t i = 0; i < CORDIC_ITERATIONS; i++)
+  {
+    CORDIC_ROTATE(i);
+  }
+#endif
+
+  // take out the CORDIC gain and the shift, rounded
+  *magnitude = (uint32_t) (((uint64_t) x * CORDIC_INV_GAIN + ((uint64_t) 1 << (30 + CORDIC_SHIFT - CORDIC_MAG_FRAC))) >> (31 + CORDIC_SHIFT - CORDIC_MAG_FRAC));
+
+  // binary angle to degrees, -180 is given as 180
+  int32_t p = (int32_t) (((int64_t) (int32_t) angle * (360 * CORDIC_PHASE_SCALE) + CORDIC_HALF_TURN) >> 32);
+
+  *phase = (p == -180 * CORDIC_PHASE_SCALE) ? 180 * CORDIC_PHASE_SCALE : p;
+}
+
+// Finds the magnitude and phase of every point of a sweep in one pass
+// Arguments:
+//  * real      - pointer to the real data registers of the points as read (big endian)
+//  * imag      - pointer to the imaginary data registers of the points as read (big endian)
+//  numPoints   - the number of points
+//  * magnitude - pointer to the array to store the magnitudes (see cordic_vector), numPoints long
+//  * phase     - pointer to the array to store the phases (see cordic_vector), numPoints long
+void cordic_sweep(uint16_t const * real, uint16_t const * imag, uint32_t numPoints, uint32_t * magnitude, int16_t * phase)
+{
+  uint8_t const * realBytes = (uint8_t const *) real;
+  uint8_t const * imagBytes = (uint8_t const *) imag;
+
+  for (uint32_t i = 0; i < numPoints; i++)
+  {
+    int32_t p;
+
+    cordic_vector((int16_t) ((realBytes[2 * i] << 8) | realBytes[2 * i + 1]),
+                  (int16_t) ((imagBytes[2 * i] << 8) | imagBytes[2 * i + 1]), &magnitude[i], &p);
+
+    phase[i] = (int16_t) p;
+  }
+}
+
+#ifndef AD5933_SIM
+// Times cordic_sweep with the DWT cycle counter
+// Arguments: the same as cordic_sweep
+// Return value:
+//  the number of CPU cycles per point
+uint32_t cordic_cycles(uint16_t const * real, uint16_t const * imag, uint32_t numPoints, uint32_t * magnitude, int16_t * phase)
+{
+  if (numPoints == 0) return 0;
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  uint32_t start = DWT->CYCCNT;
+  cordic_sweep(real, imag, numPoints, magnitude, phase);
+  uint32_t cycles = DWT->CYCCNT - start;
+
+  return cycles / numPoints;
+}
+#endif
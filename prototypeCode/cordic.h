@@ -0,0 +1,38 @@
+/*
+ *  cordic.h
+ *
+ *  Header file for cordic.c
+ *
+ */
+
+#ifndef INC_CORDIC_H_
+#define INC_CORDIC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef AD5933_SIM
+#include "nrf.h"
+#endif
+
+// defines
+#define CORDIC_ITERATIONS  16  // rotations per point, each halves the angle left (2^-15 rad after the last)
+#define CORDIC_SHIFT       14  // a 16 bit code is shifted up this far, so the rotations keep precision but fit in 32 bits
+#define CORDIC_MAG_FRAC    8   // fraction bits of a magnitude
+#define CORDIC_PHASE_SCALE 100 // a phase is in 1 / CORDIC_PHASE_SCALE degrees
+
+// unroll the rotations on the Cortex-M4, where the constant shifts are free (see cordic.c)
+#if defined(__ARM_ARCH_7EM__) && !defined(CORDIC_UNROLLED)
+#define CORDIC_UNROLLED
+#endif
+
+// conversion functions
+void cordic_vector(int16_t real, int16_t imag, uint32_t * magnitude, int32_t * phase);
+void cordic_sweep(uint16_t const * real, uint16_t const * imag, uint32_t numPoints, uint32_t * magnitude, int16_t * phase);
+
+#ifndef AD5933_SIM
+uint32_t cordic_cycles(uint16_t const * real, uint16_t const * imag, uint32_t numPoints, uint32_t * magnitude, int16_t * phase);
+#endif
+
+#endif
@@ -11,6 +11,7 @@
 
 // --- FDS Variables ---
 
+#ifdef DEBUG_FLASH
 /* Array to map FDS events to strings. */
 static char const * fds_evt_str[] =
 {
@@ -21,10 +22,45 @@ static char const * fds_evt_str[] =
   "FDS_EVT_DEL_FILE",
   "FDS_EVT_GC",
 };
+#endif
 
 // Flag to check fds initialization.
 static bool volatile m_fds_initialized;
 
+// Number of record writes queued in FDS and finished, and if any of them failed. FDS writes in the order
+// the writes were queued, so a write is done once as many writes are finished as were queued up to it
+static uint32_t m_writes_queued;
+static uint32_t volatile m_writes_done;
+static bool volatile m_write_failed;
+
+// The commit of the last sweep saved, see flashManager_commitPoll
+static SweepCommit m_commit;
+
+// Number of file deletes queued in FDS that have not finished, and if a garbage collection is running
+static uint16_t volatile m_pending_deletes;
+static bool volatile m_gc_running;
+
+// The record buffers shared by the flash sinks, and the most of them used at once and the times a sink waited
+// for one, see flashManager_acquireBuffer
+static SweepBuffer m_pool[SWEEP_POOL_BUFFERS];
+static uint8_t m_pool_peak;
+static uint32_t m_pool_waits;
+
+// The sweeps kept in flash and the retention policy, see flashManager_idle
+static SweepLog m_log = {.first = 1, .last = 0, .maxSweeps = SWEEP_LOG_MAX_SWEEPS};
+
+// The sweep catalog and the descriptors of the records of its sweeps, see flashManager_getEntry. The chunks changed
+// since the last checkpoint are marked in m_catalog_dirty. Garbage collection moves the records, so the descriptors
+// are found again in one pass once it is done (m_catalog_stale). The descriptor of a record just written has no
+// address until the record is opened, so the new ones are opened between sweeps (m_catalog_unlocated)
+static CatalogEntry m_catalog[CATALOG_SWEEPS];
+static fds_record_desc_t m_catalog_records[CATALOG_SWEEPS][CATALOG_PARTS];
+static uint32_t m_catalog_dirty;
+static uint16_t m_catalog_changes;
+static bool m_catalog_loaded;
+static bool volatile m_catalog_stale;
+static bool m_catalog_unlocated;
+
 // --- User Functions ---
 
 // Deletes a sweep from flash
@@ -35,68 +71,236 @@ static bool volatile m_fds_initialized;
 //  true  if sweep delete success
 bool flashManager_deleteSweep(uint32_t sweep_num)
 {
+  flashManager_catalogClear(sweep_num);
+
   // delete the whole file
-  return flashManager_deleteFile(sweep_num);
+  return flashManager_deleteFile(SWEEP_FILE(sweep_num));
+}
+
+// Deletes the oldest saved sweeps up to last in one pass. Every file is marked deleted without waiting for
+// each delete, then one garbage collection frees the flash of them all. Like eviction the range must start at
+// the oldest sweep kept, so the log never has gaps, and the sweeps are dropped by moving the oldest sweep kept
+// (CONFIG_SWEEP_LOG) past the ones deleted with one config record. Sweep numbers are never given out again. If a
+// delete fails the log only drops the sweeps before it, and a reset before the config record leaves the log
+// starting at a deleted sweep, which is deleted again. Waits for the FDS operations already queued and for the
+// deletes, so it must not be called while a sweep is being saved. The garbage collection is only started, it
+// runs in the background like the ones of flashManager_idle, which returns true until it is done
+// Arguments: 
+//	first:    the first sweep to delete, at or before the oldest sweep kept
+//	last:     the last sweep to delete, clamped to the newest sweep
+//	* report: pointer to store the sweeps deleted, the oldest sweep kept, the flash the garbage collection frees
+//	          and the time taken
+// Return value:
+//  false if a sweep is being committed, first is after the oldest sweep kept, or a delete, the config update
+//        or starting the garbage collection failed
+//  true  if the sweeps were deleted and the garbage collection of their flash started
+bool flashManager_deleteSweeps(uint32_t first, uint32_t last, DeleteReport * report)
+{
+  fds_stat_t stat;
+  uint32_t start = app_timer_cnt_get();
+  uint32_t sweep_num;
+  bool success = true;
+
+  memset(report, 0, sizeof(DeleteReport));
+  report->firstKept = m_log.first;
+
+  if (m_commit.state != COMMIT_NONE) return false;
+
+  if (first < m_log.first) first = m_log.first;
+  if (last > m_log.last) last = m_log.last;
+
+  // nothing kept in the range
+  if (first > last) return true;
+
+  // deleting from the middle of the log would leave a gap
+  if (first > m_log.first) return false;
+
+#ifdef DEBUG_FLASH
+  NRF_LOG_INFO("Deleting sweeps %d to %d", first, last);
+  NRF_LOG_FLUSH();
+#endif
+
+  // let the writes, deletes and garbage collection already started finish first
+  while (m_writes_done != m_writes_queued || m_pending_deletes > 0 || m_gc_running)
+  {
+    __WFE();
+  }
+
+  report->first = first;
+
+  // only wait when the FDS queue is full, stop at the first delete that fails
+  for (sweep_num = first; sweep_num <= last; sweep_num++)
+  {
+    ret_code_t ret;
+
+    while ((ret = fds_file_delete(SWEEP_FILE(sweep_num))) == FDS_ERR_NO_SPACE_IN_QUEUES)
+    {
+      __WFE();
+    }
+
+    if (ret != NRF_SUCCESS)
+    {
+      success = false;
+      break;
+    }
+
+    m_pending_deletes++;
+    flashManager_catalogClear(sweep_num);
+    report->sweeps += 1;
+  }
+
+  report->last = sweep_num - 1;
+
+  // written once the deletes are done, the log keeps every sweep from the first one not deleted
+  while (m_pending_deletes > 0)
+  {
+    __WFE();
+  }
+
+  if (sweep_num > first)
+  {
+    m_log.first = sweep_num;
+    if (!flashManager_saveFirstSweep()) success = false;
+  }
+
+  report->firstKept = m_log.first;
+
+  if (!wait_for_fds_writes() || !success || fds_stat(&stat) != NRF_SUCCESS) return false;
+
+  // one garbage collection for the whole range, left running so the caller does not wait for the page erases.
+  // The catalog finds the moved records once it is done (FDS_EVT_GC)
+  if (stat.freeable_words > 0)
+  {
+    if (fds_gc() != NRF_SUCCESS) return false;
+
+    m_gc_running = true;
+    m_log.gcRuns += 1;
+
+    report->reclaimedBytes = stat.freeable_words * sizeof(uint32_t);
+  }
+
+  report->elapsedMs = (uint32_t) ((uint64_t) app_timer_cnt_diff_compute(app_timer_cnt_get(), start) * 1000 / (APP_TIMER_CLOCK_FREQ / (APP_TIMER_CONFIG_RTC_FREQUENCY + 1)));
+
+#ifdef DEBUG_FLASH
+  NRF_LOG_INFO("%d sweeps deleted in %d ms, garbage collecting %d bytes", report->sweeps, report->elapsedMs, report->reclaimedBytes);
+  NRF_LOG_FLUSH();
+#endif
+
+  return true;
+}
+
+// Deletes every saved sweep with flashManager_deleteSweeps, the next sweep saved still gets the next number
+// Arguments: 
+//	* report: pointer to store the sweeps deleted, the oldest sweep kept, the flash reclaimed and the time taken
+// Return value:
+//  false if error deleting the sweeps
+//  true  if every sweep was deleted
+bool flashManager_deleteAllSweeps(DeleteReport * report)
+{
+  return flashManager_deleteSweeps(m_log.first, m_log.last, report);
 }
 // Gets a sweep from flash and stores the data to given arrays
 // Arguments: 
-//	* freq: pointer to the frequency data array
-//	* real: pointer to the real impedance data array
-//	* imag: pointer to the imaginary impedance data array
+//	* freq: pointer to the frequency data array (MAX_FREQ_SIZE bytes)
+//	* real: pointer to the real impedance data array (MAX_IMP_SIZE bytes)
+//	* imag: pointer to the imaginary impedance data array (MAX_IMP_SIZE bytes)
 // Return value:
 //  false if error getting sweep to flash
 //  true  if sweep get success
 bool flashManager_getSweep(uint32_t * freq, uint16_t * real, uint16_t * imag, MetaData * metadata, uint32_t sweep_num)
+{
+	SweepSink sink;
+	SweepRam ram;
+	
+	// read the sweep into the arrays
+	sweepSink_initRam(&sink, &ram, freq, real, imag, MAX_IMP_SIZE / sizeof(uint16_t));
+	
+	return flashManager_readSweep(&sink, metadata, sweep_num);
+}
+
+// Reads a sweep from flash and gives its points to a sink one at a time, straight from flash
+// so the sweep does not need to fit in RAM
+// Arguments: 
+//	* sink:     pointer to the sink to give the points to, it is started and ended here
+//	* metadata: pointer to store the sweep metadata
+//	sweep_num:  the number of the sweep to read
+// Return value:
+//  false if error reading the sweep or the sink failed
+//  true  if sweep read success
+bool flashManager_readSweep(SweepSink * sink, MetaData * metadata, uint32_t sweep_num)
 {
 #ifdef DEBUG_FLASH
-	NRF_LOG_INFO("Starting get sweep");
+	NRF_LOG_INFO("Starting read sweep %d", sweep_num);
 	NRF_LOG_FLUSH();
 #endif
 
-  // create a new record desc
-  fds_record_desc_t record_desc;
-	
-	// find the sweep metadata
-  if (!flashManager_findRecord(&record_desc, sweep_num, SWEEP_METADATA)) return false;
+  SweepReader reader;
+  SweepChunk chunk;
 
-  // copy the metadata
-  if (!flashManager_readRecord(&record_desc, metadata, sizeof(MetaData))) return false;
+  if (!flashManager_openSweep(&reader, metadata, sweep_num))
+  {
+    fds_record_desc_t record_desc;
 
-	// find the sweep frequency data
-  if (!flashManager_findRecord(&record_desc, sweep_num, SWEEP_FREQ)) return false;
+    // sweeps saved before the head record existed are read the old way
+    if (sweep_num == 0 || sweep_num < m_log.first || flashManager_findRecord(&record_desc, SWEEP_FILE(sweep_num), SWEEP_RECORD)) return false;
+    return flashManager_readLegacySweep(sink, metadata, SWEEP_FILE(sweep_num));
+  }
 
-  // copy the frequency data
-  if (!flashManager_readRecord(&record_desc, freq, sizeof(uint32_t) * metadata->numPoints)) return false;
+  if (!sweepSink_begin(sink, metadata))
+  {
+    flashManager_closeSweep(&reader);
+    return sweepSink_end(sink, metadata, false);
+  }
 
-	// find the sweep real impedance data
-  if (!flashManager_findRecord(&record_desc, sweep_num, SWEEP_REAL)) return false;
+  // give the sink the points of each part in order, the head is last
+  bool success = true;
+  while (success && flashManager_nextChunk(&reader, &chunk))
+  {
+    success = flashManager_readPart(sink, &chunk);
+  }
 
-  // copy the frequency data
-  if (!flashManager_readRecord(&record_desc, real, sizeof(uint16_t) * metadata->numPoints)) return false;
+  success = success && !reader.error && (sink->count == metadata->numPoints);
 
-	// find the sweep real impedance data
-  if (!flashManager_findRecord(&record_desc, sweep_num, SWEEP_IMAG)) return false;
+  flashManager_closeSweep(&reader);
 
-  // copy the frequency data
-  if (!flashManager_readRecord(&record_desc, imag, sizeof(uint16_t) * metadata->numPoints)) return false;
-	
 #ifdef DEBUG_FLASH
-	NRF_LOG_INFO("Sweep get success");
+	NRF_LOG_INFO("Sweep read %s", success ? "success" : "fail");
 	NRF_LOG_FLUSH();
 #endif
+
+	return sweepSink_end(sink, metadata, success);
+}
+
+// Sets up a sink that codes the points of a sweep into a record as they are measured, the record is
+// written when the sink is ended. A sweep too large for one record is saved in parts, each written while
+// the next is coded. Ending the sink only starts the commit of the sweep, see flashManager_commitPoll.
+// A failed sweep is deleted
+// Arguments: 
+//	* sink:    pointer to the sink to set up
+//	* flash:   pointer to the sink state, valid until the sink is ended
+//	sweep_num: the number of the sweep to save
+void flashManager_initSink(SweepSink * sink, FlashSink * flash, uint32_t sweep_num)
+{
+	flash->sweep_num = sweep_num;
+	flash->part = 0;
+	flash->buffer = SWEEP_POOL_NONE;
 	
-	// success
-	return true;
+	sink->begin   = flashManager_sinkBegin;
+	sink->point   = flashManager_sinkPoint;
+	sink->end     = flashManager_sinkEnd;
+	sink->context = flash;
+	sink->count   = 0;
 }
 
-// Saves sweep data to flash in a new file
+// Saves sweep data to flash in a new file. The points are coded into record buffers from the pool, so the
+// arrays can be used again once it returns. The records are written in the background, see flashManager_commitPoll
 // Arguments: 
 //	* freq: pointer to the frequency data array
 //	* real: pointer to the real impedance data array
 //	* imag: pointer to the imaginary impedance data array
 // Return value:
 //  false if error saving sweep to flash
-//  true  if sweep saved successfully
+//  true  if the commit of the sweep started
 bool flashManager_saveSweep(uint32_t * freq, uint16_t * real, uint16_t * imag, MetaData * metadata, uint32_t sweep_num)
 {
 #ifdef DEBUG_FLASH
@@ -104,27 +308,22 @@ bool flashManager_saveSweep(uint32_t * freq, uint16_t * real, uint16_t * imag, M
 	NRF_LOG_FLUSH();
 #endif
 
-  fds_record_desc_t record_desc;
+	// the encoder is too large for the stack
+	static FlashSink flash;
+	SweepSink sink;
 
-  // save frequency data
-  if (!flashManager_createRecord(&record_desc, sweep_num, SWEEP_FREQ, freq, metadata->numPoints * sizeof(uint32_t))) return false;
-	
-  // save real data
-  if (!flashManager_createRecord(&record_desc, sweep_num, SWEEP_REAL, real, metadata->numPoints * sizeof(uint16_t))) return false;
+	// pack the arrays into the sweep record through a flash sink
+	flashManager_initSink(&sink, &flash, sweep_num);
 
-  // save imaginary data
-  if (!flashManager_createRecord(&record_desc, sweep_num, SWEEP_IMAG, imag, metadata->numPoints * sizeof(uint16_t))) return false;
+	if (!sweepSink_begin(&sink, metadata)) return sweepSink_end(&sink, metadata, false);
 
-  // save metadata
-  if (!flashManager_createRecord(&record_desc, sweep_num, SWEEP_METADATA, metadata, sizeof(MetaData))) return false;
-	
-#ifdef DEBUG_FLASH
-	NRF_LOG_INFO("Sweep save success");
-	NRF_LOG_FLUSH();
-#endif
-	
-	// success
-	return true;
+	bool success = true;
+	for (uint32_t i = 0; success && i < metadata->numPoints; i++)
+	{
+		success = sweepSink_point(&sink, freq[i], real[i], imag[i]);
+	}
+
+	return sweepSink_end(&sink, metadata, success);
 }
 
 // updates the number of saved sweeps in the config file
@@ -140,6 +339,9 @@ bool flashManager_updateNumSweeps(uint32_t * num_sweeps)
   NRF_LOG_FLUSH();
 #endif
 
+  // the new sweep joins the log
+  m_log.last = *num_sweeps;
+
   // create a record desc to save the record
   fds_record_desc_t record_desc;
 
@@ -153,6 +355,74 @@ bool flashManager_updateNumSweeps(uint32_t * num_sweeps)
 	return true;
 }
 
+// Saves a calibration table in the config file, replacing the one saved before
+// Arguments: 
+//	* table: pointer to the table to save
+// Return value:
+//  false if error saving the table
+//  true  if table saved successfully
+bool flashManager_saveCalibration(CalTable const * table)
+{
+#ifdef DEBUG_FLASH
+  NRF_LOG_INFO("Saving calibration table with %d points", table->numPoints);
+  NRF_LOG_FLUSH();
+#endif
+
+  fds_record_desc_t record_desc;
+
+  // only the points used are saved
+  uint32_t num_bytes = offsetof(CalTable, points) + table->numPoints * sizeof(CalPoint);
+
+  if (flashManager_findRecord(&record_desc, CONFIG_ID, CONFIG_CALIBRATION))
+  {
+    if (!flashManager_updateRecord(&record_desc, CONFIG_ID, CONFIG_CALIBRATION, table, num_bytes)) return false;
+  }
+  else
+  {
+    if (!flashManager_createRecord(&record_desc, CONFIG_ID, CONFIG_CALIBRATION, table, num_bytes)) return false;
+  }
+
+  // FDS writes from the given table, wait until it is done with it
+  return wait_for_fds_writes();
+}
+
+// Loads the calibration table from the config file
+// Arguments: 
+//	* table: pointer to store the table, emptied if there is no usable table
+// Return value:
+//  false if there is no saved table or it can not be used
+//  true  if table loaded successfully
+bool flashManager_getCalibration(CalTable * table)
+{
+  fds_record_desc_t record_desc;
+
+  table->numPoints = 0;
+
+  if (!flashManager_findRecord(&record_desc, CONFIG_ID, CONFIG_CALIBRATION)) return false;
+
+  // read the header first to know how many points there are
+  if (!flashManager_readRecord(&record_desc, table, offsetof(CalTable, points))) return false;
+
+  if (table->numPoints == 0 || table->numPoints > CAL_MAX_POINTS)
+  {
+    table->numPoints = 0;
+    return false;
+  }
+
+  if (!flashManager_readRecord(&record_desc, table, offsetof(CalTable, points) + table->numPoints * sizeof(CalPoint)) || !calibration_valid(table))
+  {
+    table->numPoints = 0;
+    return false;
+  }
+
+#ifdef DEBUG_FLASH
+  NRF_LOG_INFO("Calibration table found with %d points", table->numPoints);
+  NRF_LOG_FLUSH();
+#endif
+
+  return true;
+}
+
 // updates the saved sweep in the config file
 // Arguments: 
 //	* sweep: pointer to the sweep to save
@@ -231,185 +501,1148 @@ bool flashManager_checkConfig(uint32_t * num_sweeps, Sweep * sweep)
     // sweep record not found, create one
     if (!flashManager_createRecord(&record_desc, CONFIG_ID, CONFIG_SWEEP, sweep, sizeof(Sweep))) return false;
   }
+
+  m_log.last = *num_sweeps;
+
+  // try to find the oldest sweep kept, before the log existed every sweep was kept
+  if (flashManager_findRecord(&record_desc, CONFIG_ID, CONFIG_SWEEP_LOG))
+  {
+    if (!flashManager_readRecord(&record_desc, &m_log.first, sizeof(uint32_t))) return false;
+  }
+  else
+  {
+    m_log.first = 1;
+    if (!flashManager_createRecord(&record_desc, CONFIG_ID, CONFIG_SWEEP_LOG, &m_log.first, sizeof(uint32_t))) return false;
+  }
+
+#ifdef DEBUG_FLASH
+  NRF_LOG_INFO("Sweeps %d to %d kept", m_log.first, m_log.last);
+  NRF_LOG_FLUSH();
+#endif
+
+  // the catalog is kept up to date from here on
+  if (!m_catalog_loaded && !flashManager_loadCatalog()) return false;
 	
   // success
 	return true;
 }
 
-// Initializes FDS
-// Return value:
-//  false if error with starting FDS
-//  true  if FDS started successfully
-bool flashManager_init(void)
+// Sets the retention policy of the sweep log, applied between sweeps by flashManager_idle
+// Arguments:
+//  max_sweeps:     the most sweeps kept, the oldest are evicted past it
+//  reserve_points: the number of points of the largest sweep to come, the oldest sweeps are evicted
+//                  and garbage collected early enough that it always fits
+void flashManager_setRetention(uint32_t max_sweeps, uint32_t reserve_points)
+{
+  // a sweep's file must be empty before the ring comes back to it
+  if (max_sweeps >= SWEEP_LOG_FILES) max_sweeps = SWEEP_LOG_FILES - 1;
+
+  m_log.maxSweeps = max_sweeps;
+  m_log.reserveWords = flashManager_sweepWords(reserve_points) + FDS_VIRTUAL_PAGE_SIZE;
+
+  // the ends of the pages are often too short for a record, keep room for the largest record on one page
+  m_log.contigWords = flashManager_sweepWords(reserve_points);
+  if (m_log.contigWords > SWEEP_RECORD_BYTES / 4 + FLASH_HEADER_WORDS) m_log.contigWords = SWEEP_RECORD_BYTES / 4 + FLASH_HEADER_WORDS;
+}
+
+// Returns the number of the oldest sweep kept, the sweeps from it to the number of saved sweeps can be read
+uint32_t flashManager_firstSweep(void)
+{
+  return m_log.first;
+}
+
+// Returns the most flash words a sweep can take, every point coded with escaped residuals
+// Arguments:
+//  num_points: the number of points of the sweep
+uint32_t flashManager_sweepWords(uint32_t num_points)
+{
+  // points of a record, whole blocks until a block might not fit
+  uint32_t record_points = ((SWEEP_RECORD_BYTES - sizeof(SweepRecord)) / SWEEP_CODEC_MAX_BLOCK_BYTES) * SWEEP_CODEC_BLOCK;
+  uint32_t num_records = (num_points + record_points - 1) / record_points;
+
+  if (num_records == 0) num_records = 1;
+
+  return num_records * (SWEEP_RECORD_BYTES / 4 + FLASH_HEADER_WORDS);
+}
+
+// Does the next step of keeping the sweep log within its retention policy, call it while no sweep is
+// being saved. The oldest sweep is evicted while there are more than maxSweeps. When the flash could not
+// take another sweep, the dirty records are garbage collected, or the oldest sweep is evicted if there are
+// none. Garbage collection is also started once enough words are dirty, and the catalog is checkpointed once
+// enough of it changed. Each step only queues FDS
+// operations, so it returns at once and the next step waits for them to finish. The next sweep then never
+// has to wait for garbage collection
+// Return value:
+//  true  if there is work in progress
+//  false if the log is within its policy and the flash is idle
+bool flashManager_idle(void)
+{
+  fds_stat_t stat;
+
+  if (m_writes_done != m_writes_queued || m_pending_deletes > 0 || m_gc_running) return true;
+
+  // find the records moved by the last garbage collection before anything else
+  if (m_catalog_stale)
+  {
+    flashManager_scanCatalog();
+    return true;
+  }
+
+  // then the records written since, so reading a new sweep does not have FDS search for them
+  if (m_catalog_unlocated)
+  {
+    flashManager_locateCatalog();
+    return true;
+  }
+
+  if (fds_stat(&stat) != NRF_SUCCESS) return false;
+
+  uint32_t kept = m_log.last + 1 - m_log.first;
+  uint32_t free = flashManager_freeWords(&stat);
+
+  bool room = (free >= m_log.reserveWords) && (stat.largest_contig >= m_log.contigWords);
+
+  // the space of an evicted sweep only comes back once it is garbage collected
+  if (kept > 0 && (kept > m_log.maxSweeps || (!room && stat.freeable_words == 0)))
+  {
+    return flashManager_evictOldest();
+  }
+
+  if (stat.freeable_words > 0 && (stat.freeable_words >= SWEEP_LOG_GC_WORDS || !room))
+  {
+    if (fds_gc() != NRF_SUCCESS) return false;
+
+#ifdef DEBUG_FLASH
+    NRF_LOG_INFO("Garbage collecting %d words", stat.freeable_words);
+    NRF_LOG_FLUSH();
+#endif
+    m_gc_running = true;
+    m_log.gcRuns += 1;
+
+    return true;
+  }
+
+  // a reset only loses the catalog entries changed since the last checkpoint, they are rebuilt from the sweeps
+  if (m_catalog_changes >= CATALOG_CHECKPOINT && room)
+  {
+    return flashManager_checkpointCatalog();
+  }
+
+  return false;
+}
+
+// Gets the flash usage and sweep log statistics
+// Arguments:
+//  * stats: pointer to store the statistics
+// Return value:
+//  false if FDS could not give its statistics
+//  true  if success
+bool flashManager_getStats(FlashStats * stats)
+{
+  fds_stat_t stat;
+
+  if (fds_stat(&stat) != NRF_SUCCESS) return false;
+
+  stats->pages      = stat.pages_available;
+  stats->usedWords  = stat.words_used - stat.freeable_words;
+  stats->dirtyWords = stat.freeable_words;
+  stats->freeWords  = flashManager_freeWords(&stat);
+  stats->usedPages  = stats->usedWords / FDS_VIRTUAL_PAGE_SIZE;
+  stats->dirtyPages = stats->dirtyWords / FDS_VIRTUAL_PAGE_SIZE;
+  stats->freePages  = stats->freeWords / FDS_VIRTUAL_PAGE_SIZE;
+  stats->firstSweep = m_log.first;
+  stats->lastSweep  = m_log.last;
+  stats->evicted    = m_log.evicted;
+  stats->gcRuns     = m_log.gcRuns;
+
+  stats->buffersUsed = 0;
+  for (uint8_t i = 0; i < SWEEP_POOL_BUFFERS; i++)
+  {
+    if (m_pool[i].owner == BUFFER_FILLING || (m_pool[i].owner == BUFFER_WRITING && flashManager_writing(m_pool[i].ticket))) stats->buffersUsed++;
+  }
+  stats->buffersPeak = m_pool_peak;
+  stats->bufferWaits = m_pool_waits;
+
+  return true;
+}
+
+// Returns the state of the commit of the last sweep saved, the head record of a sweep is written in the
+// background after its sink is ended (or flashManager_saveSweep returns) so the next sweep can be measured
+// meanwhile. Once it is not COMMIT_WRITING, flashManager_commitComplete must be called
+// Return value:
+//  COMMIT_NONE, COMMIT_WRITING, COMMIT_SAVED or COMMIT_FAILED
+uint8_t flashManager_commitPoll(void)
+{
+  return m_commit.state;
+}
+
+// Completes the commit of the last sweep saved, waiting for its head record if it is still being written.
+// A saved sweep joins the catalog, a failed one is deleted
+// Arguments:
+//  * sweep_num: pointer to store the number of the sweep
+// Return value:
+//  false if there was no commit or the sweep could not be written
+//  true  if the sweep is saved
+bool flashManager_commitComplete(uint32_t * sweep_num)
+{
+  if (m_commit.state == COMMIT_NONE) return false;
+
+  while (m_commit.state == COMMIT_WRITING)
+  {
+    __WFE();
+  }
+
+  bool success = (m_commit.state == COMMIT_SAVED);
+
+  if (success)
+  {
+    flashManager_catalogRecord(m_commit.sweep_num, SWEEP_RECORD, &m_commit.head, &m_commit.record);
+  }
+  else
+  {
+    m_write_failed = false;
+    flashManager_catalogClear(m_commit.sweep_num);
+    flashManager_deleteFile(SWEEP_FILE(m_commit.sweep_num));
+  }
+
+#ifdef DEBUG_FLASH
+  NRF_LOG_INFO("Sweep %d commit %s", m_commit.sweep_num, success ? "success" : "fail");
+  NRF_LOG_FLUSH();
+#endif
+
+  *sweep_num = m_commit.sweep_num;
+  m_commit.state = COMMIT_NONE;
+
+  return success;
+}
+
+// Gets the catalog entry of a sweep. The newest CATALOG_SWEEPS sweeps are in RAM, older ones are read from
+// their head record
+// Arguments:
+//  sweep_num: the number of the sweep
+//  * entry:   pointer to store the entry
+// Return value:
+//  false if the sweep is not kept or is in the old (version 1) format
+//  true  if success
+bool flashManager_getEntry(uint32_t sweep_num, CatalogEntry * entry)
+{
+  fds_record_desc_t record_desc;
+  SweepRecord record;
+
+  if (sweep_num == 0 || sweep_num < m_log.first || sweep_num > m_log.last) return false;
+
+  CatalogEntry const * found = flashManager_catalogEntry(sweep_num);
+
+  if (found != NULL)
+  {
+    *entry = *found;
+    return true;
+  }
+
+  if (!flashManager_findRecord(&record_desc, SWEEP_FILE(sweep_num), SWEEP_RECORD)) return false;
+  if (!flashManager_readRecord(&record_desc, &record, sizeof(SweepRecord))) return false;
+
+  entry->sweep_num = sweep_num;
+  entry->record_id = record_desc.record_id;
+  entry->numParts  = record.numParts;
+  entry->reserved  = 0;
+  entry->metadata  = record.metadata;
+
+  return true;
+}
+
+// Finds the sweeps in the catalog taken between two times, without reading the flash
+// Arguments:
+//  start_time:   the earliest time (MetaData time) of the sweeps to find
+//  end_time:     the latest time of the sweeps to find
+//  * sweep_nums: pointer to store the numbers of the sweeps found, oldest first
+//  max_sweeps:   the length of sweep_nums
+// Return value:
+//  the number of sweeps found
+uint32_t flashManager_findSweeps(uint32_t start_time, uint32_t end_time, uint32_t * sweep_nums, uint32_t max_sweeps)
+{
+  uint32_t found = 0;
+  uint32_t sweep_num = (m_log.last >= CATALOG_SWEEPS) ? m_log.last + 1 - CATALOG_SWEEPS : 1;
+
+  if (sweep_num < m_log.first) sweep_num = m_log.first;
+
+  for (; sweep_num <= m_log.last && found < max_sweeps; sweep_num++)
+  {
+    CatalogEntry const * entry = flashManager_catalogEntry(sweep_num);
+
+    if (entry != NULL && entry->metadata.time >= start_time && entry->metadata.time <= end_time)
+    {
+      sweep_nums[found++] = sweep_num;
+    }
+  }
+
+  return found;
+}
+
+// Opens a saved sweep to be read a record at a time with flashManager_nextChunk, the points are left in
+// flash for the caller to use in place. Sweeps saved before the head record existed can not be opened,
+// see flashManager_readSweep
+// Arguments: 
+//	* reader:   pointer to the reader to open, closed with flashManager_closeSweep if this succeeds
+//	* metadata: pointer to store the sweep metadata
+//	sweep_num:  the number of the sweep to open
+// Return value:
+//  false if the sweep is not kept or its head record could not be read
+//  true  if the sweep is open
+bool flashManager_openSweep(SweepReader * reader, MetaData * metadata, uint32_t sweep_num)
+{
+  fds_flash_record_t head;
+
+  reader->sweep_num = sweep_num;
+  reader->part = 1;
+  reader->error = false;
+  reader->records = NULL;
+  reader->headDesc = &reader->foundHead;
+  reader->partDesc = NULL;
+
+  // an evicted sweep's file may hold a newer sweep
+  if (sweep_num == 0 || sweep_num < m_log.first) return false;
+
+  // the catalog has the records of the newest sweeps, the others are searched for
+  if (flashManager_catalogEntry(sweep_num) != NULL)
+  {
+    reader->records = m_catalog_records[sweep_num % CATALOG_SWEEPS];
+    reader->headDesc = &reader->records[0];
+  }
+  else if (!flashManager_findRecord(&reader->foundHead, SWEEP_FILE(sweep_num), SWEEP_RECORD))
+  {
+    return false;
+  }
+
+  if (fds_record_open(reader->headDesc, &head) != NRF_SUCCESS) return false;
+
+  reader->head = head.p_data;
+  reader->headBytes = head.p_header->length_words * sizeof(uint32_t);
+
+  if ((reader->head->version != SWEEP_RECORD_VERSION && reader->head->version != SWEEP_RECORD_RUNS_VERSION) ||
+      reader->head->numParts == 0 || reader->headBytes < sizeof(SweepRecord))
+  {
+    fds_record_close(reader->headDesc);
+    return false;
+  }
+
+  *metadata = reader->head->metadata;
+
+  return true;
+}
+
+// Gives the next record of an open sweep, the part records in order then the head. The record given
+// before is closed, so its chunk is no longer valid
+// Arguments: 
+//	* reader: pointer to the open reader
+//	* chunk:  pointer to store the chunk of the record
+// Return value:
+//  false if there are no more records or one could not be opened (reader->error)
+//  true  if chunk holds the next record
+bool flashManager_nextChunk(SweepReader * reader, SweepChunk * chunk)
+{
+  fds_flash_record_t flash_record;
+  uint16_t part = reader->part;
+
+  if (reader->partDesc != NULL)
+  {
+    fds_record_close(reader->partDesc);
+    reader->partDesc = NULL;
+  }
+
+  if (reader->error || part > reader->head->numParts) return false;
+
+  if (part == reader->head->numParts)
+  {
+    chunk->record = reader->head;
+    chunk->size = reader->headBytes - sizeof(SweepRecord);
+  }
+  else
+  {
+    fds_record_desc_t * part_desc = &reader->foundPart;
+
+    if (reader->records != NULL && part < CATALOG_PARTS && reader->records[part].record_id != 0)
+    {
+      part_desc = &reader->records[part];
+    }
+    else if (!flashManager_findRecord(part_desc, SWEEP_FILE(reader->sweep_num), SWEEP_RECORD + part))
+    {
+      reader->error = true;
+      return false;
+    }
+
+    if (fds_record_open(part_desc, &flash_record) != NRF_SUCCESS)
+    {
+      reader->error = true;
+      return false;
+    }
+
+    reader->partDesc = part_desc;
+
+    if (flash_record.p_header->length_words * sizeof(uint32_t) < sizeof(SweepRecord))
+    {
+      reader->error = true;
+      return false;
+    }
+
+    chunk->record = flash_record.p_data;
+    chunk->size = flash_record.p_header->length_words * sizeof(uint32_t) - sizeof(SweepRecord);
+  }
+
+  chunk->data = (uint8_t const *) (chunk->record + 1);
+  reader->part++;
+
+  return true;
+}
+
+// Closes a sweep opened with flashManager_openSweep
+// Arguments: 
+//	* reader: pointer to the open reader
+void flashManager_closeSweep(SweepReader * reader)
+{
+  if (reader->partDesc != NULL)
+  {
+    fds_record_close(reader->partDesc);
+    reader->partDesc = NULL;
+  }
+
+  fds_record_close(reader->headDesc);
+}
+
+// Initializes FDS
+// Return value:
+//  false if error with starting FDS
+//  true  if FDS started successfully
+bool flashManager_init(void)
+{
+	ret_code_t ret;	 // NRF status
+	fds_stat_t stat; // FDS status
+	
+	// Register first to receive an event when initialization is complete.
+  (void) fds_register(fds_evt_handler);
+
+  // init fds and check for error
+  ret = fds_init();
+  APP_ERROR_CHECK(ret);
+	
+  // Wait for fds to initialize.
+  wait_for_fds_ready();
+	
+	// check FDS status
+	ret = fds_stat(&stat);
+  APP_ERROR_CHECK(ret);
+	
+	return true;
+}
+
+// --- FDS Helper Functions ---
+
+// Creates a record with given parameters
+// Arguments:
+//  * record_desc: Pointer to the record desc
+//  file_id:    The file ID to store the record
+//  record_key: The record key
+//  * p_data:   Pointer to the data to store
+//  num_bytes:  The number of bytes of the data
+// Returns:
+//  true if record write success
+//  false if record write fail
+static bool flashManager_createRecord(fds_record_desc_t * record_desc, uint32_t file_id, uint32_t record_key, void const * p_data, uint32_t num_bytes)
+{
+#ifdef DEBUG_FLASH
+  NRF_LOG_INFO("Writing %d bytes to record %d in file %d", num_bytes, record_key, file_id);
+  NRF_LOG_FLUSH();
+#endif
+
+	ret_code_t ret;	 // NRF status
+
+  // create a new record
+  fds_record_t record;
+
+  record.file_id           = file_id;
+  record.key               = record_key;
+  record.data.p_data       = p_data;
+  record.data.length_words = (num_bytes + 3) / 4; // account for remainder
+  
+  // write the record to flash
+  ret = fds_record_write(record_desc, &record);
+  if (ret == NRF_SUCCESS) m_writes_queued++;
+  
+  // check if flash full
+  if ((ret != NRF_SUCCESS) && (ret == FDS_ERR_NO_SPACE_IN_FLASH))
+  {
+#ifdef DEBUG_FLASH
+    NRF_LOG_INFO("Flash full, write record fail", record_key, file_id);
+    NRF_LOG_FLUSH();
+#endif
+    return false;
+  } // if fail, but not flash full then it is a bigger problem
+  else
+  {
+    APP_ERROR_CHECK(ret);
+  }
+
+#ifdef DEBUG_FLASH
+  NRF_LOG_INFO("Write record success", record_key, file_id);
+  NRF_LOG_FLUSH();
+#endif
+  return true;
+}
+// Updates a record at record_desc with new information. Must find the record with flashManager_findRecord
+// Arguments:
+//  * record_desc: Pointer to the record desc to update
+//  file_id:       The file ID to store the record
+//  record_key:    The record key
+//  * p_data:      Pointer to the data to store
+//  num_bytes:     The number of bytes of the data
+// Returns:
+//  true if record write success
+//  false if record write fail
+static bool flashManager_updateRecord(fds_record_desc_t * record_desc, uint32_t file_id, uint32_t record_key, void const * p_data, uint32_t num_bytes)
+{
+#ifdef DEBUG_FLASH
+  NRF_LOG_INFO("Updating record %d at file %d", record_key, file_id);
+  NRF_LOG_FLUSH();
+#endif
+
+	ret_code_t ret;	 // NRF status
+
+  // create a new record
+  fds_record_t record;
+
+  record.file_id           = file_id;
+  record.key               = record_key;
+  record.data.p_data       = p_data;
+  record.data.length_words = (num_bytes + 3) / 4; // account for remainder
+  
+  // write the record to flash
+  ret = fds_record_update(record_desc, &record);
+  if (ret == NRF_SUCCESS) m_writes_queued++;
+  
+  // check if flash full
+  if ((ret != NRF_SUCCESS) && (ret == FDS_ERR_NO_SPACE_IN_FLASH))
+  {
+#ifdef DEBUG_FLASH
+    NRF_LOG_INFO("Flash full, write record fail", record_key, file_id);
+    NRF_LOG_FLUSH();
+#endif
+    return false;
+  } // if fail, but not flash full then it is a bigger problem
+  else
+  {
+    APP_ERROR_CHECK(ret);
+  }
+
+#ifdef DEBUG_FLASH
+  NRF_LOG_INFO("Write record success", record_key, file_id);
+  NRF_LOG_FLUSH();
+#endif
+  return true;
+}
+
+// Opens a record at record_desc and copies its contents to the buffer
+// Arguments:
+//  * record_desc: Pointer to store the found record desc
+//  * buff:          Buffer to store the flash data
+//  num_bytes:     Number of bytes to read from flash
+// Returns:
+//  true if flash read success
+//  false if flash read fail
+static bool flashManager_readRecord(fds_record_desc_t * record_desc, void * buff, uint32_t num_bytes)
+{
+#ifdef DEBUG_FLASH
+  NRF_LOG_INFO("Reading from record");
+  NRF_LOG_FLUSH();
+#endif
+  // create a new flash_record struct
+  fds_flash_record_t flash_record;
+
+  // ret code to store result
+  ret_code_t ret;
+  
+  // open the record
+  ret = fds_record_open(record_desc, &flash_record);
+  // check if fail
+  if (ret != NRF_SUCCESS) 
+  {
+#ifdef DEBUG_FLASH
+    NRF_LOG_INFO("Error opening file: %s", fds_err_str(ret));
+    NRF_LOG_FLUSH();
+#endif
+    return false;
+  }
+
+  // copy the data from the record to the buffer
+  memcpy(buff, flash_record.p_data, num_bytes);
+
+  // close the file
+  if (fds_record_close(record_desc) != NRF_SUCCESS) return false;
+
+#ifdef DEBUG_FLASH
+  NRF_LOG_INFO("Read success");
+  NRF_LOG_FLUSH();
+#endif
+
+  // success
+  return true;
+}
+
+// Gives a sink the points of one chunk of a sweep. The records are read in place in flash
+// Arguments:
+//  * sink:    Pointer to the sink to give the points to
+//  remaining: The number of points of the sweep not read yet
+//  sweep_num: The number of the sweep
+//  chunk:     The chunk to read
+// Returns:
+//  true if the chunk was read
+//  false if a record is missing or the sink failed
+static bool flashManager_readChunk(SweepSink * sink, uint32_t remaining, uint32_t sweep_num, uint16_t chunk)
+{
+  static uint32_t const keys[3] = {SWEEP_FREQ, SWEEP_REAL, SWEEP_IMAG};
+
+  fds_record_desc_t record_desc[3];
+  fds_flash_record_t flash_record[3];
+  uint8_t opened = 0;
+  bool success = true;
+
+  // open the frequency, real and imaginary records of the chunk
+  while (success && opened < 3)
+  {
+    success = flashManager_findRecord(&record_desc[opened], sweep_num, keys[opened] + chunk * SWEEP_CHUNK_KEYS) &&
+              (fds_record_open(&record_desc[opened], &flash_record[opened]) == NRF_SUCCESS);
+    if (success) opened++;
+  }
+
+  if (success)
+  {
+    uint32_t const * freq = flash_record[0].p_data;
+    uint16_t const * real = flash_record[1].p_data;
+    uint16_t const * imag = flash_record[2].p_data;
+
+    // each frequency takes one word, the last chunk may be padded
+    uint32_t points = flash_record[0].p_header->length_words;
+    if (points > remaining) points = remaining;
+    if (points == 0) success = false;
+
+    for (uint32_t i = 0; success && i < points; i++)
+    {
+      success = sweepSink_point(sink, freq[i], real[i], imag[i]);
+    }
+  }
+
+  // close the records that were opened
+  while (opened > 0)
+  {
+    opened--;
+    fds_record_close(&record_desc[opened]);
+  }
+
+  return success;
+}
+
+// Reads a sweep saved in the old (version 1) format, metadata and chunks of frequency, real and
+// imaginary records
+// Arguments:
+//  * sink:     Pointer to the sink to give the points to, it is started and ended here
+//  * metadata: Pointer to store the sweep metadata
+//  sweep_num:  The number of the sweep to read
+// Returns:
+//  true if sweep read success
+//  false if error reading the sweep or the sink failed
+static bool flashManager_readLegacySweep(SweepSink * sink, MetaData * metadata, uint32_t sweep_num)
+{
+  // create a new record desc
+  fds_record_desc_t record_desc;
+	
+	// find the sweep metadata
+  if (!flashManager_findRecord(&record_desc, sweep_num, SWEEP_METADATA)) return false;
+
+  // copy the metadata
+  if (!flashManager_readRecord(&record_desc, metadata, sizeof(MetaData))) return false;
+	
+	if (!sweepSink_begin(sink, metadata)) return sweepSink_end(sink, metadata, false);
+	
+	// give the sink the points of each chunk until all the points are read
+	bool success = true;
+	for (uint16_t chunk = 0; success && sink->count < metadata->numPoints; chunk++)
+	{
+		success = flashManager_readChunk(sink, metadata->numPoints - sink->count, sweep_num, chunk);
+	}
+	
+	return sweepSink_end(sink, metadata, success);
+}
+
+// Gives a sink the points of one record of a sweep, decoding them in place
+// Arguments:
+//  * sink:  Pointer to the sink to give the points to
+//  * chunk: Pointer to the chunk of the record, from flashManager_nextChunk
+// Returns:
+//  true if the points were read
+//  false if the record is damaged or the sink failed
+static bool flashManager_readPart(SweepSink * sink, SweepChunk const * chunk)
+{
+  SweepRecord const * record = chunk->record;
+  uint32_t bytes = sizeof(SweepRecord) + chunk->size;
+
+  if (record->version == SWEEP_RECORD_VERSION)
+  {
+    SweepDecoder decoder;
+    uint32_t freq;
+    int16_t real, imag;
+
+    sweepCodec_initDecoder(&decoder, chunk->data, chunk->size, record->numPoints);
+
+    while (sweepCodec_decode(&decoder, &freq, &real, &imag))
+    {
+      if (!sweepSink_point(sink, freq, SWEEP_CODEC_WORD(real), SWEEP_CODEC_WORD(imag))) return false;
+    }
+
+    // every point must be there
+    return !decoder.error && decoder.count == record->numPoints;
+  }
+
+  // version 2, raw pairs then the runs giving their frequencies
+  uint16_t const * data = (uint16_t const *) (record + 1);
+  SweepRun const * run = (SweepRun const *) (data + 2 * record->numPoints);
+  uint32_t point = 0;
+
+  if (record->version != SWEEP_RECORD_RUNS_VERSION || record->numRuns > SWEEP_MAX_RUNS) return false;
+  if (sizeof(SweepRecord) + record->numPoints * 2 * sizeof(uint16_t) + record->numRuns * sizeof(SweepRun) > bytes) return false;
+
+  for (uint16_t i = 0; i < record->numRuns; i++, run++)
+  {
+    if (run->count > record->numPoints - point) return false;
+
+    uint32_t freq = run->start;
+    for (uint16_t j = 0; j < run->count; j++, point++)
+    {
+      if (!sweepSink_point(sink, (freq & POINT_FREQ_MASK) | ((uint32_t) run->setting << POINT_SETTING_SHIFT), data[2 * point], data[2 * point + 1])) return false;
+      freq += run->delta;
+    }
+  }
+
+  // every point must belong to a run
+  return point == record->numPoints;
+}
+
+// Takes a record buffer from the pool for a flash sink and starts a new stream for its points. A buffer is
+// waited for if they are all being written, which only happens if the points come faster than the flash
+// can write them
+// Arguments:
+//  * flash: Pointer to the flash sink state
+static void flashManager_startPart(FlashSink * flash)
+{
+  flash->buffer = flashManager_acquireBuffer();
+  flash->size = 0;
+
+  if (flash->buffer != SWEEP_POOL_NONE) ((SweepRecord *) m_pool[flash->buffer].record)->numPoints = 0;
+
+  sweepCodec_initEncoder(&flash->encoder);
+}
+
+// Queues the write of the record buffer being filled by a flash sink, the next record is filled in another
+// buffer while it is written. The head record starts the commit of the sweep instead
+// Arguments:
+//  * flash:    Pointer to the flash sink state
+//  * metadata: Pointer to the final metadata to write the head record, NULL to write the next part
+// Returns:
+//  true if the record write was queued
+//  false if record write fail
+static bool flashManager_writePart(FlashSink * flash, MetaData const * metadata)
+{
+  fds_record_desc_t record_desc;
+  uint32_t record_key;
+
+  if (flash->buffer == SWEEP_POOL_NONE) return false;
+
+  SweepBuffer * buffer = &m_pool[flash->buffer];
+  SweepRecord * record = (SweepRecord *) buffer->record;
+
+  // the last block always fits, parts are started before a block could run out of room
+  if (!sweepCodec_finish(&flash->encoder)) return false;
+  flash->size += sweepCodec_take(&flash->encoder, (uint8_t *) (record + 1) + flash->size, SWEEP_RECORD_BYTES - sizeof(SweepRecord) - flash->size);
+
+  record->version = SWEEP_RECORD_VERSION;
+  record->numRuns = 0;
+
+  if (metadata == NULL)
+  {
+    // parts are numbered after the head in the order they are written
+    record->numParts = 0;
+    record_key = SWEEP_RECORD + 1 + flash->part;
+  }
+  else
+  {
+    record->numParts = flash->part + 1;
+    record->metadata = *metadata;
+    record_key = SWEEP_RECORD;
+  }
+
+  if (!flashManager_createRecord(&record_desc, SWEEP_FILE(flash->sweep_num), record_key, record, sizeof(SweepRecord) + flash->size)) return false;
+
+  // FDS owns the buffer until the write is done
+  buffer->ticket = m_writes_queued;
+  buffer->owner = BUFFER_WRITING;
+  flash->buffer = SWEEP_POOL_NONE;
+  flash->part += 1;
+
+  if (metadata != NULL)
+  {
+    // the FDS event of the head write finishes the commit
+    m_commit.sweep_num = flash->sweep_num;
+    m_commit.head = record_desc;
+    m_commit.record = *record;
+    m_commit.state = COMMIT_WRITING;
+
+    return true;
+  }
+
+  flashManager_catalogRecord(flash->sweep_num, record_key, &record_desc, record);
+  flashManager_startPart(flash);
+
+  return true;
+}
+
+// Returns true while the record write given by its ticket (the value of m_writes_queued once it was queued)
+// has not finished, the writes finish in order
+static bool flashManager_writing(uint32_t ticket)
+{
+  return (uint32_t) (m_writes_queued - ticket) < (uint32_t) (m_writes_queued - m_writes_done);
+}
+
+// Takes a record buffer from the pool for a flash sink. A buffer being written is back in the pool once its
+// write is done, so if none are free the oldest write is waited for. Only one sink is filled at a time and it
+// fills one buffer, so there is always a buffer free or being written. The pool is a few buffers, so it is
+// searched in constant time
+// Returns:
+//  the index of the buffer, owned by the caller until it is released or handed to FDS
+//  SWEEP_POOL_NONE if every buffer is being filled
+static uint8_t flashManager_acquireBuffer(void)
+{
+  bool waited = false;
+
+  while (true)
+  {
+    uint8_t used = 0;
+    uint8_t taken = SWEEP_POOL_NONE;
+    uint32_t oldest = 0;
+    bool writing = false;
+
+    for (uint8_t i = 0; i < SWEEP_POOL_BUFFERS; i++)
+    {
+      SweepBuffer * buffer = &m_pool[i];
+
+      if (buffer->owner == BUFFER_WRITING && !flashManager_writing(buffer->ticket)) buffer->owner = BUFFER_FREE;
+
+      if (buffer->owner == BUFFER_FREE && taken == SWEEP_POOL_NONE)
+      {
+        buffer->owner = BUFFER_FILLING;
+        taken = i;
+      }
+      else if (buffer->owner != BUFFER_FREE)
+      {
+        used++;
+      }
+
+      if (buffer->owner == BUFFER_WRITING)
+      {
+        if (!writing || (uint32_t) (buffer->ticket - m_writes_done) < (uint32_t) (oldest - m_writes_done)) oldest = buffer->ticket;
+        writing = true;
+      }
+    }
+
+    if (taken != SWEEP_POOL_NONE)
+    {
+      if (used + 1 > m_pool_peak) m_pool_peak = used + 1;
+      if (waited) m_pool_waits++;
+
+      return taken;
+    }
+
+    if (!writing) return SWEEP_POOL_NONE;
+
+    // the oldest write is the first to finish
+    while (flashManager_writing(oldest))
+    {
+      __WFE();
+    }
+
+    waited = true;
+  }
+}
+
+// Puts a record buffer back in the pool without writing it
+// Arguments:
+//  buffer: the index of the buffer, SWEEP_POOL_NONE does nothing
+static void flashManager_releaseBuffer(uint8_t buffer)
+{
+  if (buffer != SWEEP_POOL_NONE) m_pool[buffer].owner = BUFFER_FREE;
+}
+
+// Deletes the oldest sweep of the log and saves the new oldest sweep. Neither is waited for, the space
+// of the sweep comes back once it is garbage collected
+// Returns:
+//  true if the delete was queued
+//  false if it could not be queued
+static bool flashManager_evictOldest(void)
+{
+#ifdef DEBUG_FLASH
+  NRF_LOG_INFO("Evicting sweep %d", m_log.first);
+  NRF_LOG_FLUSH();
+#endif
+
+  if (!flashManager_deleteFile(SWEEP_FILE(m_log.first))) return false;
+
+  flashManager_catalogClear(m_log.first);
+  m_log.first += 1;
+  m_log.evicted += 1;
+
+  // queued after the delete, a reset in between leaves first at a deleted sweep, which is evicted again
+  return flashManager_saveFirstSweep();
+}
+
+// Saves the number of the oldest sweep kept (CONFIG_SWEEP_LOG), the write is not waited for
+// Returns:
+//  true if the write was queued
+//  false if it could not be queued
+static bool flashManager_saveFirstSweep(void)
+{
+  fds_record_desc_t record_desc;
+
+  if (flashManager_findRecord(&record_desc, CONFIG_ID, CONFIG_SWEEP_LOG))
+  {
+    return flashManager_updateRecord(&record_desc, CONFIG_ID, CONFIG_SWEEP_LOG, &m_log.first, sizeof(uint32_t));
+  }
+
+  return flashManager_createRecord(&record_desc, CONFIG_ID, CONFIG_SWEEP_LOG, &m_log.first, sizeof(uint32_t));
+}
+
+// Returns the flash words not written yet, from FDS statistics
+static uint32_t flashManager_freeWords(fds_stat_t const * stat)
+{
+  uint32_t capacity = (uint32_t) stat->pages_available * FDS_VIRTUAL_PAGE_SIZE;
+  uint32_t written = stat->words_used + stat->words_reserved;
+
+  return (capacity > written) ? capacity - written : 0;
+}
+
+// Returns the catalog entry of a sweep
+// Arguments:
+//  sweep_num: the number of the sweep
+// Returns:
+//  pointer to the entry, NULL if the sweep is not in the catalog or its head record is not known
+static CatalogEntry * flashManager_catalogEntry(uint32_t sweep_num)
+{
+  uint32_t slot = sweep_num % CATALOG_SWEEPS;
+  CatalogEntry * entry = &m_catalog[slot];
+
+  if (sweep_num == 0 || entry->sweep_num != sweep_num || m_catalog_records[slot][0].record_id != entry->record_id) return NULL;
+
+  return entry;
+}
+
+// Empties the catalog entry of a sweep, unless a newer sweep has it
+// Arguments:
+//  sweep_num: the number of the sweep
+static void flashManager_catalogClear(uint32_t sweep_num)
 {
-	ret_code_t ret;	 // NRF status
-	fds_stat_t stat; // FDS status
-	
-	// Register first to receive an event when initialization is complete.
-  (void) fds_register(fds_evt_handler);
+  uint32_t slot = sweep_num % CATALOG_SWEEPS;
 
-  // init fds and check for error
-  ret = fds_init();
-  APP_ERROR_CHECK(ret);
-	
-  // Wait for fds to initialize.
-  wait_for_fds_ready();
-	
-	// check FDS status
-	ret = fds_stat(&stat);
-  APP_ERROR_CHECK(ret);
-	
-	return true;
+  if (m_catalog[slot].sweep_num > sweep_num) return;
+
+  if (m_catalog[slot].sweep_num != 0)
+  {
+    m_catalog_dirty |= 1UL << (slot / CATALOG_CHUNK);
+    m_catalog_changes += 1;
+  }
+
+  memset(&m_catalog[slot], 0, sizeof(CatalogEntry));
+  memset(m_catalog_records[slot], 0, sizeof(m_catalog_records[slot]));
 }
 
-// --- FDS Helper Functions ---
+// Adds a record that was just written to the catalog, the entry of the sweep is filled in with its head record
+// Arguments:
+//  sweep_num:     the number of the sweep
+//  record_key:    the key of the record
+//  * record_desc: pointer to the descriptor of the record
+//  * record:      pointer to the record written
+static void flashManager_catalogRecord(uint32_t sweep_num, uint32_t record_key, fds_record_desc_t const * record_desc, SweepRecord const * record)
+{
+  uint32_t slot = sweep_num % CATALOG_SWEEPS;
+  uint32_t part = record_key - SWEEP_RECORD;
 
-// Creates a record with given parameters
+  if (part < CATALOG_PARTS) m_catalog_records[slot][part] = *record_desc;
+  if (record_desc->p_record == NULL) m_catalog_unlocated = true;
+
+  if (part != 0) return;
+
+  m_catalog[slot].sweep_num = sweep_num;
+  m_catalog[slot].record_id = record_desc->record_id;
+  m_catalog[slot].numParts  = record->numParts;
+  m_catalog[slot].reserved  = 0;
+  m_catalog[slot].metadata  = record->metadata;
+
+  m_catalog_dirty |= 1UL << (slot / CATALOG_CHUNK);
+  m_catalog_changes += 1;
+}
+
+// Returns the kept sweep saved in a file that the catalog can hold
 // Arguments:
-//  * record_desc: Pointer to the record desc
-//  file_id:    The file ID to store the record
-//  record_key: The record key
-//  * p_data:   Pointer to the data to store
-//  num_bytes:  The number of bytes of the data
+//  file_id: the file ID
 // Returns:
-//  true if record write success
-//  false if record write fail
-static bool flashManager_createRecord(fds_record_desc_t * record_desc, uint32_t file_id, uint32_t record_key, void const * p_data, uint32_t num_bytes)
+//  the number of the sweep, 0 if there is none
+static uint32_t flashManager_fileSweep(uint16_t file_id)
 {
-#ifdef DEBUG_FLASH
-  NRF_LOG_INFO("Writing %d bytes to record %d in file %d", num_bytes, record_key, file_id);
-  NRF_LOG_FLUSH();
-#endif
+  if (file_id == CONFIG_ID || file_id > SWEEP_LOG_FILES || m_log.last < m_log.first) return 0;
 
-	ret_code_t ret;	 // NRF status
+  // the files after the one of the oldest sweep hold the newer sweeps in order
+  uint32_t sweep_num = m_log.first + (file_id + SWEEP_LOG_FILES - SWEEP_FILE(m_log.first)) % SWEEP_LOG_FILES;
 
-  // create a new record
-  fds_record_t record;
+  if (sweep_num > m_log.last || sweep_num + CATALOG_SWEEPS <= m_log.last) return 0;
 
-  record.file_id           = file_id;
-  record.key               = record_key;
-  record.data.p_data       = p_data;
-  record.data.length_words = (num_bytes + 3) / 4; // account for remainder
-  
-  // write the record to flash
-  ret = fds_record_write(record_desc, &record);
-  
-  // check if flash full
-  if ((ret != NRF_SUCCESS) && (ret == FDS_ERR_NO_SPACE_IN_FLASH))
-  {
-#ifdef DEBUG_FLASH
-    NRF_LOG_INFO("Flash full, write record fail", record_key, file_id);
-    NRF_LOG_FLUSH();
-#endif
-    return false;
-  } // if fail, but not flash full then it is a bigger problem
-  else
+  return sweep_num;
+}
+
+// Finds the records of the sweeps the catalog can hold in one pass over the flash, their descriptors are
+// replaced. The file ID and key of each record are read from its header without opening it (no CRC check)
+static void flashManager_scanCatalog(void)
+{
+  fds_record_desc_t record_desc;
+  fds_find_token_t ftok;
+  memset(&ftok, 0x00, sizeof(fds_find_token_t));
+
+  m_catalog_stale = false;
+  memset(m_catalog_records, 0, sizeof(m_catalog_records));
+
+  while (fds_record_iterate(&record_desc, &ftok) == NRF_SUCCESS)
   {
-    APP_ERROR_CHECK(ret);
+    fds_header_t const * header = (fds_header_t const *) record_desc.p_record;
+    uint32_t part = (uint32_t) header->record_key - SWEEP_RECORD;
+    uint32_t sweep_num = flashManager_fileSweep(header->file_id);
+
+    if (sweep_num != 0 && header->record_key >= SWEEP_RECORD && part < CATALOG_PARTS)
+    {
+      m_catalog_records[sweep_num % CATALOG_SWEEPS][part] = record_desc;
+    }
   }
 
 #ifdef DEBUG_FLASH
-  NRF_LOG_INFO("Write record success", record_key, file_id);
+  NRF_LOG_INFO("Catalog records found");
   NRF_LOG_FLUSH();
 #endif
-  return true;
 }
-// Updates a record at record_desc with new information. Must find the record with flashManager_findRecord
-// Arguments:
-//  * record_desc: Pointer to the record desc to update
-//  file_id:       The file ID to store the record
-//  record_key:    The record key
-//  * p_data:      Pointer to the data to store
-//  num_bytes:     The number of bytes of the data
-// Returns:
-//  true if record write success
-//  false if record write fail
-static bool flashManager_updateRecord(fds_record_desc_t * record_desc, uint32_t file_id, uint32_t record_key, void const * p_data, uint32_t num_bytes)
+
+// Opens the catalog records that have no address yet, FDS finds each one once and stores its address in the
+// descriptor. Records still not found are looked up when they are read
+static void flashManager_locateCatalog(void)
 {
-#ifdef DEBUG_FLASH
-  NRF_LOG_INFO("Updating record %d at file %d", record_key, file_id);
-  NRF_LOG_FLUSH();
-#endif
+  fds_flash_record_t flash_record;
 
-	ret_code_t ret;	 // NRF status
+  m_catalog_unlocated = false;
 
-  // create a new record
-  fds_record_t record;
+  for (uint32_t slot = 0; slot < CATALOG_SWEEPS; slot++)
+  {
+    for (uint32_t part = 0; part < CATALOG_PARTS; part++)
+    {
+      fds_record_desc_t * record_desc = &m_catalog_records[slot][part];
 
-  record.file_id           = file_id;
-  record.key               = record_key;
-  record.data.p_data       = p_data;
-  record.data.length_words = (num_bytes + 3) / 4; // account for remainder
-  
-  // write the record to flash
-  ret = fds_record_update(record_desc, &record);
-  
-  // check if flash full
-  if ((ret != NRF_SUCCESS) && (ret == FDS_ERR_NO_SPACE_IN_FLASH))
+      if (record_desc->record_id == 0 || record_desc->p_record != NULL) continue;
+
+      if (fds_record_open(record_desc, &flash_record) == NRF_SUCCESS) (void) fds_record_close(record_desc);
+    }
+  }
+}
+
+// Loads the catalog checkpoint and brings it up to date with the sweeps in flash, the heads of the
+// sweeps saved or deleted since the checkpoint are read
+// Returns:
+//  true if the catalog was loaded
+//  false if a head record could not be read
+static bool flashManager_loadCatalog(void)
+{
+  fds_record_desc_t record_desc;
+
+  for (uint32_t chunk = 0; chunk < CATALOG_SWEEPS / CATALOG_CHUNK; chunk++)
   {
-#ifdef DEBUG_FLASH
-    NRF_LOG_INFO("Flash full, write record fail", record_key, file_id);
-    NRF_LOG_FLUSH();
-#endif
-    return false;
-  } // if fail, but not flash full then it is a bigger problem
-  else
+    CatalogEntry * entries = &m_catalog[chunk * CATALOG_CHUNK];
+
+    if (!flashManager_findRecord(&record_desc, CONFIG_ID, CONFIG_CATALOG + chunk) ||
+        !flashManager_readRecord(&record_desc, entries, CATALOG_CHUNK * sizeof(CatalogEntry)))
+    {
+      memset(entries, 0, CATALOG_CHUNK * sizeof(CatalogEntry));
+    }
+  }
+
+  flashManager_scanCatalog();
+
+  for (uint32_t slot = 0; slot < CATALOG_SWEEPS; slot++)
   {
-    APP_ERROR_CHECK(ret);
+    CatalogEntry * entry = &m_catalog[slot];
+    fds_record_desc_t * head_desc = &m_catalog_records[slot][0];
+    SweepRecord record;
+
+    // the entry is right if the head it names is still there
+    if (head_desc->record_id != 0 && entry->record_id == head_desc->record_id && entry->sweep_num % CATALOG_SWEEPS == slot) continue;
+
+    uint32_t sweep_num = (head_desc->record_id != 0) ? flashManager_fileSweep(((fds_header_t const *) head_desc->p_record)->file_id) : 0;
+
+    if (entry->sweep_num != 0 || sweep_num != 0)
+    {
+      m_catalog_dirty |= 1UL << (slot / CATALOG_CHUNK);
+      m_catalog_changes += 1;
+    }
+
+    memset(entry, 0, sizeof(CatalogEntry));
+
+    if (sweep_num == 0) continue;
+
+    if (!flashManager_readRecord(head_desc, &record, sizeof(SweepRecord))) return false;
+
+    entry->sweep_num = sweep_num;
+    entry->record_id = head_desc->record_id;
+    entry->numParts  = record.numParts;
+    entry->metadata  = record.metadata;
   }
 
+  m_catalog_loaded = true;
+
 #ifdef DEBUG_FLASH
-  NRF_LOG_INFO("Write record success", record_key, file_id);
+  NRF_LOG_INFO("Catalog loaded, %d entries changed", m_catalog_changes);
   NRF_LOG_FLUSH();
 #endif
+
   return true;
 }
 
-// Opens a record at record_desc and copies its contents to the buffer
-// Arguments:
-//  * record_desc: Pointer to store the found record desc
-//  * buff:          Buffer to store the flash data
-//  num_bytes:     Number of bytes to read from flash
+// Saves the next changed chunk of the catalog to the config file. The write is not waited for, an entry
+// changed while it is written is saved with the next checkpoint
 // Returns:
-//  true if flash read success
-//  false if flash read fail
-static bool flashManager_readRecord(fds_record_desc_t * record_desc, void * buff, uint32_t num_bytes)
+//  true if the write was queued
+//  false if it could not be queued
+static bool flashManager_checkpointCatalog(void)
 {
-#ifdef DEBUG_FLASH
-  NRF_LOG_INFO("Reading from record");
-  NRF_LOG_FLUSH();
-#endif
-  // create a new flash_record struct
-  fds_flash_record_t flash_record;
+  fds_record_desc_t record_desc;
+  uint32_t chunk = 0;
 
-  // ret code to store result
-  ret_code_t ret;
-  
-  // open the record
-  ret = fds_record_open(record_desc, &flash_record);
-  // check if fail
-  if (ret != NRF_SUCCESS) 
+  if (m_catalog_dirty == 0)
   {
-#ifdef DEBUG_FLASH
-    NRF_LOG_INFO("Error opening file: %s", fds_err_str(ret));
-    NRF_LOG_FLUSH();
-#endif
+    m_catalog_changes = 0;
     return false;
   }
 
-  // copy the data from the record to the buffer
-  memcpy(buff, flash_record.p_data, num_bytes);
+  while ((m_catalog_dirty & (1UL << chunk)) == 0) chunk++;
 
-  // close the file
-  if (fds_record_close(record_desc) != NRF_SUCCESS) return false;
+  m_catalog_dirty &= ~(1UL << chunk);
+  if (m_catalog_dirty == 0) m_catalog_changes = 0;
 
-#ifdef DEBUG_FLASH
-  NRF_LOG_INFO("Read success");
-  NRF_LOG_FLUSH();
-#endif
+  CatalogEntry const * entries = &m_catalog[chunk * CATALOG_CHUNK];
 
-  // success
-  return true;
+  if (flashManager_findRecord(&record_desc, CONFIG_ID, CONFIG_CATALOG + chunk))
+  {
+    return flashManager_updateRecord(&record_desc, CONFIG_ID, CONFIG_CATALOG + chunk, entries, CATALOG_CHUNK * sizeof(CatalogEntry));
+  }
+
+  return flashManager_createRecord(&record_desc, CONFIG_ID, CONFIG_CATALOG + chunk, entries, CATALOG_CHUNK * sizeof(CatalogEntry));
 }
 
 // Finds a record given file ID and record key
@@ -449,30 +1682,6 @@ static bool flashManager_findRecord(fds_record_desc_t * record_desc, uint32_t fi
   }
 }
 
-// Deletes a record given a record description
-// Arguments:
-//  * record_desc: Pointer to the record description
-// Returns:
-//  true if record delete success
-//  false if record delete fail
-static bool flashManager_deleteRecord(fds_record_desc_t * record_desc)
-{
-#ifdef DEBUG_FLASH
-  NRF_LOG_INFO("Deleting record");
-  NRF_LOG_FLUSH();
-#endif
-  if (fds_record_delete(record_desc) != NRF_SUCCESS)
-  {
-#ifdef DEBUG_FLASH
-    NRF_LOG_INFO("Record delete fail");
-    NRF_LOG_FLUSH();
-#endif
-    return false;
-  }
-  // success
-  return true;
-}
-
 // Deletes a file given a file ID
 // Arguments:
 //  file_id: file id to delete
@@ -493,6 +1702,7 @@ bool flashManager_deleteFile(uint32_t file_id)
 #endif
     return false;
   }
+  m_pending_deletes++;
   // success
   return true;
 }
@@ -562,6 +1772,23 @@ static void fds_evt_handler(fds_evt_t const * p_evt)
           NRF_LOG_INFO("Record key:\t0x%04x", p_evt->write.record_key);
 #endif
         }
+        else
+        {
+          m_write_failed = true;
+        }
+        m_writes_done++;
+
+        // the head record is written last, the sweep is committed once it is done
+        if (m_commit.state == COMMIT_WRITING && p_evt->write.record_id == m_commit.head.record_id)
+        {
+          m_commit.state = (p_evt->result == NRF_SUCCESS) ? COMMIT_SAVED : COMMIT_FAILED;
+        }
+      } break;
+
+    case FDS_EVT_UPDATE:
+      {
+        if (p_evt->result != NRF_SUCCESS) m_write_failed = true;
+        m_writes_done++;
       } break;
 
     case FDS_EVT_DEL_RECORD:
@@ -576,6 +1803,17 @@ static void fds_evt_handler(fds_evt_t const * p_evt)
         }
       } break;
 
+    case FDS_EVT_DEL_FILE:
+      {
+        if (m_pending_deletes > 0) m_pending_deletes--;
+      } break;
+
+    case FDS_EVT_GC:
+      {
+        m_gc_running = false;
+        m_catalog_stale = true;
+      } break;
+
     default:
       break;
   }
@@ -589,3 +1827,97 @@ static void wait_for_fds_ready(void)
     __WFE();
   }
 }
+
+// Waits for the queued record writes to finish
+// Returns:
+//  true if all the writes succeeded
+//  false if a write failed
+static bool wait_for_fds_writes(void)
+{
+  while (m_writes_done != m_writes_queued)
+  {
+    __WFE();
+  }
+
+  bool success = !m_write_failed;
+  m_write_failed = false;
+
+  return success;
+}
+
+// --- Sink Functions ---
+
+// Starts a flash sink
+static bool flashManager_sinkBegin(SweepSink * sink, MetaData const * metadata)
+{
+  UNUSED_PARAMETER(metadata);
+
+  FlashSink * flash = sink->context;
+
+  flashManager_releaseBuffer(flash->buffer);
+  flash->part = 0;
+  flashManager_startPart(flash);
+
+  if (flash->buffer == SWEEP_POOL_NONE) return false;
+
+  // the sweep takes over the catalog entry of the sweep CATALOG_SWEEPS before it
+  flashManager_catalogClear(flash->sweep_num);
+
+  return true;
+}
+
+// Codes a point into the record buffer of a flash sink. The buffer is written as a part, and the other buffer
+// filled, before a new block is started if the block might not fit
+static bool flashManager_sinkPoint(SweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag)
+{
+  FlashSink * flash = sink->context;
+
+  uint32_t room = SWEEP_RECORD_BYTES - sizeof(SweepRecord) - flash->size;
+
+  if (flash->encoder.fill == 0 && room < SWEEP_CODEC_MAX_BLOCK_BYTES)
+  {
+    if (!flashManager_writePart(flash, NULL)) return false;
+    room = SWEEP_RECORD_BYTES - sizeof(SweepRecord);
+  }
+
+  if (flash->buffer == SWEEP_POOL_NONE) return false;
+
+  SweepRecord * record = (SweepRecord *) m_pool[flash->buffer].record;
+
+  if (!sweepCodec_encode(&flash->encoder, freq, SWEEP_CODEC_SAMPLE(real), SWEEP_CODEC_SAMPLE(imag))) return false;
+
+  // move the bytes of a finished block into the record
+  flash->size += sweepCodec_take(&flash->encoder, (uint8_t *) (record + 1) + flash->size, room);
+  record->numPoints += 1;
+
+  return true;
+}
+
+// Starts the commit of the head record of a flash sink with the last points and the metadata, or deletes the
+// sweep if it failed. The commit of the sweep before must be completed first
+static bool flashManager_sinkEnd(SweepSink * sink, MetaData * metadata, bool success)
+{
+  FlashSink * flash = sink->context;
+
+  if (m_commit.state != COMMIT_NONE) success = false;
+
+  // the head goes last, a sweep without it is never read. The parts are written by now unless the points
+  // came faster than the flash could write them
+  if (success) success = wait_for_fds_writes() && flashManager_writePart(flash, metadata);
+
+  // do not leave the parts of a failed sweep in flash
+  if (!success)
+  {
+    flashManager_releaseBuffer(flash->buffer);
+    flash->buffer = SWEEP_POOL_NONE;
+    flashManager_catalogClear(flash->sweep_num);
+    flashManager_deleteFile(SWEEP_FILE(flash->sweep_num));
+  }
+
+#ifdef DEBUG_FLASH
+  NRF_LOG_INFO("Sweep %d stream save %s, %d points", flash->sweep_num, success ? "success" : "fail", sink->count);
+  NRF_LOG_FLUSH();
+#endif
+
+  return success;
+}
@@ -15,14 +15,21 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#ifndef AD5933_SIM
 #include "nrf.h"
 #include "nrf_drv_clock.h"
 #include "nrf_drv_power.h"
 #include "app_error.h"
 #include "app_timer.h"
 #include "fds.h"
+#else
+#include "fdsSim.h"
+#endif
 
 #include "AD5933.h"
+#include "sweepSink.h"
+#include "calibration.h"
+#include "sweepCodec.h"
 
 #ifdef DEBUG_FLASH
 #include "nrf_log.h"
@@ -34,12 +41,183 @@
 #define CONFIG_ID         0x0000
 #define CONFIG_NUM_SWEEPS 0x0001
 #define CONFIG_SWEEP      0x0002
+#define CONFIG_CALIBRATION 0x0003
+#define CONFIG_SWEEP_LOG  0x0004
+#define CONFIG_CATALOG    0x0100 // first key of the sweep catalog checkpoint, chunk n uses CONFIG_CATALOG + n
 #define SWEEP_FREQ				0x0001
 #define SWEEP_REAL				0x0002
 #define SWEEP_IMAG				0x0003
 #define SWEEP_METADATA		0x0004
 #define MAX_FREQ_SIZE     2048
 #define MAX_IMP_SIZE      1024
+#define SWEEP_CHUNK_KEYS   4   // record keys taken by each chunk of an old (version 1) sweep, chunk n uses SWEEP_FREQ + n * SWEEP_CHUNK_KEYS...
+#define SWEEP_RECORD         0x1000 // key of the head record of a sweep, its other parts use the keys after it
+#define SWEEP_RECORD_VERSION 3      // points coded with sweepCodec
+#define SWEEP_RECORD_RUNS_VERSION 2 // raw real and imaginary pairs and frequency runs, still read
+#define SWEEP_RECORD_BYTES   2016   // largest record of a sweep, two fit on a virtual page
+#define SWEEP_MAX_RUNS       16     // most runs of evenly spaced frequencies in one version 2 record
+#define SWEEP_POOL_BUFFERS   2      // record buffers shared by the flash sinks, one is filled while the other is written
+#define SWEEP_POOL_NONE      0xFF   // no record buffer
+
+// owner of a record buffer of the pool, a buffer is handed from the sink filling it to the FDS write of it
+#define BUFFER_FREE    0 // in the pool
+#define BUFFER_FILLING 1 // a flash sink is coding points into it
+#define BUFFER_WRITING 2 // FDS is writing it to flash, it is back in the pool once the write is done
+
+// state of the commit of the last sweep saved, see flashManager_commitPoll
+#define COMMIT_NONE    0 // no sweep is being committed
+#define COMMIT_WRITING 1 // the records of the sweep are being written
+#define COMMIT_SAVED   2 // the sweep is in flash, call flashManager_commitComplete
+#define COMMIT_FAILED  3 // a record could not be written, call flashManager_commitComplete to delete the sweep
+
+// sweep log, sweeps are numbered from 1 forever and kept in a ring of FDS files
+#define SWEEP_LOG_FILES       0xBFFF // FDS file IDs only go to 0xBFFF, file 0 is the config file
+#define SWEEP_FILE(sweep_num) ((uint16_t) (1 + ((sweep_num) - 1) % SWEEP_LOG_FILES)) // file of a sweep, the same as its number for the first 0xBFFF
+#define SWEEP_LOG_MAX_SWEEPS  4096   // default retention, the most sweeps kept before the oldest are evicted
+#define SWEEP_LOG_GC_WORDS    FDS_VIRTUAL_PAGE_SIZE // garbage collect between sweeps once this many words are dirty
+#define FLASH_HEADER_WORDS    3      // words of the FDS header of every record
+
+// sweep catalog, the newest sweeps are found and listed without searching the flash
+#define CATALOG_SWEEPS     256 // newest sweeps in the catalog, older ones are found by searching
+#define CATALOG_PARTS      4   // records of a sweep found through the catalog, enough for 512 points
+#define CATALOG_CHUNK      32  // entries saved in each checkpoint record
+#define CATALOG_CHECKPOINT 16  // entries changed before the catalog is checkpointed
+
+// struct to hold a run of evenly spaced frequencies measured at the same setting in a version 2 record,
+// point i of the run is at start + i * delta
+typedef struct sweepRun
+{
+  uint32_t start;    // the frequency of the first point
+  uint32_t delta;    // the step to the next point (wraps for falling frequencies)
+  uint16_t count;    // the number of points
+  uint8_t setting;   // the top byte of the frequency of the points (POINT_SETTING), 0 without autoRange
+  uint8_t reserved;
+} SweepRun;
+
+// struct to hold the header of a sweep record. A sweep is saved as one record, or more if it is too large,
+// each holding a header then its numPoints points as a sweepCodec stream of their own. (Version 2 records
+// hold numPoints raw real and imaginary pairs then numRuns runs giving their frequencies.)
+// The head record (key SWEEP_RECORD) holds the last points and is written last, a sweep without it is never read
+typedef struct sweepRecord
+{
+  uint16_t version;   // SWEEP_RECORD_VERSION
+  uint16_t numParts;  // the number of records of the sweep (head record only)
+  uint16_t numRuns;   // the number of runs after the points (version 2 only)
+  uint16_t numPoints; // the number of points in this record
+  MetaData metadata;  // the sweep metadata (head record only)
+} SweepRecord;
+
+// struct to hold a record buffer of the pool. The pool holds one buffer for the flash sink being filled and
+// one for each record being written, so a sink always gets one, waiting for a write at worst
+typedef struct sweepBuffer
+{
+  uint32_t record[SWEEP_RECORD_BYTES / 4]; // the record, FDS writes it from here
+  uint32_t ticket;                         // the write of the record, see flashManager_writing
+  uint8_t owner;                           // BUFFER_FREE, BUFFER_FILLING or BUFFER_WRITING
+} SweepBuffer;
+
+// struct to hold the state of a flash sink, points are coded into a record buffer from the pool that is
+// handed to FDS once full while the next record is coded into another buffer
+typedef struct flashSink
+{
+  uint32_t sweep_num;    // the sweep number (file ID) to save to
+  uint16_t part;         // the number of parts saved
+  uint8_t buffer;        // the pool buffer being filled, SWEEP_POOL_NONE if none
+  SweepEncoder encoder;  // codes the points of the record being filled
+  uint32_t size;         // coded bytes in the record after its header
+} FlashSink;
+
+// struct to hold the commit of the last sweep saved. Its head record is written in the background, the
+// FDS event of the write finishes it
+typedef struct sweepCommit
+{
+  uint32_t sweep_num;      // the sweep being committed
+  uint8_t volatile state;  // COMMIT_NONE, COMMIT_WRITING, COMMIT_SAVED or COMMIT_FAILED
+  fds_record_desc_t head;  // the descriptor of the head record
+  SweepRecord record;      // the header of the head record, for the catalog
+} SweepCommit;
+
+// struct to hold a chunk of a saved sweep, the points of one of its records. The data is in flash and valid
+// until the next chunk is taken or the reader is closed
+typedef struct sweepChunk
+{
+  SweepRecord const * record;  // the record header, the points follow it
+  uint8_t const * data;        // the points of the record, coded if version is SWEEP_RECORD_VERSION
+  uint32_t size;               // bytes of data, rounded up to whole words
+} SweepChunk;
+
+// struct to hold the state of a sweep reader. The head record stays open while the reader is, the other
+// parts are opened one at a time in order and the head is given last
+typedef struct sweepReader
+{
+  uint32_t sweep_num;             // the sweep being read
+  uint16_t part;                  // the next part to give, numParts is the head
+  bool error;                     // a part was missing or damaged
+  SweepRecord const * head;       // the head record
+  uint32_t headBytes;             // bytes of the head record
+  fds_record_desc_t * records;    // the catalog descriptors of the sweep, NULL if it is not in the catalog
+  fds_record_desc_t * headDesc;   // the descriptor of the head record
+  fds_record_desc_t * partDesc;   // the descriptor of the open part, NULL if none
+  fds_record_desc_t foundHead;    // descriptors found by searching the flash
+  fds_record_desc_t foundPart;
+} SweepReader;
+
+// struct to hold the state of the sweep log. The sweeps from first to last are kept, the oldest are evicted
+// once there are more than maxSweeps or the flash could not take another sweep (reserveWords free with
+// contigWords of them on one page). Only first is saved (CONFIG_SWEEP_LOG), last is the number of saved
+// sweeps (CONFIG_NUM_SWEEPS)
+typedef struct sweepLog
+{
+  uint32_t first;        // number of the oldest sweep kept, last + 1 if there are none
+  uint32_t last;         // number of the newest sweep
+  uint32_t maxSweeps;    // most sweeps kept
+  uint32_t reserveWords; // flash words kept free for the next sweep
+  uint32_t contigWords;  // free words kept on one page, records can not use the end of a page they do not fit on
+  uint32_t evicted;      // number of sweeps evicted since flashManager_init
+  uint32_t gcRuns;       // number of garbage collections started since flashManager_init
+} SweepLog;
+
+// struct to hold the catalog entry of a sweep, sweep n is at n % CATALOG_SWEEPS. The entries are kept in RAM
+// with the record descriptors of the sweeps and checkpointed to the config file (CONFIG_CATALOG) between sweeps.
+// An entry is only trusted while its head record has record_id, the entries lost by a reset are rebuilt
+typedef struct catalogEntry
+{
+  uint32_t sweep_num;  // the sweep number, 0 if the entry is empty
+  uint32_t record_id;  // the FDS record ID of the head record
+  uint16_t numParts;   // the number of records of the sweep
+  uint16_t reserved;
+  MetaData metadata;   // the sweep metadata (time, temp, numPoints)
+} CatalogEntry;
+
+// struct to hold the result of a bulk delete, see flashManager_deleteSweeps
+typedef struct deleteReport
+{
+  uint32_t first;          // the first sweep deleted
+  uint32_t last;           // the last sweep deleted
+  uint32_t sweeps;         // the number of sweeps deleted
+  uint32_t firstKept;      // the oldest sweep kept after the delete (CONFIG_SWEEP_LOG), the newest sweep + 1 if none
+  uint32_t reclaimedBytes; // flash the garbage collection frees, it is still running when the report is made
+  uint32_t elapsedMs;      // time from the first delete to the start of the garbage collection
+} DeleteReport;
+
+// struct to hold flash usage statistics, the pages are the words rounded down to whole virtual pages
+typedef struct flashStats
+{
+  uint16_t pages;        // virtual pages that hold records, the swap page is not counted
+  uint16_t usedPages;    // pages worth of valid records and page tags
+  uint16_t dirtyPages;   // pages worth of deleted records, free again once garbage collected
+  uint16_t freePages;    // pages worth of words not written yet
+  uint32_t usedWords;
+  uint32_t dirtyWords;
+  uint32_t freeWords;
+  uint32_t firstSweep;   // the oldest sweep kept
+  uint32_t lastSweep;    // the newest sweep
+  uint32_t evicted;      // sweeps evicted since flashManager_init
+  uint32_t gcRuns;       // garbage collections since flashManager_init
+  uint16_t buffersUsed;  // record buffers of the pool not free
+  uint16_t buffersPeak;  // most record buffers not free at once since flashManager_init
+  uint32_t bufferWaits;  // times a flash sink waited for a record buffer to be written
+} FlashStats;
 
 // User Functions
 bool flashManager_init(void);
@@ -49,19 +227,60 @@ bool flashManager_getSweep(uint32_t * freq, uint16_t * real, uint16_t * imag, Me
 bool flashManager_updateSavedSweep(Sweep * sweep);
 bool flashManager_updateNumSweeps(uint32_t * num_sweeps);
 bool flashManager_deleteSweep(uint32_t sweep_num);
-bool flashManager_deleteAllSweeps(uint32_t num_sweeps);
+bool flashManager_deleteSweeps(uint32_t first, uint32_t last, DeleteReport * report);
+bool flashManager_deleteAllSweeps(DeleteReport * report);
+void flashManager_initSink(SweepSink * sink, FlashSink * flash, uint32_t sweep_num);
+bool flashManager_readSweep(SweepSink * sink, MetaData * metadata, uint32_t sweep_num);
+bool flashManager_saveCalibration(CalTable const * table);
+bool flashManager_getCalibration(CalTable * table);
+void flashManager_setRetention(uint32_t max_sweeps, uint32_t reserve_points);
+uint32_t flashManager_firstSweep(void);
+uint32_t flashManager_sweepWords(uint32_t num_points);
+bool flashManager_idle(void);
+bool flashManager_getStats(FlashStats * stats);
+uint8_t flashManager_commitPoll(void);
+bool flashManager_commitComplete(uint32_t * sweep_num);
+bool flashManager_getEntry(uint32_t sweep_num, CatalogEntry * entry);
+uint32_t flashManager_findSweeps(uint32_t start_time, uint32_t end_time, uint32_t * sweep_nums, uint32_t max_sweeps);
+bool flashManager_openSweep(SweepReader * reader, MetaData * metadata, uint32_t sweep_num);
+bool flashManager_nextChunk(SweepReader * reader, SweepChunk * chunk);
+void flashManager_closeSweep(SweepReader * reader);
 
 // FDS helper functions
 static bool flashManager_createRecord(fds_record_desc_t * record_desc, uint32_t file_id, uint32_t record_key, void const * p_data, uint32_t num_bytes);
 static bool flashManager_findRecord(fds_record_desc_t * record_desc, uint32_t file_id, uint32_t record_key);
 static bool flashManager_updateRecord(fds_record_desc_t* record_desc, uint32_t file_id, uint32_t record_key, void const * p_data, uint32_t num_bytes);
 static bool flashManager_readRecord(fds_record_desc_t * record_desc, void * buff, uint32_t num_bytes);
-static bool flashManager_deleteRecord(fds_record_desc_t * record_desc);
+static bool flashManager_readChunk(SweepSink * sink, uint32_t remaining, uint32_t sweep_num, uint16_t chunk);
+static bool flashManager_readLegacySweep(SweepSink * sink, MetaData * metadata, uint32_t sweep_num);
+static bool flashManager_readPart(SweepSink * sink, SweepChunk const * chunk);
+static void flashManager_startPart(FlashSink * flash);
+static bool flashManager_writePart(FlashSink * flash, MetaData const * metadata);
+static bool flashManager_evictOldest(void);
+static bool flashManager_saveFirstSweep(void);
+static uint32_t flashManager_freeWords(fds_stat_t const * stat);
+static bool flashManager_writing(uint32_t ticket);
+static uint8_t flashManager_acquireBuffer(void);
+static void flashManager_releaseBuffer(uint8_t buffer);
+static CatalogEntry * flashManager_catalogEntry(uint32_t sweep_num);
+static void flashManager_catalogClear(uint32_t sweep_num);
+static void flashManager_catalogRecord(uint32_t sweep_num, uint32_t record_key, fds_record_desc_t const * record_desc, SweepRecord const * record);
+static uint32_t flashManager_fileSweep(uint16_t file_id);
+static void flashManager_scanCatalog(void);
+static void flashManager_locateCatalog(void);
+static bool flashManager_loadCatalog(void);
+static bool flashManager_checkpointCatalog(void);
 bool flashManager_deleteFile(uint32_t file_id);
 
 // FDS functions
 const char *fds_err_str(ret_code_t ret);
 static void fds_evt_handler(fds_evt_t const * p_evt);
 static void wait_for_fds_ready(void);
+static bool wait_for_fds_writes(void);
+
+// sink functions
+static bool flashManager_sinkBegin(SweepSink * sink, MetaData const * metadata);
+static bool flashManager_sinkPoint(SweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag);
+static bool flashManager_sinkEnd(SweepSink * sink, MetaData * metadata, bool success);
 
 #endif
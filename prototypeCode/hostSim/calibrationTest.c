@@ -0,0 +1,249 @@
+/*
+ *  calibrationTest.c
+ *
+ *  Checks calibration.c on the simulated bus with a signal path that has a system phase and a low pass,
+ *  so the gain and system phase change with frequency. A sweep against the calibration resistor builds a
+ *  table through the calibration sink, the table is checked against the gain and system phase of the
+ *  model every 10 Hz, between its knots too, and is then used to convert a sweep of an RC load, which
+ *  must come out as the |Z| and phase of the load. The table is saved with flashManager_saveCalibration
+ *  and read back with flashManager_getCalibration, after a reset too. Exits with 1 on a failure.
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "AD5933.h"
+#include "calibration.h"
+#include "flashManager.h"
+#include "twiManager.h"
+#include "fdsSim.h"
+
+#define TEST_START      1000  // sweeps from 1 to 99 kHz
+#define TEST_DELTA      200
+#define TEST_STEPS      490
+#define TEST_CYCLES     15
+#define CAL_RESISTANCE  10000 // ohms
+#define SYSTEM_PHASE    30    // degrees
+#define SYSTEM_POLE     40000 // Hz
+#define LOAD_R          5000  // the RC load, 5 kOhm in series with 10 nF
+#define LOAD_C          10e-9
+#define GAIN_MARGIN_PPM 200   // rounding of the codes on top of CAL_GAIN_TOLERANCE_PPM
+#define PHASE_MARGIN    2     // rounding of the codes on top of CAL_PHASE_TOLERANCE (0.01 degree)
+#define MAX_Z_ERROR     0.002 // largest relative |Z| error of a calibrated RC load point
+#define MAX_PHASE_ERROR 10    // largest phase error of a calibrated RC load point (0.01 degree)
+
+static uint32_t m_freq[TEST_STEPS + 1];
+static uint16_t m_real[TEST_STEPS + 1];
+static uint16_t m_imag[TEST_STEPS + 1];
+static uint32_t m_magnitude[TEST_STEPS + 1];
+static int16_t m_phase[TEST_STEPS + 1];
+
+// Returns the impedance of the RC load
+static void rcLoad(uint32_t freq, double * real, double * imag)
+{
+  *real = LOAD_R;
+  *imag = -1 / (2 * M_PI * freq * LOAD_C);
+}
+
+// Sets up the simulator with the system phase and low pass of the test
+static void calibrationTest_config(twiSimConfig * config)
+{
+  twiSim_defaultConfig(config);
+  config->systemPhase    = SYSTEM_PHASE;
+  config->systemPole     = SYSTEM_POLE;
+  config->loadResistance = CAL_RESISTANCE;
+}
+
+// Fills in the sweep of the test
+static void calibrationTest_sweep(Sweep * sweep)
+{
+  memset(sweep, 0, sizeof(Sweep));
+  sweep->start            = TEST_START;
+  sweep->delta            = TEST_DELTA;
+  sweep->steps            = TEST_STEPS;
+  sweep->cycles           = TEST_CYCLES;
+  sweep->cyclesMultiplier = NO_MULT;
+  sweep->range            = RANGE1;
+  sweep->clockSource      = INTERN_CLOCK;
+  sweep->clockFrequency   = CLK_FREQ;
+  sweep->gain             = GAIN1;
+  sweep->repeats          = 1;
+  sweep->average          = AVERAGE_MEAN;
+  sweep->metadata.numPoints = sweep->steps + 1;
+}
+
+// Builds a table with the calibration sink from a sweep against the calibration resistor, the way main.c does
+// Return value:
+//  false if the sweep failed or the sink did not end with a valid table
+//  true  if success
+static bool calibrationTest_build(CalTable * table)
+{
+  static SweepEngine engine;
+  SweepSink sink;
+  CalBuilder builder;
+  Sweep sweep;
+
+  calibrationTest_sweep(&sweep);
+  calibration_initSink(&sink, &builder, table, CAL_RESISTANCE, sweep.range, sweep.gain);
+
+  if (!AD5933_SweepBeginSink(&engine, &sweep, &sink) || !sweepSink_begin(&sink, &sweep.metadata)) return false;
+
+  while (AD5933_SweepPoll(&engine) < SWEEP_COMPLETE) __WFE();
+
+  return sweepSink_end(&sink, &sweep.metadata, AD5933_SweepComplete(&engine)) && calibration_valid(table);
+}
+
+// Checks the gain and system phase of a table against the model every 10 Hz of the sweep
+// Arguments:
+//  * table      - the table
+//  gainFactor   - the gain factor of the simulator
+//  * gainError  - pointer to store the largest gain error (ppm)
+//  * phaseError - pointer to store the largest phase error (0.01 degree)
+static void calibrationTest_lookup(CalTable const * table, double gainFactor, double * gainError, double * phaseError)
+{
+  *gainError = 0;
+  *phaseError = 0;
+
+  for (uint32_t freq = TEST_START; freq <= TEST_START + TEST_STEPS * TEST_DELTA; freq += 10)
+  {
+    uint64_t gain;
+    int32_t phase;
+    double pole = (double) freq / SYSTEM_POLE;
+
+    calibration_lookup(table, freq, &gain, &phase);
+
+    // resistance * |DFT|, the DFT of the resistor is 1 / (gain factor * resistance) through the low pass
+    double expectedGain = 1 / (gainFactor * sqrt(1 + pole * pole));
+    double expectedPhase = (SYSTEM_PHASE - atan(pole) * 180 / M_PI) * CAL_PHASE_SCALE;
+
+    *gainError = fmax(*gainError, fabs((double) gain - expectedGain) * 1e6 / expectedGain);
+    *phaseError = fmax(*phaseError, fabs(phase - expectedPhase));
+  }
+}
+
+// Measures the RC load and converts it with a table
+// Arguments:
+//  * table      - the table
+//  * zError     - pointer to store the largest relative |Z| error
+//  * phaseError - pointer to store the largest phase error (0.01 degree)
+// Return value:
+//  false if the sweep failed
+//  true  if success
+static bool calibrationTest_load(CalTable const * table, double * zError, double * phaseError)
+{
+  twiSimConfig config;
+  Sweep sweep;
+
+  *zError = 0;
+  *phaseError = 0;
+
+  calibrationTest_config(&config);
+  config.load = rcLoad;
+  twiSim_init(&config);
+  if (!AD5933_Init() || !twiManager_init()) return false;
+
+  calibrationTest_sweep(&sweep);
+  if (!AD5933_Sweep(&sweep, m_freq, m_real, m_imag) || sweep.metadata.numPoints != TEST_STEPS + 1) return false;
+
+  if (calibration_applySweep(table, m_freq, m_real, m_imag, TEST_STEPS + 1, m_magnitude, m_phase) != TEST_STEPS + 1) return false;
+
+  for (uint32_t i = 0; i <= TEST_STEPS; i++)
+  {
+    double real;
+    double imag;
+
+    rcLoad(m_freq[i], &real, &imag);
+
+    // the phase is the phase of the DFT less the system phase, as in the datasheet and analyzerFunctions.py. The
+    // AD5933 measures the current, so it comes out with the sign of the phase of the admittance
+    double expectedZ = hypot(real, imag);
+    double expectedPhase = -atan2(imag, real) * 180 / M_PI * CAL_PHASE_SCALE;
+
+    *zError = fmax(*zError, fabs(m_magnitude[i] / (double) (1 << CAL_Z_FRAC) - expectedZ) / expectedZ);
+    *phaseError = fmax(*phaseError, fabs(m_phase[i] - expectedPhase));
+  }
+
+  return true;
+}
+
+// Saves a table to the simulated flash and reads it back, then again after a reset
+// Return value:
+//  false if a save or read failed or the table read back differs
+//  true  if success
+static bool calibrationTest_flash(CalTable const * table)
+{
+  CalTable read;
+  CalTable other = *table;
+  size_t size = offsetof(CalTable, points) + table->numPoints * sizeof(CalPoint);
+
+  fdsSim_init(NULL);
+  flashManager_init();
+
+  // nothing saved yet
+  if (flashManager_getCalibration(&read) || read.numPoints != 0) return false;
+
+  if (!flashManager_saveCalibration(table) || !flashManager_getCalibration(&read) || memcmp(&read, table, size) != 0) return false;
+
+  // saving again updates the record
+  other.resistance = CAL_RESISTANCE / 2;
+  other.numPoints -= 1;
+  if (!flashManager_saveCalibration(&other) || !flashManager_getCalibration(&read)) return false;
+  if (memcmp(&read, &other, offsetof(CalTable, points) + other.numPoints * sizeof(CalPoint)) != 0) return false;
+
+  if (!flashManager_saveCalibration(table)) return false;
+
+  // the RAM of flashManager.c still has FDS initialized, so wait for the init to finish here
+  fdsSim_reboot();
+  flashManager_init();
+  while (fdsSim_busy()) __WFE();
+
+  return flashManager_getCalibration(&read) && memcmp(&read, table, size) == 0;
+}
+
+int main(void)
+{
+  static CalTable table;
+  twiSimConfig config;
+  double gainError;
+  double phaseError;
+  double zError;
+  uint32_t failed = 0;
+
+  calibrationTest_config(&config);
+  twiSim_init(&config);
+  if (!AD5933_Init() || !twiManager_init() || !calibrationTest_build(&table))
+  {
+    printf("calibration sweep FAILED\n");
+    return 1;
+  }
+
+  // a smooth response needs far fewer knots than points
+  bool success = table.numPoints > 1 && table.numPoints < (TEST_STEPS + 1) / 4;
+  if (!success) failed += 1;
+  printf("table: %u knots for %u points%s\n", table.numPoints, TEST_STEPS + 1, success ? "" : "  FAILED");
+
+  calibrationTest_lookup(&table, config.gainFactor, &gainError, &phaseError);
+  success = gainError <= CAL_GAIN_TOLERANCE_PPM + GAIN_MARGIN_PPM && phaseError <= CAL_PHASE_TOLERANCE + PHASE_MARGIN;
+  if (!success) failed += 1;
+  printf("lookup every 10 Hz: gain error %.0f ppm, phase error %.2f degrees%s\n", gainError,
+         phaseError / CAL_PHASE_SCALE, success ? "" : "  FAILED");
+
+  success = calibrationTest_load(&table, &zError, &phaseError) && zError <= MAX_Z_ERROR && phaseError <= MAX_PHASE_ERROR;
+  if (!success) failed += 1;
+  printf("RC load: |Z| error %.3f%%, phase error %.2f degrees%s\n", 100 * zError, phaseError / CAL_PHASE_SCALE,
+         success ? "" : "  FAILED");
+
+  success = calibrationTest_flash(&table);
+  if (!success) failed += 1;
+  printf("flash round trip%s\n", success ? "" : "  FAILED");
+
+  if (failed > 0)
+  {
+    printf("%u checks failed\n", failed);
+    return 1;
+  }
+
+  return 0;
+}
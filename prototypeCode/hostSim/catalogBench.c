@@ -0,0 +1,230 @@
+/*
+ *  catalogBench.c
+ *
+ *  Times sweep lookups on the FDS simulator with NUM_SWEEPS sweeps saved. Every kept sweep is read with
+ *  flashManager_getSweep and has its metadata looked up with flashManager_getEntry, with the catalog, with
+ *  the catalog emptied so every lookup searches the flash for its records like before the catalog, and
+ *  after a reset that loads the catalog from its checkpoint. A time range query with flashManager_findSweeps
+ *  is timed as well. Exits with 1 if a lookup gives the wrong sweep or a lookup with the catalog searches
+ *  the flash.
+ *
+ *  The catalog is in flashManager.c's static variables, so flashManager.c is built into this file to empty it
+ *  and to clear the RAM a reset would.
+ *
+ *  Usage: catalogBench [sweeps]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "flashManager.c"
+#include "twiManager.h"
+#include "fdsSim.h"
+
+#define NUM_SWEEPS    150  // sweeps saved
+#define SWEEP_PERIOD  60   // time between sweeps (MetaData time)
+#define MAX_POINTS    512  // most points of a sweep
+
+// time and flash accesses of a set of lookups
+typedef struct lookupStats
+{
+  uint32_t lookups;
+  uint32_t fails;
+  uint64_t totalUs;
+  uint64_t worstUs;
+  uint32_t finds;
+  uint32_t headers;
+  uint32_t opens;
+} lookupStats;
+
+static uint32_t m_freq[MAX_POINTS];
+static uint16_t m_real[MAX_POINTS];
+static uint16_t m_imag[MAX_POINTS];
+
+// Adds a lookup that started at start to stats, with the flash accesses since the simulator stats were reset
+static void catalogBench_add(lookupStats * stats, uint64_t start, bool success)
+{
+  fdsSimStats fdsStats;
+  uint64_t elapsed = twiSim_micros() - start;
+
+  fdsSim_getStats(&fdsStats);
+
+  stats->lookups += 1;
+  if (!success) stats->fails += 1;
+  stats->totalUs += elapsed;
+  if (elapsed > stats->worstUs) stats->worstUs = elapsed;
+  stats->finds += fdsStats.finds;
+  stats->headers += fdsStats.headersScanned;
+  stats->opens += fdsStats.opens;
+}
+
+// Prints the means of a set of lookups
+static void catalogBench_print(char const * name, lookupStats const * stats)
+{
+  uint32_t n = stats->lookups ? stats->lookups : 1;
+
+  printf("  %-16s %9.1f %9.1f %7.1f %9.1f %7.1f\n", name, (double) stats->totalUs / n, (double) stats->worstUs,
+         (double) stats->finds / n, (double) stats->headers / n, (double) stats->opens / n);
+}
+
+// Reads every kept sweep and looks up its metadata
+// Arguments:
+//  title     - what the lookups are printed under
+//  numPoints - the number of points of every sweep
+//  catalog   - true if the lookups must not search the flash
+// Return value:
+//  the number of failed lookups, and lookups with the catalog that searched the flash
+static uint32_t catalogBench_lookups(char const * title, uint32_t numPoints, bool catalog)
+{
+  static uint32_t found[CATALOG_SWEEPS];
+  lookupStats reads = {0};
+  lookupStats entries = {0};
+  lookupStats query = {0};
+  CatalogEntry entry;
+  MetaData metadata;
+
+  for (uint32_t sweep_num = m_log.first; sweep_num <= m_log.last; sweep_num++)
+  {
+    fdsSim_resetStats();
+    uint64_t start = twiSim_micros();
+    bool success = flashManager_getSweep(m_freq, m_real, m_imag, &metadata, sweep_num) &&
+                   metadata.time == sweep_num * SWEEP_PERIOD && metadata.numPoints == numPoints;
+    catalogBench_add(&reads, start, success);
+
+    fdsSim_resetStats();
+    start = twiSim_micros();
+    success = flashManager_getEntry(sweep_num, &entry) && entry.metadata.time == sweep_num * SWEEP_PERIOD;
+    catalogBench_add(&entries, start, success);
+  }
+
+  // the middle half of the sweeps by time
+  uint32_t kept = m_log.last + 1 - m_log.first;
+  uint32_t first = m_log.first + kept / 4;
+  uint32_t last = m_log.last - kept / 4;
+
+  fdsSim_resetStats();
+  uint64_t start = twiSim_micros();
+  uint32_t count = flashManager_findSweeps(first * SWEEP_PERIOD, last * SWEEP_PERIOD, found, CATALOG_SWEEPS);
+  uint32_t expected = last + 1 - first;
+  if (expected > CATALOG_SWEEPS) expected = CATALOG_SWEEPS;
+  catalogBench_add(&query, start, !catalog || (count == expected && found[0] == last + 1 - expected));
+
+  printf("%s, %u sweeps\n", title, kept);
+  printf("  %-16s %9s %9s %7s %9s %7s\n", "per lookup", "mean us", "worst us", "finds", "headers", "opens");
+  catalogBench_print("getSweep", &reads);
+  catalogBench_print("getEntry", &entries);
+  if (catalog) catalogBench_print("findSweeps", &query);
+
+  uint32_t failed = reads.fails + entries.fails + (catalog ? query.fails : 0);
+
+  // the catalog has the records of every sweep with their addresses, so nothing is searched for
+  if (catalog) failed += reads.finds + entries.finds + query.finds + reads.headers + entries.headers + query.headers;
+
+  return failed;
+}
+
+int main(int argc, char ** argv)
+{
+  static uint32_t freq[MAX_POINTS];
+  static uint16_t real[MAX_POINTS];
+  static uint16_t imag[MAX_POINTS];
+  uint32_t numSweepsSaved = argc > 1 ? (uint32_t) atoi(argv[1]) : NUM_SWEEPS;
+  uint32_t numSweeps = 0;
+  uint32_t failed = 0;
+  twiSimConfig config;
+  fdsSimStats fdsStats;
+  Sweep sweep;
+  Sweep saved;
+
+  // one measured sweep, saved numSweepsSaved times
+  twiSim_defaultConfig(&config);
+  config.noise = 20;
+  twiSim_init(&config);
+
+  memset(&sweep, 0, sizeof(Sweep));
+  sweep.start            = 1000;
+  sweep.delta            = 100;
+  sweep.steps            = 490;
+  sweep.cycles           = 511;
+  sweep.cyclesMultiplier = TIMES4;
+  sweep.range            = RANGE1;
+  sweep.clockSource      = INTERN_CLOCK;
+  sweep.clockFrequency   = CLK_FREQ;
+  sweep.gain             = GAIN1;
+  sweep.repeats          = 1;
+  sweep.average          = AVERAGE_MEAN;
+  sweep.metadata.numPoints = sweep.steps + 1;
+
+  if (!AD5933_Init() || !twiManager_init() || !AD5933_Sweep(&sweep, freq, real, imag))
+  {
+    printf("sweep failed\n");
+    return 1;
+  }
+
+  uint32_t numPoints = sweep.metadata.numPoints;
+
+  fdsSim_init(NULL);
+  flashManager_init();
+  saved = sweep;
+  flashManager_checkConfig(&numSweeps, &saved);
+  flashManager_setRetention(numSweepsSaved, numPoints);
+
+  for (uint32_t i = 1; i <= numSweepsSaved; i++)
+  {
+    MetaData metadata = sweep.metadata;
+    uint32_t sweepNum;
+
+    metadata.time = i * SWEEP_PERIOD;
+
+    if (!flashManager_saveSweep(freq, real, imag, &metadata, numSweeps + 1) || !flashManager_commitComplete(&sweepNum))
+    {
+      printf("save of sweep %u failed\n", i);
+      return 1;
+    }
+
+    numSweeps = sweepNum;
+    flashManager_updateNumSweeps(&numSweeps);
+    while (flashManager_idle()) __WFE();
+  }
+
+  failed += catalogBench_lookups("with the catalog", numPoints, true);
+
+  // empty the catalog, every lookup searches the flash for the records of the sweep
+  memset(m_catalog, 0, sizeof(m_catalog));
+  memset(m_catalog_records, 0, sizeof(m_catalog_records));
+  failed += catalogBench_lookups("without the catalog", numPoints, false);
+
+  // reset, the RAM is cleared and the catalog is loaded from its checkpoint
+  fdsSim_reboot();
+  memset(m_catalog, 0, sizeof(m_catalog));
+  memset(m_catalog_records, 0, sizeof(m_catalog_records));
+  memset(&m_commit, 0, sizeof(m_commit));
+  m_catalog_dirty = 0;
+  m_catalog_changes = 0;
+  m_catalog_loaded = false;
+  m_catalog_stale = false;
+  m_catalog_unlocated = false;
+  m_log = (SweepLog) {.first = 1, .last = 0, .maxSweeps = SWEEP_LOG_MAX_SWEEPS};
+  flashManager_init();
+  while (fdsSim_busy()) __WFE();
+
+  fdsSim_resetStats();
+  uint64_t start = twiSim_micros();
+  numSweeps = 0;
+  saved = sweep;
+  if (!flashManager_checkConfig(&numSweeps, &saved) || numSweeps != numSweepsSaved) failed += 1;
+  fdsSim_getStats(&fdsStats);
+  printf("reset: checkConfig %.1f ms, %u finds, %u headers, %u opens\n", (twiSim_micros() - start) / 1e3,
+         fdsStats.finds, fdsStats.headersScanned, fdsStats.opens);
+
+  failed += catalogBench_lookups("after the reset", numPoints, true);
+
+  if (failed > 0)
+  {
+    printf("%u lookups failed or searched the flash with the catalog\n", failed);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ *  codecBench.c
+ *
+ *  Measures sweepCodec.c on sweeps from the TWI simulator: the coded bytes of a 491 point sweep against
+ *  the 8 bytes a point takes raw, the host time to encode a point and the words of its flash record on
+ *  the FDS simulator. Every sweep is decoded again and must give back the points it was coded from.
+ *  Exits with 1 if a sweep fails, does not decode to the same points or is not made smaller.
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "AD5933.h"
+#include "flashManager.h"
+#include "sweepCodec.h"
+#include "twiManager.h"
+#include "fdsSim.h"
+
+#define BENCH_STEPS   490 // 1-50 kHz in 100 Hz steps like the default sweep of main.c
+#define BENCH_REPEATS 200 // encodes of each sweep timed
+#define MAX_BYTES     8192
+
+// 1 kOhm in series with 10 nF
+static void rcLoad(uint32_t freq, double * real, double * imag)
+{
+  *real = 1000;
+  *imag = -1 / (2 * M_PI * freq * 10e-9);
+}
+
+// a sweep to code and the simulator set up to measure it
+typedef struct benchCase
+{
+  char const * name;
+  double noise;       // peak noise added to the codes
+  twiSim_load_t load; // impedance of the load, NULL for the 10 kOhm resistor
+} benchCase;
+
+static benchCase const m_cases[] =
+{
+  // name                 noise  load
+  {"10k, noise 20",       20,    NULL},
+  {"RC load, noise 20",   20,    rcLoad},
+  {"10k, noise 200",      200,   NULL},
+};
+
+static uint32_t m_freq[BENCH_STEPS + 1];
+static uint16_t m_real[BENCH_STEPS + 1];
+static uint16_t m_imag[BENCH_STEPS + 1];
+static uint8_t m_coded[MAX_BYTES];
+
+// Codes the sweep in m_freq, m_real and m_imag into m_coded
+// Return value:
+//  the number of bytes, 0 if the sweep did not fit
+static uint32_t codecBench_encode(uint32_t numPoints)
+{
+  static SweepEncoder enc;
+  uint32_t size = 0;
+
+  sweepCodec_initEncoder(&enc);
+
+  for (uint32_t i = 0; i < numPoints; i++)
+  {
+    if (!sweepCodec_encode(&enc, m_freq[i], SWEEP_CODEC_SAMPLE(m_real[i]), SWEEP_CODEC_SAMPLE(m_imag[i]))) return 0;
+    size += sweepCodec_take(&enc, &m_coded[size], MAX_BYTES - size);
+  }
+
+  if (!sweepCodec_finish(&enc)) return 0;
+  size += sweepCodec_take(&enc, &m_coded[size], MAX_BYTES - size);
+
+  return (size < MAX_BYTES) ? size : 0;
+}
+
+// Decodes m_coded and checks it against the sweep it was coded from
+static bool codecBench_check(uint32_t size, uint32_t numPoints)
+{
+  static SweepDecoder dec;
+
+  sweepCodec_initDecoder(&dec, m_coded, size, numPoints);
+
+  for (uint32_t i = 0; i < numPoints; i++)
+  {
+    uint32_t freq;
+    int16_t real;
+    int16_t imag;
+
+    if (!sweepCodec_decode(&dec, &freq, &real, &imag)) return false;
+    if (freq != m_freq[i] || SWEEP_CODEC_WORD(real) != m_real[i] || SWEEP_CODEC_WORD(imag) != m_imag[i]) return false;
+  }
+
+  return !dec.error;
+}
+
+// Saves the sweep to an empty FDS simulator
+// Return value:
+//  the words written for the sweep, 0 if it was not saved
+static uint32_t codecBench_flashWords(Sweep * sweep)
+{
+  fdsSimStats stats;
+  Sweep saved = *sweep;
+  uint32_t numSweeps = 0;
+  uint32_t sweepNum;
+
+  // flashManager.c still has FDS initialized from the sweep before, so wait for the init to finish here
+  fdsSim_init(NULL);
+  flashManager_init();
+  while (fdsSim_busy()) __WFE();
+  flashManager_checkConfig(&numSweeps, &saved);
+  fdsSim_resetStats();
+
+  if (!flashManager_saveSweep(m_freq, m_real, m_imag, &sweep->metadata, numSweeps + 1) ||
+      !flashManager_commitComplete(&sweepNum)) return 0;
+
+  fdsSim_getStats(&stats);
+
+  return stats.wordsWritten;
+}
+
+int main(void)
+{
+  uint32_t failed = 0;
+  uint32_t raw = (BENCH_STEPS + 1) * (sizeof(uint32_t) + 2 * sizeof(uint16_t));
+
+  printf("%-20s %5s %6s %6s %6s %8s %6s\n", "sweep", "pts", "raw", "coded", "ratio", "ns/point", "words");
+
+  for (uint32_t i = 0; i < sizeof(m_cases) / sizeof(m_cases[0]); i++)
+  {
+    benchCase const * bench = &m_cases[i];
+    twiSimConfig config;
+    Sweep sweep;
+    struct timespec begin;
+    struct timespec end;
+
+    twiSim_defaultConfig(&config);
+    config.noise = bench->noise;
+    config.load  = bench->load;
+    twiSim_init(&config);
+
+    memset(&sweep, 0, sizeof(sweep));
+    sweep.start            = 1000;
+    sweep.delta            = 100;
+    sweep.steps            = BENCH_STEPS;
+    sweep.cycles           = 15;
+    sweep.cyclesMultiplier = NO_MULT;
+    sweep.range            = RANGE1;
+    sweep.clockSource      = INTERN_CLOCK;
+    sweep.clockFrequency   = CLK_FREQ;
+    sweep.gain             = GAIN1;
+    sweep.repeats          = 1;
+    sweep.average          = AVERAGE_MEAN;
+    sweep.metadata.numPoints = sweep.steps + 1;
+
+    bool success = AD5933_Init() && twiManager_init() && AD5933_Sweep(&sweep, m_freq, m_real, m_imag) &&
+                   sweep.metadata.numPoints == BENCH_STEPS + 1;
+
+    uint32_t size = success ? codecBench_encode(BENCH_STEPS + 1) : 0;
+    success = success && size > 0 && size < raw && codecBench_check(size, BENCH_STEPS + 1);
+
+    // the host time of an encode, the board times it with sweepCodec_cycles
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (uint32_t r = 0; success && r < BENCH_REPEATS; r++) codecBench_encode(BENCH_STEPS + 1);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ns = ((end.tv_sec - begin.tv_sec) * 1e9 + (end.tv_nsec - begin.tv_nsec)) / BENCH_REPEATS / (BENCH_STEPS + 1);
+
+    uint32_t words = success ? codecBench_flashWords(&sweep) : 0;
+    success = success && words > 0;
+
+    if (!success) failed += 1;
+
+    printf("%-20s %5u %6u %6u %6.1f %8.1f %6u%s\n", bench->name, BENCH_STEPS + 1, raw, size,
+           size ? (double) raw / size : 0.0, ns, words, success ? "" : "  FAILED");
+  }
+
+  if (failed > 0)
+  {
+    printf("%u sweeps failed\n", failed);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,246 @@
+/*
+ *  commitBench.c
+ *
+ *  Measures back to back sweep throughput with the flash sink on the TWI and FDS simulators. Each sweep
+ *  is written to flash as it is measured and its commit is finished either straight after the sweep,
+ *  which holds the main loop until the flash is written like the blocking save did, or while the next
+ *  sweep is measured, the way main.c does. Exits with 1 if a sweep fails, a sweep saved does not read
+ *  back or overlapping the commits is slower.
+ *
+ *  Usage: commitBench [sweeps] [steps] [cycles]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "AD5933.h"
+#include "flashManager.h"
+#include "twiManager.h"
+#include "fdsSim.h"
+
+#define NUM_SWEEPS 50  // sweeps measured back to back
+#define NUM_STEPS  490 // increments of each sweep
+#define NUM_CYCLES 15  // settling cycles, short so the flash time shows
+#define MAX_POINTS 512 // most points of a sweep
+
+// result of a run
+typedef struct commitResult
+{
+  uint32_t saved;      // sweeps saved
+  uint32_t readFails;  // sweeps saved that did not read back
+  uint64_t totalUs;    // time of the whole run
+  uint64_t measureUs;  // time spent measuring
+  uint64_t blockedUs;  // time the main loop was held finishing sweeps and commits
+  uint32_t wordsWritten;
+  uint16_t buffersPeak; // most pool buffers used at once
+  uint32_t bufferWaits; // times a sink waited for a pool buffer
+} commitResult;
+
+static SweepEngine m_engine;
+static SweepSink m_sink;
+static FlashSink m_flash;
+static uint32_t m_num_sweeps;
+static bool m_pending; // a commit is being written
+
+// Finishes the commit of the last sweep and counts it if it was saved
+static void commitBench_finish(commitResult * result)
+{
+  uint32_t sweepNum;
+  uint64_t start = twiSim_micros();
+
+  if (flashManager_commitComplete(&sweepNum))
+  {
+    m_num_sweeps = sweepNum;
+    flashManager_updateNumSweeps(&m_num_sweeps);
+    result->saved += 1;
+  }
+
+  result->blockedUs += twiSim_micros() - start;
+  m_pending = false;
+}
+
+// Measures the sweeps back to back on a freshly initialized simulator and driver
+// Arguments:
+//  overlap   - true to finish each commit while the next sweep is measured, false to wait for it after the sweep
+//  numSweeps - the number of sweeps
+//  * sweep   - the sweep to measure
+//  * result  - pointer to store the result
+// Return value:
+//  false if a sweep failed to start
+//  true  if success
+static bool commitBench_run(bool overlap, uint32_t numSweeps, Sweep * sweep, commitResult * result)
+{
+  static uint32_t freq[MAX_POINTS];
+  static uint16_t real[MAX_POINTS];
+  static uint16_t imag[MAX_POINTS];
+  twiSimConfig config;
+  fdsSimStats fdsStats;
+  MetaData metadata;
+  Sweep saved = *sweep;
+
+  memset(result, 0, sizeof(commitResult));
+
+  twiSim_defaultConfig(&config);
+  config.noise = 20;
+  twiSim_init(&config);
+  if (!AD5933_Init() || !twiManager_init()) return false;
+
+  fdsSim_init(NULL);
+  flashManager_init();
+  m_num_sweeps = 0;
+  m_pending = false;
+  flashManager_checkConfig(&m_num_sweeps, &saved);
+  flashManager_setRetention(numSweeps, sweep->metadata.numPoints);
+  fdsSim_resetStats();
+
+  uint64_t begin = twiSim_micros();
+
+  for (uint32_t k = 0; k < numSweeps; k++)
+  {
+    // the sweep being committed still takes the next number
+    flashManager_initSink(&m_sink, &m_flash, m_num_sweeps + 1 + m_pending);
+
+    uint64_t start = twiSim_micros();
+
+    if (!AD5933_SweepBeginSink(&m_engine, sweep, &m_sink) || !sweepSink_begin(&m_sink, &sweep->metadata)) return false;
+
+    while (AD5933_SweepPoll(&m_engine) < SWEEP_COMPLETE)
+    {
+      if (m_pending && flashManager_commitPoll() != COMMIT_WRITING) commitBench_finish(result);
+      __WFE();
+    }
+
+    result->measureUs += twiSim_micros() - start;
+
+    bool success = AD5933_SweepComplete(&m_engine);
+
+    start = twiSim_micros();
+    if (m_pending) commitBench_finish(result);
+    if (sweepSink_end(&m_sink, &sweep->metadata, success)) m_pending = true;
+    result->blockedUs += twiSim_micros() - start;
+
+    if (!overlap && m_pending) commitBench_finish(result);
+  }
+
+  if (m_pending) commitBench_finish(result);
+
+  result->totalUs = twiSim_micros() - begin;
+  fdsSim_getStats(&fdsStats);
+  result->wordsWritten = fdsStats.wordsWritten;
+
+  FlashStats flashStats;
+  flashManager_getStats(&flashStats);
+  result->buffersPeak = flashStats.buffersPeak;
+  result->bufferWaits = flashStats.bufferWaits;
+
+  for (uint32_t sweepNum = flashManager_firstSweep(); sweepNum <= m_num_sweeps; sweepNum++)
+  {
+    if (!flashManager_getSweep(freq, real, imag, &metadata, sweepNum) || metadata.numPoints != sweep->metadata.numPoints)
+    {
+      result->readFails += 1;
+    }
+  }
+
+  return true;
+}
+
+// Runs commitBench_run in a child process, so both runs start from reset
+// Arguments: the same as commitBench_run
+// Return value:
+//  false if a sweep failed to start or the child did not finish
+//  true  if success
+static bool commitBench_fork(bool overlap, uint32_t numSweeps, Sweep * sweep, commitResult * result)
+{
+  int fds[2];
+  int status;
+  pid_t pid;
+
+  memset(result, 0, sizeof(commitResult));
+
+  if (pipe(fds) != 0) return false;
+
+  pid = fork();
+  if (pid < 0) return false;
+
+  if (pid == 0)
+  {
+    close(fds[0]);
+    bool success = commitBench_run(overlap, numSweeps, sweep, result);
+    _exit(write(fds[1], result, sizeof(commitResult)) == sizeof(commitResult) && success ? 0 : 1);
+  }
+
+  close(fds[1]);
+  bool got = read(fds[0], result, sizeof(commitResult)) == sizeof(commitResult);
+  close(fds[0]);
+
+  return waitpid(pid, &status, 0) == pid && got && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Prints the result of a run
+static void commitBench_print(char const * name, uint32_t numSweeps, commitResult const * result)
+{
+  printf("%-22s %6u %11.1f %9.2f %12.1f %12.2f %8.0f %6u %5u %6u\n", name, result->saved, result->totalUs / 1e3 / numSweeps,
+         numSweeps * 1e6 / result->totalUs, result->measureUs / 1e3 / numSweeps, result->blockedUs / 1e3 / numSweeps,
+         result->saved ? (double) result->wordsWritten / result->saved : 0.0, result->readFails, result->buffersPeak,
+         result->bufferWaits);
+}
+
+int main(int argc, char ** argv)
+{
+  uint32_t numSweeps = argc > 1 ? (uint32_t) atoi(argv[1]) : NUM_SWEEPS;
+  commitResult waiting;
+  commitResult overlapped;
+  Sweep sweep;
+
+  memset(&sweep, 0, sizeof(Sweep));
+  sweep.start            = 1000;
+  sweep.delta            = 100;
+  sweep.steps            = argc > 2 ? (uint16_t) atoi(argv[2]) : NUM_STEPS;
+  sweep.cycles           = argc > 3 ? (uint16_t) atoi(argv[3]) : NUM_CYCLES;
+  sweep.cyclesMultiplier = NO_MULT;
+  sweep.range            = RANGE1;
+  sweep.clockSource      = INTERN_CLOCK;
+  sweep.clockFrequency   = CLK_FREQ;
+  sweep.gain             = GAIN1;
+  sweep.repeats          = 1;
+  sweep.average          = AVERAGE_MEAN;
+  sweep.metadata.numPoints = sweep.steps + 1;
+
+  if (numSweeps == 0 || sweep.metadata.numPoints > MAX_POINTS) return 1;
+
+  bool success = commitBench_fork(false, numSweeps, &sweep, &waiting) &&
+                 commitBench_fork(true, numSweeps, &sweep, &overlapped);
+
+  printf("%u sweeps of %u points, %u settling cycles\n", numSweeps, sweep.metadata.numPoints, sweep.cycles);
+  printf("%-22s %6s %11s %9s %12s %12s %8s %6s %5s %6s\n", "commit", "saved", "ms/sweep", "sweeps/s", "measure ms",
+         "blocked ms", "words", "bad", "bufs", "waits");
+  commitBench_print("wait after the sweep", numSweeps, &waiting);
+  commitBench_print("overlap the next sweep", numSweeps, &overlapped);
+  printf("RAM: flash sink %u bytes, record buffer pool %u bytes (%u buffers)\n", (uint32_t) sizeof(FlashSink),
+         (uint32_t) (SWEEP_POOL_BUFFERS * sizeof(SweepBuffer)), SWEEP_POOL_BUFFERS);
+
+  if (!success || waiting.saved != numSweeps || overlapped.saved != numSweeps || waiting.readFails || overlapped.readFails)
+  {
+    printf("a sweep failed or did not read back\n");
+    return 1;
+  }
+
+  // a sink only waits for a buffer if the flash falls behind the sweeps
+  if (waiting.bufferWaits || overlapped.bufferWaits)
+  {
+    printf("a sink waited for a record buffer\n");
+    return 1;
+  }
+
+  if (overlapped.totalUs > waiting.totalUs)
+  {
+    printf("overlapping the commits is slower\n");
+    return 1;
+  }
+
+  return 0;
+}
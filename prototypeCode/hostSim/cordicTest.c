@@ -0,0 +1,172 @@
+/*
+ *  cordicTest.c
+ *
+ *  Checks cordic_vector against double precision hypot and atan2 over a grid of real and imaginary codes
+ *  covering every quadrant and the whole 16 bit range, plus the axes and the corners, then times
+ *  cordic_sweep. Built once with the portable loop (make cordicTest) and once with the rotations unrolled
+ *  like on the Cortex-M4 (make cordicTestUnrolled). Exits with 1 if an error is over MAX_MAG_ERROR or
+ *  MAX_PHASE_ERROR.
+ *
+ *  The times are host times, on the Cortex-M4 cordic_cycles gives the cycles per point.
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "cordic.h"
+
+#define GRID_STEP       37   // distance between grid codes, odd so every low bit pattern comes up
+#define MAX_MAG_ERROR   0.01 // largest magnitude error allowed (codes)
+#define MAX_PHASE_ERROR 0.01 // largest phase error allowed (degrees)
+#define TIMING_POINTS   4096 // points of the timed sweep
+#define TIMING_ROUNDS   200  // times the sweep is converted for the timing
+
+// worst errors found
+typedef struct cordicErrors
+{
+  uint32_t points;
+  double magnitude;  // codes
+  double relative;   // magnitude error over the magnitude
+  double phase;      // degrees
+  int16_t magReal;   // point of the worst magnitude error
+  int16_t magImag;
+  int16_t phaseReal; // point of the worst phase error
+  int16_t phaseImag;
+} cordicErrors;
+
+// Checks one point against the double precision reference and keeps the worst errors
+static void cordicTest_point(int16_t real, int16_t imag, cordicErrors * errors)
+{
+  uint32_t magnitude;
+  int32_t phase;
+
+  cordic_vector(real, imag, &magnitude, &phase);
+  errors->points += 1;
+
+  double refMagnitude = hypot(real, imag);
+  double magError = fabs(magnitude / (double) (1 << CORDIC_MAG_FRAC) - refMagnitude);
+
+  if (magError > errors->magnitude)
+  {
+    errors->magnitude = magError;
+    errors->magReal = real;
+    errors->magImag = imag;
+  }
+  if (refMagnitude > 0 && magError / refMagnitude > errors->relative) errors->relative = magError / refMagnitude;
+
+  // no signal has no phase, cordic_vector gives 0
+  if (real == 0 && imag == 0) return;
+
+  double phaseError = fabs(phase / (double) CORDIC_PHASE_SCALE - atan2(imag, real) * 180 / M_PI);
+
+  // -180 and 180 degrees are the same phase
+  if (phaseError > 180) phaseError = 360 - phaseError;
+
+  if (phaseError > errors->phase)
+  {
+    errors->phase = phaseError;
+    errors->phaseReal = real;
+    errors->phaseImag = imag;
+  }
+}
+
+// Returns a time stamp, TSC cycles where there is one, else nanoseconds
+static uint64_t cordicTest_stamp(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+// Times cordic_sweep on a sweep of points round the circle and returns the time per point in cordicTest_stamp units
+static double cordicTest_time(void)
+{
+  static uint16_t real[TIMING_POINTS];
+  static uint16_t imag[TIMING_POINTS];
+  static uint32_t magnitude[TIMING_POINTS];
+  static int16_t phase[TIMING_POINTS];
+
+  // the data registers as read from the AD5933, big endian
+  for (uint32_t i = 0; i < TIMING_POINTS; i++)
+  {
+    double angle = 2 * M_PI * i / TIMING_POINTS;
+    uint16_t r = (uint16_t) (int16_t) lround(20000 * cos(angle));
+    uint16_t m = (uint16_t) (int16_t) lround(20000 * sin(angle));
+    uint8_t * realBytes = (uint8_t *) &real[i];
+    uint8_t * imagBytes = (uint8_t *) &imag[i];
+
+    realBytes[0] = r >> 8;
+    realBytes[1] = r & 0xFF;
+    imagBytes[0] = m >> 8;
+    imagBytes[1] = m & 0xFF;
+  }
+
+  uint64_t start = cordicTest_stamp();
+
+  for (uint32_t round = 0; round < TIMING_ROUNDS; round++)
+  {
+    cordic_sweep(real, imag, TIMING_POINTS, magnitude, phase);
+    __asm__ volatile("" : : "r" (magnitude), "r" (phase) : "memory");
+  }
+
+  return (double) (cordicTest_stamp() - start) / ((double) TIMING_ROUNDS * TIMING_POINTS);
+}
+
+int main(void)
+{
+  static int16_t const edges[] = {INT16_MIN, INT16_MIN + 1, -1, 0, 1, INT16_MAX - 1, INT16_MAX};
+  cordicErrors errors = {0};
+
+  // the grid
+  for (int32_t real = INT16_MIN; real <= INT16_MAX; real += GRID_STEP)
+  {
+    for (int32_t imag = INT16_MIN; imag <= INT16_MAX; imag += GRID_STEP)
+    {
+      cordicTest_point((int16_t) real, (int16_t) imag, &errors);
+    }
+  }
+
+  // the axes, the corners and the smallest points, where the rounding matters most
+  for (uint32_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++)
+  {
+    for (int32_t code = INT16_MIN; code <= INT16_MAX; code++)
+    {
+      cordicTest_point(edges[i], (int16_t) code, &errors);
+      cordicTest_point((int16_t) code, edges[i], &errors);
+    }
+  }
+
+#ifdef CORDIC_UNROLLED
+  printf("unrolled rotations, %u points\n", errors.points);
+#else
+  printf("portable loop, %u points\n", errors.points);
+#endif
+  printf("  max magnitude error %.5f codes (%.2e of the magnitude) at %d%+dj\n", errors.magnitude, errors.relative,
+         errors.magReal, errors.magImag);
+  printf("  max phase error     %.5f degrees at %d%+dj\n", errors.phase, errors.phaseReal, errors.phaseImag);
+
+#if defined(__x86_64__) || defined(__i386__)
+  printf("  cordic_sweep %.1f host TSC cycles per point\n", cordicTest_time());
+#else
+  printf("  cordic_sweep %.1f host ns per point\n", cordicTest_time());
+#endif
+
+  if (errors.magnitude > MAX_MAG_ERROR || errors.phase > MAX_PHASE_ERROR)
+  {
+    printf("error over the limit (%.2f codes, %.2f degrees)\n", MAX_MAG_ERROR, MAX_PHASE_ERROR);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ *  deleteBench.c
+ *
+ *  Times flashManager_deleteSweeps on the FDS simulator with NUM_SWEEPS sweeps saved: once deleting them all in
+ *  one call, and once one sweep a call like sending USB command 10 for each. After each call the main loop's
+ *  flashManager_idle runs until the garbage collection the delete started is done. Prints the time the calls
+ *  held the main loop, the time until the flash was idle again, and the garbage collections and page erases.
+ *  Exits with 1 if a delete fails, a deleted sweep still reads, the sweep after them does not, or one call is
+ *  not faster than one call a sweep.
+ *
+ *  Usage: deleteBench [sweeps]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "AD5933.h"
+#include "flashManager.h"
+#include "twiManager.h"
+#include "fdsSim.h"
+
+#define NUM_SWEEPS 200 // sweeps deleted
+#define NUM_STEPS  490 // increments of each sweep
+#define MAX_POINTS 512 // most points of a sweep
+
+// result of a run
+typedef struct deleteResult
+{
+  uint32_t deleted;    // sweeps the reports count as deleted
+  uint32_t readFails;  // deleted sweeps that still read and kept ones that do not
+  uint64_t blockedUs;  // time spent in flashManager_deleteSweeps
+  uint64_t totalUs;    // time from the first delete until flashManager_idle has nothing left to do
+  uint32_t gcRuns;
+  uint32_t pagesErased;
+} deleteResult;
+
+static uint32_t m_freq[MAX_POINTS];
+static uint16_t m_real[MAX_POINTS];
+static uint16_t m_imag[MAX_POINTS];
+
+// Saves numSweeps + 1 sweeps on a freshly initialized simulator and driver, then deletes the first numSweeps
+// Arguments:
+//  perSweep  - true to delete one sweep a call, false for all of them in one call
+//  numSweeps - the number of sweeps to delete
+//  * result  - pointer to store the result
+// Return value:
+//  false if the sweep or a save failed
+//  true  if success
+static bool deleteBench_run(bool perSweep, uint32_t numSweeps, deleteResult * result)
+{
+  twiSimConfig config;
+  fdsSimStats fdsStats;
+  DeleteReport report;
+  MetaData metadata;
+  Sweep sweep;
+  Sweep saved;
+  uint32_t numSaved = 0;
+
+  memset(result, 0, sizeof(deleteResult));
+
+  twiSim_defaultConfig(&config);
+  config.noise = 20;
+  twiSim_init(&config);
+
+  memset(&sweep, 0, sizeof(Sweep));
+  sweep.start            = 1000;
+  sweep.delta            = 100;
+  sweep.steps            = NUM_STEPS;
+  sweep.cycles           = 15;
+  sweep.cyclesMultiplier = NO_MULT;
+  sweep.range            = RANGE1;
+  sweep.clockSource      = INTERN_CLOCK;
+  sweep.clockFrequency   = CLK_FREQ;
+  sweep.gain             = GAIN1;
+  sweep.repeats          = 1;
+  sweep.average          = AVERAGE_MEAN;
+  sweep.metadata.numPoints = sweep.steps + 1;
+
+  if (!AD5933_Init() || !twiManager_init() || !AD5933_Sweep(&sweep, m_freq, m_real, m_imag)) return false;
+
+  fdsSim_init(NULL);
+  flashManager_init();
+  saved = sweep;
+  flashManager_checkConfig(&numSaved, &saved);
+  flashManager_setRetention(numSweeps + 1, sweep.metadata.numPoints);
+
+  // the sweeps to delete and one more that is kept
+  for (uint32_t i = 0; i <= numSweeps; i++)
+  {
+    uint32_t sweepNum;
+
+    if (!flashManager_saveSweep(m_freq, m_real, m_imag, &sweep.metadata, numSaved + 1) ||
+        !flashManager_commitComplete(&sweepNum)) return false;
+
+    numSaved = sweepNum;
+    flashManager_updateNumSweeps(&numSaved);
+    while (flashManager_idle()) __WFE();
+  }
+
+  uint32_t first = flashManager_firstSweep();
+  uint32_t last = first + numSweeps - 1;
+
+  fdsSim_resetStats();
+  uint64_t begin = twiSim_micros();
+
+  for (uint32_t sweepNum = first; sweepNum <= last; sweepNum = perSweep ? sweepNum + 1 : last + 1)
+  {
+    uint64_t start = twiSim_micros();
+    bool success = flashManager_deleteSweeps(sweepNum, perSweep ? sweepNum : last, &report);
+    result->blockedUs += twiSim_micros() - start;
+
+    if (!success) return false;
+    result->deleted += report.sweeps;
+
+    // the main loop between commands
+    while (flashManager_idle()) __WFE();
+  }
+
+  result->totalUs = twiSim_micros() - begin;
+  fdsSim_getStats(&fdsStats);
+  result->gcRuns = fdsStats.gcRuns;
+  result->pagesErased = fdsStats.pagesErased;
+
+  for (uint32_t sweepNum = first; sweepNum <= last; sweepNum++)
+  {
+    if (flashManager_getSweep(m_freq, m_real, m_imag, &metadata, sweepNum)) result->readFails += 1;
+  }
+
+  if (flashManager_firstSweep() != last + 1 || !flashManager_getSweep(m_freq, m_real, m_imag, &metadata, last + 1))
+  {
+    result->readFails += 1;
+  }
+
+  return true;
+}
+
+// Runs deleteBench_run in a child process, so both runs start from reset
+// Arguments: the same as deleteBench_run
+// Return value:
+//  false if a save or delete failed or the child did not finish
+//  true  if success
+static bool deleteBench_fork(bool perSweep, uint32_t numSweeps, deleteResult * result)
+{
+  int fds[2];
+  int status;
+  pid_t pid;
+
+  memset(result, 0, sizeof(deleteResult));
+
+  if (pipe(fds) != 0) return false;
+
+  pid = fork();
+  if (pid < 0) return false;
+
+  if (pid == 0)
+  {
+    close(fds[0]);
+    bool success = deleteBench_run(perSweep, numSweeps, result);
+    _exit(write(fds[1], result, sizeof(deleteResult)) == sizeof(deleteResult) && success ? 0 : 1);
+  }
+
+  close(fds[1]);
+  bool got = read(fds[0], result, sizeof(deleteResult)) == sizeof(deleteResult);
+  close(fds[0]);
+
+  return waitpid(pid, &status, 0) == pid && got && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Prints the result of a run
+static void deleteBench_print(char const * name, deleteResult const * result)
+{
+  printf("%-18s %7u %11.1f %8.2f %5u %7u %5u\n", name, result->deleted, result->blockedUs / 1e3, result->totalUs / 1e6,
+         result->gcRuns, result->pagesErased, result->readFails);
+}
+
+int main(int argc, char ** argv)
+{
+  uint32_t numSweeps = argc > 1 ? (uint32_t) atoi(argv[1]) : NUM_SWEEPS;
+  deleteResult once;
+  deleteResult perSweep;
+
+  if (numSweeps == 0) return 1;
+
+  bool success = deleteBench_fork(false, numSweeps, &once) && deleteBench_fork(true, numSweeps, &perSweep);
+
+  printf("%u sweeps of %u points\n", numSweeps, NUM_STEPS + 1);
+  printf("%-18s %7s %11s %8s %5s %7s %5s\n", "delete", "deleted", "blocked ms", "total s", "gcs", "erases", "bad");
+  deleteBench_print("in one call", &once);
+  deleteBench_print("one call a sweep", &perSweep);
+
+  if (!success || once.deleted != numSweeps || perSweep.deleted != numSweeps || once.readFails || perSweep.readFails)
+  {
+    printf("a delete failed or the sweeps did not read as expected\n");
+    return 1;
+  }
+
+  if (once.totalUs >= perSweep.totalUs)
+  {
+    printf("deleting in one call is not faster\n");
+    return 1;
+  }
+
+  return 0;
+}
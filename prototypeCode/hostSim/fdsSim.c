@@ -0,0 +1,700 @@
+/*
+ *  fdsSim.c
+ *
+ *  Host (Linux) stand-in for the FDS module of the nRF SDK. The virtual pages are an array of words
+ *  laid out like FDS lays out flash: a page tag, then records of a three word header and their data,
+ *  with one page kept empty as the swap page for garbage collection. A deleted record is only marked
+ *  dirty, its words come back when garbage collection copies the valid records of its page to the
+ *  swap page and erases it.
+ *
+ *  Operations are queued like in FDS and run one at a time on the simulated clock of twiSim.c, each
+ *  taking the time the flash takes to write or erase, then the event handlers are called from the
+ *  flash "interrupt" when the CPU sleeps in __WFE. Finding and opening records costs CPU time for
+ *  every record header looked at, so the cost of many small records shows up in the benchmarks.
+ *
+ */
+
+#include <math.h>
+
+#include "fdsSim.h"
+
+#define FDS_SIM_MAX_USERS 4
+#define FDS_SIM_ERASED    0xFFFFFFFF
+
+// a queued FDS operation
+typedef struct fdsSimOp
+{
+  fds_evt_id_t id;       // the event the operation ends with
+  uint16_t file_id;
+  uint16_t key;
+  void const * p_data;   // data of a write, read when the write finishes like the flash does
+  uint32_t length_words;
+  uint32_t record_id;    // the record written or deleted
+  uint32_t old_id;       // the record replaced by an update
+  uint16_t page;         // page reserved for a write
+} fdsSimOp;
+
+static fdsSimConfig m_config;
+static fdsSimStats m_stats;
+
+static uint32_t m_flash[FDS_VIRTUAL_PAGES][FDS_VIRTUAL_PAGE_SIZE];
+static uint16_t m_used[FDS_VIRTUAL_PAGES];     // words written on each page, including its tag
+static uint16_t m_reserved[FDS_VIRTUAL_PAGES]; // words reserved on each page by queued writes
+static uint16_t m_swap;                         // the page kept empty for garbage collection
+static bool m_formatted;                        // the pages have their tags
+static uint32_t m_last_id;                      // the last record ID given out
+
+static fds_cb_t m_users[FDS_SIM_MAX_USERS];
+static uint8_t m_num_users;
+static bool m_initialized;
+static uint16_t m_gc_runs;                      // descriptors from before a garbage collection must look their record up again
+static uint16_t m_open;                         // number of open records
+
+static fdsSimOp m_queue[FDS_OP_QUEUE_SIZE];
+static uint8_t m_queue_head;
+static uint8_t m_queue_count;
+static bool m_running;                          // the operation at the head of the queue is running
+static double m_cpu_debt;                       // CPU time under 1 us not yet added to the clock
+
+static ret_code_t fdsSim_queue(fdsSimOp const * op);
+static void fdsSim_startNext(void);
+static void fdsSim_finish(void);
+static ret_code_t fdsSim_run(fdsSimOp * op);
+static void fdsSim_writeRecord(fdsSimOp const * op);
+static uint32_t fdsSim_collect(void);
+static bool fdsSim_reserve(uint32_t words, uint16_t * page);
+static uint32_t * fdsSim_locate(uint32_t record_id);
+static ret_code_t fdsSim_find(uint16_t file_id, uint16_t record_key, fds_record_desc_t * p_desc, fds_find_token_t * p_token);
+static void fdsSim_cpu(double us);
+
+// --- Simulator control ---
+
+// Fills config with the flash timing of the nRF52840 and the CRC check of the prototype (FDS_CRC_CHECK_ON_READ)
+// Arguments:
+//  * config - pointer to the configuration to fill
+void fdsSim_defaultConfig(fdsSimConfig * config)
+{
+  config->writeWordUs  = 41;
+  config->erasePageUs  = 85000;
+  config->opOverheadUs = 20;
+  config->findHeaderUs = 1;
+  config->crcWordUs    = 0.75;
+}
+
+// Erases the simulated flash and resets FDS and the statistics
+// Arguments:
+//  * config - simulator configuration, NULL for fdsSim_defaultConfig
+void fdsSim_init(fdsSimConfig const * config)
+{
+  if (config == NULL)
+  {
+    fdsSim_defaultConfig(&m_config);
+  }
+  else
+  {
+    m_config = *config;
+  }
+
+  memset(m_flash, 0xFF, sizeof(m_flash));
+  memset(m_used, 0, sizeof(m_used));
+  m_formatted = false;
+  m_last_id = 0;
+
+  fdsSim_reboot();
+  fdsSim_resetStats();
+}
+
+// Resets FDS as if the nRF52 was reset, the records in flash are kept. Queued operations are lost
+void fdsSim_reboot(void)
+{
+  memset(m_reserved, 0, sizeof(m_reserved));
+  m_num_users = 0;
+  m_initialized = false;
+  m_open = 0;
+  m_queue_head = 0;
+  m_queue_count = 0;
+  m_running = false;
+  m_cpu_debt = 0;
+
+  twiSim_setWakeup(0, NULL);
+}
+
+// Returns true while an operation is queued or running
+bool fdsSim_busy(void)
+{
+  return m_queue_count > 0;
+}
+
+// Copies the statistics since the last fdsSim_resetStats
+// Arguments:
+//  * stats - pointer to the struct to copy to
+void fdsSim_getStats(fdsSimStats * stats)
+{
+  *stats = m_stats;
+}
+
+// Clears the statistics
+void fdsSim_resetStats(void)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+}
+
+// --- FDS functions ---
+
+ret_code_t fds_register(fds_cb_t cb)
+{
+  if (m_num_users >= FDS_SIM_MAX_USERS) return FDS_ERR_USER_LIMIT_REACHED;
+
+  m_users[m_num_users++] = cb;
+
+  return NRF_SUCCESS;
+}
+
+// Tags the pages the first time, then ends with FDS_EVT_INIT like FDS
+ret_code_t fds_init(void)
+{
+  fdsSimOp op = {.id = FDS_EVT_INIT};
+
+  if (!m_formatted)
+  {
+    for (uint16_t page = 0; page < FDS_VIRTUAL_PAGES; page++)
+    {
+      m_flash[page][0] = 0xDEADC0DE;
+      m_flash[page][1] = 0xF11E01FF;
+      m_used[page] = FDS_PAGE_TAG_SIZE;
+    }
+
+    m_swap = FDS_VIRTUAL_PAGES - 1;
+    m_formatted = true;
+  }
+
+  return fdsSim_queue(&op);
+}
+
+ret_code_t fds_record_write(fds_record_desc_t * p_desc, fds_record_t const * p_record)
+{
+  fdsSimOp op = {.id = FDS_EVT_WRITE, .file_id = p_record->file_id, .key = p_record->key,
+                 .p_data = p_record->data.p_data, .length_words = p_record->data.length_words};
+
+  if (!m_initialized) return FDS_ERR_NOT_INITIALIZED;
+  if (p_record->file_id == FDS_FILE_ID_INVALID || p_record->key == FDS_RECORD_KEY_DIRTY) return FDS_ERR_INVALID_ARG;
+  if (op.length_words + FDS_HEADER_SIZE > FDS_VIRTUAL_PAGE_SIZE - FDS_PAGE_TAG_SIZE) return FDS_ERR_RECORD_TOO_LARGE;
+  if (m_queue_count >= FDS_OP_QUEUE_SIZE) return FDS_ERR_NO_SPACE_IN_QUEUES;
+  if (!fdsSim_reserve(op.length_words + FDS_HEADER_SIZE, &op.page)) return FDS_ERR_NO_SPACE_IN_FLASH;
+
+  op.record_id = ++m_last_id;
+
+  if (p_desc != NULL)
+  {
+    p_desc->record_id = op.record_id;
+    p_desc->p_record = NULL;
+    p_desc->gc_run_count = m_gc_runs;
+    p_desc->record_is_open = false;
+  }
+
+  return fdsSim_queue(&op);
+}
+
+ret_code_t fds_record_update(fds_record_desc_t * p_desc, fds_record_t const * p_record)
+{
+  uint32_t old_id = p_desc->record_id;
+  ret_code_t ret = fds_record_write(p_desc, p_record);
+
+  if (ret != NRF_SUCCESS) return ret;
+
+  // the write was queued last, turn it into the update
+  fdsSimOp * op = &m_queue[(m_queue_head + m_queue_count - 1) % FDS_OP_QUEUE_SIZE];
+  op->id = FDS_EVT_UPDATE;
+  op->old_id = old_id;
+
+  return NRF_SUCCESS;
+}
+
+ret_code_t fds_record_delete(fds_record_desc_t * p_desc)
+{
+  fdsSimOp op = {.id = FDS_EVT_DEL_RECORD, .record_id = p_desc->record_id};
+
+  if (!m_initialized) return FDS_ERR_NOT_INITIALIZED;
+
+  return fdsSim_queue(&op);
+}
+
+ret_code_t fds_file_delete(uint16_t file_id)
+{
+  fdsSimOp op = {.id = FDS_EVT_DEL_FILE, .file_id = file_id};
+
+  if (!m_initialized) return FDS_ERR_NOT_INITIALIZED;
+  if (file_id == FDS_FILE_ID_INVALID) return FDS_ERR_INVALID_ARG;
+
+  return fdsSim_queue(&op);
+}
+
+ret_code_t fds_gc(void)
+{
+  fdsSimOp op = {.id = FDS_EVT_GC};
+
+  if (!m_initialized) return FDS_ERR_NOT_INITIALIZED;
+
+  return fdsSim_queue(&op);
+}
+
+ret_code_t fds_record_find(uint16_t file_id, uint16_t record_key, fds_record_desc_t * p_desc, fds_find_token_t * p_token)
+{
+  return fdsSim_find(file_id, record_key, p_desc, p_token);
+}
+
+ret_code_t fds_record_find_by_key(uint16_t record_key, fds_record_desc_t * p_desc, fds_find_token_t * p_token)
+{
+  return fdsSim_find(FDS_FILE_ID_INVALID, record_key, p_desc, p_token);
+}
+
+ret_code_t fds_record_find_in_file(uint16_t file_id, fds_record_desc_t * p_desc, fds_find_token_t * p_token)
+{
+  return fdsSim_find(file_id, FDS_RECORD_KEY_DIRTY, p_desc, p_token);
+}
+
+ret_code_t fds_record_iterate(fds_record_desc_t * p_desc, fds_find_token_t * p_token)
+{
+  return fdsSim_find(FDS_FILE_ID_INVALID, FDS_RECORD_KEY_DIRTY, p_desc, p_token);
+}
+
+ret_code_t fds_record_open(fds_record_desc_t * p_desc, fds_flash_record_t * p_flash_record)
+{
+  // the record may have moved, FDS looks it up again by its ID
+  if (p_desc->p_record == NULL || p_desc->gc_run_count != m_gc_runs)
+  {
+    p_desc->p_record = fdsSim_locate(p_desc->record_id);
+    p_desc->gc_run_count = m_gc_runs;
+  }
+
+  if (p_desc->p_record == NULL) return FDS_ERR_NOT_FOUND;
+
+  fds_header_t const * header = (fds_header_t const *) p_desc->p_record;
+
+  m_stats.opens += 1;
+  fdsSim_cpu(m_config.crcWordUs * header->length_words);
+
+  p_flash_record->p_header = header;
+  p_flash_record->p_data = p_desc->p_record + FDS_HEADER_SIZE;
+
+  if (!p_desc->record_is_open) m_open += 1;
+  p_desc->record_is_open = true;
+
+  return NRF_SUCCESS;
+}
+
+ret_code_t fds_record_close(fds_record_desc_t * p_desc)
+{
+  if (!p_desc->record_is_open) return FDS_ERR_NO_OPEN_RECORDS;
+
+  p_desc->record_is_open = false;
+  m_open -= 1;
+
+  return NRF_SUCCESS;
+}
+
+ret_code_t fds_stat(fds_stat_t * p_stat)
+{
+  memset(p_stat, 0, sizeof(fds_stat_t));
+
+  p_stat->pages_available = FDS_VIRTUAL_PAGES - 1;
+  p_stat->open_records = m_open;
+
+  for (uint16_t page = 0; page < FDS_VIRTUAL_PAGES; page++)
+  {
+    if (page == m_swap) continue;
+
+    uint32_t offset = FDS_PAGE_TAG_SIZE;
+    while (offset < m_used[page])
+    {
+      fds_header_t const * header = (fds_header_t const *) &m_flash[page][offset];
+      uint32_t words = FDS_HEADER_SIZE + header->length_words;
+
+      if (header->record_key == FDS_RECORD_KEY_DIRTY)
+      {
+        p_stat->dirty_records += 1;
+        p_stat->freeable_words += words;
+      }
+      else
+      {
+        p_stat->valid_records += 1;
+      }
+
+      offset += words;
+    }
+
+    uint32_t free = FDS_VIRTUAL_PAGE_SIZE - m_used[page] - m_reserved[page];
+
+    p_stat->words_used += m_used[page];
+    p_stat->words_reserved += m_reserved[page];
+    if (free > p_stat->largest_contig) p_stat->largest_contig = free;
+  }
+
+  return NRF_SUCCESS;
+}
+
+// --- Helper functions ---
+
+// Queues an operation and starts it if the flash is idle
+static ret_code_t fdsSim_queue(fdsSimOp const * op)
+{
+  if (m_queue_count >= FDS_OP_QUEUE_SIZE) return FDS_ERR_NO_SPACE_IN_QUEUES;
+
+  m_queue[(m_queue_head + m_queue_count) % FDS_OP_QUEUE_SIZE] = *op;
+  m_queue_count += 1;
+
+  fdsSim_startNext();
+
+  return NRF_SUCCESS;
+}
+
+// Starts the operation at the head of the queue, it finishes after the time the flash takes for it
+static void fdsSim_startNext(void)
+{
+  if (m_running || m_queue_count == 0) return;
+
+  fdsSimOp const * op = &m_queue[m_queue_head];
+  double us = 0;
+
+  switch (op->id)
+  {
+    case FDS_EVT_WRITE:
+      us = m_config.writeWordUs * (op->length_words + FDS_HEADER_SIZE);
+      break;
+
+    case FDS_EVT_UPDATE:
+      us = m_config.writeWordUs * (op->length_words + FDS_HEADER_SIZE + 1);
+      break;
+
+    case FDS_EVT_DEL_RECORD:
+      us = m_config.writeWordUs;
+      break;
+
+    default:
+      // deleting a file and garbage collection take as long as the work they find, added when they run
+      break;
+  }
+
+  m_running = true;
+  m_stats.flashBusyUs += (uint64_t) us;
+  twiSim_setWakeup(twiSim_micros() + (uint64_t) (m_config.opOverheadUs + us), fdsSim_finish);
+}
+
+// Called when the running operation is done, carries it out and tells the users
+static void fdsSim_finish(void)
+{
+  fdsSimOp op = m_queue[m_queue_head];
+  fds_evt_t evt;
+
+  ret_code_t result = fdsSim_run(&op);
+
+  m_queue_head = (m_queue_head + 1) % FDS_OP_QUEUE_SIZE;
+  m_queue_count -= 1;
+  m_running = false;
+
+  memset(&evt, 0, sizeof(evt));
+  evt.id = op.id;
+  evt.result = result;
+
+  if (op.id == FDS_EVT_WRITE || op.id == FDS_EVT_UPDATE)
+  {
+    evt.write.record_id = op.record_id;
+    evt.write.file_id = op.file_id;
+    evt.write.record_key = op.key;
+    evt.write.is_record_updated = (op.id == FDS_EVT_UPDATE);
+  }
+  else if (op.id == FDS_EVT_DEL_RECORD || op.id == FDS_EVT_DEL_FILE)
+  {
+    evt.del.record_id = op.record_id;
+    evt.del.file_id = op.file_id;
+    evt.del.record_key = op.key;
+  }
+
+  // the handlers may queue more operations
+  for (uint8_t i = 0; i < m_num_users; i++)
+  {
+    m_users[i](&evt);
+  }
+
+  fdsSim_startNext();
+}
+
+// Carries out an operation on the flash array
+// Return value:
+//  the result of the event
+static ret_code_t fdsSim_run(fdsSimOp * op)
+{
+  switch (op->id)
+  {
+    case FDS_EVT_INIT:
+      m_initialized = true;
+      return NRF_SUCCESS;
+
+    case FDS_EVT_WRITE:
+      fdsSim_writeRecord(op);
+      return NRF_SUCCESS;
+
+    case FDS_EVT_UPDATE:
+    {
+      fdsSim_writeRecord(op);
+
+      uint32_t * old = fdsSim_locate(op->old_id);
+      if (old != NULL) ((fds_header_t *) old)->record_key = FDS_RECORD_KEY_DIRTY;
+
+      return NRF_SUCCESS;
+    }
+
+    case FDS_EVT_DEL_RECORD:
+    {
+      uint32_t * record = fdsSim_locate(op->record_id);
+      if (record == NULL) return FDS_ERR_NOT_FOUND;
+
+      fds_header_t * header = (fds_header_t *) record;
+      op->file_id = header->file_id;
+      op->key = header->record_key;
+      header->record_key = FDS_RECORD_KEY_DIRTY;
+      m_stats.deletes += 1;
+
+      return NRF_SUCCESS;
+    }
+
+    case FDS_EVT_DEL_FILE:
+    {
+      uint32_t deleted = 0;
+
+      for (uint16_t page = 0; page < FDS_VIRTUAL_PAGES; page++)
+      {
+        if (page == m_swap) continue;
+
+        uint32_t offset = FDS_PAGE_TAG_SIZE;
+        while (offset < m_used[page])
+        {
+          fds_header_t * header = (fds_header_t *) &m_flash[page][offset];
+
+          if (header->record_key != FDS_RECORD_KEY_DIRTY && header->file_id == op->file_id)
+          {
+            header->record_key = FDS_RECORD_KEY_DIRTY;
+            deleted += 1;
+          }
+
+          offset += FDS_HEADER_SIZE + header->length_words;
+        }
+      }
+
+      // one word written to mark each record
+      m_stats.deletes += deleted;
+      m_stats.flashBusyUs += (uint64_t) (m_config.writeWordUs * deleted);
+      twiSim_advance((uint64_t) (m_config.writeWordUs * deleted));
+
+      return NRF_SUCCESS;
+    }
+
+    case FDS_EVT_GC:
+    {
+      uint64_t us = (uint64_t) (fdsSim_collect());
+
+      m_stats.flashBusyUs += us;
+      twiSim_advance(us);
+
+      return NRF_SUCCESS;
+    }
+
+    default:
+      return FDS_ERR_INTERNAL;
+  }
+}
+
+// Writes the header and data of a record at the end of its reserved page
+static void fdsSim_writeRecord(fdsSimOp const * op)
+{
+  uint16_t page = op->page;
+  uint32_t words = FDS_HEADER_SIZE + op->length_words;
+  fds_header_t * header = (fds_header_t *) &m_flash[page][m_used[page]];
+
+  header->record_key = op->key;
+  header->length_words = op->length_words;
+  header->file_id = op->file_id;
+  header->crc16 = 0xFFFF;
+  header->record_id = op->record_id;
+  memcpy(&m_flash[page][m_used[page] + FDS_HEADER_SIZE], op->p_data, op->length_words * sizeof(uint32_t));
+
+  m_used[page] += words;
+  m_reserved[page] -= words;
+
+  m_stats.writes += 1;
+  m_stats.wordsWritten += words;
+}
+
+// Copies the valid records of every page with dirty records to the swap page, then erases the page,
+// which becomes the swap page. Descriptors from before look their records up again when opened
+// Return value:
+//  the time the flash took (us)
+static uint32_t fdsSim_collect(void)
+{
+  double us = 0;
+
+  for (uint16_t page = 0; page < FDS_VIRTUAL_PAGES; page++)
+  {
+    if (page == m_swap) continue;
+
+    // only pages with dirty records and no queued writes are collected
+    bool dirty = false;
+    uint32_t offset = FDS_PAGE_TAG_SIZE;
+    while (offset < m_used[page])
+    {
+      fds_header_t const * header = (fds_header_t const *) &m_flash[page][offset];
+      if (header->record_key == FDS_RECORD_KEY_DIRTY) dirty = true;
+      offset += FDS_HEADER_SIZE + header->length_words;
+    }
+
+    if (!dirty || m_reserved[page] > 0) continue;
+
+    // copy the valid records to the swap page
+    uint16_t swap = m_swap;
+    m_used[swap] = FDS_PAGE_TAG_SIZE;
+    m_flash[swap][0] = m_flash[page][0];
+    m_flash[swap][1] = m_flash[page][1];
+
+    offset = FDS_PAGE_TAG_SIZE;
+    while (offset < m_used[page])
+    {
+      fds_header_t const * header = (fds_header_t const *) &m_flash[page][offset];
+      uint32_t words = FDS_HEADER_SIZE + header->length_words;
+
+      if (header->record_key != FDS_RECORD_KEY_DIRTY)
+      {
+        memcpy(&m_flash[swap][m_used[swap]], header, words * sizeof(uint32_t));
+        m_used[swap] += words;
+        us += m_config.writeWordUs * words;
+      }
+
+      offset += words;
+    }
+
+    // erase the old page, it is the new swap page
+    memset(m_flash[page], 0xFF, sizeof(m_flash[page]));
+    m_flash[page][0] = 0xDEADC0DE;
+    m_flash[page][1] = 0xF11E01FF;
+    m_used[page] = FDS_PAGE_TAG_SIZE;
+    m_swap = page;
+
+    us += m_config.erasePageUs + m_config.writeWordUs * FDS_PAGE_TAG_SIZE;
+    m_stats.pagesErased += 1;
+  }
+
+  m_gc_runs += 1;
+  m_stats.gcRuns += 1;
+
+  return (uint32_t) us;
+}
+
+// Reserves space for a record on the first page it fits on, like FDS
+// Return value:
+//  false if no page has room
+static bool fdsSim_reserve(uint32_t words, uint16_t * page)
+{
+  for (uint16_t i = 0; i < FDS_VIRTUAL_PAGES; i++)
+  {
+    if (i == m_swap) continue;
+
+    if ((uint32_t) (FDS_VIRTUAL_PAGE_SIZE - m_used[i] - m_reserved[i]) >= words)
+    {
+      m_reserved[i] += words;
+      *page = i;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Finds the header of a valid record by its ID, looking at every header like FDS does
+// Return value:
+//  pointer to the header, NULL if the record is not in flash
+static uint32_t * fdsSim_locate(uint32_t record_id)
+{
+  for (uint16_t page = 0; page < FDS_VIRTUAL_PAGES; page++)
+  {
+    if (page == m_swap) continue;
+
+    uint32_t offset = FDS_PAGE_TAG_SIZE;
+    while (offset < m_used[page])
+    {
+      fds_header_t * header = (fds_header_t *) &m_flash[page][offset];
+
+      m_stats.headersScanned += 1;
+      fdsSim_cpu(m_config.findHeaderUs);
+
+      if (header->record_key != FDS_RECORD_KEY_DIRTY && header->record_id == record_id) return &m_flash[page][offset];
+
+      offset += FDS_HEADER_SIZE + header->length_words;
+    }
+  }
+
+  return NULL;
+}
+
+// Finds the next valid record after the token with a matching file ID and key
+// (FDS_FILE_ID_INVALID and FDS_RECORD_KEY_DIRTY match anything)
+static ret_code_t fdsSim_find(uint16_t file_id, uint16_t record_key, fds_record_desc_t * p_desc, fds_find_token_t * p_token)
+{
+  uint16_t page = 0;
+  uint32_t offset = FDS_PAGE_TAG_SIZE;
+
+  if (!m_initialized) return FDS_ERR_NOT_INITIALIZED;
+
+  m_stats.finds += 1;
+
+  // carry on after the record found last
+  if (p_token->p_addr != NULL)
+  {
+    fds_header_t const * last = (fds_header_t const *) p_token->p_addr;
+
+    page = p_token->page;
+    offset = (p_token->p_addr - m_flash[page]) + FDS_HEADER_SIZE + last->length_words;
+  }
+
+  for (; page < FDS_VIRTUAL_PAGES; page++, offset = FDS_PAGE_TAG_SIZE)
+  {
+    if (page == m_swap) continue;
+
+    while (offset < m_used[page])
+    {
+      fds_header_t const * header = (fds_header_t const *) &m_flash[page][offset];
+
+      m_stats.headersScanned += 1;
+      fdsSim_cpu(m_config.findHeaderUs);
+
+      if (header->record_key != FDS_RECORD_KEY_DIRTY &&
+          (file_id == FDS_FILE_ID_INVALID || header->file_id == file_id) &&
+          (record_key == FDS_RECORD_KEY_DIRTY || header->record_key == record_key))
+      {
+        p_desc->record_id = header->record_id;
+        p_desc->p_record = &m_flash[page][offset];
+        p_desc->gc_run_count = m_gc_runs;
+        p_desc->record_is_open = false;
+
+        p_token->p_addr = &m_flash[page][offset];
+        p_token->page = page;
+
+        return NRF_SUCCESS;
+      }
+
+      offset += FDS_HEADER_SIZE + header->length_words;
+    }
+  }
+
+  return FDS_ERR_NOT_FOUND;
+}
+
+// Moves simulated time forward for CPU work, keeping the fractions of a us
+static void fdsSim_cpu(double us)
+{
+  m_cpu_debt += us;
+
+  uint64_t whole = (uint64_t) floor(m_cpu_debt);
+  m_cpu_debt -= whole;
+
+  twiSim_advance(whole);
+  m_stats.cpuUs += whole;
+}
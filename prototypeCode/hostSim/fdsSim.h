@@ -0,0 +1,198 @@
+/*
+ *  fdsSim.h
+ *
+ *  Header file for fdsSim.c, a host (Linux) stand-in for the Flash Data Storage (FDS) module of the
+ *  nRF SDK used by flashManager.c. Records live in a model of the FDS virtual pages, so they are
+ *  memory mapped like on the nRF52, and writes, deletes and garbage collection take the time the
+ *  flash would take, on the simulated clock of twiSim.c.
+ *
+ *  Build flashManager.c with AD5933_SIM defined and hostSim on the include path, for example:
+ *    gcc -DAD5933_SIM -I. -IhostSim flashManager.c sweepSink.c hostSim/fdsSim.c hostSim/twiSim.c bench.c -lm
+ *
+ */
+
+#ifndef INC_FDSSIM_H_
+#define INC_FDSSIM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "twiSim.h"
+
+// --- FDS stand-ins (sdk_config.h of the prototype) ---
+
+#ifndef FDS_VIRTUAL_PAGES
+#define FDS_VIRTUAL_PAGES     124
+#endif
+#ifndef FDS_VIRTUAL_PAGE_SIZE
+#define FDS_VIRTUAL_PAGE_SIZE 1024 // words
+#endif
+#ifndef FDS_OP_QUEUE_SIZE
+#define FDS_OP_QUEUE_SIZE     4
+#endif
+
+#define FDS_PAGE_TAG_SIZE     2      // words at the start of every page
+#define FDS_HEADER_SIZE       3      // words of every record header
+#define FDS_FILE_ID_INVALID   0xFFFF
+#define FDS_RECORD_KEY_DIRTY  0x0000
+
+#define NRF_ERROR_FDS_ERR_BASE 0x8600
+
+enum
+{
+  FDS_ERR_OPERATION_TIMEOUT = NRF_ERROR_FDS_ERR_BASE,
+  FDS_ERR_NOT_INITIALIZED,
+  FDS_ERR_UNALIGNED_ADDR,
+  FDS_ERR_INVALID_ARG,
+  FDS_ERR_NULL_ARG,
+  FDS_ERR_NO_OPEN_RECORDS,
+  FDS_ERR_NO_SPACE_IN_FLASH,
+  FDS_ERR_NO_SPACE_IN_QUEUES,
+  FDS_ERR_RECORD_TOO_LARGE,
+  FDS_ERR_NOT_FOUND,
+  FDS_ERR_NO_PAGES,
+  FDS_ERR_USER_LIMIT_REACHED,
+  FDS_ERR_CRC_CHECK_FAILED,
+  FDS_ERR_BUSY,
+  FDS_ERR_INTERNAL,
+};
+
+typedef struct
+{
+  uint16_t record_key;
+  uint16_t length_words;
+  uint16_t file_id;
+  uint16_t crc16;
+  uint32_t record_id;
+} fds_header_t;
+
+typedef struct
+{
+  uint32_t record_id;
+  uint32_t const * p_record;
+  uint16_t gc_run_count;
+  bool record_is_open;
+} fds_record_desc_t;
+
+typedef struct
+{
+  uint32_t const * p_addr;
+  uint16_t page;
+} fds_find_token_t;
+
+typedef struct
+{
+  fds_header_t const * p_header;
+  void const * p_data;
+} fds_flash_record_t;
+
+typedef struct
+{
+  uint16_t file_id;
+  uint16_t key;
+  struct
+  {
+    void const * p_data;
+    uint32_t length_words;
+  } data;
+} fds_record_t;
+
+typedef enum
+{
+  FDS_EVT_INIT,
+  FDS_EVT_WRITE,
+  FDS_EVT_UPDATE,
+  FDS_EVT_DEL_RECORD,
+  FDS_EVT_DEL_FILE,
+  FDS_EVT_GC
+} fds_evt_id_t;
+
+typedef struct
+{
+  fds_evt_id_t id;
+  ret_code_t result;
+  union
+  {
+    struct
+    {
+      uint32_t record_id;
+      uint16_t file_id;
+      uint16_t record_key;
+      bool is_record_updated;
+    } write;
+    struct
+    {
+      uint32_t record_id;
+      uint16_t file_id;
+      uint16_t record_key;
+    } del;
+  };
+} fds_evt_t;
+
+typedef void (*fds_cb_t)(fds_evt_t const * p_evt);
+
+typedef struct
+{
+  uint16_t pages_available;
+  uint16_t open_records;
+  uint16_t valid_records;
+  uint16_t dirty_records;
+  uint32_t words_reserved;
+  uint32_t words_used;
+  uint32_t largest_contig;
+  uint32_t freeable_words;
+  bool corruption;
+} fds_stat_t;
+
+ret_code_t fds_register(fds_cb_t cb);
+ret_code_t fds_init(void);
+ret_code_t fds_record_write(fds_record_desc_t * p_desc, fds_record_t const * p_record);
+ret_code_t fds_record_update(fds_record_desc_t * p_desc, fds_record_t const * p_record);
+ret_code_t fds_record_delete(fds_record_desc_t * p_desc);
+ret_code_t fds_file_delete(uint16_t file_id);
+ret_code_t fds_gc(void);
+ret_code_t fds_record_find(uint16_t file_id, uint16_t record_key, fds_record_desc_t * p_desc, fds_find_token_t * p_token);
+ret_code_t fds_record_find_by_key(uint16_t record_key, fds_record_desc_t * p_desc, fds_find_token_t * p_token);
+ret_code_t fds_record_find_in_file(uint16_t file_id, fds_record_desc_t * p_desc, fds_find_token_t * p_token);
+ret_code_t fds_record_iterate(fds_record_desc_t * p_desc, fds_find_token_t * p_token);
+ret_code_t fds_record_open(fds_record_desc_t * p_desc, fds_flash_record_t * p_flash_record);
+ret_code_t fds_record_close(fds_record_desc_t * p_desc);
+ret_code_t fds_stat(fds_stat_t * p_stat);
+
+// --- Simulator control ---
+
+// simulator configuration
+typedef struct fdsSimConfig
+{
+  double writeWordUs;     // time to write one word (nRF52840 tWRITE)
+  double erasePageUs;     // time to erase one page (nRF52840 tERASEPAGE)
+  double opOverheadUs;    // CPU time FDS and fstorage take to start each queued operation
+  double findHeaderUs;    // CPU time fds_record_find takes for each record header it looks at
+  double crcWordUs;       // CPU time fds_record_open takes for each word to check the CRC, 0 for no CRC check
+} fdsSimConfig;
+
+// flash statistics
+typedef struct fdsSimStats
+{
+  uint32_t writes;         // number of records written (write and update)
+  uint32_t wordsWritten;   // number of words written, including record headers
+  uint32_t deletes;        // number of records deleted
+  uint32_t finds;          // number of fds_record_find calls (and its variants)
+  uint32_t headersScanned; // number of record headers looked at by the finds
+  uint32_t opens;          // number of records opened
+  uint32_t gcRuns;         // number of garbage collections
+  uint32_t pagesErased;    // number of pages erased by garbage collection
+  uint64_t flashBusyUs;    // time the flash was busy writing and erasing
+  uint64_t cpuUs;          // CPU time spent finding and opening records
+} fdsSimStats;
+
+void fdsSim_init(fdsSimConfig const * config);
+void fdsSim_defaultConfig(fdsSimConfig * config);
+void fdsSim_reboot(void);
+bool fdsSim_busy(void);
+void fdsSim_getStats(fdsSimStats * stats);
+void fdsSim_resetStats(void);
+
+#endif
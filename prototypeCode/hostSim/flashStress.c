@@ -0,0 +1,176 @@
+/*
+ *  flashStress.c
+ *
+ *  Runs the sweep log through STRESS_CYCLES save and evict cycles on the FDS simulator, the way the RTC
+ *  handler and the main loop of main.c use it: save a sweep, finish the commit, then garbage collect in
+ *  the idle time before the next sweep. Every cycle the newest and the oldest kept sweeps are read back
+ *  and the sweep just evicted must be gone. Exits with 1 if a save or read fails, a save has to wait on a
+ *  garbage collection, more sweeps are kept than the retention allows or the oldest kept sweep goes back.
+ *
+ *  Usage: flashStress [cycles] [retention], the default retention is SWEEP_LOG_MAX_SWEEPS, which the
+ *  simulated flash fills before reaching, so sweeps are evicted for space. A smaller retention evicts
+ *  them by count.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AD5933.h"
+#include "flashManager.h"
+#include "twiManager.h"
+#include "fdsSim.h"
+
+#define STRESS_CYCLES  10000 // save and evict cycles
+#define REPORT_CYCLES  2000  // cycles between progress lines
+#define MAX_POINTS     512   // most points of a sweep
+
+// Fills in the default sweep of main.c
+static void flashStress_sweep(Sweep * sweep)
+{
+  memset(sweep, 0, sizeof(Sweep));
+  sweep->start            = 1000;
+  sweep->delta            = 100;
+  sweep->steps            = 490;
+  sweep->cycles           = 511;
+  sweep->cyclesMultiplier = TIMES4;
+  sweep->range            = RANGE1;
+  sweep->clockSource      = INTERN_CLOCK;
+  sweep->clockFrequency   = CLK_FREQ;
+  sweep->gain             = GAIN1;
+  sweep->repeats          = 1;
+  sweep->average          = AVERAGE_MEAN;
+  sweep->metadata.numPoints = sweep->steps + 1;
+}
+
+// Prints the state of the sweep log
+static void flashStress_report(uint32_t cycle)
+{
+  FlashStats stats;
+
+  flashManager_getStats(&stats);
+  printf("cycle %5u: kept %u - %u (%u), pages %u used %u dirty %u free %u, evicted %u, gc %u\n", cycle,
+         stats.firstSweep, stats.lastSweep, stats.lastSweep + 1 - stats.firstSweep, stats.pages, stats.usedPages,
+         stats.dirtyPages, stats.freePages, stats.evicted, stats.gcRuns);
+}
+
+int main(int argc, char ** argv)
+{
+  static uint32_t freq[MAX_POINTS];
+  static uint16_t real[MAX_POINTS];
+  static uint16_t imag[MAX_POINTS];
+  static uint32_t readFreq[MAX_POINTS];
+  static uint16_t readReal[MAX_POINTS];
+  static uint16_t readImag[MAX_POINTS];
+  uint32_t cycles = argc > 1 ? (uint32_t) atoi(argv[1]) : STRESS_CYCLES;
+  uint32_t retention = argc > 2 ? (uint32_t) atoi(argv[2]) : SWEEP_LOG_MAX_SWEEPS;
+  uint32_t saveFails = 0;
+  uint32_t readFails = 0;
+  uint32_t gcWaits = 0;
+  uint32_t retentionFails = 0;
+  uint64_t worstSaveUs = 0;
+  uint64_t worstIdleUs = 0;
+  uint64_t idleUs = 0;
+  uint32_t numSweeps = 0;
+  uint32_t first = 1;
+  twiSimConfig config;
+  fdsSimStats fdsStats;
+  MetaData readMetadata;
+  Sweep sweep;
+  Sweep saved;
+
+  // one measured sweep, each cycle saves it with fresh noise so no two sweeps code to the same size
+  twiSim_defaultConfig(&config);
+  config.noise = 20;
+  twiSim_init(&config);
+  flashStress_sweep(&sweep);
+  if (!AD5933_Init() || !twiManager_init() || !AD5933_Sweep(&sweep, freq, real, imag))
+  {
+    printf("sweep failed\n");
+    return 1;
+  }
+
+  uint32_t numPoints = sweep.metadata.numPoints;
+
+  fdsSim_init(NULL);
+  flashManager_init();
+  saved = sweep;
+  flashManager_checkConfig(&numSweeps, &saved);
+  flashManager_setRetention(retention, numPoints);
+
+  srand(1);
+
+  for (uint32_t cycle = 0; cycle < cycles; cycle++)
+  {
+    MetaData metadata = sweep.metadata;
+    uint32_t sweepNum;
+
+    for (uint32_t k = 0; k < numPoints; k++)
+    {
+      int32_t noise = (rand() % 41) - 20;
+
+      // every seventh sweep is much noisier, so it codes to more words
+      if (cycle % 7 == 0) noise += (rand() % 401) - 200;
+      real[k] = SWEEP_CODEC_WORD(SWEEP_CODEC_SAMPLE(real[k]) + noise);
+    }
+    metadata.time = cycle;
+
+    // the save from the RTC handler must not wait on a garbage collection
+    fdsSim_getStats(&fdsStats);
+    uint32_t gcRuns = fdsStats.gcRuns;
+    uint64_t start = twiSim_micros();
+
+    bool committed = flashManager_saveSweep(freq, real, imag, &metadata, numSweeps + 1) && flashManager_commitComplete(&sweepNum);
+
+    uint64_t elapsed = twiSim_micros() - start;
+    if (elapsed > worstSaveUs) worstSaveUs = elapsed;
+
+    fdsSim_getStats(&fdsStats);
+    if (fdsStats.gcRuns != gcRuns) gcWaits += 1;
+
+    if (!committed)
+    {
+      saveFails += 1;
+      continue;
+    }
+
+    numSweeps = sweepNum;
+    flashManager_updateNumSweeps(&numSweeps);
+
+    // the idle time until the next sweep, where the garbage is collected
+    start = twiSim_micros();
+    while (flashManager_idle()) __WFE();
+
+    elapsed = twiSim_micros() - start;
+    idleUs += elapsed;
+    if (elapsed > worstIdleUs) worstIdleUs = elapsed;
+
+    // the newest sweep reads back as saved, the oldest kept one reads and the one before it is gone
+    if (!flashManager_getSweep(readFreq, readReal, readImag, &readMetadata, numSweeps) ||
+        memcmp(readFreq, freq, sizeof(uint32_t) * numPoints) != 0 || memcmp(readReal, real, sizeof(uint16_t) * numPoints) != 0 ||
+        memcmp(readImag, imag, sizeof(uint16_t) * numPoints) != 0 || readMetadata.time != cycle)
+    {
+      readFails += 1;
+    }
+
+    uint32_t oldest = flashManager_firstSweep();
+
+    if (!flashManager_getSweep(readFreq, readReal, readImag, &readMetadata, oldest)) readFails += 1;
+    if (oldest > 1 && flashManager_getSweep(readFreq, readReal, readImag, &readMetadata, oldest - 1)) readFails += 1;
+
+    // sweeps are only evicted from the oldest end
+    if (oldest < first || numSweeps + 1 - oldest > retention) retentionFails += 1;
+    first = oldest;
+
+    if ((cycle + 1) % REPORT_CYCLES == 0 || cycle == cycles - 1) flashStress_report(cycle + 1);
+  }
+
+  fdsSim_getStats(&fdsStats);
+  printf("saves failed %u, saves waiting on gc %u, reads failed %u, retention broken %u\n", saveFails, gcWaits,
+         readFails, retentionFails);
+  printf("save worst %.1f ms, idle work mean %.1f ms worst %.1f ms, pages erased %u\n", worstSaveUs / 1e3,
+         cycles ? idleUs / 1e3 / cycles : 0.0, worstIdleUs / 1e3, fdsStats.pagesErased);
+
+  return (saveFails || gcWaits || readFails || retentionFails) ? 1 : 0;
+}
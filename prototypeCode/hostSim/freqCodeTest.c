@@ -0,0 +1,121 @@
+/*
+ *  freqCodeTest.c
+ *
+ *  Checks AD5933_FreqCode and AD5933_FREQ_CODE against the exact frequency code (freq * 2^27 * CLK_DIV /
+ *  clkFreq rounded to the nearest code) for every frequency from 1 Hz to 100 kHz, on the internal clock
+ *  and on two external clocks, then times a call. Build it with AD5934 defined to check the AD5934
+ *  (make freqCodeTest5934). Exits with 1 on any mismatch.
+ *
+ *  The times are host times. A Cortex-M4 does the 64 bit multiply of the internal clock path in a few
+ *  cycles, where the old float and pow() path ran a software double pow(), so host cycles only show
+ *  how the paths compare.
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "AD5933.h"
+
+#define MAX_TEST_FREQ 100000  // highest frequency checked (Hz)
+#define TIMING_ROUNDS 20      // times every frequency is converted for the timing
+
+// clocks checked, the internal clock takes the multiply and shift path, the others the division
+static uint32_t const m_clocks[] = {CLK_FREQ, 16000000, 4000000};
+
+// Exact frequency code, freq * 2^27 * CLK_DIV / clkFreq rounded half up
+static uint32_t freqCodeTest_reference(uint32_t freq, uint32_t clkFreq)
+{
+  uint64_t num = (uint64_t) freq * CLK_DIV * ((uint64_t) 1 << 27);
+  uint64_t code = num / clkFreq;
+
+  if (2 * (num % clkFreq) >= clkFreq) code += 1;
+
+  return (uint32_t) code;
+}
+
+// The float and pow() code SetStart and SetDelta used before AD5933_FreqCode, for comparison
+static uint32_t freqCodeTest_float(uint32_t freq, uint32_t clkFreq)
+{
+  return (uint32_t) (((float) freq / (clkFreq / CLK_DIV)) * pow(2, 27));
+}
+
+// Returns a time stamp, TSC cycles where there is one, else nanoseconds
+static uint64_t freqCodeTest_stamp(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+// Times conversions of every frequency and returns the time per call in freqCodeTest_stamp units
+static double freqCodeTest_time(uint32_t (*convert)(uint32_t, uint32_t), uint32_t clkFreq)
+{
+  volatile uint32_t sink = 0;
+  uint64_t start = freqCodeTest_stamp();
+
+  for (uint32_t round = 0; round < TIMING_ROUNDS; round++)
+  {
+    for (uint32_t freq = 1; freq <= MAX_TEST_FREQ; freq++) sink += convert(freq, clkFreq);
+  }
+
+  UNUSED_PARAMETER(sink);
+
+  return (double) (freqCodeTest_stamp() - start) / ((double) TIMING_ROUNDS * MAX_TEST_FREQ);
+}
+
+int main(void)
+{
+  uint32_t failed = 0;
+
+  printf("CLK_DIV %d, 1 Hz - %d kHz\n", CLK_DIV, MAX_TEST_FREQ / 1000);
+  printf("%-10s %12s %12s %18s\n", "clock", "mismatches", "macro", "old float path");
+
+  for (uint32_t c = 0; c < sizeof(m_clocks) / sizeof(m_clocks[0]); c++)
+  {
+    uint32_t mismatches = 0;
+    uint32_t macroMismatches = 0;
+    uint32_t floatMismatches = 0;
+
+    for (uint32_t freq = 1; freq <= MAX_TEST_FREQ; freq++)
+    {
+      uint32_t code = freqCodeTest_reference(freq, m_clocks[c]);
+
+      if (AD5933_FreqCode(freq, m_clocks[c]) != code) mismatches += 1;
+      if (m_clocks[c] == CLK_FREQ && AD5933_FREQ_CODE(freq) != code) macroMismatches += 1;
+      if (freqCodeTest_float(freq, m_clocks[c]) != code) floatMismatches += 1;
+    }
+
+    failed += mismatches + macroMismatches;
+
+    printf("%-10u %12u %12s %18u\n", m_clocks[c], mismatches, m_clocks[c] == CLK_FREQ ? (macroMismatches ? "FAILED" : "0") : "-",
+           floatMismatches);
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  printf("host TSC cycles per call:\n");
+#else
+  printf("host ns per call:\n");
+#endif
+  printf("  AD5933_FreqCode, internal clock %6.1f\n", freqCodeTest_time(AD5933_FreqCode, CLK_FREQ));
+  printf("  AD5933_FreqCode, external clock %6.1f\n", freqCodeTest_time(AD5933_FreqCode, 16000000));
+  printf("  old float and pow() path        %6.1f\n", freqCodeTest_time(freqCodeTest_float, CLK_FREQ));
+
+  if (failed > 0)
+  {
+    printf("%u mismatches\n", failed);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ *  planBench.c
+ *
+ *  Runs sweep plans on the simulated bus with sweepPlan_run and again as one AD5933_Sweep per segment,
+ *  and prints the wall time of both. Chaining the segments skips the reset and the 100 ms settling of
+ *  every segment after the first. The frequencies of both runs are checked against the segments, and
+ *  the ones of log plans against their ideal log spaced frequency. Log plans with a tolerance too tight
+ *  for PLAN_MAX_SEGMENTS are checked to stop at the cap with the points added so far still in tolerance.
+ *  Exits with 1 if a plan fails, measures the wrong points, is not faster than separate sweeps, or a
+ *  plan that does not fit is not refused.
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "AD5933.h"
+#include "twiManager.h"
+#include "sweepPlan.h"
+
+#define MAX_POINTS 1024 // most points of a plan
+
+// a plan to run, either linear segments or a log spaced spec
+typedef struct benchPlan
+{
+  char const * name;
+  SweepSegment const * segments; // linear segments, NULL for a log plan
+  uint8_t numSegments;
+  uint32_t start;                // log plan from start to stop Hz
+  uint32_t stop;
+  uint16_t pointsPerDecade;
+  uint16_t tolerance;            // in parts per thousand
+  bool fits;                     // false if the log plan needs more than PLAN_MAX_SEGMENTS segments
+} benchPlan;
+
+// the settings of every log plan segment
+static SweepSegment const m_logSettings = {0, 0, 0, 15, NO_MULT, RANGE1, GAIN1};
+
+// a low band with more settling and two faster bands, the last two continue each other and are merged
+static SweepSegment const m_bands[] =
+{
+  // start  delta  steps cycles multiplier range   gain
+  {  1000,   100,    90,   50,  NO_MULT,   RANGE1, GAIN1},
+  { 10000,   500,    60,  100,  NO_MULT,   RANGE1, GAIN1},
+  { 40500,   500,    19,  100,  NO_MULT,   RANGE1, GAIN1},
+  { 50000,  1000,    50,   15,  NO_MULT,   RANGE1, GAIN1},
+};
+
+static benchPlan const m_plans[] =
+{
+  // name                            segments  count  start  stop    ppd  tol  fits
+  {"4 bands, 2 merged",              m_bands,  4,     0,     0,      0,   0,   true},
+  {"log 10/decade 1 ppt",            NULL,     0,     1000,  100000, 10,  1,   true},
+  {"log 50/decade 10 ppt",           NULL,     0,     1000,  100000, 50,  10,  true},
+  {"log 100/decade 20 ppt",          NULL,     0,     1000,  100000, 100, 20,  true},
+  {"log 20/decade 5 ppt",            NULL,     0,     1000,  100000, 20,  5,   false},
+  {"log 100/decade 1 ppt",           NULL,     0,     1000,  100000, 100, 1,   false},
+  {"log 20/decade exact",            NULL,     0,     1000,  100000, 20,  0,   false},
+};
+
+static uint32_t m_freq[MAX_POINTS];
+static uint16_t m_real[MAX_POINTS];
+static uint16_t m_imag[MAX_POINTS];
+static uint32_t m_expected[MAX_POINTS];
+
+// Fills in the sweep the plan takes its clock settings and metadata from
+static void planBench_base(Sweep * base)
+{
+  memset(base, 0, sizeof(Sweep));
+  base->range          = RANGE1;
+  base->clockSource    = INTERN_CLOCK;
+  base->clockFrequency = CLK_FREQ;
+  base->gain           = GAIN1;
+  base->repeats        = 1;
+  base->average        = AVERAGE_MEAN;
+}
+
+// Builds a plan
+// Arguments:
+//  * bench - the plan to build
+//  * plan  - pointer to the plan to fill
+// Return value:
+//  what sweepPlan_addSegment or sweepPlan_addLog returned
+static bool planBench_build(benchPlan const * bench, SweepPlan * plan)
+{
+  sweepPlan_init(plan);
+
+  if (bench->segments == NULL)
+  {
+    return sweepPlan_addLog(plan, bench->start, bench->stop, bench->pointsPerDecade, bench->tolerance, &m_logSettings);
+  }
+
+  for (uint8_t i = 0; i < bench->numSegments; i++)
+  {
+    if (!sweepPlan_addSegment(plan, &bench->segments[i])) return false;
+  }
+
+  return true;
+}
+
+// Lists the frequency of every point of a plan into m_expected
+static void planBench_expected(SweepPlan const * plan)
+{
+  uint32_t n = 0;
+
+  for (uint8_t s = 0; s < plan->numSegments; s++)
+  {
+    SweepSegment const * segment = &plan->segments[s];
+
+    for (uint32_t j = 0; j <= segment->steps && n < MAX_POINTS; j++) m_expected[n++] = segment->start + segment->delta * j;
+  }
+}
+
+// Checks the frequencies of a log plan against their ideal log spaced frequency
+// Arguments:
+//  * bench - the log plan
+//  points  - number of points in m_expected
+// Return value:
+//  the largest error in parts per thousand, above the tolerance if a point does not fit
+static double planBench_logError(benchPlan const * bench, uint32_t points)
+{
+  double worst = 0;
+
+  for (uint32_t i = 0; i < points; i++)
+  {
+    double ideal = bench->start * pow(10, (double) i / bench->pointsPerDecade);
+    // the segment starts are rounded to whole Hz
+    double error = fmax(0, fabs(m_expected[i] - ideal) - 0.5) * 1000 / ideal;
+
+    if (error > worst) worst = error;
+  }
+
+  return worst;
+}
+
+// Runs a plan with sweepPlan_run on a freshly initialized simulator and driver
+// Arguments:
+//  * plan   - the compiled plan
+//  * wallUs - pointer to store the simulated time the plan took
+// Return value:
+//  false if the plan failed or measured the wrong points
+//  true  if success
+static bool planBench_runPlan(SweepPlan * plan, uint64_t * wallUs)
+{
+  Sweep base;
+  MetaData metadata;
+
+  twiSim_init(NULL);
+  if (!AD5933_Init() || !twiManager_init()) return false;
+
+  planBench_base(&base);
+  memset(m_freq, 0, sizeof(m_freq));
+
+  uint64_t start = twiSim_micros();
+  bool success = sweepPlan_run(plan, &base, m_freq, m_real, m_imag, &metadata);
+  *wallUs = twiSim_micros() - start;
+
+  return success && metadata.numPoints == plan->numPoints &&
+         memcmp(m_freq, m_expected, plan->numPoints * sizeof(uint32_t)) == 0;
+}
+
+// Runs every segment of a plan as its own AD5933_Sweep on a freshly initialized simulator and driver
+// Arguments:
+//  * plan   - the compiled plan
+//  * wallUs - pointer to store the simulated time all the sweeps took
+// Return value:
+//  false if a sweep failed or measured the wrong points
+//  true  if success
+static bool planBench_runSeparate(SweepPlan * plan, uint64_t * wallUs)
+{
+  Sweep sweep;
+  uint32_t n = 0;
+  bool success = true;
+
+  twiSim_init(NULL);
+  if (!AD5933_Init() || !twiManager_init()) return false;
+
+  memset(m_freq, 0, sizeof(m_freq));
+
+  uint64_t start = twiSim_micros();
+
+  for (uint8_t s = 0; s < plan->numSegments && success; s++)
+  {
+    SweepSegment const * segment = &plan->segments[s];
+
+    planBench_base(&sweep);
+    sweep.start            = segment->start;
+    sweep.delta            = segment->delta;
+    sweep.steps            = segment->steps;
+    sweep.cycles           = segment->cycles;
+    sweep.cyclesMultiplier = segment->cyclesMultiplier;
+    sweep.range            = segment->range;
+    sweep.gain             = segment->gain;
+    sweep.metadata.numPoints = sweep.steps + 1;
+
+    success = AD5933_Sweep(&sweep, &m_freq[n], &m_real[n], &m_imag[n]) && sweep.metadata.numPoints == sweep.steps + 1;
+    n += sweep.steps + 1;
+  }
+
+  *wallUs = twiSim_micros() - start;
+
+  return success && memcmp(m_freq, m_expected, plan->numPoints * sizeof(uint32_t)) == 0;
+}
+
+int main(void)
+{
+  uint32_t failed = 0;
+
+  printf("%-24s %5s %5s %5s %7s %9s %10s %7s\n", "plan", "segs", "hw", "pts", "err ppt", "plan s", "separate s", "speedup");
+
+  for (uint32_t i = 0; i < sizeof(m_plans) / sizeof(m_plans[0]); i++)
+  {
+    benchPlan const * bench = &m_plans[i];
+    SweepPlan plan;
+    uint64_t planUs = 0;
+    uint64_t separateUs = 0;
+    double error = 0;
+    bool success;
+
+    bool built = planBench_build(bench, &plan);
+    uint8_t segments = plan.numSegments;
+
+    sweepPlan_compile(&plan);
+    planBench_expected(&plan);
+    if (bench->segments == NULL) error = planBench_logError(bench, plan.numPoints);
+
+    if (!bench->fits)
+    {
+      // refused once it ran out of segments, the points that did fit are still in tolerance
+      success = !built && segments == PLAN_MAX_SEGMENTS && error <= bench->tolerance;
+
+      printf("%-24s %5u %5u %5u %7.2f %9s %10s %7s%s\n", bench->name, segments, plan.numSegments, plan.numPoints,
+             error, "-", "-", "refused", success ? "" : "  FAILED");
+    }
+    else
+    {
+      success = built && error <= bench->tolerance && planBench_runPlan(&plan, &planUs) &&
+                planBench_runSeparate(&plan, &separateUs) && planUs < separateUs;
+
+      printf("%-24s %5u %5u %5u %7.2f %9.3f %10.3f %6.2fx%s\n", bench->name, segments, plan.numSegments,
+             plan.numPoints, error, planUs / 1e6, separateUs / 1e6, planUs ? (double) separateUs / planUs : 0.0,
+             success ? "" : "  FAILED");
+    }
+
+    if (!success) failed += 1;
+  }
+
+  if (failed > 0)
+  {
+    printf("%u plans failed\n", failed);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,241 @@
+/*
+ *  pollBench.c
+ *
+ *  Times the status polls of a sweep on the simulated bus. Each plan runs once with the engine, which
+ *  sleeps until AD5933_PointTime says the point is ready, and once with the fixed 10 ms status poll
+ *  AD5933_Sweep used before the engine, rebuilt here from the register helpers. The wall time, status
+ *  reads and wakeups of both are printed next to the predicted time, the start settling plus the sum of
+ *  AD5933_PointTime over the points. The engine also measures the temperature while the output settles,
+ *  its settle time and the temperature it read are printed. Exits with 1 if a sweep fails, the engine is
+ *  slower than the fixed poll, reads the status more than about once a point, does not fill in the
+ *  temperature or settles for longer than SWEEP_SETTLE_MS.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "AD5933.h"
+#include "twiManager.h"
+
+#define FIXED_POLL_MS   10   // status poll period of the old AD5933_Sweep
+#define MAX_POINTS      512  // most points of a sweep
+#define SIM_TEMPERATURE 25   // die temperature of twiSim_defaultConfig in Celsius
+#define SETTLE_SLACK_US 1000 // settling allowed past SWEEP_SETTLE_MS for the transfers that end it
+
+// a sweep plan to time
+typedef struct pollPlan
+{
+  char const * name;
+  uint32_t start;     // start frequency in Hz
+  uint32_t delta;     // frequency increment in Hz
+  uint16_t steps;     // number of increments
+  uint16_t cycles;    // settling cycles
+  uint8_t multiplier; // settling cycles multiplier (NO_MULT, TIMES2, TIMES4)
+} pollPlan;
+
+static pollPlan const m_plans[] =
+{
+  // name                    start  delta  steps cycles multiplier
+  {"50-100 kHz 15 cycles",  50000,   100,  500,   15,  NO_MULT},
+  {"10-60 kHz 100 cycles",  10000,   100,  500,  100,  NO_MULT},
+  {"1-50 kHz 511x4",         1000,   100,  490,  511,  TIMES4},
+  {"1-2 kHz 511x4",          1000,    10,  100,  511,  TIMES4},
+};
+
+// result of one sweep
+typedef struct pollResult
+{
+  bool success;
+  uint32_t points;
+  uint64_t wallUs;
+  uint64_t settleUs;  // time from the end of AD5933_SweepBegin to the first point being started (engine only)
+  int16_t temp;       // metadata.temp of the sweep (engine only)
+  twiSimStats stats;
+} pollResult;
+
+// Fills in a sweep from a plan
+static void pollBench_sweep(pollPlan const * plan, Sweep * sweep)
+{
+  memset(sweep, 0, sizeof(Sweep));
+  sweep->start            = plan->start;
+  sweep->delta            = plan->delta;
+  sweep->steps            = plan->steps;
+  sweep->cycles           = plan->cycles;
+  sweep->cyclesMultiplier = plan->multiplier;
+  sweep->range            = RANGE1;
+  sweep->clockSource      = INTERN_CLOCK;
+  sweep->clockFrequency   = CLK_FREQ;
+  sweep->gain             = GAIN1;
+  sweep->repeats          = 1;
+  sweep->average          = AVERAGE_MEAN;
+  sweep->metadata.numPoints = sweep->steps + 1;
+}
+
+// Predicts the time of a sweep, the settling at the start frequency plus the measurement of every point
+static uint64_t pollBench_predicted(Sweep * sweep)
+{
+  uint64_t us = SWEEP_SETTLE_MS * 1000;
+
+  for (uint32_t step = 0; step <= sweep->steps; step++)
+  {
+    us += AD5933_PointTime(sweep, sweep->start + step * sweep->delta);
+  }
+
+  return us;
+}
+
+// Sweeps like AD5933_Sweep did before the engine, reading the status every FIXED_POLL_MS until the data is ready
+// Arguments:
+//  * sweep  - the sweep to run
+//  * points - pointer to store the number of points read
+// Return value:
+//  false if a transfer failed
+//  true  if success
+static bool pollBench_fixedSweep(Sweep * sweep, uint32_t * points)
+{
+  uint8_t status;
+  uint16_t data[2];
+
+  *points = 0;
+
+  if (!AD5933_SetControl(STANDBY, sweep->range, sweep->gain, sweep->clockSource, 1)) return false;
+  if (!AD5933_SetStart(sweep->start, sweep->clockFrequency)) return false;
+  if (!AD5933_SetDelta(sweep->delta, sweep->clockFrequency)) return false;
+  if (!AD5933_SetSteps(sweep->steps)) return false;
+  if (!AD5933_SetCycles(sweep->cycles, sweep->cyclesMultiplier)) return false;
+  if (!AD5933_SetControl(INIT_START_FREQ, sweep->range, sweep->gain, sweep->clockSource, 0)) return false;
+
+  nrf_delay_ms(SWEEP_SETTLE_MS);
+
+  if (!AD5933_SetControl(START_SWEEP, sweep->range, sweep->gain, sweep->clockSource, 0)) return false;
+  if (!AD5933_ReadStatus(&status)) return false;
+
+  while (true)
+  {
+    // wait till the measurement is done
+    while ((status & STATUS_DATA) != STATUS_DATA)
+    {
+      nrf_delay_ms(FIXED_POLL_MS);
+      if (!AD5933_ReadStatus(&status)) return false;
+    }
+
+    if (!AD5933_ReadData(data)) return false;
+    *points += 1;
+
+    // the status that said the last point is ready also says the sweep is done
+    if ((status & STATUS_DONE) == STATUS_DONE) break;
+
+    if (!AD5933_SetControl(INCREMENT_FREQ, sweep->range, sweep->gain, sweep->clockSource, 0)) return false;
+    if (!AD5933_ReadStatus(&status)) return false;
+  }
+
+  return AD5933_SetControl(POWER_DOWN, sweep->range, sweep->gain, sweep->clockSource, 0);
+}
+
+// Runs a plan on a freshly initialized simulator and driver
+// Arguments:
+//  * plan   - the plan
+//  engine   - true for the engine, false for the fixed poll
+//  * result - pointer to store the result
+static void pollBench_run(pollPlan const * plan, bool engine, pollResult * result)
+{
+  static uint32_t freq[MAX_POINTS];
+  static uint16_t real[MAX_POINTS];
+  static uint16_t imag[MAX_POINTS];
+  Sweep sweep;
+
+  memset(result, 0, sizeof(pollResult));
+  pollBench_sweep(plan, &sweep);
+
+  twiSim_init(NULL);
+  if (!AD5933_Init() || !twiManager_init()) return;
+  twiSim_resetStats();
+
+  uint64_t start = twiSim_micros();
+
+  if (engine)
+  {
+    SweepEngine sweepEngine;
+
+    // AD5933_Sweep, timing the settling where the temperature is measured
+    result->success = AD5933_SweepBegin(&sweepEngine, &sweep, freq, real, imag);
+    uint64_t settleStart = twiSim_micros();
+
+    while (result->success && AD5933_SweepPoll(&sweepEngine) < SWEEP_COMPLETE)
+    {
+      if (result->settleUs == 0 && sweepEngine.state != SWEEP_SETTLING) result->settleUs = twiSim_micros() - settleStart;
+      __WFE();
+    }
+
+    result->success = result->success && AD5933_SweepComplete(&sweepEngine);
+    result->points = sweep.metadata.numPoints;
+    result->temp = sweep.metadata.temp;
+  }
+  else
+  {
+    result->success = pollBench_fixedSweep(&sweep, &result->points);
+  }
+
+  result->wallUs = twiSim_micros() - start;
+  twiSim_getStats(&result->stats);
+}
+
+// Prints one row of the table
+static void pollBench_print(char const * name, char const * poll, pollResult const * result, uint64_t predictedUs)
+{
+  printf("%-22s %-6s %5u %9.3f %8.2f %8u %8u %9.3f\n", name, poll, result->points, result->wallUs / 1e6,
+         (double) result->wallUs / predictedUs, result->stats.statusReads, result->stats.wakeups,
+         (result->wallUs - result->stats.sleepUs) / 1e6);
+}
+
+int main(void)
+{
+  uint32_t failed = 0;
+
+  printf("%-22s %-6s %5s %9s %8s %8s %8s %9s\n", "plan", "poll", "pts", "wall s", "/predict", "status",
+         "wakeups", "busy s");
+
+  for (uint32_t i = 0; i < sizeof(m_plans) / sizeof(m_plans[0]); i++)
+  {
+    uint32_t expected = (uint32_t) m_plans[i].steps + 1;
+    pollResult engine;
+    pollResult fixed;
+    Sweep sweep;
+
+    pollBench_sweep(&m_plans[i], &sweep);
+    uint64_t predictedUs = pollBench_predicted(&sweep);
+
+    pollBench_run(&m_plans[i], true, &engine);
+    pollBench_run(&m_plans[i], false, &fixed);
+
+    printf("%-22s %-6s %5u %9.3f\n", m_plans[i].name, "model", expected, predictedUs / 1e6);
+    pollBench_print("", "engine", &engine, predictedUs);
+    pollBench_print("", "10 ms", &fixed, predictedUs);
+
+    printf("%-22s %-6s %5s %9.6f %8s temp %d C\n", "", "settle", "", engine.settleUs / 1e6, "", engine.temp);
+
+    // the engine reads the status once a point, a few extra reads are allowed for late points
+    bool passed = engine.success && fixed.success && engine.points == expected && fixed.points == expected &&
+                  engine.wallUs <= fixed.wallUs && engine.stats.statusReads <= expected + expected / 10 + 2;
+
+    // the temperature is measured while the output settles, so it is filled in and the settling is no longer
+    // than SWEEP_SETTLE_MS (the first point starts on the wake up after it, within a transfer or two)
+    passed = passed && engine.temp == SIM_TEMPERATURE && engine.settleUs >= SWEEP_SETTLE_MS * 1000 &&
+             engine.settleUs <= SWEEP_SETTLE_MS * 1000 + SETTLE_SLACK_US;
+
+    if (!passed)
+    {
+      printf("%-22s FAILED\n", m_plans[i].name);
+      failed += 1;
+    }
+  }
+
+  if (failed > 0)
+  {
+    printf("%u plans failed\n", failed);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ *  responsivenessBench.c
+ *
+ *  Checks that the main loop stays responsive while a sweep runs. A repeated app_timer stands in for
+ *  USB commands arriving every COMMAND_PERIOD_MS, and the time each waits before the main loop serves
+ *  it is measured, once with the sweep engine polled from the main loop like main.c does, and once
+ *  with the blocking AD5933_Sweep, which holds the main loop until the sweep is done. Exits with 1 if
+ *  a sweep fails or a command waits longer than MAX_LATENCY_US with the engine.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AD5933.h"
+#include "twiManager.h"
+
+#define COMMAND_PERIOD_MS 10   // a command arrives this often
+// longest a command may wait with the engine. A command that arrives while the driver sleeps on a transfer
+// inside AD5933_SweepPoll is only seen at the next wakeup, which is at most one command later
+#define MAX_LATENCY_US    (2 * COMMAND_PERIOD_MS * 1000)
+#define MAX_COMMANDS      65536
+#define MAX_POINTS        512  // most points of a sweep
+
+APP_TIMER_DEF(m_command_timer);
+
+static uint64_t m_arrivals[MAX_COMMANDS]; // simulated time each command arrived
+static uint32_t m_arrived;                // number of commands arrived
+static uint32_t m_served;                 // number of commands served
+
+// latency of the commands served
+typedef struct latencyStats
+{
+  uint32_t commands;
+  uint64_t maxUs;
+  uint64_t totalUs;
+} latencyStats;
+
+// A command arrives
+static void responsivenessBench_commandHandler(void * p_context)
+{
+  UNUSED_PARAMETER(p_context);
+
+  if (m_arrived < MAX_COMMANDS) m_arrivals[m_arrived++] = twiSim_micros();
+}
+
+// Serves every command that has arrived and adds the time they waited to stats
+static void responsivenessBench_serve(latencyStats * stats)
+{
+  uint64_t now = twiSim_micros();
+
+  for (; m_served < m_arrived; m_served++)
+  {
+    uint64_t latency = now - m_arrivals[m_served];
+
+    stats->commands += 1;
+    stats->totalUs += latency;
+    if (latency > stats->maxUs) stats->maxUs = latency;
+  }
+}
+
+// Sets up the simulator, the driver and the command timer and fills in the default sweep of main.c
+static void responsivenessBench_init(Sweep * sweep)
+{
+  twiSim_init(NULL);
+  AD5933_Init();
+  twiManager_init();
+
+  m_arrived = 0;
+  m_served = 0;
+  app_timer_create(&m_command_timer, APP_TIMER_MODE_REPEATED, responsivenessBench_commandHandler);
+
+  memset(sweep, 0, sizeof(Sweep));
+  sweep->start            = 1000;
+  sweep->delta            = 100;
+  sweep->steps            = 490;
+  sweep->cycles           = 511;
+  sweep->cyclesMultiplier = TIMES4;
+  sweep->range            = RANGE1;
+  sweep->clockSource      = INTERN_CLOCK;
+  sweep->clockFrequency   = CLK_FREQ;
+  sweep->gain             = GAIN1;
+  sweep->repeats          = 1;
+  sweep->average          = AVERAGE_MEAN;
+  sweep->metadata.numPoints = sweep->steps + 1;
+}
+
+int main(void)
+{
+  static uint32_t freq[MAX_POINTS];
+  static uint16_t real[MAX_POINTS];
+  static uint16_t imag[MAX_POINTS];
+  SweepEngine engine;
+  Sweep sweep;
+  latencyStats polled = {0};
+  latencyStats blocking = {0};
+  uint64_t start;
+  uint64_t polledUs;
+  uint64_t blockingUs;
+  uint32_t loops = 0;
+  bool success = true;
+
+  // the engine, polled from the main loop
+  responsivenessBench_init(&sweep);
+  start = twiSim_micros();
+  app_timer_start(m_command_timer, APP_TIMER_TICKS(COMMAND_PERIOD_MS), NULL);
+
+  if (!AD5933_SweepBegin(&engine, &sweep, freq, real, imag)) success = false;
+
+  while (success && AD5933_SweepRunning(&engine))
+  {
+    responsivenessBench_serve(&polled);
+    loops += 1;
+
+    if (AD5933_SweepPoll(&engine) >= SWEEP_COMPLETE)
+    {
+      success = AD5933_SweepComplete(&engine);
+      break;
+    }
+
+    __WFE();
+  }
+
+  responsivenessBench_serve(&polled);
+  app_timer_stop(m_command_timer);
+  polledUs = twiSim_micros() - start;
+
+  // the blocking sweep, the main loop only gets to the commands once it returns
+  responsivenessBench_init(&sweep);
+  start = twiSim_micros();
+  app_timer_start(m_command_timer, APP_TIMER_TICKS(COMMAND_PERIOD_MS), NULL);
+
+  if (!AD5933_Sweep(&sweep, freq, real, imag)) success = false;
+
+  responsivenessBench_serve(&blocking);
+  app_timer_stop(m_command_timer);
+  blockingUs = twiSim_micros() - start;
+
+  printf("491 point sweep, a command every %d ms\n", COMMAND_PERIOD_MS);
+  printf("%-10s %9s %9s %13s %13s %11s\n", "sweep", "wall s", "commands", "mean wait ms", "max wait ms", "main loops");
+  printf("%-10s %9.3f %9u %13.3f %13.3f %11u\n", "engine", polledUs / 1e6, polled.commands,
+         polled.commands ? polled.totalUs / 1e3 / polled.commands : 0.0, polled.maxUs / 1e3, loops);
+  printf("%-10s %9.3f %9u %13.3f %13.3f %11u\n", "blocking", blockingUs / 1e6, blocking.commands,
+         blocking.commands ? blocking.totalUs / 1e3 / blocking.commands : 0.0, blocking.maxUs / 1e3, 1);
+
+  if (!success)
+  {
+    printf("sweep failed\n");
+    return 1;
+  }
+
+  if (polled.maxUs > MAX_LATENCY_US)
+  {
+    printf("a command waited longer than %d us\n", MAX_LATENCY_US);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ *  shadowTest.c
+ *
+ *  Checks the shadow registers of AD5933.c on the simulated bus. Sweeps are run back to back: the
+ *  first writes every configuration register, an identical one skips the START, DELTA, STEPS and
+ *  CYCLES writes (TwiStats.skippedWrites), and a sweep with one field changed writes only that
+ *  register, which must then hold the new value in the AD5933 model. Forgetting the shadow with
+ *  AD5933_InvalidateShadow makes the next sweep write everything again. Exits with 1 on a failure.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "AD5933.h"
+#include "twiManager.h"
+
+#define TEST_STEPS     20
+#define CONFIG_WRITES  4 // START, DELTA, STEPS and CYCLES
+#define CONTROL2_SKIPS 4 // CONTROL2 writes of STANDBY, INIT_START_FREQ, START_SWEEP and POWER_DOWN
+#define RESET_WRITES   2 // of those, written after a reset: STANDBY with the reset bit and INIT_START_FREQ
+
+// a sweep to run and what its setup writes should do
+typedef struct shadowStep
+{
+  char const * name;
+  uint32_t start;       // start frequency in Hz
+  uint32_t delta;       // frequency increment in Hz
+  uint16_t cycles;      // settling cycles
+  bool invalidate;      // AD5933_InvalidateShadow before the sweep
+  bool reset;           // the shadow does not show the AD5933 idle, so the sweep resets it
+  uint8_t skipped;      // START, DELTA, STEPS and CYCLES writes that should be skipped
+} shadowStep;
+
+// run in order, each compared to the sweep before it
+static shadowStep const m_steps[] =
+{
+  // name                   start  delta  cycles invalidate reset  skipped
+  {"first sweep",           10000,   100,   15,  false,     true,  0},
+  {"identical",             10000,   100,   15,  false,     false, CONFIG_WRITES},
+  {"identical again",       10000,   100,   15,  false,     false, CONFIG_WRITES},
+  {"start changed",         12000,   100,   15,  false,     false, CONFIG_WRITES - 1},
+  {"delta changed",         12000,   200,   15,  false,     false, CONFIG_WRITES - 1},
+  {"cycles changed",        12000,   200,   30,  false,     false, CONFIG_WRITES - 1},
+  {"all but steps changed",  5000,    50,   60,  false,     false, 1},
+  {"shadow invalidated",     5000,    50,   60,  true,      true,  0},
+};
+
+// Reads a big endian register of the AD5933 model
+static uint32_t shadowTest_reg(uint8_t reg, uint8_t numbytes)
+{
+  uint32_t value = 0;
+
+  for (uint8_t i = 0; i < numbytes; i++) value = (value << 8) | twiSim_device()->regs[reg - SIM_REG_BASE + i];
+
+  return value;
+}
+
+int main(void)
+{
+  static uint32_t freq[TEST_STEPS + 1];
+  static uint16_t real[TEST_STEPS + 1];
+  static uint16_t imag[TEST_STEPS + 1];
+  uint32_t failed = 0;
+
+  twiSim_init(NULL);
+  if (!AD5933_Init() || !twiManager_init())
+  {
+    printf("init FAILED\n");
+    return 1;
+  }
+
+  printf("%-22s %7s %7s %8s\n", "sweep", "xfers", "skipped", "expected");
+
+  for (uint32_t i = 0; i < sizeof(m_steps) / sizeof(m_steps[0]); i++)
+  {
+    shadowStep const * step = &m_steps[i];
+    Sweep sweep;
+    TwiStats stats;
+    twiSimStats simStats;
+
+    memset(&sweep, 0, sizeof(sweep));
+    sweep.start            = step->start;
+    sweep.delta            = step->delta;
+    sweep.steps            = TEST_STEPS;
+    sweep.cycles           = step->cycles;
+    sweep.cyclesMultiplier = NO_MULT;
+    sweep.range            = RANGE1;
+    sweep.clockSource      = INTERN_CLOCK;
+    sweep.clockFrequency   = CLK_FREQ;
+    sweep.gain             = GAIN1;
+    sweep.repeats          = 1;
+    sweep.average          = AVERAGE_MEAN;
+
+    if (step->invalidate) AD5933_InvalidateShadow();
+
+    twiSim_resetStats();
+    bool success = AD5933_Sweep(&sweep, freq, real, imag) && sweep.metadata.numPoints == TEST_STEPS + 1;
+    AD5933_GetTwiStats(&stats);
+    twiSim_getStats(&simStats);
+
+    // leave out the skipped CONTROL2 writes, the clock source never changes so only a reset writes any
+    uint32_t skipped = stats.skippedWrites - CONTROL2_SKIPS + (step->reset ? RESET_WRITES : 0);
+
+    // whatever was skipped or written, the AD5933 must hold this sweep
+    success = success && skipped == step->skipped &&
+              shadowTest_reg(START_FREQ_REG, 3) == AD5933_FreqCode(step->start, CLK_FREQ) &&
+              shadowTest_reg(DELTA_FREQ_REG, 3) == AD5933_FreqCode(step->delta, CLK_FREQ) &&
+              shadowTest_reg(NUM_STEPS_REG, 2) == TEST_STEPS &&
+              (shadowTest_reg(NUM_CYCLES_REG, 2) & 0x1FF) == step->cycles;
+
+    if (!success) failed += 1;
+
+    printf("%-22s %7u %7u %8u%s\n", step->name, simStats.transactions, skipped, step->skipped,
+           success ? "" : "  FAILED");
+  }
+
+  if (failed > 0)
+  {
+    printf("%u sweeps failed\n", failed);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ *  sweepBench.c
+ *
+ *  Runs AD5933_Sweep on the simulated bus for a set of Sweep configurations and prints the wall time,
+ *  bus time and traffic of each, so the driver can be benchmarked and checked without a dev board.
+ *  Built and run by the Makefile in this folder (make bench, make check). Exits with 1 if any sweep, the
+ *  ones with injected faults included, fails, measures the wrong number of points or does not finish.
+ *  Each sweep runs in its own process, so the simulator, the driver and the PPI backend start from reset
+ *  like on a board that just booted.
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "AD5933.h"
+#include "twiManager.h"
+
+// 300 ohm in series with 2 nF, small enough at the top of the sweep to saturate the DFT at RANGE1 and GAIN1
+static void rcLoad(uint32_t freq, double * real, double * imag)
+{
+  *real = 300;
+  *imag = -1 / (2 * M_PI * freq * 2e-9);
+}
+
+// a Sweep configuration to run and the simulator set up to run it on
+typedef struct benchCase
+{
+  char const * name;
+  uint32_t start;           // start frequency in Hz
+  uint32_t delta;           // frequency increment in Hz
+  uint16_t steps;           // number of increments
+  uint16_t cycles;          // settling cycles
+  uint8_t multiplier;       // settling cycles multiplier (NO_MULT, TIMES2, TIMES4)
+  uint8_t repeats;          // measurements averaged at each point
+  uint8_t average;          // how the repeats are averaged (AVERAGE_)
+  bool autoRange;           // pick the range and gain of each point
+  bool fastPath;            // AD5933_SetFastPath
+  uint32_t faultEvery;      // NACK every faultEvery transfers, 0 for none
+  uint32_t hangEvery;       // hang every hangEvery transfers, 0 for none
+  uint32_t stuckEvery;      // hold SDA low every stuckEvery transfers, 0 for never
+  uint32_t maxBusFrequency; // fastest clock the bus works at, 0 for the default
+  double noise;             // peak noise added to the codes
+  twiSim_load_t load;       // impedance of the load, NULL for the 10 kOhm resistor
+  double maxZError;         // largest mean |Z| error allowed (fraction) with no saturated points, 0 for unchecked
+} benchCase;
+
+// the configurations, the first is the default sweep of main.c
+static benchCase const m_cases[] =
+{
+  // name                      start  delta  steps cycles multiplier repeats average          auto   fast   fault hang stuck maxBus  noise  load       max Z err
+  {"default 1-50 kHz 511x4",    1000,   100,  490,  511,  TIMES4,    1,      AVERAGE_MEAN,    false, true,  0,    0,   0,    0,      0,     NULL,      0},
+  {"default, register path",    1000,   100,  490,  511,  TIMES4,    1,      AVERAGE_MEAN,    false, false, 0,    0,   0,    0,      0,     NULL,      0},
+  {"50-100 kHz 15 cycles",     50000,   100,  500,   15,  NO_MULT,   1,      AVERAGE_MEAN,    false, true,  0,    0,   0,    0,      0,     NULL,      0},
+  {"10-60 kHz 100 cycles",     10000,   100,  500,  100,  NO_MULT,   1,      AVERAGE_MEAN,    false, true,  0,    0,   0,    0,      0,     NULL,      0},
+  {"1-2 kHz 511x4",             1000,    10,  100,  511,  TIMES4,    1,      AVERAGE_MEAN,    false, true,  0,    0,   0,    0,      0,     NULL,      0},
+  {"4 repeats, mean",          10000,   100,  100,   15,  NO_MULT,   4,      AVERAGE_MEAN,    false, true,  0,    0,   0,    0,      50,    NULL,      0},
+  {"8 repeats, median",        10000,   100,  100,   15,  NO_MULT,   8,      AVERAGE_MEDIAN,  false, true,  0,    0,   0,    0,      50,    NULL,      0},
+  {"8 repeats, trimmed",       10000,   100,  100,   15,  NO_MULT,   8,      AVERAGE_TRIMMED, false, true,  0,    0,   0,    0,      50,    NULL,      0},
+  {"auto range",               10000,   100,  100,   15,  NO_MULT,   1,      AVERAGE_MEAN,    true,  true,  0,    0,   0,    0,      0,     NULL,      0},
+  {"NACK every 51 transfers",  10000,   100,  100,   15,  NO_MULT,   1,      AVERAGE_MEAN,    false, true,  51,   0,   0,    0,      0,     NULL,      0},
+  {"hang every 300 transfers", 10000,   100,  100,   15,  NO_MULT,   1,      AVERAGE_MEAN,    false, true,  0,    300, 0,    0,      0,     NULL,      0},
+  {"SDA stuck every 500",      10000,   100,  100,   15,  NO_MULT,   1,      AVERAGE_MEAN,    false, true,  0,    0,   500,  0,      0,     NULL,      0},
+  {"NACK every 23, 4 repeats", 10000,   100,  100,   15,  NO_MULT,   4,      AVERAGE_MEAN,    false, true,  23,   0,   0,    0,      0,     NULL,      0},
+  {"hang every 23, auto range",10000,   100,  100,   15,  NO_MULT,   1,      AVERAGE_MEAN,    true,  true,  0,    23,  0,    0,      0,     NULL,      0},
+  {"SDA stuck every 29",       10000,   100,  100,   15,  NO_MULT,   1,      AVERAGE_MEAN,    false, true,  0,    0,   29,   0,      0,     NULL,      0},
+  {"bus limited to 100 kHz",   10000,   100,  100,   15,  NO_MULT,   1,      AVERAGE_MEAN,    false, true,  0,    0,   0,    100000, 0,     NULL,      0},
+  {"RC load, fixed range",      1000,   200,  495,   15,  NO_MULT,   1,      AVERAGE_MEAN,    false, true,  0,    0,   0,    0,      20,    rcLoad,    0},
+  {"RC load, auto range",       1000,   200,  495,   15,  NO_MULT,   1,      AVERAGE_MEAN,    true,  true,  0,    0,   0,    0,      20,    rcLoad,    0.005},
+};
+
+// Runs one configuration on a freshly initialized simulator and driver, in the process it is called from
+// Arguments:
+//  * bench  - the configuration
+//  backend  - AD5933_BACKEND_CPU or AD5933_BACKEND_PPI
+//  * report - pointer to store the result of the sweep
+// Return value:
+//  false if the sweep failed or measured the wrong number of points
+//  true  if success
+static bool sweepBench_run(benchCase const * bench, uint8_t backend, twiSimReport * report)
+{
+  twiSimConfig config;
+  Sweep sweep;
+
+  memset(report, 0, sizeof(twiSimReport));
+
+  twiSim_defaultConfig(&config);
+  config.faultEvery = bench->faultEvery;
+  config.hangEvery  = bench->hangEvery;
+  config.stuckEvery = bench->stuckEvery;
+  config.noise      = bench->noise;
+  config.load       = bench->load;
+  if (bench->maxBusFrequency != 0) config.maxBusFrequency = bench->maxBusFrequency;
+
+  twiSim_init(&config);
+  if (!AD5933_Init() || !twiManager_init() || !AD5933_SetBackend(backend)) return false;
+  AD5933_SetFastPath(bench->fastPath);
+
+  memset(&sweep, 0, sizeof(sweep));
+  sweep.start            = bench->start;
+  sweep.delta            = bench->delta;
+  sweep.steps            = bench->steps;
+  sweep.cycles           = bench->cycles;
+  sweep.cyclesMultiplier = bench->multiplier;
+  sweep.range            = RANGE1;
+  sweep.clockSource      = INTERN_CLOCK;
+  sweep.clockFrequency   = CLK_FREQ;
+  sweep.gain             = GAIN1;
+  sweep.repeats          = bench->repeats;
+  sweep.average          = bench->average;
+  sweep.autoRange        = bench->autoRange;
+  sweep.metadata.numPoints = sweep.steps + 1;
+
+  if (!twiSim_runSweep(&sweep, report) || report->points != (uint32_t) bench->steps + 1) return false;
+
+  return bench->maxZError == 0 || (report->saturated == 0 && report->zError <= bench->maxZError);
+}
+
+// Runs one configuration with sweepBench_run in a child process
+// Arguments:
+//  * bench  - the configuration
+//  backend  - AD5933_BACKEND_CPU or AD5933_BACKEND_PPI
+//  * report - pointer to store the result of the sweep
+// Return value:
+//  false if the sweep failed, measured the wrong number of points or the child did not finish
+//  true  if success
+static bool sweepBench_fork(benchCase const * bench, uint8_t backend, twiSimReport * report)
+{
+  int fds[2];
+  int status;
+  pid_t pid;
+
+  memset(report, 0, sizeof(twiSimReport));
+
+  if (pipe(fds) != 0) return false;
+
+  pid = fork();
+  if (pid < 0) return false;
+
+  if (pid == 0)
+  {
+    close(fds[0]);
+    bool success = sweepBench_run(bench, backend, report);
+    _exit(write(fds[1], report, sizeof(twiSimReport)) == sizeof(twiSimReport) && success ? 0 : 1);
+  }
+
+  close(fds[1]);
+  bool got = read(fds[0], report, sizeof(twiSimReport)) == sizeof(twiSimReport);
+  close(fds[0]);
+
+  return waitpid(pid, &status, 0) == pid && got && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(void)
+{
+  uint8_t backends[] = {AD5933_BACKEND_CPU, AD5933_BACKEND_PPI};
+  uint32_t failed = 0;
+
+  printf("%-26s %-4s %5s %9s %8s %7s %7s %6s %6s %6s %7s %6s %5s %7s\n", "sweep", "poll", "pts", "wall s", "bus s",
+         "xfers", "bytes", "faults", "hangs", "stuck", "wakeups", "sleep%", "sat", "|Z|err%");
+
+  for (uint8_t b = 0; b < sizeof(backends); b++)
+  {
+#ifndef AD5933_PPI_POLL
+    // the PPI backend is only built with AD5933_PPI_POLL (make sweepBenchPpi)
+    if (backends[b] == AD5933_BACKEND_PPI) continue;
+#endif
+
+    for (uint32_t i = 0; i < sizeof(m_cases) / sizeof(m_cases[0]); i++)
+    {
+      twiSimReport report;
+      bool success = sweepBench_fork(&m_cases[i], backends[b], &report);
+
+      if (!success) failed += 1;
+
+      printf("%-26s %-4s %5u %9.3f %8.3f %7u %7u %6u %6u %6u %7u %6.1f %5u %7.3f%s\n", m_cases[i].name,
+             backends[b] == AD5933_BACKEND_PPI ? "ppi" : "cpu", report.points, report.wallTimeUs / 1e6,
+             report.stats.busTimeUs / 1e6, report.stats.transactions, report.stats.bytes, report.stats.faults,
+             report.stats.hangs, report.stats.stuck, report.stats.wakeups,
+             report.wallTimeUs ? 100.0 * report.stats.sleepUs / report.wallTimeUs : 0.0, report.saturated,
+             100 * report.zError, success ? "" : "  FAILED");
+    }
+  }
+
+  if (failed > 0)
+  {
+    printf("%u sweeps failed\n", failed);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ *  sweepMultiBench.c
+ *
+ *  Runs the same sweep on 1 to 8 simulated AD5933s behind a TCA9548A mux with sweepMulti_run and prints
+ *  the wall time, bus traffic and aggregate throughput of each against the single channel. Each AD5933
+ *  measures its own resistor. Each run is repeated to check every AD5933 kept its shadow registers, so the
+ *  repeat skips the reset and the setup writes on every channel. Exits with 1 if a channel fails, measures
+ *  the wrong number of points, a frequency or impedance is off, a repeat does not skip the writes, or
+ *  several channels do not measure more points a second than one.
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "AD5933.h"
+#include "twiManager.h"
+#include "sweepMulti.h"
+
+#define BENCH_START  10000 // sweep of each channel, 10-20 kHz at 100 settling cycles
+#define BENCH_DELTA  100
+#define BENCH_STEPS  100
+#define BENCH_CYCLES 100
+#define MAX_Z_ERROR  0.01  // largest relative impedance error of a point
+#define SKIPPED_XFERS 8    // fewest transfers each AD5933 should save when the same sweep runs again
+
+// points of each channel
+static uint32_t m_freq[MUX_CHANNELS][BENCH_STEPS + 1];
+static uint16_t m_real[MUX_CHANNELS][BENCH_STEPS + 1];
+static uint16_t m_imag[MUX_CHANNELS][BENCH_STEPS + 1];
+
+// Returns the resistor the AD5933 on a mux channel measures
+static double sweepMultiBench_resistance(uint8_t channel)
+{
+  return 5000.0 * (channel + 1);
+}
+
+// Converts a data register as stored by the engine (big endian) to its code
+static int16_t sweepMultiBench_code(uint16_t const * data)
+{
+  uint8_t const * bytes = (uint8_t const *) data;
+
+  return (int16_t) ((bytes[0] << 8) | bytes[1]);
+}
+
+// Checks the points of a channel against its sweep and resistor
+// Arguments:
+//  channel     - the mux channel
+//  * sweep     - the sweep it ran
+//  gainFactor  - the gain factor of the simulator
+// Return value:
+//  false if a point is missing, at the wrong frequency or measured the wrong impedance
+//  true  if all points are right
+static bool sweepMultiBench_check(uint8_t channel, Sweep const * sweep, double gainFactor)
+{
+  double resistance = sweepMultiBench_resistance(channel);
+
+  if (sweep->metadata.numPoints != BENCH_STEPS + 1) return false;
+
+  for (uint16_t i = 0; i <= BENCH_STEPS; i++)
+  {
+    double magnitude = hypot(sweepMultiBench_code(&m_real[channel][i]), sweepMultiBench_code(&m_imag[channel][i]));
+
+    if (m_freq[channel][i] != BENCH_START + (uint32_t) i * BENCH_DELTA) return false;
+    if (magnitude == 0 || fabs(1 / (gainFactor * magnitude) - resistance) > MAX_Z_ERROR * resistance) return false;
+  }
+
+  return true;
+}
+
+// Runs the sweep on the first channels of a mux, then runs it again
+// Arguments:
+//  channels             - number of AD5933s
+//  * report             - pointer to store the wall time and bus statistics of the first run, points has the
+//                         points of all channels
+//  * againTransactions  - pointer to store the number of transfers of the second run
+// Return value:
+//  false if a channel failed, measured the wrong points or the second run did not skip the setup writes
+//  true  if success
+static bool sweepMultiBench_run(uint8_t channels, twiSimReport * report, uint32_t * againTransactions)
+{
+  twiSimConfig config;
+  twiSimStats stats;
+  SweepMultiRunner runner;
+  Sweep sweeps[MUX_CHANNELS];
+  bool success = true;
+
+  memset(report, 0, sizeof(twiSimReport));
+
+  twiSim_defaultConfig(&config);
+  config.muxChannels = channels;
+  for (uint8_t i = 0; i < channels; i++) config.channelResistance[i] = sweepMultiBench_resistance(i);
+
+  twiSim_init(&config);
+  if (!AD5933_Init()) return false;
+  AD5933_UseMux(true);
+  if (!twiManager_init()) return false;
+
+  sweepMulti_init(&runner);
+
+  for (uint8_t i = 0; i < channels; i++)
+  {
+    memset(&sweeps[i], 0, sizeof(Sweep));
+    sweeps[i].start            = BENCH_START;
+    sweeps[i].delta            = BENCH_DELTA;
+    sweeps[i].steps            = BENCH_STEPS;
+    sweeps[i].cycles           = BENCH_CYCLES;
+    sweeps[i].cyclesMultiplier = NO_MULT;
+    sweeps[i].range            = RANGE1;
+    sweeps[i].clockSource      = INTERN_CLOCK;
+    sweeps[i].clockFrequency   = CLK_FREQ;
+    sweeps[i].gain             = GAIN1;
+    sweeps[i].repeats          = 1;
+    sweeps[i].average          = AVERAGE_MEAN;
+
+    if (!sweepMulti_addChannel(&runner, i, &sweeps[i], m_freq[i], m_real[i], m_imag[i])) return false;
+  }
+
+  twiSim_resetStats();
+  uint64_t start = twiSim_micros();
+
+  report->success = sweepMulti_run(&runner);
+  report->wallTimeUs = twiSim_micros() - start;
+  twiSim_getStats(&report->stats);
+
+  for (uint8_t i = 0; i < channels; i++)
+  {
+    report->points += sweeps[i].metadata.numPoints;
+    if (!sweepMultiBench_check(i, &sweeps[i], config.gainFactor)) success = false;
+  }
+
+  // the same sweeps again, every AD5933 kept its registers so none is reset and the setup writes are skipped
+  twiSim_resetStats();
+  success = sweepMulti_run(&runner) && success;
+  twiSim_getStats(&stats);
+  *againTransactions = stats.transactions;
+
+  if (report->stats.transactions < stats.transactions + SKIPPED_XFERS * channels) success = false;
+
+  return report->success && success;
+}
+
+int main(void)
+{
+  twiSimReport single;
+  uint32_t failed = 0;
+
+  printf("%-8s %6s %9s %8s %7s %7s %7s %9s %7s %8s\n", "channels", "pts", "wall s", "bus s", "xfers", "again",
+         "muxes", "pts/s", "vs 1", "sleep%");
+
+  for (uint8_t channels = 1; channels <= MUX_CHANNELS; channels++)
+  {
+    twiSimReport report;
+    uint32_t again;
+    bool success = sweepMultiBench_run(channels, &report, &again);
+    double throughput = report.wallTimeUs ? report.points * 1e6 / report.wallTimeUs : 0;
+
+    if (channels == 1) single = report;
+    double singleThroughput = single.wallTimeUs ? single.points * 1e6 / single.wallTimeUs : 0;
+    double ratio = singleThroughput > 0 ? throughput / singleThroughput : 0;
+
+    // every AD5933 settles and measures on its own, so each channel added should add points a second
+    if (channels > 1 && ratio <= 1) success = false;
+    if (!success) failed += 1;
+
+    printf("%-8u %6u %9.3f %8.3f %7u %7u %7u %9.1f %6.2fx %7.1f%s\n", channels, report.points,
+           report.wallTimeUs / 1e6, report.stats.busTimeUs / 1e6, report.stats.transactions, again,
+           report.stats.muxWrites, throughput, ratio,
+           report.wallTimeUs ? 100.0 * report.stats.sleepUs / report.wallTimeUs : 0.0, success ? "" : "  FAILED");
+  }
+
+  if (failed > 0)
+  {
+    printf("%u runs failed\n", failed);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,1100 @@
+/*
+ *  twiSim.c
+ *
+ *  Host stand-in for the TWI driver, app_timer and nrf_delay used by AD5933.c.
+ *  Transfers are decoded by a register and timing model of the AD5933 so the driver can be
+ *  run and benchmarked without a dev board. Time only moves when the bus is used, when the
+ *  CPU sleeps in __WFE, spins on a transfer or when nrf_delay_ms is called.
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "AD5933.h"
+
+// --- Simulator state ---
+
+static twiSimConfig m_config;
+static twiSimStats m_stats;
+static twiSimDevice m_devices[SIM_MAX_DEVICES]; // the AD5933s, only the first without a mux
+static uint8_t m_mux;     // control register of the mux, bit n connects channel n
+static uint64_t m_now;    // simulated time in us
+static uint32_t m_random; // state of the noise generator
+
+static bool m_xfer_pending; // a transfer is on the bus
+static bool m_xfer_error;   // the transfer on the bus will be NACKed
+static nrf_drv_twi_xfer_type_t m_xfer_type; // direction of the transfer on the bus
+static bool m_sda_stuck;    // the AD5933 is holding SDA low
+static uint32_t m_bus_frequency; // TWI clock in Hz
+static nrf_drv_twi_evt_handler_t m_handler; // event handler given to nrf_drv_twi_init
+
+static nrf_drv_twi_xfer_desc_t m_held;   // transfer waiting for its start task
+static bool m_held_valid;
+
+static bool m_timer_running;             // the TIMER is counting
+static bool m_timer_compared;            // COMPARE0 event of the TIMER
+static uint64_t m_timer_start;           // simulated time the TIMER was started (us)
+static uint32_t m_timer_cc;              // compare value of channel 0 (ticks)
+static uint32_t m_timer_shorts;          // shorts of the TIMER
+static nrf_timer_frequency_t m_timer_frequency;
+
+static uint32_t m_ppi_eep[SIM_PPI_CHANNELS]; // event end point of each PPI channel
+static uint32_t m_ppi_tep[SIM_PPI_CHANNELS]; // task end point of each PPI channel
+static bool m_ppi_enabled[SIM_PPI_CHANNELS];
+static uint8_t m_ppi_allocated;
+static bool m_xfer_hung;    // the transfer on the bus will never finish
+static uint64_t m_xfer_end; // simulated time the transfer on the bus finishes
+
+static twiSimTimer * m_timers[SIM_MAX_TIMERS];
+static uint8_t m_num_timers = 0;
+
+static bool m_wake_pending;              // another peripheral model (the flash) will wake the CPU
+static uint64_t m_wake_time;             // simulated time it wakes the CPU
+static void (*m_wake_handler)(void);     // its interrupt handler
+
+static bool twiSim_transfer(uint8_t address, uint8_t numbytes, bool chained);
+static twiSimDevice * twiSim_target(void);
+static bool twiSim_answers(uint8_t address);
+static void twiSim_writeTo(uint8_t address, uint8_t const * data, uint8_t numbytes);
+static void twiSim_readFrom(uint8_t address, uint8_t * data, uint8_t numbytes);
+static void twiSim_startXfer(nrf_drv_twi_xfer_desc_t const * desc);
+static uint64_t twiSim_timerCompareTime(void);
+static void twiSim_timerCompare(void);
+static void twiSim_finishTransfer(void);
+static void twiSim_write(twiSimDevice * device, uint8_t const * data, uint8_t numbytes);
+static void twiSim_read(twiSimDevice * device, uint8_t * data, uint8_t numbytes);
+static uint8_t twiSim_readReg(twiSimDevice * device, uint8_t reg);
+static void twiSim_command(twiSimDevice * device, uint8_t control);
+static void twiSim_measure(twiSimDevice * device);
+static double twiSim_scale(uint8_t setting);
+static void twiSim_impedance(uint8_t channel, uint32_t freq, double * zReal, double * zImag);
+static uint32_t twiSim_frequency(twiSimDevice * device, uint8_t reg);
+static uint64_t twiSim_settleUs(twiSimDevice * device, uint32_t freq);
+static double twiSim_noise(void);
+
+// Fills config with a 100 kHz bus, the internal AD5933 clock and a 10 kOhm resistor
+// Arguments:
+//  * config - pointer to the configuration to fill
+void twiSim_defaultConfig(twiSimConfig * config)
+{
+  config->busFrequency   = 100000;
+  config->maxBusFrequency = 400000;
+  config->overheadUs     = 20;
+  config->mclk           = CLK_FREQ;
+  config->gainFactor     = 1e-8;
+  config->systemPhase    = 0;
+  config->systemPole     = 0;
+  config->loadResistance = 10000;
+  memset(config->channelResistance, 0, sizeof(config->channelResistance));
+  config->load           = NULL;
+  config->noise          = 0;
+  config->temperature    = 25;
+  config->faultEvery     = 0;
+  config->hangEvery      = 0;
+  config->stuckEvery     = 0;
+  config->muxChannels    = 0;
+}
+
+// Resets simulated time, the statistics and the AD5933 model
+// Arguments:
+//  * config - simulator configuration, NULL for twiSim_defaultConfig
+void twiSim_init(twiSimConfig const * config)
+{
+  if (config == NULL)
+  {
+    twiSim_defaultConfig(&m_config);
+  }
+  else
+  {
+    m_config = *config;
+  }
+
+  memset(m_devices, 0, sizeof(m_devices));
+  for (uint8_t i = 0; i < SIM_MAX_DEVICES; i++)
+  {
+    m_devices[i].command = POWER_DOWN;
+    m_devices[i].channel = i;
+  }
+
+  // the mux powers up with every channel off
+  m_mux = 0;
+
+  m_now = 0;
+  m_random = 1;
+  m_num_timers = 0;
+  m_xfer_done = false;
+  m_xfer_pending = false;
+  m_xfer_hung = false;
+  m_sda_stuck = false;
+  m_bus_frequency = m_config.busFrequency;
+  m_handler = NULL;
+  m_held_valid = false;
+  m_timer_running = false;
+  m_timer_compared = false;
+  m_ppi_allocated = 0;
+  memset(m_ppi_enabled, 0, sizeof(m_ppi_enabled));
+  twi_error = false;
+  m_wake_pending = false;
+
+  twiSim_resetStats();
+}
+
+// Returns the simulated time in us
+uint64_t twiSim_micros(void)
+{
+  return m_now;
+}
+
+// Moves simulated time forward without running timers (the CPU is busy)
+// Arguments:
+//  us - number of us to move forward
+void twiSim_advance(uint64_t us)
+{
+  m_now += us;
+}
+
+// Has another peripheral model wake the CPU at a given time and run its handler, replacing the wakeup set before
+// Arguments:
+//  time      - simulated time to wake the CPU (us)
+//  * handler - the interrupt handler of the peripheral, NULL to cancel the wakeup
+void twiSim_setWakeup(uint64_t time, void (*handler)(void))
+{
+  m_wake_pending = (handler != NULL);
+  m_wake_time = time;
+  m_wake_handler = handler;
+}
+
+// Sleeps the CPU until the transfer on the bus finishes or the next timer expires and runs its handler,
+// like __WFE on the nRF52. If nothing is running nothing would wake the CPU, so it returns without moving time
+void twiSim_waitForEvent(void)
+{
+  twiSimTimer * next = NULL;
+
+  m_stats.wakeups += 1;
+
+  // a TIMER compare without an interrupt does not wake the CPU, it only starts what PPI connects to it
+  while (m_timer_running)
+  {
+    uint64_t compare = twiSim_timerCompareTime();
+    bool first = !(m_xfer_pending && !m_xfer_hung && m_xfer_end <= compare) && !(m_wake_pending && m_wake_time <= compare);
+
+    for (uint8_t i = 0; i < m_num_timers; i++)
+    {
+      if (m_timers[i]->active && m_timers[i]->expires <= compare) first = false;
+    }
+
+    if (!first) break;
+
+    if (compare > m_now)
+    {
+      m_stats.sleepUs += compare - m_now;
+      m_now = compare;
+    }
+
+    twiSim_timerCompare();
+  }
+
+  // find the timer that expires first
+  for (uint8_t i = 0; i < m_num_timers; i++)
+  {
+    if (m_timers[i]->active && (next == NULL || m_timers[i]->expires < next->expires)) next = m_timers[i];
+  }
+
+  // the interrupt of another peripheral model
+  if (m_wake_pending && (next == NULL || m_wake_time < next->expires) && !(m_xfer_pending && !m_xfer_hung && m_xfer_end <= m_wake_time))
+  {
+    if (m_wake_time > m_now)
+    {
+      m_stats.sleepUs += m_wake_time - m_now;
+      m_now = m_wake_time;
+    }
+
+    m_wake_pending = false;
+    m_wake_handler();
+    return;
+  }
+
+  // the TWI interrupt wakes the CPU when the transfer finishes
+  if (m_xfer_pending && !m_xfer_hung && (next == NULL || m_xfer_end < next->expires))
+  {
+    if (m_xfer_end > m_now)
+    {
+      m_stats.sleepUs += m_xfer_end - m_now;
+      m_now = m_xfer_end;
+    }
+
+    twiSim_finishTransfer();
+    return;
+  }
+
+  if (next == NULL) return;
+
+  if (next->expires > m_now)
+  {
+    m_stats.sleepUs += next->expires - m_now;
+    m_now = next->expires;
+  }
+
+  // run the handlers of every timer that has expired
+  for (uint8_t i = 0; i < m_num_timers; i++)
+  {
+    twiSimTimer * timer = m_timers[i];
+
+    if (!timer->active || timer->expires > m_now) continue;
+
+    if (timer->mode == APP_TIMER_MODE_REPEATED)
+    {
+      timer->expires += timer->interval;
+    }
+    else
+    {
+      timer->active = false;
+    }
+
+    timer->handler(timer->p_context);
+  }
+}
+
+// Copies the statistics since the last twiSim_resetStats
+// Arguments:
+//  * stats - pointer to the struct to copy to
+void twiSim_getStats(twiSimStats * stats)
+{
+  *stats = m_stats;
+}
+
+// Clears the statistics
+void twiSim_resetStats(void)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+}
+
+// Returns the AD5933 model so benchmarks can inspect or preload registers (the AD5933 on mux channel 0)
+twiSimDevice * twiSim_device(void)
+{
+  return &m_devices[0];
+}
+
+// Returns the model of the AD5933 on a mux channel, NULL if the channel has none
+twiSimDevice * twiSim_channelDevice(uint8_t channel)
+{
+  if (channel >= SIM_MAX_DEVICES || channel >= m_config.muxChannels) return NULL;
+
+  return &m_devices[channel];
+}
+
+// Stand-in for APP_ERROR_CHECK, errors that would reset the nRF52 abort the simulation
+void twiSim_errorCheck(ret_code_t err_code, char const * file, int line)
+{
+  if (err_code == NRF_SUCCESS) return;
+
+  fprintf(stderr, "%s:%d: error 0x%x\n", file, line, (unsigned) err_code);
+  abort();
+}
+
+// Runs AD5933_Sweep on the simulated bus and reports how long it took and how the bus was used
+// Arguments:
+//  * sweep  - the sweep to run
+//  * report - pointer to the struct to store the results
+// Returns:
+//  what AD5933_Sweep returned
+bool twiSim_runSweep(Sweep * sweep, twiSimReport * report)
+{
+  uint32_t * freq = malloc(sizeof(uint32_t) * (sweep->steps + 1));
+  uint16_t * real = malloc(sizeof(uint16_t) * (sweep->steps + 1));
+  uint16_t * imag = malloc(sizeof(uint16_t) * (sweep->steps + 1));
+
+  twiSim_resetStats();
+  uint64_t start = m_now;
+
+  report->success    = AD5933_Sweep(sweep, freq, real, imag);
+  report->points     = sweep->metadata.numPoints;
+  report->wallTimeUs = m_now - start;
+  twiSim_getStats(&report->stats);
+
+  // compare |Z| of every point to the load, scaled back from the setting it was measured at
+  report->saturated = 0;
+  report->zError = 0;
+
+  for (uint32_t i = 0; i < report->points; i++)
+  {
+    uint8_t * bytes = (uint8_t *) &real[i];
+    int16_t re = (int16_t) ((bytes[0] << 8) | bytes[1]);
+    bytes = (uint8_t *) &imag[i];
+    int16_t im = (int16_t) ((bytes[0] << 8) | bytes[1]);
+
+    uint8_t setting = freq[i] >> POINT_SETTING_SHIFT;
+    if (!(setting & POINT_SETTING_USED)) setting = (sweep->range << 1) | sweep->gain;
+
+    double zReal, zImag;
+    twiSim_impedance(0, freq[i] & POINT_FREQ_MASK, &zReal, &zImag);
+
+    double z = twiSim_scale(setting) / (m_config.gainFactor * sqrt((double) re * re + (double) im * im));
+    report->zError += fabs(z / sqrt(zReal * zReal + zImag * zImag) - 1);
+
+    if (re == INT16_MAX || re == INT16_MIN || im == INT16_MAX || im == INT16_MIN) report->saturated += 1;
+  }
+
+  if (report->points > 0) report->zError /= report->points;
+
+  free(freq);
+  free(real);
+  free(imag);
+
+  return report->success;
+}
+
+// --- nRF SDK stand-ins ---
+
+// Stand-in for nrf_drv_twi_tx. Returns once the transfer is started, m_xfer_done and twi_error are set
+// the way twi_handler would on the nRF52 once the bus time has passed (see twiSim_finishTransfer)
+ret_code_t nrf_drv_twi_tx(nrf_drv_twi_t const * p_instance, uint8_t address, uint8_t const * p_data, uint8_t length, bool no_stop)
+{
+  UNUSED_PARAMETER(p_instance);
+  UNUSED_PARAMETER(no_stop);
+
+  if (m_xfer_pending) return NRF_ERROR_BUSY;
+
+  m_xfer_type = NRF_DRV_TWI_XFER_TX;
+  if (twiSim_transfer(address, length, false)) twiSim_writeTo(address, p_data, length);
+
+  return NRF_SUCCESS;
+}
+
+// Stand-in for nrf_drv_twi_rx
+ret_code_t nrf_drv_twi_rx(nrf_drv_twi_t const * p_instance, uint8_t address, uint8_t * p_data, uint8_t length)
+{
+  UNUSED_PARAMETER(p_instance);
+
+  if (m_xfer_pending) return NRF_ERROR_BUSY;
+
+  m_xfer_type = NRF_DRV_TWI_XFER_RX;
+  if (twiSim_transfer(address, length, false)) twiSim_readFrom(address, p_data, length);
+
+  return NRF_SUCCESS;
+}
+
+// Stand-in for nrf_drv_twi_xfer. TXRX and TXTX are two transfers joined by a repeated start,
+// with NRF_DRV_TWI_FLAG_HOLD_XFER the transfer waits for its start task (PPI)
+ret_code_t nrf_drv_twi_xfer(nrf_drv_twi_t const * p_instance, nrf_drv_twi_xfer_desc_t const * p_xfer_desc, uint32_t flags)
+{
+  UNUSED_PARAMETER(p_instance);
+
+  if (m_xfer_pending) return NRF_ERROR_BUSY;
+
+  if (flags & NRF_DRV_TWI_FLAG_HOLD_XFER)
+  {
+    m_held = *p_xfer_desc;
+    m_held_valid = true;
+    return NRF_SUCCESS;
+  }
+
+  // the CPU sets up the transfer
+  m_now += m_config.overheadUs;
+  twiSim_startXfer(p_xfer_desc);
+
+  return NRF_SUCCESS;
+}
+
+uint32_t nrf_drv_twi_start_task_get(nrf_drv_twi_t const * p_instance, nrf_drv_twi_xfer_type_t xfer_type)
+{
+  UNUSED_PARAMETER(p_instance);
+  UNUSED_PARAMETER(xfer_type);
+
+  return SIM_TWI_START_TASK;
+}
+
+uint32_t nrf_drv_twi_stopped_event_get(nrf_drv_twi_t const * p_instance)
+{
+  UNUSED_PARAMETER(p_instance);
+
+  return SIM_TWI_STOPPED_EVENT;
+}
+
+// Stand-in for nrf_drv_twi_init. Events go to event_handler like on the nRF52, benchmarks that never
+// call it get m_xfer_done and twi_error set directly. A bus clear releases a stuck SDA
+ret_code_t nrf_drv_twi_init(nrf_drv_twi_t const * p_instance, nrf_drv_twi_config_t const * p_config, nrf_drv_twi_evt_handler_t event_handler, void * p_context)
+{
+  UNUSED_PARAMETER(p_instance);
+  UNUSED_PARAMETER(p_context);
+
+  m_handler = event_handler;
+  m_bus_frequency = p_config->frequency;
+  m_stats.inits += 1;
+
+  // nine SCL pulses let the AD5933 finish the byte it is sending and release SDA
+  if (p_config->clear_bus_init)
+  {
+    m_stats.busClears += 1;
+    m_sda_stuck = false;
+  }
+
+  return NRF_SUCCESS;
+}
+
+// Stand-in for nrf_drv_twi_uninit, aborts the transfer on the bus
+void nrf_drv_twi_uninit(nrf_drv_twi_t const * p_instance)
+{
+  nrf_drv_twi_disable(p_instance);
+}
+
+// Stand-in for nrf_drv_twi_enable
+void nrf_drv_twi_enable(nrf_drv_twi_t const * p_instance)
+{
+  UNUSED_PARAMETER(p_instance);
+}
+
+// Stand-in for nrf_drv_twi_disable, aborts the transfer on the bus
+void nrf_drv_twi_disable(nrf_drv_twi_t const * p_instance)
+{
+  UNUSED_PARAMETER(p_instance);
+
+  if (m_xfer_pending) m_stats.aborts += 1;
+
+  m_xfer_pending = false;
+  m_xfer_hung = false;
+}
+
+ret_code_t nrf_drv_timer_init(nrf_drv_timer_t const * p_instance, nrf_drv_timer_config_t const * p_config, nrf_timer_event_handler_t timer_event_handler)
+{
+  UNUSED_PARAMETER(p_instance);
+  UNUSED_PARAMETER(timer_event_handler);
+
+  m_timer_frequency = p_config->frequency;
+  m_timer_running = false;
+
+  return NRF_SUCCESS;
+}
+
+void nrf_drv_timer_enable(nrf_drv_timer_t const * p_instance)
+{
+  UNUSED_PARAMETER(p_instance);
+
+  m_timer_running = true;
+  m_timer_start = m_now;
+}
+
+void nrf_drv_timer_disable(nrf_drv_timer_t const * p_instance)
+{
+  UNUSED_PARAMETER(p_instance);
+
+  m_timer_running = false;
+}
+
+void nrf_drv_timer_clear(nrf_drv_timer_t const * p_instance)
+{
+  UNUSED_PARAMETER(p_instance);
+
+  m_timer_start = m_now;
+}
+
+uint32_t nrf_drv_timer_us_to_ticks(nrf_drv_timer_t const * p_instance, uint32_t time_us)
+{
+  UNUSED_PARAMETER(p_instance);
+
+  return time_us * (16 >> m_timer_frequency);
+}
+
+void nrf_drv_timer_extended_compare(nrf_drv_timer_t const * p_instance, nrf_timer_cc_channel_t cc_channel, uint32_t cc_value, nrf_timer_short_mask_t timer_short_mask, bool enable_int)
+{
+  UNUSED_PARAMETER(p_instance);
+  UNUSED_PARAMETER(cc_channel);
+  UNUSED_PARAMETER(enable_int);
+
+  m_timer_cc = cc_value;
+  m_timer_shorts = timer_short_mask;
+  m_timer_compared = false;
+}
+
+uint32_t nrf_drv_timer_compare_event_address_get(nrf_drv_timer_t const * p_instance, uint32_t channel)
+{
+  UNUSED_PARAMETER(p_instance);
+  UNUSED_PARAMETER(channel);
+
+  return SIM_TIMER_COMPARE0_EVENT;
+}
+
+bool nrf_timer_event_check(void * p_reg, nrf_timer_event_t event)
+{
+  UNUSED_PARAMETER(p_reg);
+  UNUSED_PARAMETER(event);
+
+  return m_timer_compared;
+}
+
+void nrf_timer_event_clear(void * p_reg, nrf_timer_event_t event)
+{
+  UNUSED_PARAMETER(p_reg);
+  UNUSED_PARAMETER(event);
+
+  m_timer_compared = false;
+}
+
+ret_code_t nrf_drv_ppi_init(void)
+{
+  return NRF_SUCCESS;
+}
+
+ret_code_t nrf_drv_ppi_channel_alloc(nrf_ppi_channel_t * p_channel)
+{
+  if (m_ppi_allocated >= SIM_PPI_CHANNELS) return NRF_ERROR_BUSY;
+
+  *p_channel = m_ppi_allocated++;
+  return NRF_SUCCESS;
+}
+
+ret_code_t nrf_drv_ppi_channel_assign(nrf_ppi_channel_t channel, uint32_t eep, uint32_t tep)
+{
+  m_ppi_eep[channel] = eep;
+  m_ppi_tep[channel] = tep;
+  return NRF_SUCCESS;
+}
+
+ret_code_t nrf_drv_ppi_channel_enable(nrf_ppi_channel_t channel)
+{
+  m_ppi_enabled[channel] = true;
+  return NRF_SUCCESS;
+}
+
+ret_code_t nrf_drv_ppi_channel_disable(nrf_ppi_channel_t channel)
+{
+  m_ppi_enabled[channel] = false;
+  return NRF_SUCCESS;
+}
+
+// Stand-in for nrf_delay_ms, the CPU is busy for the whole delay
+void nrf_delay_ms(uint32_t ms)
+{
+  m_now += (uint64_t) ms * 1000;
+}
+
+ret_code_t app_timer_create(app_timer_id_t const * p_timer_id, app_timer_mode_t mode, app_timer_timeout_handler_t timeout_handler)
+{
+  twiSimTimer * timer = *p_timer_id;
+
+  timer->handler = timeout_handler;
+  timer->mode    = mode;
+  timer->active  = false;
+
+  // only register each timer once
+  for (uint8_t i = 0; i < m_num_timers; i++)
+  {
+    if (m_timers[i] == timer) return NRF_SUCCESS;
+  }
+
+  if (m_num_timers >= SIM_MAX_TIMERS) return NRF_ERROR_BUSY;
+  m_timers[m_num_timers++] = timer;
+
+  return NRF_SUCCESS;
+}
+
+ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void * p_context)
+{
+  // a running timer is not restarted, same as app_timer
+  if (timer_id->active) return NRF_SUCCESS;
+
+  timer_id->interval  = ((uint64_t) timeout_ticks * 1000000 + APP_TIMER_TICK_FREQ - 1) / APP_TIMER_TICK_FREQ;
+  timer_id->expires   = m_now + timer_id->interval;
+  timer_id->p_context = p_context;
+  timer_id->active    = true;
+
+  return NRF_SUCCESS;
+}
+
+ret_code_t app_timer_stop(app_timer_id_t timer_id)
+{
+  timer_id->active = false;
+  return NRF_SUCCESS;
+}
+
+uint32_t app_timer_cnt_get(void)
+{
+  // a CPU waiting on a transfer without sleeping reads the counter in a loop
+  if (m_xfer_pending)
+  {
+    m_now += SIM_SPIN_US;
+    twiSim_finishTransfer();
+  }
+
+  return (uint32_t) ((m_now * APP_TIMER_TICK_FREQ) / 1000000) & APP_TIMER_MAX_CNT_VAL;
+}
+
+uint32_t app_timer_cnt_diff_compute(uint32_t ticks_to, uint32_t ticks_from)
+{
+  return (ticks_to - ticks_from) & APP_TIMER_MAX_CNT_VAL;
+}
+
+// --- Bus model ---
+
+// Accounts for the time and statistics of a transfer and decides if it is acknowledged
+// Arguments:
+//  address  - the 7 bit address of the transfer
+//  numbytes - the number of data bytes
+// Returns:
+//  true if the AD5933 acknowledges the transfer
+static bool twiSim_transfer(uint8_t address, uint8_t numbytes, bool chained)
+{
+  // the second half of a TXRX or TXTX only runs if the first half went through
+  if (chained && (m_xfer_hung || m_xfer_error)) return false;
+
+  // start, address + data bytes with their ack bits, and stop
+  uint32_t bits = 1 + (numbytes + 1) * 9 + 1;
+  uint64_t busUs = ((uint64_t) bits * 1000000 + m_bus_frequency - 1) / m_bus_frequency;
+
+  m_stats.transactions += 1;
+  m_stats.bytes += numbytes + 1;
+  m_stats.busTimeUs += busUs;
+
+  // after a repeated start the transfer carries on
+  if (chained)
+  {
+    m_xfer_end += busUs;
+  }
+  else
+  {
+    // the CPU is busy for the driver overhead, then the transfer runs on its own
+    m_now += m_config.overheadUs;
+    m_xfer_pending = true;
+    m_xfer_end = m_now + busUs;
+    m_xfer_done = false;
+    m_xfer_error = false;
+  }
+
+  // injected stuck bus, the AD5933 holds SDA low until the bus is cleared
+  if (m_config.stuckEvery != 0 && (m_stats.transactions % m_config.stuckEvery) == 0 && !m_sda_stuck)
+  {
+    m_stats.stuck += 1;
+    m_sda_stuck = true;
+  }
+
+  // injected hang, the transfer never finishes and the AD5933 never sees it
+  if (m_sda_stuck || (m_config.hangEvery != 0 && (m_stats.transactions % m_config.hangEvery) == 0))
+  {
+    m_stats.hangs += 1;
+    m_xfer_hung = true;
+    return false;
+  }
+
+  // nothing answers at the address, or two AD5933s behind the mux answer at once and garble the bus
+  if (!twiSim_answers(address))
+  {
+    m_xfer_error = true;
+    return false;
+  }
+
+  // the edges are too slow for the clock, the bytes are garbled and NACKed
+  if (m_bus_frequency > m_config.maxBusFrequency)
+  {
+    m_xfer_error = true;
+    return false;
+  }
+
+  // injected fault
+  if (m_config.faultEvery != 0 && (m_stats.transactions % m_config.faultEvery) == 0)
+  {
+    m_stats.faults += 1;
+    m_xfer_error = true;
+    return false;
+  }
+
+  return true;
+}
+
+// Returns the AD5933 the bus reaches at AD5933_ADDR: the only one without a mux, or the one on the
+// channel the mux connects. NULL if the mux connects none or more than one
+static twiSimDevice * twiSim_target(void)
+{
+  if (m_config.muxChannels == 0) return &m_devices[0];
+
+  twiSimDevice * device = NULL;
+
+  for (uint8_t i = 0; i < m_config.muxChannels && i < SIM_MAX_DEVICES; i++)
+  {
+    if (!(m_mux & (1 << i))) continue;
+    if (device != NULL) return NULL;
+
+    device = &m_devices[i];
+  }
+
+  return device;
+}
+
+// Checks if a device acknowledges its address
+static bool twiSim_answers(uint8_t address)
+{
+  if (address == MUX_ADDR) return m_config.muxChannels != 0;
+
+  return address == AD5933_ADDR && twiSim_target() != NULL;
+}
+
+// Decodes a write to the mux or the AD5933 it connects
+static void twiSim_writeTo(uint8_t address, uint8_t const * data, uint8_t numbytes)
+{
+  if (address != MUX_ADDR)
+  {
+    twiSim_write(twiSim_target(), data, numbytes);
+    return;
+  }
+
+  // each byte written replaces the control register
+  if (numbytes == 0) return;
+
+  m_mux = data[numbytes - 1];
+  m_stats.muxWrites += 1;
+}
+
+// Decodes a read from the mux or the AD5933 it connects
+static void twiSim_readFrom(uint8_t address, uint8_t * data, uint8_t numbytes)
+{
+  if (address != MUX_ADDR)
+  {
+    twiSim_read(twiSim_target(), data, numbytes);
+    return;
+  }
+
+  // the control register is read back for every byte
+  memset(data, m_mux, numbytes);
+}
+
+// Runs a transfer described for nrf_drv_twi_xfer, the driver overhead has been accounted for
+static void twiSim_startXfer(nrf_drv_twi_xfer_desc_t const * desc)
+{
+  uint8_t address = desc->address;
+
+  m_xfer_type = desc->type;
+
+  // the overhead was paid by the caller (or by nobody for a PPI start)
+  uint32_t overhead = m_config.overheadUs;
+  m_config.overheadUs = 0;
+
+  switch (desc->type)
+  {
+    case NRF_DRV_TWI_XFER_TX:
+      if (twiSim_transfer(address, desc->primary_length, false)) twiSim_writeTo(address, desc->p_primary_buf, desc->primary_length);
+      break;
+
+    case NRF_DRV_TWI_XFER_RX:
+      if (twiSim_transfer(address, desc->primary_length, false)) twiSim_readFrom(address, desc->p_primary_buf, desc->primary_length);
+      break;
+
+    case NRF_DRV_TWI_XFER_TXRX:
+      if (twiSim_transfer(address, desc->primary_length, false)) twiSim_writeTo(address, desc->p_primary_buf, desc->primary_length);
+      if (twiSim_transfer(address, desc->secondary_length, true)) twiSim_readFrom(address, desc->p_secondary_buf, desc->secondary_length);
+      break;
+
+    case NRF_DRV_TWI_XFER_TXTX:
+      if (twiSim_transfer(address, desc->primary_length, false)) twiSim_writeTo(address, desc->p_primary_buf, desc->primary_length);
+      if (twiSim_transfer(address, desc->secondary_length, true)) twiSim_writeTo(address, desc->p_secondary_buf, desc->secondary_length);
+      break;
+  }
+
+  m_config.overheadUs = overhead;
+}
+
+// Returns the simulated time the running TIMER reaches its compare value
+static uint64_t twiSim_timerCompareTime(void)
+{
+  uint32_t ticksPerUs = 16 >> m_timer_frequency;
+
+  return m_timer_start + (m_timer_cc + ticksPerUs - 1) / ticksPerUs;
+}
+
+// Fires COMPARE0 of the TIMER, runs its shorts and the tasks PPI connects to it
+static void twiSim_timerCompare(void)
+{
+  m_timer_compared = true;
+
+  if (m_timer_shorts & NRF_TIMER_SHORT_COMPARE0_STOP_MASK)
+  {
+    m_timer_running = false;
+  }
+  else
+  {
+    // clear short, or the 32 bit counter wraps before it compares again
+    m_timer_start = m_now;
+  }
+
+  for (uint8_t i = 0; i < m_ppi_allocated; i++)
+  {
+    if (!m_ppi_enabled[i] || m_ppi_eep[i] != SIM_TIMER_COMPARE0_EVENT) continue;
+
+    if (m_ppi_tep[i] == SIM_TWI_START_TASK && m_held_valid && !m_xfer_pending)
+    {
+      m_stats.ppiStarts += 1;
+      twiSim_startXfer(&m_held);
+    }
+  }
+}
+
+// Reports the transfer on the bus as done once its bus time has passed, like twi_handler
+static void twiSim_finishTransfer(void)
+{
+  if (!m_xfer_pending || m_xfer_hung || m_now < m_xfer_end) return;
+
+  m_xfer_pending = false;
+
+  if (m_handler == NULL)
+  {
+    m_xfer_done = true;
+    twi_error = m_xfer_error;
+    return;
+  }
+
+  nrf_drv_twi_evt_t event;
+  event.type = m_xfer_error ? NRF_DRV_TWI_EVT_DATA_NACK : NRF_DRV_TWI_EVT_DONE;
+  event.xfer_desc.type = m_xfer_type;
+
+  m_handler(&event, NULL);
+}
+
+// Decodes a write to the AD5933 (set pointer, block read/write commands or a register write)
+static void twiSim_write(twiSimDevice * device, uint8_t const * data, uint8_t numbytes)
+{
+  if (numbytes < 2)
+  {
+    m_xfer_error = true;
+    return;
+  }
+
+  if (data[0] == SET_POINTER)
+  {
+    device->pointer = data[1];
+  }
+  else if (data[0] == BLOCK_READ)
+  {
+    device->blockRead = data[1];
+  }
+  else if (data[0] == BLOCK_WRITE)
+  {
+    for (uint8_t i = 0; i < data[1] && i + 2 < numbytes; i++)
+    {
+      uint8_t reg = device->pointer + i;
+      if (reg >= SIM_REG_BASE && reg < SIM_REG_BASE + SIM_NUM_REGS) device->regs[reg - SIM_REG_BASE] = data[i + 2];
+    }
+  }
+  else if (data[0] >= SIM_REG_BASE && data[0] < SIM_REG_BASE + SIM_NUM_REGS && numbytes == 2)
+  {
+    device->regs[data[0] - SIM_REG_BASE] = data[1];
+
+    if (data[0] == CONTROL1_REG) twiSim_command(device, data[1]);
+
+    // reset puts the AD5933 in standby
+    if (data[0] == CONTROL2_REG && (data[1] & 0x10))
+    {
+      device->measuring = false;
+      device->command = STANDBY;
+    }
+  }
+  else
+  {
+    // unknown command, the AD5933 NACKs it
+    m_xfer_error = true;
+  }
+}
+
+// Decodes a read from the AD5933, either an armed block read or a receive byte at the pointer
+static void twiSim_read(twiSimDevice * device, uint8_t * data, uint8_t numbytes)
+{
+  if (device->blockRead != 0)
+  {
+    for (uint8_t i = 0; i < numbytes; i++)
+    {
+      data[i] = twiSim_readReg(device, device->pointer + i);
+    }
+    device->blockRead = 0;
+  }
+  else
+  {
+    data[0] = twiSim_readReg(device, device->pointer);
+  }
+}
+
+// Reads a register, the status register is built from the measurement state
+static uint8_t twiSim_readReg(twiSimDevice * device, uint8_t reg)
+{
+  if (reg < SIM_REG_BASE || reg >= SIM_REG_BASE + SIM_NUM_REGS) return 0;
+
+  if (reg == STATUS_REG)
+  {
+    uint8_t status = STATUS_NONE;
+    uint16_t steps = ((device->regs[NUM_STEPS_REG - SIM_REG_BASE] & 0x01) << 8) | device->regs[NUM_STEPS_REG - SIM_REG_BASE + 1];
+
+    m_stats.statusReads += 1;
+
+    if (device->tempRequested && m_now >= device->tempTime) status |= STATUS_TEMP;
+    if (device->measuring && m_now >= device->dataTime)
+    {
+      status |= STATUS_DATA;
+      if (device->step >= steps) status |= STATUS_DONE;
+    }
+
+    return status;
+  }
+
+  return device->regs[reg - SIM_REG_BASE];
+}
+
+// Acts on a command written to CONTROL1
+static void twiSim_command(twiSimDevice * device, uint8_t control)
+{
+  uint8_t command = control >> 4;
+  uint16_t steps = ((device->regs[NUM_STEPS_REG - SIM_REG_BASE] & 0x01) << 8) | device->regs[NUM_STEPS_REG - SIM_REG_BASE + 1];
+
+  switch (command)
+  {
+    case START_SWEEP:
+      device->step = 0;
+      twiSim_measure(device);
+      break;
+
+    case INCREMENT_FREQ:
+      if (device->step < steps) device->step += 1;
+      twiSim_measure(device);
+      break;
+
+    case REPEAT_FREQ:
+      twiSim_measure(device);
+      break;
+
+    case MEASURE_TEMP:
+    {
+      // 14 bit two's complement, 1/32 degree per bit
+      int16_t code = (int16_t) lround(m_config.temperature * 32) & 0x3FFF;
+      device->regs[TEMP_REG - SIM_REG_BASE]     = (code >> 8) & 0x3F;
+      device->regs[TEMP_REG - SIM_REG_BASE + 1] = code & 0xFF;
+      device->tempRequested = true;
+      device->tempTime = m_now + SIM_TEMP_US;
+      // the AD5933 returns to the mode it was in
+      return;
+    }
+
+    case POWER_DOWN:
+    case STANDBY:
+      device->measuring = false;
+      break;
+
+    default:
+      break;
+  }
+
+  device->command = command;
+}
+
+// Starts a measurement at the current step, the result is valid after the settling time and the DFT
+static void twiSim_measure(twiSimDevice * device)
+{
+  uint8_t control = device->regs[CONTROL1_REG - SIM_REG_BASE];
+  uint32_t freq = twiSim_frequency(device, START_FREQ_REG) + device->step * twiSim_frequency(device, DELTA_FREQ_REG);
+  double zReal, zImag;
+  double scale = twiSim_scale(control);
+
+  twiSim_impedance(device->channel, freq, &zReal, &zImag);
+
+  // the DFT result is the admittance divided by the gain factor, rotated by the system phase
+  double mag = scale / (m_config.gainFactor * sqrt(zReal * zReal + zImag * zImag));
+  double phase = -atan2(zImag, zReal) + m_config.systemPhase * M_PI / 180;
+
+  // the low pass of the signal path
+  if (m_config.systemPole != 0)
+  {
+    mag /= sqrt(1 + (freq / m_config.systemPole) * (freq / m_config.systemPole));
+    phase -= atan(freq / m_config.systemPole);
+  }
+
+  double real = mag * cos(phase) + twiSim_noise();
+  double imag = mag * sin(phase) + twiSim_noise();
+
+  // the DFT saturates at the limits of its 16 bit registers
+  int16_t codes[2];
+  codes[0] = (int16_t) fmax(-32768, fmin(32767, lround(real)));
+  codes[1] = (int16_t) fmax(-32768, fmin(32767, lround(imag)));
+
+  device->regs[REAL_REG - SIM_REG_BASE]     = (codes[0] >> 8) & 0xFF;
+  device->regs[REAL_REG - SIM_REG_BASE + 1] = codes[0] & 0xFF;
+  device->regs[IMAG_REG - SIM_REG_BASE]     = (codes[1] >> 8) & 0xFF;
+  device->regs[IMAG_REG - SIM_REG_BASE + 1] = codes[1] & 0xFF;
+
+  device->measuring = true;
+  device->dataTime = m_now + twiSim_settleUs(device, freq)
+                   + ((uint64_t) SIM_DFT_SAMPLES * SIM_ADC_DIV * 1000000 + m_config.mclk - 1) / m_config.mclk;
+}
+
+// Returns how much larger the DFT result is than at RANGE1 and GAIN1
+// Arguments:
+//  setting - the output excitation range (bits 2:1) and PGA gain (bit 0), as in CONTROL1 and POINT_SETTING
+static double twiSim_scale(uint8_t setting)
+{
+  double scale;
+
+  switch ((setting >> 1) & 0x03)
+  {
+    case RANGE1: scale = 1.0; break; // 2 V p-p
+    case RANGE2: scale = 0.5; break; // 1 V p-p
+    case RANGE3: scale = 0.2; break; // 400 mV p-p
+    default:     scale = 0.1; break; // 200 mV p-p
+  }
+  if ((setting & 0x01) == GAIN5) scale *= 5;
+
+  return scale;
+}
+
+// Returns the impedance of the load of the AD5933 on a mux channel at freq (Hz) in ohms
+static void twiSim_impedance(uint8_t channel, uint32_t freq, double * zReal, double * zImag)
+{
+  if (m_config.load != NULL)
+  {
+    m_config.load(freq, zReal, zImag);
+    return;
+  }
+
+  *zReal = m_config.loadResistance;
+  *zImag = 0;
+
+  if (channel < SIM_MAX_DEVICES && m_config.channelResistance[channel] != 0)
+  {
+    *zReal = m_config.channelResistance[channel];
+  }
+}
+
+// Converts a 24 bit frequency code register to Hz
+static uint32_t twiSim_frequency(twiSimDevice * device, uint8_t reg)
+{
+  uint8_t * code = &device->regs[reg - SIM_REG_BASE];
+  uint32_t value = ((uint32_t) code[0] << 16) | ((uint32_t) code[1] << 8) | code[2];
+
+  return (uint32_t) llround((double) value * (m_config.mclk / CLK_DIV) / (1 << 27));
+}
+
+// Returns the settling time in us set by NUM_CYCLES_REG at freq
+static uint64_t twiSim_settleUs(twiSimDevice * device, uint32_t freq)
+{
+  uint8_t * reg = &device->regs[NUM_CYCLES_REG - SIM_REG_BASE];
+  uint32_t cycles = ((reg[0] & 0x01) << 8) | reg[1];
+  uint32_t multiplier;
+
+  // multiplier bits D10-D9
+  switch ((reg[0] >> 1) & 0x03)
+  {
+    case 0x01: multiplier = 2; break;
+    case 0x03: multiplier = 4; break;
+    default:   multiplier = 1; break;
+  }
+
+  if (freq == 0) return 0;
+
+  return ((uint64_t) cycles * multiplier * 1000000 + freq - 1) / freq;
+}
+
+// Returns uniform noise in [-noise, noise]
+static double twiSim_noise(void)
+{
+  if (m_config.noise == 0) return 0;
+
+  // xorshift32
+  m_random ^= m_random << 13;
+  m_random ^= m_random >> 17;
+  m_random ^= m_random << 5;
+
+  return m_config.noise * (2.0 * m_random / 4294967295.0 - 1.0);
+}
@@ -0,0 +1,336 @@
+/*
+ *  twiSim.h
+ *
+ *  Header file for twiSim.c, a host (Linux) stand-in for the parts of the nRF SDK used by AD5933.c.
+ *  The TWI bus is backed by a register and timing model of the AD5933 (or of several behind a
+ *  TCA9548A mux), time is simulated.
+ *
+ *  Build AD5933.c with AD5933_SIM defined and hostSim on the include path, for example:
+ *    gcc -DAD5933_SIM -I. -IhostSim AD5933.c sweepSink.c twiManager.c hostSim/twiSim.c bench.c -lm
+ *  add -DAD5933_PPI_POLL and twiPoll.c for the PPI polling backend.
+ *
+ */
+
+#ifndef INC_TWISIM_H_
+#define INC_TWISIM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// --- nRF SDK stand-ins ---
+
+typedef uint32_t ret_code_t;
+
+#define NRF_SUCCESS     0
+#define NRF_ERROR_MODULE_ALREADY_INITIALIZED 0x8
+#define NRF_ERROR_BUSY  17
+
+#define APP_IRQ_PRIORITY_HIGH 2
+#define ARDUINO_SCL_PIN       27
+#define ARDUINO_SDA_PIN       26
+
+#define UNUSED_PARAMETER(X) ((void)(X))
+#define UNUSED_VARIABLE(X)  ((void)(X))
+
+// errors that would reset the nRF52 abort the simulation
+#define APP_ERROR_CHECK(ERR_CODE) twiSim_errorCheck((ERR_CODE), __FILE__, __LINE__)
+
+// sleeping the CPU moves simulated time to the next timer event
+#define __WFE() twiSim_waitForEvent()
+
+typedef struct
+{
+  uint8_t inst_idx;
+} nrf_drv_twi_t;
+
+#define NRF_DRV_TWI_INSTANCE(id) {(id)}
+
+// the simulated driver takes the clock in Hz
+typedef enum
+{
+  NRF_DRV_TWI_FREQ_100K = 100000,
+  NRF_DRV_TWI_FREQ_250K = 250000,
+  NRF_DRV_TWI_FREQ_400K = 400000
+} nrf_drv_twi_frequency_t;
+
+typedef struct
+{
+  uint32_t scl;
+  uint32_t sda;
+  nrf_drv_twi_frequency_t frequency;
+  uint8_t interrupt_priority;
+  bool clear_bus_init;
+  bool hold_bus_uninit;
+} nrf_drv_twi_config_t;
+
+typedef enum
+{
+  NRF_DRV_TWI_EVT_DONE,
+  NRF_DRV_TWI_EVT_ADDRESS_NACK,
+  NRF_DRV_TWI_EVT_DATA_NACK
+} nrf_drv_twi_evt_type_t;
+
+typedef enum
+{
+  NRF_DRV_TWI_XFER_TX,
+  NRF_DRV_TWI_XFER_RX,
+  NRF_DRV_TWI_XFER_TXRX,
+  NRF_DRV_TWI_XFER_TXTX
+} nrf_drv_twi_xfer_type_t;
+
+typedef struct
+{
+  nrf_drv_twi_xfer_type_t type;
+  uint8_t address;
+  uint8_t primary_length;
+  uint8_t secondary_length;
+  uint8_t * p_primary_buf;
+  uint8_t * p_secondary_buf;
+} nrf_drv_twi_xfer_desc_t;
+
+#define NRF_DRV_TWI_XFER_DESC_TXRX(addr, p_tx, tx_len, p_rx, rx_len) \
+  {NRF_DRV_TWI_XFER_TXRX, (addr), (tx_len), (rx_len), (p_tx), (p_rx)}
+#define NRF_DRV_TWI_XFER_DESC_TXTX(addr, p_tx, tx_len, p_tx2, tx_len2) \
+  {NRF_DRV_TWI_XFER_TXTX, (addr), (tx_len), (tx_len2), (p_tx), (p_tx2)}
+
+// only HOLD_XFER changes what the simulated driver does, the transfer waits for its start task
+#define NRF_DRV_TWI_FLAG_TX_POSTINC          (1UL << 0)
+#define NRF_DRV_TWI_FLAG_RX_POSTINC          (1UL << 1)
+#define NRF_DRV_TWI_FLAG_NO_XFER_EVT_HANDLER (1UL << 2)
+#define NRF_DRV_TWI_FLAG_REPEATED_XFER       (1UL << 3)
+#define NRF_DRV_TWI_FLAG_HOLD_XFER           (1UL << 4)
+
+typedef struct
+{
+  nrf_drv_twi_evt_type_t type;
+  nrf_drv_twi_xfer_desc_t xfer_desc;
+} nrf_drv_twi_evt_t;
+
+typedef void (*nrf_drv_twi_evt_handler_t)(nrf_drv_twi_evt_t const * p_event, void * p_context);
+
+ret_code_t nrf_drv_twi_init(nrf_drv_twi_t const * p_instance, nrf_drv_twi_config_t const * p_config, nrf_drv_twi_evt_handler_t event_handler, void * p_context);
+void nrf_drv_twi_uninit(nrf_drv_twi_t const * p_instance);
+ret_code_t nrf_drv_twi_xfer(nrf_drv_twi_t const * p_instance, nrf_drv_twi_xfer_desc_t const * p_xfer_desc, uint32_t flags);
+uint32_t nrf_drv_twi_start_task_get(nrf_drv_twi_t const * p_instance, nrf_drv_twi_xfer_type_t xfer_type);
+uint32_t nrf_drv_twi_stopped_event_get(nrf_drv_twi_t const * p_instance);
+ret_code_t nrf_drv_twi_tx(nrf_drv_twi_t const * p_instance, uint8_t address, uint8_t const * p_data, uint8_t length, bool no_stop);
+ret_code_t nrf_drv_twi_rx(nrf_drv_twi_t const * p_instance, uint8_t address, uint8_t * p_data, uint8_t length);
+void nrf_drv_twi_enable(nrf_drv_twi_t const * p_instance);
+void nrf_drv_twi_disable(nrf_drv_twi_t const * p_instance);
+void nrf_delay_ms(uint32_t ms);
+
+// one TIMER with compare channel 0, enough for the autonomous status poll in twiPoll.c
+typedef enum
+{
+  NRF_TIMER_FREQ_16MHz = 0,
+  NRF_TIMER_FREQ_8MHz,
+  NRF_TIMER_FREQ_4MHz,
+  NRF_TIMER_FREQ_2MHz,
+  NRF_TIMER_FREQ_1MHz
+} nrf_timer_frequency_t;
+
+typedef enum
+{
+  NRF_TIMER_CC_CHANNEL0 = 0
+} nrf_timer_cc_channel_t;
+
+typedef enum
+{
+  NRF_TIMER_EVENT_COMPARE0 = 0x140
+} nrf_timer_event_t;
+
+typedef enum
+{
+  NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK = 1 << 0,
+  NRF_TIMER_SHORT_COMPARE0_STOP_MASK  = 1 << 8
+} nrf_timer_short_mask_t;
+
+typedef struct
+{
+  void * p_reg;
+  uint8_t instance_id;
+} nrf_drv_timer_t;
+
+typedef struct
+{
+  nrf_timer_frequency_t frequency;
+  uint8_t mode;
+  uint8_t bit_width;
+  uint8_t interrupt_priority;
+  void * p_context;
+} nrf_drv_timer_config_t;
+
+typedef void (*nrf_timer_event_handler_t)(nrf_timer_event_t event_type, void * p_context);
+
+#define NRF_DRV_TIMER_INSTANCE(id)   {NULL, (id)}
+#define NRF_DRV_TIMER_DEFAULT_CONFIG {NRF_TIMER_FREQ_16MHz, 0, 3, 6, NULL}
+
+ret_code_t nrf_drv_timer_init(nrf_drv_timer_t const * p_instance, nrf_drv_timer_config_t const * p_config, nrf_timer_event_handler_t timer_event_handler);
+void nrf_drv_timer_enable(nrf_drv_timer_t const * p_instance);
+void nrf_drv_timer_disable(nrf_drv_timer_t const * p_instance);
+void nrf_drv_timer_clear(nrf_drv_timer_t const * p_instance);
+uint32_t nrf_drv_timer_us_to_ticks(nrf_drv_timer_t const * p_instance, uint32_t time_us);
+void nrf_drv_timer_extended_compare(nrf_drv_timer_t const * p_instance, nrf_timer_cc_channel_t cc_channel, uint32_t cc_value, nrf_timer_short_mask_t timer_short_mask, bool enable_int);
+uint32_t nrf_drv_timer_compare_event_address_get(nrf_drv_timer_t const * p_instance, uint32_t channel);
+bool nrf_timer_event_check(void * p_reg, nrf_timer_event_t event);
+void nrf_timer_event_clear(void * p_reg, nrf_timer_event_t event);
+
+// PPI connects an event address to a task address without the CPU
+typedef uint8_t nrf_ppi_channel_t;
+
+ret_code_t nrf_drv_ppi_init(void);
+ret_code_t nrf_drv_ppi_channel_alloc(nrf_ppi_channel_t * p_channel);
+ret_code_t nrf_drv_ppi_channel_assign(nrf_ppi_channel_t channel, uint32_t eep, uint32_t tep);
+ret_code_t nrf_drv_ppi_channel_enable(nrf_ppi_channel_t channel);
+ret_code_t nrf_drv_ppi_channel_disable(nrf_ppi_channel_t channel);
+
+// app_timer runs from RTC1 with APP_TIMER_CONFIG_RTC_FREQUENCY 1 in sdk_config.h (16384 Hz)
+#define APP_TIMER_CLOCK_FREQ         32768
+#define APP_TIMER_CONFIG_RTC_FREQUENCY 1
+#define APP_TIMER_TICK_FREQ          (APP_TIMER_CLOCK_FREQ / (APP_TIMER_CONFIG_RTC_FREQUENCY + 1))
+#define APP_TIMER_MIN_TIMEOUT_TICKS  5
+#define APP_TIMER_MAX_CNT_VAL        0x00FFFFFF
+#define APP_TIMER_TICKS(MS)          ((uint32_t)(((uint64_t)(MS) * APP_TIMER_TICK_FREQ + 500) / 1000))
+
+typedef void (*app_timer_timeout_handler_t)(void * p_context);
+
+typedef enum
+{
+  APP_TIMER_MODE_SINGLE_SHOT,
+  APP_TIMER_MODE_REPEATED
+} app_timer_mode_t;
+
+typedef struct twiSimTimer
+{
+  app_timer_timeout_handler_t handler;
+  app_timer_mode_t mode;
+  bool active;
+  uint64_t expires;  // simulated time in us
+  uint64_t interval; // repeat interval in us
+  void * p_context;
+} twiSimTimer;
+
+typedef twiSimTimer * app_timer_id_t;
+
+#define APP_TIMER_DEF(timer_id) \
+  static twiSimTimer timer_id##_data; \
+  static app_timer_id_t const timer_id = &timer_id##_data
+
+ret_code_t app_timer_create(app_timer_id_t const * p_timer_id, app_timer_mode_t mode, app_timer_timeout_handler_t timeout_handler);
+ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void * p_context);
+ret_code_t app_timer_stop(app_timer_id_t timer_id);
+uint32_t app_timer_cnt_get(void);
+uint32_t app_timer_cnt_diff_compute(uint32_t ticks_to, uint32_t ticks_from);
+
+// --- Simulator ---
+
+// the AD5933 register model
+#define SIM_NUM_REGS     0x20 // registers 0x80 - 0x9F
+#define SIM_REG_BASE     0x80
+#define SIM_DFT_SAMPLES  1024 // the ADC takes 1024 samples for each DFT
+#define SIM_ADC_DIV      16   // the ADC samples at MCLK / 16
+#define SIM_TEMP_US      800  // time for a temperature conversion
+#define SIM_MAX_TIMERS   8
+#define SIM_SPIN_US      1    // time a CPU spinning on a flag takes to read the app_timer counter
+#define SIM_PPI_CHANNELS 20
+#define SIM_MAX_DEVICES  8    // AD5933s behind the TCA9548A, one on each channel
+
+// addresses the simulated peripherals give PPI
+#define SIM_TIMER_COMPARE0_EVENT 0x40009140
+#define SIM_TWI_START_TASK       0x40003008
+#define SIM_TWI_STOPPED_EVENT    0x40003104
+
+// returns the impedance of the simulated load at freq (Hz) in ohms
+typedef void (*twiSim_load_t)(uint32_t freq, double * real, double * imag);
+
+// simulator configuration
+typedef struct twiSimConfig
+{
+  uint32_t busFrequency;      // TWI clock in Hz until nrf_drv_twi_init sets it
+  uint32_t maxBusFrequency;   // fastest clock the bus works at, faster transfers are NACKed
+  uint32_t overheadUs;        // driver and interrupt time per transfer in us
+  uint32_t mclk;              // AD5933 system clock in Hz
+  double gainFactor;          // AD5933 gain factor (1 / (ohms * code)) at RANGE1 and GAIN1
+  double systemPhase;         // AD5933 system phase in degrees
+  double systemPole;          // corner of a first order low pass in the signal path in Hz, so the gain and system
+                              // phase change with frequency, 0 for a flat response
+  double loadResistance;      // resistance of the load when load is NULL
+  double channelResistance[SIM_MAX_DEVICES]; // resistance of the load of the AD5933 on each mux channel
+                              // when load is NULL, 0 for loadResistance
+  twiSim_load_t load;         // impedance of the load, NULL for a plain resistor
+  double noise;               // peak noise added to the real and imaginary codes
+  double temperature;         // die temperature in Celcius
+  uint32_t faultEvery;        // NACK every faultEvery transfers, 0 for no faults
+  uint32_t hangEvery;         // never finish every hangEvery transfers, 0 for no hangs
+  uint32_t stuckEvery;        // leave SDA held low by the AD5933 every stuckEvery transfers, every transfer
+                              // hangs until a bus clear (nrf_drv_twi_init with clear_bus_init), 0 for never
+  uint8_t muxChannels;        // number of AD5933s behind a TCA9548A mux at MUX_ADDR (on channels 0 - muxChannels - 1),
+                              // 0 for one AD5933 straight on the bus
+} twiSimConfig;
+
+// bus and timing statistics
+typedef struct twiSimStats
+{
+  uint64_t busTimeUs;     // time the bus was in use
+  uint32_t transactions;  // number of transfers
+  uint32_t bytes;         // number of bytes on the bus including address bytes
+  uint32_t faults;        // number of NACKs injected
+  uint32_t hangs;         // number of transfers that were made to never finish
+  uint32_t aborts;        // number of transfers aborted by disabling the driver
+  uint32_t stuck;         // number of times the AD5933 was left holding SDA low
+  uint32_t busClears;     // number of times SCL was clocked to clear the bus
+  uint32_t inits;         // number of times the driver was initialized
+  uint32_t wakeups;       // number of times the CPU woke from __WFE
+  uint32_t ppiStarts;     // number of transfers started by PPI without the CPU
+  uint64_t sleepUs;       // time the CPU spent asleep in __WFE
+  uint32_t statusReads;   // number of reads of STATUS_REG
+  uint32_t muxWrites;     // number of writes to the control register of the mux
+} twiSimStats;
+
+// result of a simulated sweep
+typedef struct twiSimReport
+{
+  bool success;           // what AD5933_Sweep returned
+  uint32_t points;        // number of points measured
+  uint64_t wallTimeUs;    // simulated time the sweep took
+  twiSimStats stats;      // bus statistics of the sweep
+  uint32_t saturated;     // number of points with a code at the limit of the 16 bit registers
+  double zError;          // mean relative error of |Z| against the load, from gainFactor and the setting of each
+                          // point, so only meaningful with a systemPole of 0
+} twiSimReport;
+
+// model of one AD5933
+typedef struct twiSimDevice
+{
+  uint8_t regs[SIM_NUM_REGS]; // register file
+  uint8_t pointer;            // address pointer
+  uint8_t blockRead;          // number of bytes armed by a block read command
+  uint8_t command;            // last command written to CONTROL1
+  uint16_t step;              // current increment of the sweep
+  bool measuring;             // a DFT is in progress or done
+  uint64_t dataTime;          // simulated time the DFT result is valid
+  bool tempRequested;         // a temperature conversion is in progress or done
+  uint64_t tempTime;          // simulated time the temperature result is valid
+  uint8_t channel;            // mux channel of the AD5933
+} twiSimDevice;
+
+void twiSim_init(twiSimConfig const * config);
+void twiSim_defaultConfig(twiSimConfig * config);
+uint64_t twiSim_micros(void);
+void twiSim_advance(uint64_t us);
+void twiSim_setWakeup(uint64_t time, void (*handler)(void));
+void twiSim_waitForEvent(void);
+void twiSim_getStats(twiSimStats * stats);
+void twiSim_resetStats(void);
+twiSimDevice * twiSim_device(void);
+twiSimDevice * twiSim_channelDevice(uint8_t channel);
+void twiSim_errorCheck(ret_code_t err_code, char const * file, int line);
+
+// runs AD5933_Sweep on the simulated bus (struct sweepParams is the Sweep struct from AD5933.h)
+struct sweepParams;
+bool twiSim_runSweep(struct sweepParams * sweep, twiSimReport * report);
+
+#endif
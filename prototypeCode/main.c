@@ -24,8 +24,6 @@
 #include "app_util_platform.h"
 #include "nrf_drv_twi.h"
 
-#include "mem_manager.h"
-
 #include "fds.h"
 
 #include "nrf_drv_rtc.h"
@@ -41,6 +39,9 @@
 #include "AD5933.h"
 #include "flashManager.h"
 #include "usbManager.h"
+#include "sweepSink.h"
+#include "twiManager.h"
+#include "calibration.h"
 
 // --- User Defines ---
 
@@ -52,9 +53,18 @@
 #define LED_SWEEP  (BSP_LED_2) // LED to signal if sweep is being done
 #define LED_AD5933 (BSP_LED_3) // LED to singal if the AD5933 is connected
 
+// what to do with the sweep data once the sweep engine finishes
+#define ACTION_NONE     0
+#define ACTION_SAVE     1 // save to flash (RTC sweeps)
+#define ACTION_SAVE_USB 2 // save to flash and send the result over usb (command 2)
+#define ACTION_SEND_USB 3 // send the sweep over usb (command 3)
+#define ACTION_CALIBRATE 4 // build a calibration table from the sweep and save it to flash (command 5)
+
 bool recieveSweep(Sweep * sweep);
 void set_default(Sweep * sweep);
-bool saveSweep();
+bool startSweep(uint8_t action);
+void finishSweep(void);
+void finishCommit(void);
 
 // variable to store the number of saved sweeps
 static uint32_t numSweeps = 0;
@@ -62,24 +72,27 @@ static uint32_t numSweeps = 0;
 // create a new sweep
 static Sweep sweep = {0};
 
-// --- TWI Defines ---
-
-// Needed to get the instance ID
-#define TWI_INSTANCE_ID     0
+// engine that runs the sweep in the background of the main loop
+static SweepEngine engine = {0};
 
-// function declarations
-void twi_handler(nrf_drv_twi_evt_t const * p_event, void * p_context);
-void twi_init (void);
+// the action to take when the running sweep is done
+static uint8_t sweepAction = ACTION_NONE;
 
+// the action of the saved sweep being committed to flash, the next sweep can run meanwhile
+static uint8_t commitAction = ACTION_NONE;
 
-// get the TWI instance
-const nrf_drv_twi_t m_twi = NRF_DRV_TWI_INSTANCE(TWI_INSTANCE_ID);
+// where the points of the running sweep go as they are measured, so only one chunk is ever in RAM
+// (the flash sink codes into record buffers from the flash manager pool, one is written while another is filled)
+static SweepSink sweepSink;
+static FlashSink flashSink;
 
-// Indicates if operation on TWI has ended
-volatile bool m_xfer_done = false;
+// the calibration table used to convert sweeps, and the one being built by a calibration sweep
+static CalTable calTable;
+static CalTable calNew;
+static CalBuilder calBuilder;
 
-// Indicates TWI error
-volatile bool twi_error = false;
+// the resistance the next calibration sweep is measured against (ohms)
+static uint32_t calResistance = 0;
 
 // --- RTC Defines ---
 #define RTC_FREQ 8 																 // RTC frequency in Hz
@@ -94,6 +107,9 @@ static void rtc_config(void);
 // to keep track of the number of compare events triggered
 static uint32_t compares = 1;
 
+// set by the rtc handler when it is time for a sweep, the sweep itself runs in the main loop
+static volatile bool rtcSweepPending = false;
+
 // --- GPIOTE Defines ---
 void in_pin_handler(nrf_drv_gpiote_pin_t pin, nrf_gpiote_polarity_t action);
 static void gpiote_init(void);
@@ -113,17 +129,23 @@ int main(void)
   NRF_LOG_FLUSH();
 #endif
 
-  // init twi
-  twi_init();
-
   // init USB
   usbManager_init();
 	
 	// init flashManager
 	flashManager_init();
 	
-	// init memory manager
-	nrf_mem_init();
+	// init the AD5933 sweep engine (must be done after usbManager_init() due to app_timer being needed)
+	AD5933_Init();
+	
+	// init twi at the fastest speed the AD5933 works at (must be done after AD5933_Init() due to the transfer timeouts)
+	twiManager_init();
+	
+#ifdef AD5933_PPI_POLL
+	// let TIMER1 and PPI read the status and data of each point (must be done after twiManager_init()),
+	// the sweeps stay on the CPU backend if the timer or PPI channel could not be set up
+	AD5933_SetBackend(AD5933_BACKEND_PPI);
+#endif
 	
 	// init rtc (must be done after init_usb() due to the low frequency clock being needed)
 	rtc_config();
@@ -147,6 +169,12 @@ int main(void)
 	
 	// load the config files from flash
 	flashManager_checkConfig(&numSweeps, &oldSweep);
+	
+	// keep room for the next sweep, the oldest sweeps are evicted between sweeps once the flash fills
+	flashManager_setRetention(SWEEP_LOG_MAX_SWEEPS, sweep.steps + 1);
+	
+	// load the calibration table, sweeps can only be sent calibrated once there is one
+	flashManager_getCalibration(&calTable);
 
   if (i2c_stats) {nrf_drv_gpiote_out_clear(LED_AD5933);}
 #ifdef DEBUG_LOG
@@ -165,11 +193,13 @@ int main(void)
 			NRF_LOG_FLUSH();
 			
 			// read the config file
-			// send the number of saved sweeps
+			// send the number of saved sweeps (the newest sweep) and the number still kept
 			if (command[0] == 1)
 			{
 				flashManager_checkConfig(&numSweeps, &oldSweep);
-				usbManager_writeBytes(&numSweeps, sizeof(numSweeps));
+				
+				uint32_t buff[2] = {numSweeps, numSweeps + 1 - flashManager_firstSweep()};
+				usbManager_writeBytes(buff, sizeof(buff));
 				
 				// also reset the pointer here
 				pointer = numSweeps;
@@ -177,145 +207,269 @@ int main(void)
 			// execute a sweep and save to flash
 			else if (command[0] == 2)
 			{
-				// allocate memory for sweep data
-				uint32_t * freq = nrf_malloc(MAX_FREQ_SIZE);
-				uint16_t * real = nrf_malloc(MAX_IMP_SIZE);
-				uint16_t * imag = nrf_malloc(MAX_IMP_SIZE);
-				
-				uint8_t buff[1]; // to save the result
-
-				if (AD5933_Sweep(&sweep, freq, real, imag))
+				// the result is sent once the sweep is done, only send a fail now
+				if (!startSweep(ACTION_SAVE_USB))
 				{
-					if (flashManager_saveSweep(freq, real, imag, &sweep.metadata, numSweeps + 1))
-					{
-						numSweeps += 1;
-						flashManager_updateNumSweeps(&numSweeps);
-#ifdef DEBUG_LOG
-						NRF_LOG_INFO("Sweep %d saved", numSweeps);
-						NRF_LOG_FLUSH();
-#endif
-						
-						// send sweep success over usb
-						buff[0] = 2;
-					}
-					else
-					{
-						buff[0] = 1;
-					}
+					uint8_t buff[1] = {1};
+					usbManager_writeBytes(buff, 1);
 				}
-				else
-				{
-					buff[0] = 1;
-				}
-				// send result
-				usbManager_writeBytes(buff, 1);
-				
-				// free the memory
-				nrf_free(freq);
-				nrf_free(real);
-				nrf_free(imag);
 			}
 			// execute a sweep and immedietly send it over usb, do not save to flash
 			else if (command[0] == 3)
 			{
-				// allocate memory for sweeps
-				uint32_t * freq = nrf_malloc(MAX_FREQ_SIZE);
-				uint16_t * real = nrf_malloc(MAX_IMP_SIZE);
-				uint16_t * imag = nrf_malloc(MAX_IMP_SIZE);
+				// the sweep is sent once the sweep is done, only send a fail now
+				if (!startSweep(ACTION_SEND_USB))
+				{
+					uint8_t buff[1] = {1};
+					usbManager_writeBytes(buff, 1);
+				}
+			}
+			// send the pointer sweep over usb
+			else if (command[0] == 4)
+			{
+				// if pointer is past the oldest sweep kept, set it at the most recent sweep saved
+				if (pointer < flashManager_firstSweep()) pointer = numSweeps;
+					
+				// stream the sweep from flash over usb (use separate sink and metadata since a sweep may be running).
+				// The PC takes this sweep as raw points (start byte 3), so the coded records have to be decoded:
+				// flashManager_readSweep reads them a chunk at a time with the sweep reader and decodes each point
+				// into the sink as it goes, so the sweep is never copied to RAM. Command 7 sends the records as they are
+				SweepSink usbSink;
+				MetaData metadata;
+				usbManager_initSink(&usbSink);
 				
-				// execute the sweep
-				if (AD5933_Sweep(&sweep, freq, real, imag))
+				if (flashManager_readSweep(&usbSink, &metadata, pointer))
 				{
 #ifdef DEBUG_LOG
-					NRF_LOG_INFO("Sending Sweep");
-#endif
-					if (usbManager_sendSweep(freq, real, imag, &sweep.metadata))
-					{
-#ifdef DEBUG_LOG
-						NRF_LOG_INFO("Sweep Send Success");
-#endif
-					}
-					else
-					{
-#ifdef DEBUG_LOG
-						NRF_LOG_INFO("Sweep Send Fail");
+					NRF_LOG_INFO("Sweep send from flash success");
+					NRF_LOG_FLUSH();
 #endif
-					}
+				}
+				else
+				{
 #ifdef DEBUG_LOG
+					NRF_LOG_INFO("Sweep send fail");
 					NRF_LOG_FLUSH();
 #endif
 				}
 				
-				// free the memory
-				nrf_free(freq);
-				nrf_free(real);
-				nrf_free(imag);
+				// move pointer down
+				pointer--;
 			}
-			// send the pointer sweep over usb
-			else if (command[0] == 4)
+			// calibrate against the resistance sent after the command, the result is sent once the sweep is done
+			else if (command[0] == 5)
 			{
-				// allocate memory for sweeps
-				uint32_t * freq = nrf_malloc(MAX_FREQ_SIZE);
-				uint16_t * real = nrf_malloc(MAX_IMP_SIZE);
-				uint16_t * imag = nrf_malloc(MAX_IMP_SIZE);
+				usbManager_readBytes(&calResistance, sizeof(calResistance));
 				
-				// if pointer is at file 0, set it at the most recent sweep saved
-				if (pointer == 0) pointer = numSweeps;
-					
-				// get the sweep data from flash
-				if (flashManager_getSweep(freq, real, imag, &sweep.metadata, pointer))
+				if (calResistance == 0 || !startSweep(ACTION_CALIBRATE))
 				{
-					if (usbManager_sendSweep(freq, real, imag, &sweep.metadata))
+					uint8_t buff[1] = {1};
+					usbManager_writeBytes(buff, 1);
+				}
+			}
+			// send the pointer sweep over usb converted to calibrated impedance
+			else if (command[0] == 6)
+			{
+				if (pointer < flashManager_firstSweep()) pointer = numSweeps;
+				
+				if (calTable.numPoints == 0)
+				{
+					uint8_t buff[1] = {1};
+					usbManager_writeBytes(buff, 1);
+				}
+				else
+				{
+					SweepSink usbSink;
+					MetaData metadata;
+					usbManager_initCalibratedSink(&usbSink, &calTable);
+					
+					if (flashManager_readSweep(&usbSink, &metadata, pointer))
 					{
 #ifdef DEBUG_LOG
-						NRF_LOG_INFO("Sweep send from flash success");
+						NRF_LOG_INFO("Calibrated sweep send from flash success");
 						NRF_LOG_FLUSH();
 #endif
 					}
 					else
 					{
 #ifdef DEBUG_LOG
-						NRF_LOG_INFO("Sweep send fail");
+						NRF_LOG_INFO("Calibrated sweep send fail");
 						NRF_LOG_FLUSH();
 #endif
 					}
+					
+					pointer--;
 				}
+			}
+			// send the pointer sweep over usb coded with sweepCodec.c, straight from flash
+			else if (command[0] == 7)
+			{
+				if (pointer < flashManager_firstSweep()) pointer = numSweeps;
 				
-				// free memory
-				nrf_free(freq);
-				nrf_free(real);
-				nrf_free(imag);
+				if (usbManager_sendSavedSweep(pointer))
+				{
+#ifdef DEBUG_LOG
+					NRF_LOG_INFO("Coded sweep send from flash success");
+					NRF_LOG_FLUSH();
+#endif
+				}
+				else
+				{
+#ifdef DEBUG_LOG
+					NRF_LOG_INFO("Coded sweep send fail");
+					NRF_LOG_FLUSH();
+#endif
+				}
 				
-				// move pointer down
 				pointer--;
 			}
+			// send the flash usage statistics
+			else if (command[0] == 8)
+			{
+				FlashStats stats = {0};
+				
+				flashManager_getStats(&stats);
+				usbManager_writeBytes(&stats, sizeof(stats));
+			}
+			// send the catalog entries of the saved sweeps taken between the two times sent after the command
+			else if (command[0] == 9)
+			{
+				static uint32_t found[CATALOG_SWEEPS];
+				uint32_t times[2];
+				
+				usbManager_readBytes(times, sizeof(times));
+				
+				uint32_t count = flashManager_findSweeps(times[0], times[1], found, CATALOG_SWEEPS);
+				usbManager_writeBytes(&count, sizeof(count));
+				
+				for (uint32_t i = 0; i < count; i++)
+				{
+					CatalogEntry entry;
+					
+					flashManager_getEntry(found[i], &entry);
+					usbManager_writeBytes(&entry, sizeof(entry));
+				}
+			}
+			// delete the oldest saved sweeps from the first to the last number sent after the command and start the
+			// garbage collection of their flash, send the result then the delete report. flashManager_idle waits for
+			// the garbage collection between sweeps
+			else if (command[0] == 10)
+			{
+				uint32_t range[2];
+				DeleteReport report = {0};
+				bool res = false;
+				
+				usbManager_readBytes(range, sizeof(range));
+				
+				// the delete blocks the main loop until the FDS operations already queued and its deletes are done,
+				// which would stall a running sweep
+				if (!AD5933_SweepRunning(&engine))
+				{
+					if (commitAction != ACTION_NONE) finishCommit();
+					
+					res = flashManager_deleteSweeps(range[0], range[1], &report);
+				}
+				
+				uint8_t buff[1] = {res ? 2 : 1};
+				usbManager_writeBytes(buff, 1);
+				usbManager_writeBytes(&report, sizeof(report));
+			}
     }
+		
+		// start the sweep requested by the rtc
+		if (rtcSweepPending && startSweep(ACTION_SAVE))
+		{
+			rtcSweepPending = false;
+		}
+		
+		// let the sweep engine do its next step, then handle the data if the sweep is done
+		if (AD5933_SweepRunning(&engine) && AD5933_SweepPoll(&engine) >= SWEEP_COMPLETE)
+		{
+			finishSweep();
+		}
+		
+		// count the saved sweep once its head record is in flash
+		if (commitAction != ACTION_NONE && flashManager_commitPoll() != COMMIT_WRITING)
+		{
+			finishCommit();
+		}
+		
+		// evict old sweeps and garbage collect between sweeps, so a save never waits for it
+		if (sweepAction == ACTION_NONE)
+		{
+			flashManager_idle();
+		}
+		
     // Sleep CPU only if there was no interrupt since last loop processing
     __WFE();
 	}
 }
 
 
-bool saveSweep()
+// Starts a sweep in the background. The sweep engine is run from the main loop
+// Arguments:
+//  action: what to do with the data when the sweep is done (ACTION_)
+// Returns:
+//  true if the sweep started
+//  false if a sweep is already running or the sweep could not be started
+bool startSweep(uint8_t action)
 {
-	// allocate memory for sweep data
-	uint32_t * freq = nrf_malloc(MAX_FREQ_SIZE);
-	uint16_t * real = nrf_malloc(MAX_IMP_SIZE);
-	uint16_t * imag = nrf_malloc(MAX_IMP_SIZE);
+	// only one sweep at a time
+	if (sweepAction != ACTION_NONE) return false;
 	
-	bool res = false; // saves if sweep success
-
-	if (AD5933_Sweep(&sweep, freq, real, imag))
+	// the points are sent over usb or saved to flash as they are measured
+	if (action == ACTION_SEND_USB)
+	{
+		usbManager_initSink(&sweepSink);
+	}
+	else if (action == ACTION_CALIBRATE)
+	{
+		calibration_initSink(&sweepSink, &calBuilder, &calNew, calResistance, sweep.range, sweep.gain);
+	}
+	else
+	{
+		// the sweep being committed is numSweeps + 1 until it is done
+		flashManager_initSink(&sweepSink, &flashSink, numSweeps + 1 + (commitAction != ACTION_NONE));
+	}
+	
+	// the number of points the sink should expect
+	sweep.metadata.numPoints = sweep.steps + 1;
+	
+	// start the sink once the sweep has started, so nothing is sent for a sweep that never started
+	if (!AD5933_SweepBeginSink(&engine, &sweep, &sweepSink) || !sweepSink_begin(&sweepSink, &sweep.metadata))
 	{
-		if (flashManager_saveSweep(freq, real, imag, &sweep.metadata, numSweeps + 1))
-		{
-			numSweeps += 1;
-			flashManager_updateNumSweeps(&numSweeps);
 #ifdef DEBUG_LOG
-			NRF_LOG_INFO("Sweep %d saved", numSweeps);
-			NRF_LOG_FLUSH();
+		NRF_LOG_INFO("Sweep start fail");
+		NRF_LOG_FLUSH();
 #endif
-			res = true;
+		AD5933_SweepComplete(&engine);
+		
+		return false;
+	}
+	
+	sweepAction = action;
+	nrf_drv_gpiote_out_toggle(LED_SWEEP);
+	
+	return true;
+}
+
+// Ends the sink of the finished sweep and handles the result according to the action it was started with
+void finishSweep(void)
+{
+	bool res = AD5933_SweepComplete(&engine); // saves if sweep success
+	
+	// the sweep before must be committed first, it almost always is by now
+	if (commitAction != ACTION_NONE) finishCommit();
+	
+	// save the last of the data (or throw it away if the sweep failed)
+	res = sweepSink_end(&sweepSink, &sweep.metadata, res);
+	
+	if (sweepAction == ACTION_SAVE || sweepAction == ACTION_SAVE_USB)
+	{
+		// the head record is written in the background, the sweep is counted once it is done
+		if (res)
+		{
+			commitAction = sweepAction;
 		}
 		else
 		{
@@ -323,22 +477,67 @@ bool saveSweep()
 			NRF_LOG_INFO("Sweep save fail");
 			NRF_LOG_FLUSH();
 #endif
+			// send the result over usb
+			if (sweepAction == ACTION_SAVE_USB)
+			{
+				uint8_t buff[1] = {1};
+				usbManager_writeBytes(buff, 1);
+			}
 		}
 	}
-	else
+	else if (sweepAction == ACTION_CALIBRATE)
 	{
+		// only replace the table in use once the new one is saved
+		if (res) res = flashManager_saveCalibration(&calNew);
+		if (res) calTable = calNew;
 #ifdef DEBUG_LOG
-		NRF_LOG_INFO("Sweep save fail");
+		if (res) NRF_LOG_INFO("Calibration saved with %d points", calTable.numPoints);
+		else NRF_LOG_INFO("Calibration fail");
 		NRF_LOG_FLUSH();
 #endif
+		
+		uint8_t buff[1] = {res ? 2 : 1};
+		usbManager_writeBytes(buff, 1);
 	}
+	else if (sweepAction == ACTION_SEND_USB)
+	{
+		// the points were already sent, a failed sweep ends early
+#ifdef DEBUG_LOG
+		if (res) NRF_LOG_INFO("Sweep Send Success");
+		else NRF_LOG_INFO("Sweep Send Fail");
+		NRF_LOG_FLUSH();
+#endif
+	}
+	
+	sweepAction = ACTION_NONE;
+	nrf_drv_gpiote_out_toggle(LED_SWEEP);
+}
+
+// Counts the saved sweep once its head record is committed to flash and sends the result of a usb save
+void finishCommit(void)
+{
+	uint32_t sweep_num;
+	bool res = flashManager_commitComplete(&sweep_num); // waits if the head record is still being written
 	
-	// free the memory
-	nrf_free(freq);
-	nrf_free(real);
-	nrf_free(imag);
+	if (res)
+	{
+		numSweeps = sweep_num;
+		flashManager_updateNumSweeps(&numSweeps);
+	}
+#ifdef DEBUG_LOG
+	if (res) NRF_LOG_INFO("Sweep %d saved", numSweeps);
+	else NRF_LOG_INFO("Sweep save fail");
+	NRF_LOG_FLUSH();
+#endif
 	
-	return res;
+	// send the result over usb
+	if (commitAction == ACTION_SAVE_USB)
+	{
+		uint8_t buff[1] = {res ? 2 : 1};
+		usbManager_writeBytes(buff, 1);
+	}
+	
+	commitAction = ACTION_NONE;
 }
 
 // recieves usb data for a sweep parameter over usb
@@ -363,8 +562,11 @@ void set_default(Sweep * sweep)
   sweep->clockSource 				= INTERN_CLOCK;
   sweep->clockFrequency 		= CLK_FREQ;
   sweep->gain 							= GAIN1;
+  sweep->repeats 						= 1;
+  sweep->average 						= AVERAGE_MEAN;
+  sweep->autoRange 					= false;
 	sweep->metadata.numPoints = sweep->steps + 1;
-	sweep->metadata.temp			= 100;
+	sweep->metadata.temp			= TEMP_UNKNOWN; // measured by the sweep engine
 	sweep->metadata.time			= 30;
 
   return;
@@ -435,9 +637,8 @@ static void rtc_handler(nrf_drv_rtc_int_type_t int_type)
 	if (int_type == NRF_DRV_RTC_INT_COMPARE0)
 	{
 		// what to do when the time to compare to has been triggered
-		nrf_drv_gpiote_out_toggle(LED_SWEEP);
-		saveSweep();
-		nrf_drv_gpiote_out_toggle(LED_SWEEP);
+		// the sweep takes seconds so it is started from the main loop instead of here
+		rtcSweepPending = true;
 		nrf_drv_rtc_cc_set(&rtc, 0, compares * (COMPARE_TIME * RTC_FREQ), true);
 	  compares++;
 	}
@@ -478,81 +679,3 @@ static void rtc_config(void)
     //Power on RTC instance
     //nrf_drv_rtc_enable(&rtc);
 }
-
-// --- TWI Functions ---
-
-// TWI events handler.
-void twi_handler(nrf_drv_twi_evt_t const * p_event, void * p_context)
-{
-  switch (p_event -> type)
-  {
-    case NRF_DRV_TWI_EVT_DONE:
-      if (p_event -> xfer_desc.type == NRF_DRV_TWI_XFER_RX)
-      {
-#if defined(DEBUG_LOG) && defined(DEBUG_TWI_ALL)
-        NRF_LOG_INFO("TWI Read Success");
-        NRF_LOG_FLUSH();
-#endif
-      }
-      else if (p_event -> xfer_desc.type == NRF_DRV_TWI_XFER_TX)
-      {
-#if defined(DEBUG_LOG) && defined(DEBUG_TWI_ALL)
-        NRF_LOG_INFO("TWI Write Success");
-        NRF_LOG_FLUSH();
-#endif
-      }
-
-      // set transfer done to true
-      m_xfer_done = true;
-      // set error to false
-      twi_error = false;
-      break;
-
-    case NRF_DRV_TWI_EVT_ADDRESS_NACK:
-#if defined(DEBUG_LOG) && defined(DEBUG_TWI_ALL)
-      NRF_LOG_INFO("TWI Address Not Found");
-      NRF_LOG_FLUSH();
-#endif
-
-      // set transfer done to true
-      m_xfer_done = true;
-      // set twi error to true
-      twi_error = true;
-      break;
-
-    case NRF_DRV_TWI_EVT_DATA_NACK:
-#if defined(DEBUG_LOG) && defined(DEBUG_TWI_ALL)
-      NRF_LOG_INFO("TWI Transfer Failed");
-      NRF_LOG_FLUSH();
-#endif
-
-      // set transfer done to true
-      m_xfer_done = true;
-      // set twi error to true
-      twi_error = true;
-      break;
-
-    default:
-      break;
-  }
-}
-
-
-// TWI (I2C) initialization.
-void twi_init (void)
-{
-  ret_code_t err_code;
-
-  const nrf_drv_twi_config_t twi_lm75b_config = {
-    .scl                = ARDUINO_SCL_PIN,
-    .sda                = ARDUINO_SDA_PIN,
-    .frequency          = NRF_DRV_TWI_FREQ_100K,
-    .interrupt_priority = APP_IRQ_PRIORITY_HIGH,
-    .clear_bus_init     = false
-  };
-  // this inits twi and sets the handler function
-  err_code = nrf_drv_twi_init(&m_twi, &twi_lm75b_config, twi_handler, NULL);
-  APP_ERROR_CHECK(err_code);
-
-  nrf_drv_twi_enable(&m_twi);
-}
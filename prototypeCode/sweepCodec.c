@@ -0,0 +1,402 @@
+/*
+ *  sweepCodec.c
+ *
+ *  Lossless streaming codec for the points of a sweep, used to store sweeps in flash and to send them
+ *  over USB and BLE. Neighbouring points of a sweep are close, so each point is coded as its difference
+ *  from what the last points predict: the frequency from a straight line through the last two, the real
+ *  and imaginary samples from the last ones.
+ *
+ *  The residuals are zigzag mapped (0, -1, 1, -2... to 0, 1, 2, 3...) and Rice coded in blocks of
+ *  SWEEP_CODEC_BLOCK points. Each block starts with the Rice parameter k of each channel, picked from
+ *  the mean residual of the block, then each residual is its quotient (residual >> k) in unary, ones
+ *  ended by a zero, and its low k bits. A residual whose quotient reaches SWEEP_CODEC_ESCAPE is sent as
+ *  SWEEP_CODEC_ESCAPE ones and its raw bits instead. The last block may be shorter, the decoder is told
+ *  how many points there are.
+ *
+ *  The encoder keeps one block of residuals and the coded bytes of one block, about 400 bytes of RAM.
+ *  The caller takes the coded bytes out after each point, as many at a time as its flash record, USB
+ *  write or BLE package has room for.
+ *
+ *  testProgram/sweepCodec.py decodes the same stream on the PC and the hub.
+ *
+ */
+
+#include "sweepCodec.h"
+
+static void sweepCodec_emitBlock(SweepEncoder * enc);
+static uint8_t sweepCodec_riceParameter(uint64_t sum, uint8_t count, uint8_t maxK);
+static void sweepCodec_putBits(SweepEncoder * enc, uint32_t value, uint8_t numBits);
+static void sweepCodec_putResidual(SweepEncoder * enc, uint32_t residual, uint8_t k, uint8_t rawBits);
+static bool sweepCodec_decodeBlock(SweepDecoder * dec);
+static uint32_t sweepCodec_getBits(SweepDecoder * dec, uint8_t numBits);
+static uint32_t sweepCodec_getResidual(SweepDecoder * dec, uint8_t k, uint8_t rawBits);
+
+// --- Encoding Functions ---
+
+// Starts an encoder on a new stream
+// Arguments:
+//  * enc - pointer to the encoder
+void sweepCodec_initEncoder(SweepEncoder * enc)
+{
+  enc->start = 0;
+  enc->size = 0;
+  enc->bits = 0;
+  enc->numBits = 0;
+  enc->fill = 0;
+  enc->count = 0;
+  enc->freq[0] = 0;
+  enc->freq[1] = 0;
+  enc->prev[0] = 0;
+  enc->prev[1] = 0;
+}
+
+// Adds a point to the stream, the block is coded once it is full
+// Arguments:
+//  * enc - pointer to the encoder
+//  freq  - frequency of the point
+//  real  - real sample of the point (see SWEEP_CODEC_SAMPLE)
+//  imag  - imaginary sample of the point
+// Return value:
+//  false if the point fills the block and the bytes of the last block have not all been taken, the point is not taken
+//  true  if success
+bool sweepCodec_encode(SweepEncoder * enc, uint32_t freq, int16_t real, int16_t imag)
+{
+  if (enc->fill == SWEEP_CODEC_BLOCK - 1 && enc->start < enc->size) return false;
+
+  // residuals wrap, so every value has one
+  int32_t freqResidual = (int32_t) (freq - 2 * enc->freq[0] + enc->freq[1]);
+  int16_t realResidual = (int16_t) (uint16_t) (real - enc->prev[0]);
+  int16_t imagResidual = (int16_t) (uint16_t) (imag - enc->prev[1]);
+
+  // zigzag maps small residuals of either sign to small codes
+  enc->freqResidual[enc->fill] = ((uint32_t) freqResidual << 1) ^ (uint32_t) (freqResidual >> 31);
+  enc->sampleResidual[0][enc->fill] = (uint16_t) (((uint16_t) realResidual << 1) ^ (uint16_t) (realResidual >> 15));
+  enc->sampleResidual[1][enc->fill] = (uint16_t) (((uint16_t) imagResidual << 1) ^ (uint16_t) (imagResidual >> 15));
+
+  // the line through the first point alone is flat, the second point is predicted to be at the first
+  enc->freq[1] = (enc->count == 0) ? freq : enc->freq[0];
+  enc->freq[0] = freq;
+  enc->prev[0] = real;
+  enc->prev[1] = imag;
+  enc->fill += 1;
+  enc->count += 1;
+
+  if (enc->fill == SWEEP_CODEC_BLOCK) sweepCodec_emitBlock(enc);
+
+  return true;
+}
+
+// Ends the stream, coding the last block and padding the last byte with zeros
+// Arguments:
+//  * enc - pointer to the encoder
+// Return value:
+//  false if the bytes of the last block have not all been taken
+//  true  if success
+bool sweepCodec_finish(SweepEncoder * enc)
+{
+  if (enc->start < enc->size) return false;
+
+  enc->start = 0;
+  enc->size = 0;
+
+  if (enc->fill > 0) sweepCodec_emitBlock(enc);
+
+  if (enc->numBits > 0) sweepCodec_putBits(enc, 0, 8 - enc->numBits);
+
+  return true;
+}
+
+// Takes coded bytes out of an encoder
+// Arguments:
+//  * enc    - pointer to the encoder
+//  * buff   - buffer to copy the bytes to
+//  maxBytes - most bytes to take
+// Return value:
+//  the number of bytes taken
+uint32_t sweepCodec_take(SweepEncoder * enc, uint8_t * buff, uint32_t maxBytes)
+{
+  uint32_t numBytes = enc->size - enc->start;
+
+  if (numBytes > maxBytes) numBytes = maxBytes;
+
+  memcpy(buff, &enc->out[enc->start], numBytes);
+  enc->start += numBytes;
+
+  return numBytes;
+}
+
+// --- Decoding Functions ---
+
+// Starts a decoder on a coded stream, which is read in place
+// Arguments:
+//  * dec     - pointer to the decoder
+//  * in      - the coded stream
+//  size      - bytes in the stream
+//  numPoints - the number of points in the stream
+void sweepCodec_initDecoder(SweepDecoder * dec, void const * in, uint32_t size, uint32_t numPoints)
+{
+  dec->in = in;
+  dec->size = size;
+  dec->pos = 0;
+  dec->bits = 0;
+  dec->numBits = 0;
+  dec->remaining = numPoints;
+  dec->fill = 0;
+  dec->next = 0;
+  dec->count = 0;
+  dec->freq[0] = 0;
+  dec->freq[1] = 0;
+  dec->prev[0] = 0;
+  dec->prev[1] = 0;
+  dec->error = false;
+}
+
+// Gets the next point of the stream
+// Arguments:
+//  * dec  - pointer to the decoder
+//  * freq - pointer to store the frequency of the point
+//  * real - pointer to store the real sample of the point
+//  * imag - pointer to store the imaginary sample of the point
+// Return value:
+//  false if there are no more points or the stream is damaged (error is set)
+//  true  if success
+bool sweepCodec_decode(SweepDecoder * dec, uint32_t * freq, int16_t * real, int16_t * imag)
+{
+  if (dec->next == dec->fill && !sweepCodec_decodeBlock(dec)) return false;
+
+  *freq = dec->blockFreq[dec->next];
+  *real = dec->blockSample[0][dec->next];
+  *imag = dec->blockSample[1][dec->next];
+  dec->next += 1;
+
+  return true;
+}
+
+#ifndef AD5933_SIM
+// Times encoding a sweep with the DWT cycle counter
+// Arguments:
+//  * freq, * real, * imag - the points of the sweep, real and imaginary data as raw register words
+//  numPoints              - the number of points
+//  * out, capacity        - output buffer for the stream
+// Return value:
+//  the number of CPU cycles per point, 0 if the stream did not fit
+uint32_t sweepCodec_cycles(uint32_t const * freq, uint16_t const * real, uint16_t const * imag, uint32_t numPoints, uint8_t * out, uint32_t capacity)
+{
+  SweepEncoder enc;
+  uint32_t size = 0;
+  bool success = true;
+
+  if (numPoints == 0) return 0;
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  uint32_t start = DWT->CYCCNT;
+  sweepCodec_initEncoder(&enc);
+  for (uint32_t i = 0; success && i < numPoints; i++)
+  {
+    success = sweepCodec_encode(&enc, freq[i], SWEEP_CODEC_SAMPLE(real[i]), SWEEP_CODEC_SAMPLE(imag[i]));
+    size += sweepCodec_take(&enc, &out[size], capacity - size);
+  }
+  success = success && sweepCodec_finish(&enc);
+  size += sweepCodec_take(&enc, &out[size], capacity - size);
+  uint32_t cycles = DWT->CYCCNT - start;
+
+  return (success && enc.start == enc.size) ? cycles / numPoints : 0;
+}
+#endif
+
+// --- Helper Functions ---
+
+// Codes the block of residuals into out, the Rice parameter of each channel first
+static void sweepCodec_emitBlock(SweepEncoder * enc)
+{
+  // all the bytes of the last block were taken
+  enc->start = 0;
+  enc->size = 0;
+
+  uint64_t freqSum = 0;
+  uint32_t sampleSum[2] = {0, 0};
+
+  for (uint8_t i = 0; i < enc->fill; i++)
+  {
+    freqSum += enc->freqResidual[i];
+    sampleSum[0] += enc->sampleResidual[0][i];
+    sampleSum[1] += enc->sampleResidual[1][i];
+  }
+
+  uint8_t k[3] =
+  {
+    sweepCodec_riceParameter(freqSum, enc->fill, SWEEP_CODEC_FREQ_BITS - 1),
+    sweepCodec_riceParameter(sampleSum[0], enc->fill, SWEEP_CODEC_SAMPLE_BITS - 1),
+    sweepCodec_riceParameter(sampleSum[1], enc->fill, SWEEP_CODEC_SAMPLE_BITS - 1)
+  };
+
+  sweepCodec_putBits(enc, (k[0] << (2 * SWEEP_CODEC_K_BITS)) | (k[1] << SWEEP_CODEC_K_BITS) | k[2], 3 * SWEEP_CODEC_K_BITS);
+
+  for (uint8_t i = 0; i < enc->fill; i++)
+  {
+    sweepCodec_putResidual(enc, enc->freqResidual[i], k[0], SWEEP_CODEC_FREQ_BITS);
+  }
+
+  for (uint8_t channel = 0; channel < 2; channel++)
+  {
+    for (uint8_t i = 0; i < enc->fill; i++)
+    {
+      sweepCodec_putResidual(enc, enc->sampleResidual[channel][i], k[channel + 1], SWEEP_CODEC_SAMPLE_BITS);
+    }
+  }
+
+  enc->fill = 0;
+}
+
+// Picks the Rice parameter for residuals with the given sum, about log2 of their mean
+static uint8_t sweepCodec_riceParameter(uint64_t sum, uint8_t count, uint8_t maxK)
+{
+  uint8_t k = 0;
+
+  while (k < maxK && ((uint64_t) count << (k + 1)) <= sum) k++;
+
+  return k;
+}
+
+// Adds up to 24 bits to the stream, whole bytes go to out
+static void sweepCodec_putBits(SweepEncoder * enc, uint32_t value, uint8_t numBits)
+{
+  enc->bits = (enc->bits << numBits) | value;
+  enc->numBits += numBits;
+
+  while (enc->numBits >= 8)
+  {
+    enc->numBits -= 8;
+    enc->out[enc->size++] = (uint8_t) (enc->bits >> enc->numBits);
+  }
+
+  enc->bits &= (1u << enc->numBits) - 1;
+}
+
+// Adds one Rice coded residual to the output
+static void sweepCodec_putResidual(SweepEncoder * enc, uint32_t residual, uint8_t k, uint8_t rawBits)
+{
+  uint32_t quotient = residual >> k;
+
+  if (quotient >= SWEEP_CODEC_ESCAPE)
+  {
+    // too large, send the escape and the raw bits
+    sweepCodec_putBits(enc, (1u << SWEEP_CODEC_ESCAPE) - 1, SWEEP_CODEC_ESCAPE);
+    if (rawBits > 16) sweepCodec_putBits(enc, residual >> 16, rawBits - 16);
+    sweepCodec_putBits(enc, residual & 0xFFFF, 16);
+    return;
+  }
+
+  // the quotient in unary, ended by a zero
+  sweepCodec_putBits(enc, ((1u << quotient) - 1) << 1, quotient + 1);
+
+  if (k > 16)
+  {
+    sweepCodec_putBits(enc, (residual >> 16) & ((1u << (k - 16)) - 1), k - 16);
+    k = 16;
+  }
+  if (k > 0) sweepCodec_putBits(enc, residual & ((1u << k) - 1), k);
+}
+
+// Decodes the next block of the stream and rebuilds its points
+// Return value:
+//  false if there are no more points or the stream is damaged (error is set)
+static bool sweepCodec_decodeBlock(SweepDecoder * dec)
+{
+  if (dec->remaining == 0 || dec->error) return false;
+
+  uint8_t count = dec->remaining < SWEEP_CODEC_BLOCK ? dec->remaining : SWEEP_CODEC_BLOCK;
+  uint32_t header = sweepCodec_getBits(dec, 3 * SWEEP_CODEC_K_BITS);
+  uint8_t mask = (1u << SWEEP_CODEC_K_BITS) - 1;
+  uint8_t k[3] = {(header >> (2 * SWEEP_CODEC_K_BITS)) & mask, (header >> SWEEP_CODEC_K_BITS) & mask, header & mask};
+
+  if (k[1] >= SWEEP_CODEC_SAMPLE_BITS || k[2] >= SWEEP_CODEC_SAMPLE_BITS) dec->error = true;
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    uint32_t residual = sweepCodec_getResidual(dec, k[0], SWEEP_CODEC_FREQ_BITS);
+    uint32_t freq = 2 * dec->freq[0] - dec->freq[1] + ((residual >> 1) ^ (0u - (residual & 1)));
+
+    dec->blockFreq[i] = freq;
+    dec->freq[1] = (dec->count + i == 0) ? freq : dec->freq[0];
+    dec->freq[0] = freq;
+  }
+
+  for (uint8_t channel = 0; channel < 2; channel++)
+  {
+    for (uint8_t i = 0; i < count; i++)
+    {
+      uint32_t residual = sweepCodec_getResidual(dec, k[channel + 1], SWEEP_CODEC_SAMPLE_BITS);
+
+      dec->prev[channel] = (int16_t) (uint16_t) (dec->prev[channel] + ((residual >> 1) ^ (0u - (residual & 1))));
+      dec->blockSample[channel][i] = dec->prev[channel];
+    }
+  }
+
+  if (dec->error) return false;
+
+  dec->remaining -= count;
+  dec->count += count;
+  dec->fill = count;
+  dec->next = 0;
+
+  return true;
+}
+
+// Reads up to 24 bits of the stream, past its end reads zeros and sets error
+static uint32_t sweepCodec_getBits(SweepDecoder * dec, uint8_t numBits)
+{
+  while (dec->numBits < numBits)
+  {
+    uint8_t byte = 0;
+
+    if (dec->pos < dec->size)
+    {
+      byte = dec->in[dec->pos];
+    }
+    else
+    {
+      dec->error = true;
+    }
+
+    dec->pos += 1;
+    dec->bits = (dec->bits << 8) | byte;
+    dec->numBits += 8;
+  }
+
+  dec->numBits -= numBits;
+  uint32_t value = (dec->bits >> dec->numBits) & ((1u << numBits) - 1);
+  dec->bits &= (1u << dec->numBits) - 1;
+
+  return value;
+}
+
+// Reads one Rice coded residual of the stream
+static uint32_t sweepCodec_getResidual(SweepDecoder * dec, uint8_t k, uint8_t rawBits)
+{
+  uint32_t quotient = 0;
+
+  // count the ones of the quotient
+  while (quotient < SWEEP_CODEC_ESCAPE && sweepCodec_getBits(dec, 1)) quotient++;
+
+  if (quotient == SWEEP_CODEC_ESCAPE)
+  {
+    uint32_t residual = 0;
+    if (rawBits > 16) residual = sweepCodec_getBits(dec, rawBits - 16) << 16;
+    return residual | sweepCodec_getBits(dec, 16);
+  }
+
+  uint32_t residual = quotient << k;
+
+  if (k > 16)
+  {
+    residual |= sweepCodec_getBits(dec, k - 16) << 16;
+    k = 16;
+  }
+  if (k > 0) residual |= sweepCodec_getBits(dec, k);
+
+  return residual;
+}
@@ -0,0 +1,88 @@
+/*
+ *  sweepCodec.h
+ *
+ *  Header file for sweepCodec.c
+ *
+ */
+
+#ifndef INC_SWEEPCODEC_H_
+#define INC_SWEEPCODEC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef AD5933_SIM
+#include "nrf.h"
+#endif
+
+// defines
+#define SWEEP_CODEC_BLOCK       16 // points in each block, each channel picks its Rice parameter once per block
+#define SWEEP_CODEC_ESCAPE      16 // a residual with a quotient this large is sent raw after SWEEP_CODEC_ESCAPE ones
+#define SWEEP_CODEC_K_BITS      5  // bits of the Rice parameter of each channel in each block
+#define SWEEP_CODEC_FREQ_BITS   32 // bits of a raw frequency residual
+#define SWEEP_CODEC_SAMPLE_BITS 16 // bits of a raw real or imaginary residual
+
+// most bytes one block can take, every residual escaped, plus the byte finishing the stream
+#define SWEEP_CODEC_MAX_BLOCK_BYTES \
+  ((3 * SWEEP_CODEC_K_BITS + SWEEP_CODEC_BLOCK * (3 * SWEEP_CODEC_ESCAPE + SWEEP_CODEC_FREQ_BITS + 2 * SWEEP_CODEC_SAMPLE_BITS) + 7) / 8 + 1)
+
+// the real and imaginary data of the driver are the raw register words, big-endian in memory,
+// these swap one to the signed sample the codec predicts on (on the little-endian nRF52) and back
+#define SWEEP_CODEC_SAMPLE(word)  ((int16_t) ((uint16_t) (((uint16_t) (word) >> 8) | ((uint16_t) (word) << 8))))
+#define SWEEP_CODEC_WORD(sample)  ((uint16_t) (((uint16_t) (sample) >> 8) | ((uint16_t) (sample) << 8)))
+
+// struct to hold the state of an encoder. Each point is coded as three residuals: the frequency against
+// a straight line through the last two (0 inside an evenly spaced run), and the real and imaginary samples
+// against the last ones. The residuals are zigzag mapped and Rice coded a block at a time, most significant bit first.
+// The bytes of a block wait in out until they are taken with sweepCodec_take
+typedef struct sweepEncoder
+{
+  uint8_t out[SWEEP_CODEC_MAX_BLOCK_BYTES]; // coded bytes not taken yet
+  uint16_t start;                        // first byte in out not taken
+  uint16_t size;                         // bytes in out
+  uint32_t bits;                         // bits not yet added to out
+  uint8_t numBits;                       // number of bits in bits, always under 8 between blocks
+  uint8_t fill;                          // points in the block
+  uint32_t count;                        // points encoded
+  uint32_t freq[2];                      // the last two frequencies, freq[0] is the last
+  int16_t prev[2];                       // the last real and imaginary samples
+  uint32_t freqResidual[SWEEP_CODEC_BLOCK];
+  uint16_t sampleResidual[2][SWEEP_CODEC_BLOCK];
+} SweepEncoder;
+
+// struct to hold the state of a decoder reading a coded stream in place
+typedef struct sweepDecoder
+{
+  uint8_t const * in;                    // the coded stream
+  uint32_t size;                         // bytes in the stream
+  uint32_t pos;                          // next byte to read
+  uint32_t bits;                         // bits read but not used
+  uint8_t numBits;                       // number of bits in bits
+  uint32_t remaining;                    // points not decoded yet
+  uint8_t fill;                          // points decoded in the block
+  uint8_t next;                          // next point of the block to give out
+  uint32_t count;                        // points decoded
+  uint32_t freq[2];                      // the last two frequencies
+  int16_t prev[2];                       // the last real and imaginary samples
+  uint32_t blockFreq[SWEEP_CODEC_BLOCK];
+  int16_t blockSample[2][SWEEP_CODEC_BLOCK];
+  bool error;                            // the stream ran out or is damaged
+} SweepDecoder;
+
+// encoding functions
+void sweepCodec_initEncoder(SweepEncoder * enc);
+bool sweepCodec_encode(SweepEncoder * enc, uint32_t freq, int16_t real, int16_t imag);
+bool sweepCodec_finish(SweepEncoder * enc);
+uint32_t sweepCodec_take(SweepEncoder * enc, uint8_t * buff, uint32_t maxBytes);
+
+// decoding functions
+void sweepCodec_initDecoder(SweepDecoder * dec, void const * in, uint32_t size, uint32_t numPoints);
+bool sweepCodec_decode(SweepDecoder * dec, uint32_t * freq, int16_t * real, int16_t * imag);
+
+#ifndef AD5933_SIM
+uint32_t sweepCodec_cycles(uint32_t const * freq, uint16_t const * real, uint16_t const * imag, uint32_t numPoints, uint8_t * out, uint32_t capacity);
+#endif
+
+#endif
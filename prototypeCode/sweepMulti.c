@@ -0,0 +1,338 @@
+/*
+ *  sweepMulti.c
+ *
+ *  Runs sweeps on several AD5933s at once, one on each channel of a TCA9548A mux (see AD5933_UseMux).
+ *  Every AD5933 settles and runs its DFTs on its own, so the bus is only needed between points: while
+ *  one AD5933 measures, the others are configured, read and stepped. Each channel has its own sweep
+ *  engine, Sweep and MetaData, and the CPU sleeps until the channel that is due first needs the bus.
+ *
+ */
+
+#include "sweepMulti.h"
+
+static SweepChannel * sweepMulti_add(SweepMultiRunner * runner, uint8_t mux, Sweep * sweep);
+static bool sweepMulti_pollDue(SweepMultiRunner * runner);
+static uint8_t sweepMulti_update(SweepMultiRunner * runner);
+static bool sweepMulti_select(uint8_t mux);
+static void sweepMulti_drop(SweepChannel * channel);
+
+// --- Channel setup functions ---
+
+// Removes all channels from a runner
+// Arguments:
+//  * runner - pointer to the runner
+void sweepMulti_init(SweepMultiRunner * runner)
+{
+  runner->numChannels = 0;
+  runner->state = SWEEP_IDLE;
+}
+
+// Adds an AD5933 whose points are stored in arrays
+// Arguments:
+//  * runner - pointer to the runner
+//  mux      - the mux channel of the AD5933
+//  * sweep  - pointer to the sweep to run on it
+//  * freq   - pointer to the arrary to store frequency data, sweep->steps + 1 long
+//  * real   - pointer to the array to store real impedance, sweep->steps + 1 long
+//  * imag   - pointer to the array to store imaginary impedance, sweep->steps + 1 long
+// Return value:
+//  false if the runner is full, the mux channel is already used or an array is missing
+//  true  if the channel was added
+bool sweepMulti_addChannel(SweepMultiRunner * runner, uint8_t mux, Sweep * sweep, uint32_t * freq, uint16_t * real, uint16_t * imag)
+{
+  // make sure there is somewhere to put the data
+  if (freq == NULL || real == NULL || imag == NULL) return false;
+
+  SweepChannel * channel = sweepMulti_add(runner, mux, sweep);
+  if (channel == NULL) return false;
+
+  channel->freq = freq;
+  channel->real = real;
+  channel->imag = imag;
+
+  return true;
+}
+
+// Adds an AD5933 whose points go to a sink as they are measured. The caller starts and ends the sink
+// Arguments:
+//  * runner - pointer to the runner
+//  mux      - the mux channel of the AD5933
+//  * sweep  - pointer to the sweep to run on it
+//  * sink   - pointer to the sink to give the points to
+// Return value:
+//  false if the runner is full, the mux channel is already used or there is no sink
+//  true  if the channel was added
+bool sweepMulti_addChannelSink(SweepMultiRunner * runner, uint8_t mux, Sweep * sweep, SweepSink * sink)
+{
+  if (sink == NULL) return false;
+
+  SweepChannel * channel = sweepMulti_add(runner, mux, sweep);
+  if (channel == NULL) return false;
+
+  channel->sink = sink;
+
+  return true;
+}
+
+// --- Running functions ---
+
+// Configures every AD5933 and starts it settling, one after the other, so they settle at the same time.
+// A channel that can not be started is marked SWEEP_ERROR and the others carry on. Returns without
+// waiting, call sweepMulti_poll whenever the CPU wakes up until it returns SWEEP_COMPLETE or SWEEP_ERROR
+// Arguments:
+//  * runner - pointer to the runner with its channels added
+// Return value:
+//  false if no channel could be started
+//  true  if at least one channel started
+bool sweepMulti_begin(SweepMultiRunner * runner)
+{
+  bool started = false;
+
+  runner->state = SWEEP_IDLE;
+
+  if (runner->numChannels == 0) return false;
+
+  // an armed PPI poll would hold the bus while another AD5933 needs it
+  runner->backend = AD5933_GetBackend();
+  AD5933_SetBackend(AD5933_BACKEND_CPU);
+
+  for (uint8_t i = 0; i < runner->numChannels; i++)
+  {
+    SweepChannel * channel = &runner->channels[i];
+    bool success = false;
+
+    if (sweepMulti_select(channel->mux))
+    {
+      if (channel->sink == NULL)
+      {
+        success = AD5933_SweepBegin(&channel->engine, channel->sweep, channel->freq, channel->real, channel->imag);
+      }
+      else
+      {
+        success = AD5933_SweepBeginSink(&channel->engine, channel->sweep, channel->sink);
+      }
+    }
+
+    if (!success)
+    {
+      channel->sweep->metadata.numPoints = 0;
+      channel->state = SWEEP_ERROR;
+      continue;
+    }
+
+    channel->state = SWEEP_SETTLING;
+    started = true;
+  }
+
+  if (!started)
+  {
+    AD5933_SetBackend(runner->backend);
+    runner->state = SWEEP_ERROR;
+    return false;
+  }
+
+  sweepMulti_update(runner);
+
+  return true;
+}
+
+// Runs the next step of every channel that is due, then sets the sweep timer for the channel due next.
+// Channels that became due while the others were using the bus are served in the same call
+// Arguments:
+//  * runner - pointer to the runner
+// Return value:
+//  the SWEEP_ state of the runner
+uint8_t sweepMulti_poll(SweepMultiRunner * runner)
+{
+  if (runner->state != SWEEP_SETTLING && runner->state != SWEEP_MEASURING) return runner->state;
+
+  // every step starts a wait, so this ends once no channel is due
+  while (sweepMulti_pollDue(runner));
+
+  return sweepMulti_update(runner);
+}
+
+// Finishes the sweeps after sweepMulti_poll returned SWEEP_COMPLETE or SWEEP_ERROR. The result of each
+// channel is in its state, and the points it measured in the metadata of its sweep
+// Arguments:
+//  * runner - pointer to the runner
+// Return value:
+//  false if any channel failed
+//  true  if every channel completed
+bool sweepMulti_complete(SweepMultiRunner * runner)
+{
+  bool success = (runner->state == SWEEP_COMPLETE);
+
+  // stop the sweeps that are still running, each AD5933 is powered down on its own channel
+  if (runner->state == SWEEP_SETTLING || runner->state == SWEEP_MEASURING)
+  {
+    for (uint8_t i = 0; i < runner->numChannels; i++)
+    {
+      SweepChannel * channel = &runner->channels[i];
+
+      if (!AD5933_SweepRunning(&channel->engine)) continue;
+
+      if (sweepMulti_select(channel->mux))
+      {
+        AD5933_SweepComplete(&channel->engine);
+        channel->state = SWEEP_ERROR;
+      }
+      else
+      {
+        sweepMulti_drop(channel);
+      }
+    }
+
+    AD5933_SetBackend(runner->backend);
+  }
+
+  runner->state = SWEEP_IDLE;
+
+  return success;
+}
+
+// Runs the sweeps of every channel, blocking until they are all done
+// Arguments:
+//  * runner - pointer to the runner with its channels added
+// Return value:
+//  false if any channel failed
+//  true  if every channel completed
+bool sweepMulti_run(SweepMultiRunner * runner)
+{
+  if (!sweepMulti_begin(runner)) return false;
+
+  // sleep until the sweep timer fires, then let the channels that are due take their next step
+  while (sweepMulti_poll(runner) < SWEEP_COMPLETE)
+  {
+    __WFE();
+  }
+
+  return sweepMulti_complete(runner);
+}
+
+// --- Helper functions ---
+
+// Adds a channel to the runner
+// Return value:
+//  the new channel, NULL if the runner is full or the mux channel is already used
+static SweepChannel * sweepMulti_add(SweepMultiRunner * runner, uint8_t mux, Sweep * sweep)
+{
+  if (runner->numChannels >= MULTI_MAX_CHANNELS || mux >= MUX_CHANNELS || sweep == NULL) return NULL;
+
+  for (uint8_t i = 0; i < runner->numChannels; i++)
+  {
+    if (runner->channels[i].mux == mux) return NULL;
+  }
+
+  SweepChannel * channel = &runner->channels[runner->numChannels];
+
+  channel->sweep = sweep;
+  channel->sink  = NULL;
+  channel->freq  = NULL;
+  channel->real  = NULL;
+  channel->imag  = NULL;
+  channel->mux   = mux;
+  channel->state = SWEEP_IDLE;
+  channel->engine.state = SWEEP_IDLE;
+
+  runner->numChannels += 1;
+
+  return channel;
+}
+
+// Runs the next step of every channel that is due
+// Return value:
+//  true if any channel was due
+static bool sweepMulti_pollDue(SweepMultiRunner * runner)
+{
+  bool polled = false;
+
+  for (uint8_t i = 0; i < runner->numChannels; i++)
+  {
+    SweepChannel * channel = &runner->channels[i];
+
+    // only talk to the AD5933s that have work to do, each select is a transfer
+    if (!AD5933_SweepDue(&channel->engine)) continue;
+
+    polled = true;
+
+    if (!sweepMulti_select(channel->mux))
+    {
+      sweepMulti_drop(channel);
+      continue;
+    }
+
+    channel->state = AD5933_SweepPoll(&channel->engine);
+
+    // the engine has powered the AD5933 down, return it to idle
+    if (channel->state >= SWEEP_COMPLETE)
+    {
+      channel->state = AD5933_SweepComplete(&channel->engine) ? SWEEP_COMPLETE : SWEEP_ERROR;
+    }
+  }
+
+  return polled;
+}
+
+// Works out the state of the runner from its channels and sets the sweep timer for the channel due next.
+// The engines share one sweep timer, so the timer each of them set for itself is replaced
+// Return value:
+//  the SWEEP_ state of the runner
+static uint8_t sweepMulti_update(SweepMultiRunner * runner)
+{
+  SweepEngine * next = NULL;
+  uint32_t nextTicks = 0;
+  bool measuring = false;
+  bool failed = false;
+
+  for (uint8_t i = 0; i < runner->numChannels; i++)
+  {
+    SweepChannel * channel = &runner->channels[i];
+
+    if (channel->state == SWEEP_ERROR) failed = true;
+    if (!AD5933_SweepRunning(&channel->engine)) continue;
+
+    if (channel->state == SWEEP_MEASURING) measuring = true;
+
+    uint32_t ticks = AD5933_SweepTicksLeft(&channel->engine);
+    if (next == NULL || ticks < nextTicks)
+    {
+      next = &channel->engine;
+      nextTicks = ticks;
+    }
+  }
+
+  // still running, wake the CPU when the first channel is due
+  if (next != NULL)
+  {
+    AD5933_SweepWake(next);
+    runner->state = measuring ? SWEEP_MEASURING : SWEEP_SETTLING;
+    return runner->state;
+  }
+
+  // all done
+  AD5933_SetBackend(runner->backend);
+  runner->state = failed ? SWEEP_ERROR : SWEEP_COMPLETE;
+
+  return runner->state;
+}
+
+// Selects the mux channel of an AD5933, the bus is recovered once if the select fails
+// Return value:
+//  false if the channel could not be selected
+//  true  if success
+static bool sweepMulti_select(uint8_t mux)
+{
+  if (AD5933_SelectChannel(mux)) return true;
+
+  return twiManager_recover() && AD5933_SelectChannel(mux);
+}
+
+// Gives up on a channel whose AD5933 can not be reached. Its engine is stopped without the power down
+// command, with no channel selected it would go nowhere or to the AD5933 of another channel
+static void sweepMulti_drop(SweepChannel * channel)
+{
+  channel->sweep->metadata.numPoints = channel->sweep->currentStep;
+  channel->engine.state = SWEEP_IDLE;
+  channel->state = SWEEP_ERROR;
+}
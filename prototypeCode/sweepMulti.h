@@ -0,0 +1,54 @@
+/*
+ *  sweepMulti.h
+ *
+ *  Header file for sweepMulti.c
+ *
+ */
+
+#ifndef INC_SWEEPMULTI_H_
+#define INC_SWEEPMULTI_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "AD5933.h"
+#include "twiManager.h"
+
+// defines
+#define MULTI_MAX_CHANNELS MUX_CHANNELS // most AD5933s swept at once, one on each mux channel
+
+// struct to hold the sweep of one AD5933
+typedef struct sweepChannel
+{
+  SweepEngine engine;  // engine running the sweep of the channel
+  Sweep * sweep;       // the sweep of the channel, its metadata gets the points measured
+  SweepSink * sink;    // where the points go, NULL if they go to freq, real and imag
+  uint32_t * freq;     // arrays of the points when there is no sink, sweep->steps + 1 long
+  uint16_t * real;
+  uint16_t * imag;
+  uint8_t mux;         // the mux channel of the AD5933
+  uint8_t state;       // the SWEEP_ state of the channel
+} SweepChannel;
+
+// struct to hold the state of sweeps running on several AD5933s at once
+typedef struct sweepMultiRunner
+{
+  SweepChannel channels[MULTI_MAX_CHANNELS];
+  uint8_t numChannels;
+  uint8_t backend;     // engine backend to put back when the sweeps are done
+  uint8_t state;       // SWEEP_SETTLING or SWEEP_MEASURING until every channel is done, then SWEEP_COMPLETE or SWEEP_ERROR
+} SweepMultiRunner;
+
+// channel setup functions
+void sweepMulti_init(SweepMultiRunner * runner);
+bool sweepMulti_addChannel(SweepMultiRunner * runner, uint8_t mux, Sweep * sweep, uint32_t * freq, uint16_t * real, uint16_t * imag);
+bool sweepMulti_addChannelSink(SweepMultiRunner * runner, uint8_t mux, Sweep * sweep, SweepSink * sink);
+
+// running functions
+bool sweepMulti_begin(SweepMultiRunner * runner);
+uint8_t sweepMulti_poll(SweepMultiRunner * runner);
+bool sweepMulti_complete(SweepMultiRunner * runner);
+bool sweepMulti_run(SweepMultiRunner * runner);
+
+#endif
@@ -0,0 +1,364 @@
+/*
+ *  sweepPlan.c
+ *
+ *  Builds sweep plans out of linear segments and log spaced specs, compiles them into the fewest
+ *  hardware sweeps and runs them back to back on the AD5933 as one sweep.
+ *
+ */
+
+#include "sweepPlan.h"
+
+static bool sweepPlan_merge(SweepSegment * first, SweepSegment const * second);
+static bool sweepPlan_fits(float first, float ratio, uint16_t steps, uint32_t delta, float tolerance);
+static float sweepPlan_decadeRoot(uint16_t n);
+static void sweepPlan_fillSweep(Sweep * sweep, Sweep const * base, SweepSegment const * segment);
+
+// --- Plan building functions ---
+
+// Empties a plan
+// Arguments:
+//  * plan - pointer to the plan
+void sweepPlan_init(SweepPlan * plan)
+{
+  plan->numSegments = 0;
+  plan->numPoints = 0;
+}
+
+// Adds a linear segment to the end of a plan
+// Arguments:
+//  * plan    - pointer to the plan
+//  * segment - pointer to the segment to copy into the plan
+// Return value:
+//  false if the plan is full or the segment is outside what the AD5933 can sweep
+//  true  if the segment was added
+bool sweepPlan_addSegment(SweepPlan * plan, SweepSegment const * segment)
+{
+  if (plan->numSegments >= PLAN_MAX_SEGMENTS) return false;
+
+  // check the segment is within the AD5933 limits
+  if (segment->start < PLAN_MIN_FREQ || segment->start > PLAN_MAX_FREQ) return false;
+  if (segment->steps > PLAN_MAX_STEPS) return false;
+  if (segment->start + segment->delta * segment->steps > PLAN_MAX_FREQ) return false;
+
+  plan->segments[plan->numSegments] = *segment;
+  plan->numSegments += 1;
+  plan->numPoints += segment->steps + 1;
+
+  return true;
+}
+
+// Adds log spaced points from start to stop as the fewest linear segments that keep every point
+// within tolerance of its ideal log spaced frequency
+// Arguments:
+//  * plan          - pointer to the plan
+//  start           - frequency of the first point in Hz
+//  stop            - highest frequency in Hz
+//  pointsPerDecade - number of points in every decade
+//  tolerance       - largest error of any point in parts per thousand of its frequency
+//  * settings      - segment to copy cycles, cyclesMultiplier, range and gain from
+// Return value:
+//  false if the arguments are out of range or the plan ran out of segments
+//  true  if the points were added
+bool sweepPlan_addLog(SweepPlan * plan, uint32_t start, uint32_t stop, uint16_t pointsPerDecade, uint16_t tolerance, SweepSegment const * settings)
+{
+  if (start < PLAN_MIN_FREQ || stop > PLAN_MAX_FREQ || stop <= start || pointsPerDecade == 0) return false;
+
+  float ratio = sweepPlan_decadeRoot(pointsPerDecade); // ratio between neighboring points
+  float error = tolerance / 1000.0f;
+  float first = start;                                 // ideal frequency of the first point of a segment
+  float end = stop + 0.5f;
+
+  while (first <= end)
+  {
+    SweepSegment segment = *settings;
+    uint16_t steps = 0;
+    uint32_t delta = 0;
+    float ideal = first;
+
+    // grow the segment until a linear ramp from its first to its last point no longer fits
+    for (uint16_t m = 1; m <= PLAN_MAX_STEPS; m++)
+    {
+      ideal *= ratio;
+      if (ideal > end) break;
+
+      uint32_t d = (uint32_t) ((ideal - first) / m + 0.5f);
+      if (!sweepPlan_fits(first, ratio, m, d, error)) break;
+
+      // rounding the increment up can take the last point past stop
+      if ((uint32_t) (first + 0.5f) + d * m > stop) break;
+
+      steps = m;
+      delta = d;
+    }
+
+    segment.start = (uint32_t) (first + 0.5f);
+    segment.delta = delta;
+    segment.steps = steps;
+
+    if (!sweepPlan_addSegment(plan, &segment)) return false;
+
+    // the next segment starts at the point after the last point of this one
+    for (uint16_t i = 0; i <= steps; i++) first *= ratio;
+  }
+
+  return true;
+}
+
+// Merges neighboring segments that continue each other with the same settings, so they run
+// as one hardware sweep. The points of the plan do not change
+// Arguments:
+//  * plan - pointer to the plan
+void sweepPlan_compile(SweepPlan * plan)
+{
+  uint8_t count = 0;
+
+  for (uint8_t i = 0; i < plan->numSegments; i++)
+  {
+    if (count > 0 && sweepPlan_merge(&plan->segments[count - 1], &plan->segments[i])) continue;
+
+    plan->segments[count] = plan->segments[i];
+    count += 1;
+  }
+
+  plan->numSegments = count;
+}
+
+// --- Plan running functions ---
+
+// Starts running a plan. Returns without waiting, call sweepPlan_poll whenever the CPU wakes up
+// until it returns SWEEP_COMPLETE or SWEEP_ERROR
+// Arguments:
+//  * runner - pointer to the runner that tracks the plan
+//  * plan   - pointer to the plan to run
+//  * base   - sweep to take the clock settings and metadata from
+//  * freq   - pointer to the arrary to store frequency data, plan->numPoints long
+//  * real   - pointer to the array to store real impedance, plan->numPoints long
+//  * imag   - pointer to the array to store imaginary impedance, plan->numPoints long
+// Return value:
+//  false if the plan is empty or the first segment could not be started
+//  true  if the plan started
+bool sweepPlan_begin(SweepPlanRunner * runner, SweepPlan * plan, Sweep const * base, uint32_t * freq, uint16_t * real, uint16_t * imag)
+{
+  runner->state = SWEEP_IDLE;
+
+  // make sure there is somewhere to put the data
+  if (freq == NULL || real == NULL || imag == NULL) return false;
+
+  sweepSink_initRam(&runner->ramSink, &runner->ram, freq, real, imag, plan->numPoints);
+
+  return sweepPlan_beginSink(runner, plan, base, &runner->ramSink);
+}
+
+// Same as sweepPlan_begin, but the points of every segment go to a sink as they are measured,
+// so the plan can have more points than fit in RAM. The caller starts and ends the sink
+// Arguments:
+//  * runner - pointer to the runner that tracks the plan
+//  * plan   - pointer to the plan to run
+//  * base   - sweep to take the clock settings and metadata from
+//  * sink   - pointer to the sink to give the points to
+// Return value:
+//  false if the plan is empty or the first segment could not be started
+//  true  if the plan started
+bool sweepPlan_beginSink(SweepPlanRunner * runner, SweepPlan * plan, Sweep const * base, SweepSink * sink)
+{
+  runner->plan    = plan;
+  runner->segment = 0;
+  runner->points  = 0;
+  runner->state   = SWEEP_IDLE;
+
+  if (plan->numSegments == 0) return false;
+
+  sweepPlan_fillSweep(&runner->sweeps[0], base, &plan->segments[0]);
+
+  if (!AD5933_SweepBeginSink(&runner->engine, &runner->sweeps[0], sink)) return false;
+
+  // keep the output on if there is another segment after this one
+  runner->engine.keepPowered = (plan->numSegments > 1);
+  runner->state = SWEEP_SETTLING;
+
+  return true;
+}
+
+// Runs the next step of the current segment and chains the next segment when it is done
+// Arguments:
+//  * runner - pointer to the runner that tracks the plan
+// Return value:
+//  the SWEEP_ state of the plan
+uint8_t sweepPlan_poll(SweepPlanRunner * runner)
+{
+  if (runner->state != SWEEP_SETTLING && runner->state != SWEEP_MEASURING) return runner->state;
+
+  uint8_t state = AD5933_SweepPoll(&runner->engine);
+
+  // segment still running
+  if (state < SWEEP_COMPLETE)
+  {
+    runner->state = state;
+    return runner->state;
+  }
+
+  Sweep * done = &runner->sweeps[runner->segment & 1];
+  runner->points += done->metadata.numPoints;
+
+  if (!AD5933_SweepComplete(&runner->engine))
+  {
+    runner->state = SWEEP_ERROR;
+    return runner->state;
+  }
+
+  runner->segment += 1;
+
+  // all segments done
+  if (runner->segment >= runner->plan->numSegments)
+  {
+    runner->state = SWEEP_COMPLETE;
+    return runner->state;
+  }
+
+  // chain the next segment, its points go to the sink right after the points of the finished segments
+  Sweep * next = &runner->sweeps[runner->segment & 1];
+  sweepPlan_fillSweep(next, done, &runner->plan->segments[runner->segment]);
+
+  if (!AD5933_SweepChain(&runner->engine, next))
+  {
+    // the output was left on for this segment, turn it off
+    AD5933_SetControl(POWER_DOWN, next->range, next->gain, next->clockSource, 0);
+    runner->state = SWEEP_ERROR;
+    return runner->state;
+  }
+
+  runner->engine.keepPowered = (runner->segment + 1 < runner->plan->numSegments);
+  runner->state = SWEEP_SETTLING;
+
+  return runner->state;
+}
+
+// Finishes a plan after sweepPlan_poll returned SWEEP_COMPLETE or SWEEP_ERROR
+// Arguments:
+//  * runner   - pointer to the runner that tracks the plan
+//  * metadata - pointer to the metadata of the merged sweep, numPoints is set to the points measured
+// Return value:
+//  false if the plan failed
+//  true  if every segment completed
+bool sweepPlan_complete(SweepPlanRunner * runner, MetaData * metadata)
+{
+  bool success = (runner->state == SWEEP_COMPLETE);
+
+  // stop a plan that is still running
+  if (runner->state == SWEEP_SETTLING || runner->state == SWEEP_MEASURING)
+  {
+    AD5933_SweepComplete(&runner->engine);
+  }
+
+  metadata->numPoints = runner->points;
+  runner->state = SWEEP_IDLE;
+
+  return success;
+}
+
+// Runs a whole plan, blocking until it is done
+// Arguments:
+//  * plan     - pointer to the plan to run
+//  * base     - sweep to take the clock settings and metadata from
+//  * freq     - pointer to the arrary to store frequency data, plan->numPoints long
+//  * real     - pointer to the array to store real impedance, plan->numPoints long
+//  * imag     - pointer to the array to store imaginary impedance, plan->numPoints long
+//  * metadata - pointer to the metadata of the merged sweep
+// Return value:
+//  false if the plan failed
+//  true  if every segment completed
+bool sweepPlan_run(SweepPlan * plan, Sweep const * base, uint32_t * freq, uint16_t * real, uint16_t * imag, MetaData * metadata)
+{
+  SweepPlanRunner runner;
+
+  if (!sweepPlan_begin(&runner, plan, base, freq, real, imag)) return false;
+
+  // sleep until the engine timer fires, then let the plan take its next step
+  while (sweepPlan_poll(&runner) < SWEEP_COMPLETE)
+  {
+    __WFE();
+  }
+
+  return sweepPlan_complete(&runner, metadata);
+}
+
+// --- Helper functions ---
+
+// Appends second to first if second continues the ramp of first with the same settings
+// Return value:
+//  true if second was merged into first
+static bool sweepPlan_merge(SweepSegment * first, SweepSegment const * second)
+{
+  // the settings must match
+  if (first->cycles != second->cycles || first->cyclesMultiplier != second->cyclesMultiplier) return false;
+  if (first->range != second->range || first->gain != second->gain) return false;
+  if (second->start <= first->start) return false;
+
+  // a single point segment takes the increment of the segment it joins
+  uint32_t delta = (first->steps != 0) ? first->delta : (second->start - first->start);
+  if (second->steps != 0 && second->delta != delta) return false;
+
+  // second must start one increment after the end of first
+  if (second->start != first->start + delta * (first->steps + 1)) return false;
+  if (first->steps + second->steps + 1 > PLAN_MAX_STEPS) return false;
+
+  first->delta = delta;
+  first->steps += second->steps + 1;
+
+  return true;
+}
+
+// Checks if every point of a linear ramp is within tolerance of its log spaced frequency
+// Arguments:
+//  first     - ideal frequency of the first point
+//  ratio     - ratio between neighboring log spaced points
+//  steps     - number of increments of the ramp
+//  delta     - increment of the ramp in Hz
+//  tolerance - largest allowed error as a fraction of the frequency
+static bool sweepPlan_fits(float first, float ratio, uint16_t steps, uint32_t delta, float tolerance)
+{
+  uint32_t start = (uint32_t) (first + 0.5f);
+  float ideal = first;
+
+  for (uint16_t j = 1; j <= steps; j++)
+  {
+    ideal *= ratio;
+
+    float error = (float) (start + delta * j) - ideal;
+    if (error < 0) error = -error;
+    if (error > tolerance * ideal) return false;
+  }
+
+  return true;
+}
+
+// Calculates 10^(1/n) with Newton's method so the plan does not need libm
+static float sweepPlan_decadeRoot(uint16_t n)
+{
+  float x = 1.0f + 2.302585f / n; // e^(ln(10) / n) is close to 1 + ln(10) / n
+
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    // x^(n - 1)
+    float p = 1.0f;
+    for (uint16_t k = 1; k < n; k++) p *= x;
+
+    x -= (p * x - 10.0f) / (n * p);
+  }
+
+  return x;
+}
+
+// Fills a sweep with the frequencies and settings of a segment and the rest from base
+static void sweepPlan_fillSweep(Sweep * sweep, Sweep const * base, SweepSegment const * segment)
+{
+  *sweep = *base;
+
+  sweep->start            = segment->start;
+  sweep->delta            = segment->delta;
+  sweep->steps            = segment->steps;
+  sweep->cycles           = segment->cycles;
+  sweep->cyclesMultiplier = segment->cyclesMultiplier;
+  sweep->range            = segment->range;
+  sweep->gain             = segment->gain;
+}
@@ -0,0 +1,70 @@
+/*
+ *  sweepPlan.h
+ *
+ *  Header file for sweepPlan.c
+ *
+ */
+
+#ifndef INC_SWEEPPLAN_H_
+#define INC_SWEEPPLAN_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "AD5933.h"
+#include "sweepSink.h"
+
+// defines
+#define PLAN_MAX_SEGMENTS 16  // most hardware sweeps in a plan
+#define PLAN_MAX_STEPS    511 // most increments the AD5933 can do in one sweep
+#define PLAN_MIN_FREQ     1000
+#define PLAN_MAX_FREQ     100000
+
+// struct to hold one linear segment of a sweep plan, run as one hardware sweep
+typedef struct sweepSegment
+{
+  uint32_t start;           // the start frequency
+  uint32_t delta;           // the size of each increment
+  uint16_t steps;           // the number of increments
+  uint16_t cycles;          // the number of settling cycle times
+  uint8_t cyclesMultiplier; // the multiplier for the settling cycle times
+  uint8_t range;            // the output excitation voltage range
+  uint8_t gain;             // the PGA gain of the input frequency
+} SweepSegment;
+
+// struct to hold a sweep plan, a list of segments run back to back
+typedef struct sweepPlan
+{
+  SweepSegment segments[PLAN_MAX_SEGMENTS];
+  uint8_t numSegments;
+  uint32_t numPoints; // total number of points of all segments
+} SweepPlan;
+
+// struct to hold the state of a running sweep plan
+typedef struct sweepPlanRunner
+{
+  SweepEngine engine;  // engine running the current segment
+  SweepPlan * plan;    // the plan being run
+  Sweep sweeps[2];     // sweep of the current and previous segment (chaining compares them)
+  uint8_t segment;     // index of the current segment
+  uint32_t points;     // number of points measured by the finished segments
+  SweepSink ramSink;   // sink used when the plan is given arrays
+  SweepRam ram;        // arrays of ramSink, long enough for the whole plan
+  uint8_t state;       // the SWEEP_ state of the plan
+} SweepPlanRunner;
+
+// plan building functions
+void sweepPlan_init(SweepPlan * plan);
+bool sweepPlan_addSegment(SweepPlan * plan, SweepSegment const * segment);
+bool sweepPlan_addLog(SweepPlan * plan, uint32_t start, uint32_t stop, uint16_t pointsPerDecade, uint16_t tolerance, SweepSegment const * settings);
+void sweepPlan_compile(SweepPlan * plan);
+
+// plan running functions
+bool sweepPlan_begin(SweepPlanRunner * runner, SweepPlan * plan, Sweep const * base, uint32_t * freq, uint16_t * real, uint16_t * imag);
+bool sweepPlan_beginSink(SweepPlanRunner * runner, SweepPlan * plan, Sweep const * base, SweepSink * sink);
+uint8_t sweepPlan_poll(SweepPlanRunner * runner);
+bool sweepPlan_complete(SweepPlanRunner * runner, MetaData * metadata);
+bool sweepPlan_run(SweepPlan * plan, Sweep const * base, uint32_t * freq, uint16_t * real, uint16_t * imag, MetaData * metadata);
+
+#endif
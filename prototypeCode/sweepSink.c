@@ -0,0 +1,97 @@
+/*
+ *  sweepSink.c
+ *
+ *  Sweep sinks take the points of a sweep one at a time as they are measured, so a sweep does
+ *  not need to fit in RAM. The flash sink is in flashManager.c and the USB sink in usbManager.c
+ *
+ */
+
+#include "sweepSink.h"
+
+static bool sweepSink_ramPoint(SweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag);
+
+// Starts a sink before the first point of a sweep
+// Arguments:
+//  * sink     - pointer to the sink
+//  * metadata - metadata of the sweep, numPoints is the number of points expected
+// Return value:
+//  false if the sink could not be started
+//  true  if success
+bool sweepSink_begin(SweepSink * sink, MetaData const * metadata)
+{
+  sink->count = 0;
+
+  if (sink->begin == NULL) return true;
+
+  return sink->begin(sink, metadata);
+}
+
+// Gives a sink the next point of the sweep
+// Arguments:
+//  * sink - pointer to the sink
+//  freq   - frequency of the point
+//  real   - real impedance of the point
+//  imag   - imaginary impedance of the point
+// Return value:
+//  false if the sink could not take the point
+//  true  if success
+bool sweepSink_point(SweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag)
+{
+  if (!sink->point(sink, freq, real, imag)) return false;
+
+  sink->count += 1;
+
+  return true;
+}
+
+// Ends a sink after the last point of a sweep
+// Arguments:
+//  * sink     - pointer to the sink
+//  * metadata - final metadata of the sweep
+//  success    - false if the sweep failed, the sink should throw away what it has
+// Return value:
+//  false if the sweep failed or the sink could not finish
+//  true  if success
+bool sweepSink_end(SweepSink * sink, MetaData * metadata, bool success)
+{
+  if (sink->end == NULL) return success;
+
+  return sink->end(sink, metadata, success) && success;
+}
+
+// Sets up a sink that stores the points in arrays
+// Arguments:
+//  * sink   - pointer to the sink to set up
+//  * ram    - pointer to the struct to hold the arrays, must stay valid while the sink is used
+//  * freq   - pointer to the arrary to store frequency data
+//  * real   - pointer to the array to store real impedance
+//  * imag   - pointer to the array to store imaginary impedance
+//  capacity - length of the arrays
+void sweepSink_initRam(SweepSink * sink, SweepRam * ram, uint32_t * freq, uint16_t * real, uint16_t * imag, uint32_t capacity)
+{
+  ram->freq     = freq;
+  ram->real     = real;
+  ram->imag     = imag;
+  ram->capacity = capacity;
+
+  sink->begin   = NULL;
+  sink->point   = sweepSink_ramPoint;
+  sink->end     = NULL;
+  sink->context = ram;
+  sink->count   = 0;
+}
+
+// Stores a point in the arrays of a RAM sink
+static bool sweepSink_ramPoint(SweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag)
+{
+  SweepRam * ram = sink->context;
+
+  // the arrays are full
+  if (sink->count >= ram->capacity) return false;
+
+  ram->freq[sink->count] = freq;
+  ram->real[sink->count] = real;
+  ram->imag[sink->count] = imag;
+
+  return true;
+}
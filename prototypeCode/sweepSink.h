@@ -0,0 +1,25 @@
+/*
+ *  sweepSink.h
+ *
+ *  Header file for sweepSink.c
+ *
+ */
+
+#ifndef INC_SWEEPSINK_H_
+#define INC_SWEEPSINK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "AD5933.h"
+
+// sink functions, called by whoever runs the sweep
+bool sweepSink_begin(SweepSink * sink, MetaData const * metadata);
+bool sweepSink_point(SweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag);
+bool sweepSink_end(SweepSink * sink, MetaData * metadata, bool success);
+
+// RAM sink, stores the points in arrays
+void sweepSink_initRam(SweepSink * sink, SweepRam * ram, uint32_t * freq, uint16_t * real, uint16_t * imag, uint32_t capacity);
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ *  twiManager.c
+ *
+ *  Brings up the TWI bus to the AD5933 at the fastest speed it works at, and gets it back
+ *  when a transfer fails: the bus is cleared by clocking SCL until the AD5933 lets go of SDA,
+ *  the driver is restarted and the bus is slowed down if the speed stopped working.
+ *  A recovery never speeds the bus up again, it stays at the slower speed until twiManager_init
+ *  probes from the fastest speed again.
+ *
+ */
+
+#include <string.h>
+
+#include "twiManager.h"
+#include "AD5933.h"
+
+// get the TWI instance
+const nrf_drv_twi_t m_twi = NRF_DRV_TWI_INSTANCE(TWI_INSTANCE_ID);
+
+// Indicates if operation on TWI has ended
+volatile bool m_xfer_done = false;
+
+// Indicates TWI error
+volatile bool twi_error = false;
+
+// driver settings and clock of each speed, fastest first
+static const nrf_drv_twi_frequency_t m_speed_setting[TWI_NUM_SPEEDS] = {NRF_DRV_TWI_FREQ_400K, NRF_DRV_TWI_FREQ_250K, NRF_DRV_TWI_FREQ_100K};
+static const uint32_t m_speed_frequency[TWI_NUM_SPEEDS] = {400000, 250000, 100000};
+
+// index of the speed in use
+static uint8_t m_speed = TWI_NUM_SPEEDS - 1;
+
+// the driver has been initialized
+static bool m_started = false;
+
+// counters since twiManager_init
+static TwiBusStats m_stats;
+
+// Starts the TWI driver at the fastest speed the AD5933 answers reliably at. Must be called
+// after AD5933_Init, the probe uses its transfer timeouts
+// Return value:
+//  false if the AD5933 did not answer at any speed, the driver is left running at 100 kHz
+//  true  if success
+bool twiManager_init(void)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+
+  for (uint8_t speed = 0; speed < TWI_NUM_SPEEDS; speed++)
+  {
+    if (twiManager_start(speed) && twiManager_probe()) return true;
+
+#ifdef DEBUG_TWI
+    NRF_LOG_INFO("TWI probe at %d Hz failed", m_speed_frequency[speed]);
+    NRF_LOG_FLUSH();
+#endif
+  }
+
+  return false;
+}
+
+// Gets the bus working again after a failed or timed out transfer. The driver is restarted with
+// a bus clear, which clocks SCL until a stuck AD5933 releases SDA, and the bus is probed. If the
+// probe fails the next slower speed is tried. The speed is never raised here, see twiManager_init
+// Return value:
+//  false if the AD5933 did not answer at any speed
+//  true  if the bus works again
+bool twiManager_recover(void)
+{
+  m_stats.recoveries += 1;
+
+  for (uint8_t speed = m_speed; speed < TWI_NUM_SPEEDS; speed++)
+  {
+    if (speed != m_speed) m_stats.fallbacks += 1;
+
+    if (twiManager_start(speed) && twiManager_probe()) return true;
+  }
+
+#ifdef DEBUG_TWI
+  NRF_LOG_INFO("TWI bus could not be recovered");
+  NRF_LOG_FLUSH();
+#endif
+
+  return false;
+}
+
+// Returns the TWI clock in use in Hz
+uint32_t twiManager_getFrequency(void)
+{
+  return m_speed_frequency[m_speed];
+}
+
+// Copies the bus manager counters
+// Arguments:
+//  * stats - pointer to the struct to copy to
+void twiManager_getStats(TwiBusStats * stats)
+{
+  *stats = m_stats;
+  stats->frequency = m_speed_frequency[m_speed];
+}
+
+// (Re)initializes the TWI driver at a speed. clear_bus_init makes the driver clock SCL
+// before it takes the pins, so a slave holding SDA low finishes its byte and lets go
+// Arguments:
+//  speed - index of the speed in m_speed_setting
+// Return value:
+//  false if the driver could not be initialized
+//  true  if success
+static bool twiManager_start(uint8_t speed)
+{
+  ret_code_t err_code;
+
+  const nrf_drv_twi_config_t twi_config = {
+    .scl                = ARDUINO_SCL_PIN,
+    .sda                = ARDUINO_SDA_PIN,
+    .frequency          = m_speed_setting[speed],
+    .interrupt_priority = APP_IRQ_PRIORITY_HIGH,
+    .clear_bus_init     = true,
+    .hold_bus_uninit    = false
+  };
+
+  if (m_started)
+  {
+    nrf_drv_twi_uninit(&m_twi);
+    m_started = false;
+  }
+
+  m_speed = speed;
+  m_xfer_done = false;
+  twi_error = false;
+
+  // this inits twi and sets the handler function
+  err_code = nrf_drv_twi_init(&m_twi, &twi_config, twiManager_handler, NULL);
+  if (err_code != NRF_SUCCESS) return false;
+
+  nrf_drv_twi_enable(&m_twi);
+  m_started = true;
+
+  // nothing is known about the AD5933 pointer or registers after the bus was cleared
+  AD5933_InvalidateShadow();
+
+  return true;
+}
+
+// Checks that the AD5933 (or the mux in front of the AD5933s) answers at the current speed
+// Return value:
+//  false if any read failed
+//  true  if all reads succeeded
+static bool twiManager_probe(void)
+{
+  for (uint8_t i = 0; i < TWI_PROBE_READS; i++)
+  {
+    if (!AD5933_Probe()) return false;
+  }
+
+  return true;
+}
+
+// TWI events handler.
+static void twiManager_handler(nrf_drv_twi_evt_t const * p_event, void * p_context)
+{
+  UNUSED_PARAMETER(p_context);
+
+  switch (p_event -> type)
+  {
+    case NRF_DRV_TWI_EVT_DONE:
+#if defined(DEBUG_TWI) && defined(DEBUG_TWI_ALL)
+      if (p_event -> xfer_desc.type == NRF_DRV_TWI_XFER_RX)
+      {
+        NRF_LOG_INFO("TWI Read Success");
+      }
+      else if (p_event -> xfer_desc.type == NRF_DRV_TWI_XFER_TX)
+      {
+        NRF_LOG_INFO("TWI Write Success");
+      }
+#endif
+
+      // set transfer done to true
+      m_xfer_done = true;
+      // set error to false
+      twi_error = false;
+      break;
+
+    case NRF_DRV_TWI_EVT_ADDRESS_NACK:
+#if defined(DEBUG_TWI) && defined(DEBUG_TWI_ALL)
+      NRF_LOG_INFO("TWI Address Not Found");
+#endif
+
+      // set transfer done to true
+      m_xfer_done = true;
+      // set twi error to true
+      twi_error = true;
+      break;
+
+    case NRF_DRV_TWI_EVT_DATA_NACK:
+#if defined(DEBUG_TWI) && defined(DEBUG_TWI_ALL)
+      NRF_LOG_INFO("TWI Transfer Failed");
+#endif
+
+      // set transfer done to true
+      m_xfer_done = true;
+      // set twi error to true
+      twi_error = true;
+      break;
+
+    default:
+      break;
+  }
+}
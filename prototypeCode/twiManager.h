@@ -0,0 +1,54 @@
+/*
+ *  twiManager.h
+ *  
+ *  Header file for twiManager.c
+ *
+ */
+ 
+#ifndef INC_TWIMANAGER_H_
+#define INC_TWIMANAGER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef AD5933_SIM
+#include "twiSim.h"
+#else
+#include "nrf_drv_twi.h"
+#include "app_util_platform.h"
+#include "boards.h"
+#endif
+
+#ifdef DEBUG_TWI
+#include "nrf_log.h"
+#include "nrf_log_ctrl.h"
+#include "nrf_log_default_backends.h"
+#endif
+
+// defines
+#define TWI_INSTANCE_ID   0
+#define TWI_NUM_SPEEDS    3 // 400 kHz, 250 kHz and 100 kHz, fastest first
+#define TWI_PROBE_READS   8 // status reads that must all succeed for a speed to be used
+#define TWI_POINT_RETRIES 3 // times a failed status or data read or command of a point is retried after recovering the bus
+
+// struct to hold the bus manager counters
+typedef struct twiBusStats
+{
+  uint32_t frequency;  // the TWI clock in use (Hz)
+  uint16_t recoveries; // number of times the bus was cleared and the driver restarted
+  uint16_t fallbacks;  // number of times the bus was slowed down because a speed stopped working
+} TwiBusStats;
+
+// public functions
+bool twiManager_init(void);
+bool twiManager_recover(void);
+uint32_t twiManager_getFrequency(void);
+void twiManager_getStats(TwiBusStats * stats);
+
+// static functions
+static bool twiManager_start(uint8_t speed);
+static bool twiManager_probe(void);
+static void twiManager_handler(nrf_drv_twi_evt_t const * p_event, void * p_context);
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ *  twiPoll.c
+ *
+ *  Polls the AD5933 for a point without the CPU. A TIMER compare starts a TWIM transfer held
+ *  in EasyDMA through PPI: a block read command and a POLL_BYTES read of STATUS_REG up to the
+ *  imaginary data, so the status and the data come back in one transfer. The CPU sleeps until
+ *  twi_handler reports the transfer done. The AD5933 pointer must be at STATUS_REG, the block
+ *  read leaves it there.
+ *
+ */
+
+#include "AD5933.h"
+
+#ifdef AD5933_PPI_POLL
+
+#include "twiPoll.h"
+
+// timer that starts the poll
+static const nrf_drv_timer_t m_poll_timer = NRF_DRV_TIMER_INSTANCE(POLL_TIMER_INSTANCE);
+
+// connects the timer compare event to the TWIM start task
+static nrf_ppi_channel_t m_poll_channel;
+
+// block read command of the poll, EasyDMA needs it in RAM
+static uint8_t m_poll_command[2] = {BLOCK_READ, POLL_BYTES};
+
+// a poll is armed and has not been finished with twiPoll_cancel
+static bool m_armed = false;
+
+// Sets up the timer and the PPI channel. The TWI driver must be running (twiManager_init)
+// Return value:
+//  false if the timer or PPI channel could not be set up
+//  true  if success
+bool twiPoll_init(void)
+{
+  ret_code_t err_code;
+
+  nrf_drv_timer_config_t timer_config = NRF_DRV_TIMER_DEFAULT_CONFIG;
+  timer_config.frequency = NRF_TIMER_FREQ_1MHz;
+
+  err_code = nrf_drv_timer_init(&m_poll_timer, &timer_config, twiPoll_timerHandler);
+  if (err_code != NRF_SUCCESS) return false;
+
+  // the PPI driver may already be up for another module
+  err_code = nrf_drv_ppi_init();
+  if (err_code != NRF_SUCCESS && err_code != NRF_ERROR_MODULE_ALREADY_INITIALIZED) return false;
+
+  if (nrf_drv_ppi_channel_alloc(&m_poll_channel) != NRF_SUCCESS) return false;
+
+  err_code = nrf_drv_ppi_channel_assign(m_poll_channel,
+                                        nrf_drv_timer_compare_event_address_get(&m_poll_timer, NRF_TIMER_CC_CHANNEL0),
+                                        nrf_drv_twi_start_task_get(&m_twi, NRF_DRV_TWI_XFER_TXRX));
+  if (err_code != NRF_SUCCESS) return false;
+
+  return nrf_drv_ppi_channel_enable(m_poll_channel) == NRF_SUCCESS;
+}
+
+// Arms a poll us microseconds from now. The transfer is set up in EasyDMA and the timer is started,
+// nothing runs on the CPU until the transfer is done and twi_handler sets m_xfer_done
+// Arguments:
+//  us     - time until the poll
+//  * buff - array of POLL_BYTES to read STATUS_REG to the imaginary data into, must stay valid until done
+// Return value:
+//  false if the transfer could not be set up
+//  true  if success
+bool twiPoll_arm(uint32_t us, uint8_t * buff)
+{
+  nrf_drv_twi_xfer_desc_t xfer = NRF_DRV_TWI_XFER_DESC_TXRX(AD5933_ADDR, m_poll_command, sizeof(m_poll_command), buff, POLL_BYTES);
+
+  nrf_drv_timer_disable(&m_poll_timer);
+  nrf_timer_event_clear(m_poll_timer.p_reg, NRF_TIMER_EVENT_COMPARE0);
+
+  m_xfer_done = false;
+  if (nrf_drv_twi_xfer(&m_twi, &xfer, NRF_DRV_TWI_FLAG_HOLD_XFER) != NRF_SUCCESS) return false;
+
+  // the timer stops itself on the compare, so it starts one transfer
+  nrf_drv_timer_extended_compare(&m_poll_timer, NRF_TIMER_CC_CHANNEL0, nrf_drv_timer_us_to_ticks(&m_poll_timer, us),
+                                 NRF_TIMER_SHORT_COMPARE0_STOP_MASK, false);
+  nrf_drv_timer_clear(&m_poll_timer);
+  nrf_drv_timer_enable(&m_poll_timer);
+
+  m_armed = true;
+  return true;
+}
+
+// Returns true if the armed poll has finished (the status and data are in the buffer given to
+// twiPoll_arm, or twi_error is set)
+bool twiPoll_done(void)
+{
+  return m_armed && m_xfer_done;
+}
+
+// Stops the armed poll
+// Returns:
+//  true if the poll transfer has started and is still on the bus, wait for m_xfer_done before using the bus
+bool twiPoll_cancel(void)
+{
+  if (!m_armed) return false;
+
+  m_armed = false;
+  nrf_drv_timer_disable(&m_poll_timer);
+
+  return nrf_timer_event_check(m_poll_timer.p_reg, NRF_TIMER_EVENT_COMPARE0) && !m_xfer_done;
+}
+
+// The compare interrupt is not enabled, PPI does all the work
+static void twiPoll_timerHandler(nrf_timer_event_t event_type, void * p_context)
+{
+  UNUSED_PARAMETER(event_type);
+  UNUSED_PARAMETER(p_context);
+}
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ *  twiPoll.h
+ *  
+ *  Header file for twiPoll.c
+ *
+ *  Only built with AD5933_PPI_POLL defined. The nRF52 build also needs the TIMER1 and PPI
+ *  drivers enabled in sdk_config.h (TIMER_ENABLED, TIMER1_ENABLED, PPI_ENABLED) and TWIM
+ *  (TWI0_USE_EASY_DMA, already set)
+ *
+ */
+ 
+#ifndef INC_TWIPOLL_H_
+#define INC_TWIPOLL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef AD5933_SIM
+#include "twiSim.h"
+#else
+#include "nrf_drv_twi.h"
+#include "nrf_drv_timer.h"
+#include "nrf_drv_ppi.h"
+#endif
+
+// defines
+#define POLL_TIMER_INSTANCE 1 // TIMER0 is used by the SoftDevice when BLE is added
+
+// public functions
+bool twiPoll_init(void);
+bool twiPoll_arm(uint32_t us, uint8_t * buff);
+bool twiPoll_cancel(void);
+bool twiPoll_done(void);
+
+// static functions
+static void twiPoll_timerHandler(nrf_timer_event_t event_type, void * p_context);
+
+#endif
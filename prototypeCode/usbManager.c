@@ -16,67 +16,59 @@ static uint8_t m_tx_buffer[NRF_DRV_USBD_EPSIZE];
 
 // Indicates if USB rx has occured
 static volatile bool rx_ready = false;
-static volatile bool tx_ready = false;
+static volatile bool tx_ready = false;  // the last write is done and the next one can start
+static volatile bool port_open = false;
 
+// encoder of the coded sink, only one coded sweep is sent at a time
+static SweepEncoder m_encoder;
 
-// Sends a sweep over usb given the sweep data
+
+// Sends a saved sweep over usb straight from flash, the coded records are sent as they are saved without
+// decoding them or copying them to RAM. The start byte is 6, then each record is a segment: its number of
+// bytes and of points (2 bytes each) then the coded bytes. A segment of 0 bytes ends the sweep. Sweeps
+// saved before the records were coded are decoded and sent the same as usbManager_initCodedSink
 // Arguments:
-//  * freq     - pointer to the frequency data
-//  * real     - real impedance data pointer
-//  * imag     - imaginary impedance data pointer
-//  * metadata - pointer to the sweep metadata
-//  sweepNum   - the sweep number to send
+//  sweep_num - the number of the sweep to send
 // Returns:
 //  true if send success
 //  false if send fail
-bool usbManager_sendSweep(uint32_t * freq, uint16_t * real , uint16_t * imag, MetaData * metadata)
+bool usbManager_sendSavedSweep(uint32_t sweep_num)
 {
-	uint8_t buff[8];		      // buffer to store data points
-	uint8_t * sel;			     //	pointer to select each byte in data
-	bool ret;       		    // saves if get sweep fails
-  uint16_t current = 0;  // keeps track of the current data point
+	bool ret;
+	SweepReader reader;
+	SweepChunk chunk;
+	MetaData metadata;
+	uint8_t start[1] = {6};
+	SweepChunk const end = {0};
 
 #ifdef DEBUG_USB
-  NRF_LOG_INFO("Sending sweep over usb");
+  NRF_LOG_INFO("Sending saved sweep %d over usb", sweep_num);
   NRF_LOG_FLUSH();
 #endif
-	
-	// let the python script know to start reading
-	uint8_t start[1] = {3};
-	usbManager_writeBytes(start, 1);
 
-  do {
-		// wait 10ms, this fixed an invalid data error being reported by usb_write
-		nrf_delay_ms(10);
-		
-		// cut up frequency into bytes
-		sel = (uint8_t *) &freq[current];
-		buff[0] = sel[0];
-		buff[1] = sel[1];
-		buff[2] = sel[2];
-		buff[3] = sel[3];
-
-		// copy the real and imaginary impedance values
-		sel = (uint8_t *) &real[current];
-		buff[4] = sel[0];
-		buff[5] = sel[1];
+	bool open = flashManager_openSweep(&reader, &metadata, sweep_num);
+	
+	if (!open || reader.head->version != SWEEP_RECORD_VERSION)
+	{
+		SweepSink sink;
 		
-		sel = (uint8_t *) &imag[current];
-		buff[6] = sel[0];
-		buff[7] = sel[1];
-
-		// send all the data over usb
-		ret = usbManager_writeBytes(buff, 8);
+		if (open) flashManager_closeSweep(&reader);
 		
-		// increment data point
-		current++;
-	} while (ret && current < metadata->numPoints);
-	// wait once more, this also fixes a usb invalid data issue
-	nrf_delay_ms(10);
+		usbManager_initCodedSink(&sink);
+		return flashManager_readSweep(&sink, &metadata, sweep_num);
+	}
 	
-	// send a blank sweep to indicate sweep done
-	uint8_t done[8] = {0};
-	ret = usbManager_writeBytes(done, 8);
+	ret = usbManager_writeBytes(start, 1);
+	
+	while (ret && flashManager_nextChunk(&reader, &chunk))
+	{
+		ret = usbManager_sendSegment(&chunk);
+	}
+	
+	// the end is sent even if a segment failed, so the python script stops reading
+	ret = usbManager_sendSegment(&end) && ret && !reader.error;
+	
+	flashManager_closeSweep(&reader);
 
 #ifdef DEBUG_USB
 	if (ret) 
@@ -87,7 +79,262 @@ bool usbManager_sendSweep(uint32_t * freq, uint16_t * real , uint16_t * imag, Me
   return ret;
 }
 
-// Writes numBytes from buff over USB
+// Sets up a sink that sends the points of a sweep over usb as they are given to it. The start byte is 3,
+// then each point is the frequency (4 bytes), real and imaginary data (2 bytes each). A blank point of
+// 8 bytes ends the sweep
+// Arguments:
+//  * sink - pointer to the sink to set up
+void usbManager_initSink(SweepSink * sink)
+{
+	sink->begin   = usbManager_sinkBegin;
+	sink->point   = usbManager_sinkPoint;
+	sink->end     = usbManager_sinkEnd;
+	sink->context = NULL;
+	sink->count   = 0;
+}
+
+// Sets up a sink that converts the points of a sweep to calibrated impedance and sends them over usb.
+// Each point is the frequency (4 bytes), |Z| in ohms with CAL_Z_FRAC fraction bits (4 bytes) and
+// the phase in 0.01 degree (2 bytes, signed), after the same start byte as usbManager_initSink
+// Arguments:
+//  * sink  - pointer to the sink to set up
+//  * table - pointer to the calibration table, must stay valid while the sink is used
+void usbManager_initCalibratedSink(SweepSink * sink, CalTable const * table)
+{
+	sink->begin   = usbManager_sinkBegin;
+	sink->point   = usbManager_calibratedSinkPoint;
+	sink->end     = usbManager_calibratedSinkEnd;
+	sink->context = (void *) table;
+	sink->count   = 0;
+}
+
+// Sets up a sink that codes the points of a sweep with sweepCodec.c and sends the coded bytes over usb.
+// The start byte is 5, then the coded stream follows in writes of a length byte and up to USB_CODED_CHUNK
+// bytes. A length of 0 ends the stream and is followed by the number of points (4 bytes)
+// Arguments:
+//  * sink - pointer to the sink to set up
+void usbManager_initCodedSink(SweepSink * sink)
+{
+	sink->begin   = usbManager_codedSinkBegin;
+	sink->point   = usbManager_codedSinkPoint;
+	sink->end     = usbManager_codedSinkEnd;
+	sink->context = &m_encoder;
+	sink->count   = 0;
+}
+
+// Lets the python script know a sweep is coming
+// Returns:
+//  true if write success
+//  false if write fail
+static bool usbManager_sendStart(void)
+{
+	uint8_t start[1] = {3};
+	return usbManager_writeBytes(start, 1);
+}
+
+// Sends one data point of a sweep
+// Arguments:
+//  freq - the frequency of the point
+//  real - the real impedance of the point
+//  imag - the imaginary impedance of the point
+// Returns:
+//  true if write success
+//  false if write fail
+static bool usbManager_sendPoint(uint32_t freq, uint16_t real, uint16_t imag)
+{
+	uint8_t buff[8];		      // buffer to store data points
+	uint8_t * sel;			     //	pointer to select each byte in data
+	
+	// cut up frequency into bytes
+	sel = (uint8_t *) &freq;
+	buff[0] = sel[0];
+	buff[1] = sel[1];
+	buff[2] = sel[2];
+	buff[3] = sel[3];
+
+	// copy the real and imaginary impedance values
+	sel = (uint8_t *) &real;
+	buff[4] = sel[0];
+	buff[5] = sel[1];
+	
+	sel = (uint8_t *) &imag;
+	buff[6] = sel[0];
+	buff[7] = sel[1];
+
+	// send all the data over usb
+	return usbManager_writeBytes(buff, 8);
+}
+
+// Sends a blank data point to let the python script know the sweep is done
+// Returns:
+//  true if write success
+//  false if write fail
+static bool usbManager_sendEnd(void)
+{
+	uint8_t done[8] = {0};
+	return usbManager_writeBytes(done, 8);
+}
+
+// Sends one calibrated data point of a sweep
+// Arguments:
+//  freq      - the frequency of the point
+//  magnitude - |Z| of the point (ohms with CAL_Z_FRAC fraction bits)
+//  phase     - the phase of the point (0.01 degree)
+// Returns:
+//  true if write success
+//  false if write fail
+static bool usbManager_sendCalibratedPoint(uint32_t freq, uint32_t magnitude, int16_t phase)
+{
+	uint8_t buff[10];
+	
+	memcpy(&buff[0], &freq, 4);
+	memcpy(&buff[4], &magnitude, 4);
+	memcpy(&buff[8], &phase, 2);
+	
+	return usbManager_writeBytes(buff, 10);
+}
+
+// Sends a blank calibrated data point to let the python script know the sweep is done
+// Returns:
+//  true if write success
+//  false if write fail
+static bool usbManager_sendCalibratedEnd(void)
+{
+	uint8_t done[10] = {0};
+	return usbManager_writeBytes(done, 10);
+}
+
+// Sends the coded bytes waiting in an encoder
+// Arguments:
+//  * enc - pointer to the encoder
+// Returns:
+//  true if write success
+//  false if write fail
+static bool usbManager_sendCoded(SweepEncoder * enc)
+{
+	uint8_t buff[USB_CODED_CHUNK + 1];
+	
+	while ((buff[0] = sweepCodec_take(enc, &buff[1], USB_CODED_CHUNK)) > 0)
+	{
+		if (!usbManager_writeBytes(buff, buff[0] + 1)) return false;
+	}
+	
+	return true;
+}
+
+// Ends a coded sweep with a length of 0 and the number of points
+// Arguments:
+//  numPoints - the number of points coded
+// Returns:
+//  true if write success
+//  false if write fail
+static bool usbManager_sendCodedEnd(uint32_t numPoints)
+{
+	uint8_t buff[5] = {0};
+	
+	memcpy(&buff[1], &numPoints, 4);
+	return usbManager_writeBytes(buff, 5);
+}
+
+// Sends one record of a saved sweep as a segment, the coded bytes are written from flash in place
+// Arguments:
+//  * chunk - pointer to the chunk of the record, a size of 0 sends the end of the sweep
+// Returns:
+//  true if write success
+//  false if write fail
+static bool usbManager_sendSegment(SweepChunk const * chunk)
+{
+	uint16_t header[2] = {chunk->size, chunk->size > 0 ? chunk->record->numPoints : 0};
+	uint32_t sent = 0;
+	
+	if (!usbManager_writeBytes(header, sizeof(header))) return false;
+	
+	while (sent < chunk->size)
+	{
+		uint32_t num_bytes = chunk->size - sent;
+		if (num_bytes > USB_SEGMENT_CHUNK) num_bytes = USB_SEGMENT_CHUNK;
+		
+		// the flash is not changed while the record is open, so it can be sent from in place
+		if (!usbManager_writeBytes((void *) (chunk->data + sent), num_bytes)) return false;
+		sent += num_bytes;
+	}
+	
+	return true;
+}
+
+// Starts a usb sink
+static bool usbManager_sinkBegin(SweepSink * sink, MetaData const * metadata)
+{
+	return usbManager_sendStart();
+}
+
+// Sends a point given to a usb sink, the raw points only carry the frequency and not the setting
+// of an auto ranged point (POINT_SETTING), the coded and calibrated sinks keep it
+static bool usbManager_sinkPoint(SweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag)
+{
+	return usbManager_sendPoint(freq & POINT_FREQ_MASK, real, imag);
+}
+
+// Ends a usb sink, a failed sweep is cut short by the blank point
+static bool usbManager_sinkEnd(SweepSink * sink, MetaData * metadata, bool success)
+{
+#ifdef DEBUG_USB
+	NRF_LOG_INFO("Streamed %d points over usb", sink->count);
+	NRF_LOG_FLUSH();
+#endif
+	return usbManager_sendEnd();
+}
+
+// Converts a point given to a calibrated usb sink and sends it
+static bool usbManager_calibratedSinkPoint(SweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag)
+{
+	uint32_t magnitude;
+	int16_t phase;
+	
+	if (!calibration_apply((CalTable const *) sink->context, freq, real, imag, &magnitude, &phase)) return false;
+	
+	return usbManager_sendCalibratedPoint(freq & POINT_FREQ_MASK, magnitude, phase);
+}
+
+// Ends a calibrated usb sink, a failed sweep is cut short by the blank point
+static bool usbManager_calibratedSinkEnd(SweepSink * sink, MetaData * metadata, bool success)
+{
+	return usbManager_sendCalibratedEnd();
+}
+
+// Starts a coded usb sink
+static bool usbManager_codedSinkBegin(SweepSink * sink, MetaData const * metadata)
+{
+	uint8_t start[1] = {5};
+	
+	sweepCodec_initEncoder((SweepEncoder *) sink->context);
+	
+	return usbManager_writeBytes(start, 1);
+}
+
+// Codes a point given to a coded usb sink, the bytes are sent once its block is done
+static bool usbManager_codedSinkPoint(SweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag)
+{
+	SweepEncoder * enc = (SweepEncoder *) sink->context;
+	
+	if (!sweepCodec_encode(enc, freq, SWEEP_CODEC_SAMPLE(real), SWEEP_CODEC_SAMPLE(imag))) return false;
+	
+	return usbManager_sendCoded(enc);
+}
+
+// Ends a coded usb sink, a failed sweep is cut short after the points already coded
+static bool usbManager_codedSinkEnd(SweepSink * sink, MetaData * metadata, bool success)
+{
+	SweepEncoder * enc = (SweepEncoder *) sink->context;
+	
+	if (!sweepCodec_finish(enc) || !usbManager_sendCoded(enc)) return false;
+	
+	return usbManager_sendCodedEnd(enc->count);
+}
+
+// Writes numBytes from buff over USB. The write waits for the TX done event of the write before it, since
+// starting a transfer while one is in progress fails (this was the invalid data error the fixed delays between
+// writes used to hide). A port that is closed or does not take the transfer within USB_TX_TIMEOUT_MS fails the write
 // Arguments:
 //  * buff   - The buffer to write
 //  numBytes - The number of bytes to write over usb
@@ -113,8 +360,25 @@ bool usbManager_writeBytes(void * buff, uint32_t numBytes)
     return false;
   }
   
-  // wait till tx_ready
-  // while (!tx_ready);
+  // wait till the write before is done, the events are only handled while the queue is processed
+  uint32_t waited = 0;
+  while (!tx_ready)
+  {
+    while (app_usbd_event_queue_process());
+    if (tx_ready || !port_open || waited >= USB_TX_TIMEOUT_MS * 1000) break;
+    
+    nrf_delay_us(10);
+    waited += 10;
+  }
+  
+  if (!tx_ready)
+  {
+#ifdef DEBUG_USB
+    NRF_LOG_INFO("USB Write Timeout");
+    NRF_LOG_FLUSH();
+#endif
+    return false;
+  }
 
   // reset tx_ready
   tx_ready = false;
@@ -125,7 +389,8 @@ bool usbManager_writeBytes(void * buff, uint32_t numBytes)
   // check if fail
   if (ret != NRF_SUCCESS)
   {
-		if (ret == NRF_ERROR_BUSY)
+    // no transfer was started, so no TX done event will come
+    tx_ready = port_open;
 #ifdef DEBUG_USB
     NRF_LOG_INFO("USB Write Fail %x", ret);
     NRF_LOG_FLUSH();
@@ -260,6 +525,7 @@ void cdc_acm_user_ev_handler(app_usbd_class_inst_t const * p_inst,
   {
     case APP_USBD_CDC_ACM_USER_EVT_PORT_OPEN:
       {
+        port_open = true;
         tx_ready = true;
         /*Setup first transfer*/
         ret_code_t ret = app_usbd_cdc_acm_read(&m_app_cdc_acm, m_rx_buffer, READ_SIZE);
@@ -268,6 +534,7 @@ void cdc_acm_user_ev_handler(app_usbd_class_inst_t const * p_inst,
       }
     case APP_USBD_CDC_ACM_USER_EVT_PORT_CLOSE:
 		{
+			port_open = false;
 			tx_ready = false;
       rx_ready = false;
       break;
@@ -1,70 +1,102 @@
-/*
- *  usbManager.h
- *
- *  Header file for usbManager.c
- *
- *  Author: Henry Silva
- *
- */
-
-#ifndef INC_USBMANAGER_H_
-#define INC_USBMANAGER_H_
-
-#include <stdbool.h>
-#include <stddef.h>
-#include <stdint.h>
-#include <stdio.h>
-
-#include "nrf.h"
-#include "nrf_drv_usbd.h"
-#include "nrf_drv_clock.h"
-#include "nrf_gpio.h"
-
-#include "app_usbd_core.h"
-#include "app_usbd.h"
-#include "app_usbd_string_desc.h"
-#include "app_usbd_cdc_acm.h"
-#include "app_usbd_serial_num.h"
-#include "app_timer.h"
-
-#include "boards.h"
-
-#include "AD5933.h"
-
-#ifdef DEBUG_USB
-#include "nrf_log.h"
-#include "nrf_log_ctrl.h"
-#include "nrf_log_default_backends.h"
-#endif
-
-// if power detection is enabled
-#ifndef USBD_POWER_DETECTION
-#define USBD_POWER_DETECTION true
-#endif
-
-// LED for USB status
-#define LED_USB_RESUME      1
-
-#define CDC_ACM_COMM_INTERFACE  0
-#define CDC_ACM_COMM_EPIN       NRF_DRV_USBD_EPIN2
-
-#define CDC_ACM_DATA_INTERFACE  1
-#define CDC_ACM_DATA_EPIN       NRF_DRV_USBD_EPIN1
-#define CDC_ACM_DATA_EPOUT      NRF_DRV_USBD_EPOUT1
-
-#define READ_SIZE 1
-#define WRITE_SIZE 32
-
-bool usbManager_sendSweep(uint32_t * freq, uint16_t * real , uint16_t * imag, MetaData * metadata);
-bool usbManager_getByte(uint8_t * buff);
-bool usbManager_writeBytes(void * buff, uint32_t numBytes);
-bool usbManager_readBytes(void * buff, uint32_t numBytes);
-bool usbManager_readReady(void);
-bool usbManager_init(void);
-void usbManager_flush(void);
-
-void cdc_acm_user_ev_handler(app_usbd_class_inst_t const * p_inst, app_usbd_cdc_acm_user_event_t event);
-void usbd_user_ev_handler(app_usbd_event_type_t event);
-static void init_usb(void);
-
-#endif
+/*
+ *  usbManager.h
+ *
+ *  Header file for usbManager.c
+ *
+ *  Author: Henry Silva
+ *
+ */
+
+#ifndef INC_USBMANAGER_H_
+#define INC_USBMANAGER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "nrf.h"
+#include "nrf_drv_usbd.h"
+#include "nrf_drv_clock.h"
+#include "nrf_gpio.h"
+#include "nrf_delay.h"
+
+#include "app_usbd_core.h"
+#include "app_usbd.h"
+#include "app_usbd_string_desc.h"
+#include "app_usbd_cdc_acm.h"
+#include "app_usbd_serial_num.h"
+#include "app_timer.h"
+
+#include "boards.h"
+
+#include "AD5933.h"
+#include "sweepSink.h"
+#include "calibration.h"
+#include "sweepCodec.h"
+#include "flashManager.h"
+
+#ifdef DEBUG_USB
+#include "nrf_log.h"
+#include "nrf_log_ctrl.h"
+#include "nrf_log_default_backends.h"
+#endif
+
+// if power detection is enabled
+#ifndef USBD_POWER_DETECTION
+#define USBD_POWER_DETECTION true
+#endif
+
+// LED for USB status
+#define LED_USB_RESUME      1
+
+#define CDC_ACM_COMM_INTERFACE  0
+#define CDC_ACM_COMM_EPIN       NRF_DRV_USBD_EPIN2
+
+#define CDC_ACM_DATA_INTERFACE  1
+#define CDC_ACM_DATA_EPIN       NRF_DRV_USBD_EPIN1
+#define CDC_ACM_DATA_EPOUT      NRF_DRV_USBD_EPOUT1
+
+#define READ_SIZE 1
+#define WRITE_SIZE 32
+
+#define USB_CODED_CHUNK 62 // most coded bytes in one write, after the length byte
+#define USB_SEGMENT_CHUNK 63 // most bytes of a saved sweep segment in one write
+#define USB_TX_TIMEOUT_MS 100 // longest wait for the write before to be done
+
+bool usbManager_sendSavedSweep(uint32_t sweep_num);
+void usbManager_initSink(SweepSink * sink);
+void usbManager_initCalibratedSink(SweepSink * sink, CalTable const * table);
+void usbManager_initCodedSink(SweepSink * sink);
+bool usbManager_getByte(uint8_t * buff);
+bool usbManager_writeBytes(void * buff, uint32_t numBytes);
+bool usbManager_readBytes(void * buff, uint32_t numBytes);
+bool usbManager_readReady(void);
+bool usbManager_init(void);
+void usbManager_flush(void);
+
+void cdc_acm_user_ev_handler(app_usbd_class_inst_t const * p_inst, app_usbd_cdc_acm_user_event_t event);
+void usbd_user_ev_handler(app_usbd_event_type_t event);
+static void init_usb(void);
+
+// sweep sending helpers
+static bool usbManager_sendStart(void);
+static bool usbManager_sendPoint(uint32_t freq, uint16_t real, uint16_t imag);
+static bool usbManager_sendEnd(void);
+static bool usbManager_sendCalibratedPoint(uint32_t freq, uint32_t magnitude, int16_t phase);
+static bool usbManager_sendCalibratedEnd(void);
+static bool usbManager_sendCoded(SweepEncoder * enc);
+static bool usbManager_sendCodedEnd(uint32_t numPoints);
+static bool usbManager_sendSegment(SweepChunk const * chunk);
+
+// sink functions
+static bool usbManager_sinkBegin(SweepSink * sink, MetaData const * metadata);
+static bool usbManager_sinkPoint(SweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag);
+static bool usbManager_sinkEnd(SweepSink * sink, MetaData * metadata, bool success);
+static bool usbManager_calibratedSinkPoint(SweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag);
+static bool usbManager_calibratedSinkEnd(SweepSink * sink, MetaData * metadata, bool success);
+static bool usbManager_codedSinkBegin(SweepSink * sink, MetaData const * metadata);
+static bool usbManager_codedSinkPoint(SweepSink * sink, uint32_t freq, uint16_t real, uint16_t imag);
+static bool usbManager_codedSinkEnd(SweepSink * sink, MetaData * metadata, bool success);
+
+#endif
@@ -4,11 +4,12 @@ import numpy as np
 import pandas as pd
 import struct
 import time
+import sweepCodec
 
 comPort = 'COM7'
 
 def save_sweeps(gain):
-    numSaved = get_num_saved()
+    (last, numSaved) = get_saved_range()
 
     if (numSaved < 1):
         print('No sweeps on flash to save. Aborting')
@@ -17,9 +18,12 @@ def save_sweeps(gain):
     print('Files will be saved in this format: (filename)_(sweep number). example: ZK18_1')
     name = input('Input a filename: ')
 
-    for i in range(numSaved, 0, -1):
+    for i in range(last, last - numSaved, -1):
         print(f'Saving Sweep #{i}')
-        data = get_sweep(fromFlash=True)
+        data = get_coded_sweep()
+        if data is None:
+            print('Sweep Read Failed')
+            return
         data = calc_impedance(data, gain)
         df = create_dataframe(data)
         print(df)
@@ -30,6 +34,31 @@ def save_sweeps(gain):
 
     return
 
+# saves every sweep on flash converted to impedance by the calibration on the device
+def save_calibrated_sweeps():
+    (last, numSaved) = get_saved_range()
+
+    if (numSaved < 1):
+        print('No sweeps on flash to save. Aborting')
+        return
+
+    print('Files will be saved in this format: (filename)_(sweep number). example: ZK18_1')
+    name = input('Input a filename: ')
+
+    for i in range(last, last - numSaved, -1):
+        print(f'Saving Sweep #{i}')
+        data = get_calibrated_sweep()
+        if data is None:
+            print('No calibration on the device, calibrate with "k" first')
+            return
+        df = create_dataframe(data)
+        print(df)
+        filename = name + '_' + str(i)
+        output_csv(df, filename)
+        time.sleep(1)
+
+    return
+
 def sweep_now():
     data = get_sweep(fromFlash=False)
     df = create_dataframe(data)
@@ -94,30 +123,138 @@ def calc_gain_factor(data, calibration):
         gain.append((d[0], g, ps))
     return gain
 
+# runs a sweep against a calibration resistor and has the device build and save its calibration from it
+def calibrate_device():
+    calibration = int(input('Input the Calibration Resistance (Ohms) : '))
+
+    ser = open_usb()
+    if not (ser):
+        return
+
+    # send the calibrate command followed by the resistance (4 byte int)
+    ser.write(bytes([5]) + calibration.to_bytes(4, "little"))
+
+    # should read 2 back once the sweep is done
+    buff = ser.read(1)
+    ser.close()
+
+    if (int.from_bytes(buff, "little") != 2):
+        print('Calibration Failed')
+    else:
+        print('Calibration Saved To Flash')
+
+    return
+
 def get_num_saved():
+    return get_saved_range()[1]
+
+# returns (the number of the newest sweep, the number of sweeps kept on flash), the oldest sweeps are
+# evicted once the flash fills so the sweeps kept are the newest ones
+def get_saved_range():
     # open usb connection
     ser = open_usb()
     if not ser:
-        return -1
+        return (-1, -1)
 
     # send the get num saved command
     buff = bytes([1])
     ser.write(buff)
     
-    # should get back the number of sweeps (4 byte int)
+    # should get back the number of the newest sweep and the number of sweeps kept (4 byte ints)
+    buff = ser.read(8)
+
+    # convert the numbers of saved sweeps
+    last = int.from_bytes(buff[0:4], "little")
+    num_saved = int.from_bytes(buff[4:8], "little")
+
+    ser.close()
+
+    return (last, num_saved)
+
+# prints the flash usage of the device, in pages of 1024 words
+def print_flash_stats():
+    ser = open_usb()
+    if not ser:
+        return
+
+    ser.write(bytes([8]))
+    buff = ser.read(44)
+    ser.close()
+
+    if (len(buff) != 44):
+        print('Flash Stats Failed')
+        return
+
+    (pages, used, dirty, free, usedWords, dirtyWords, freeWords, first, last, evicted, gcRuns, buffersUsed, buffersPeak, bufferWaits) = struct.unpack('<4H7I2HI', buff)
+
+    print(f'Flash pages: {pages} ({used} used, {dirty} dirty, {free} free)')
+    print(f'Flash words: {usedWords} used, {dirtyWords} dirty, {freeWords} free')
+    print(f'Sweeps kept: #{first} to #{last}, {evicted} evicted and {gcRuns} garbage collections since reset')
+    print(f'Record buffers: {buffersUsed} in use, at most {buffersPeak} at once, {bufferWaits} waits for a write since reset')
+
+# prints the catalog entries of the sweeps kept on flash taken between two times, the device finds them
+# without searching its flash
+def print_catalog(start=0, end=0xFFFFFFFF):
+    ser = open_usb()
+    if not ser:
+        return
+
+    ser.write(bytes([9]) + struct.pack('<2I', start, end))
     buff = ser.read(4)
 
-    # convert and print the number of saved sweeps
-    num_saved = int.from_bytes(buff, "little")
+    if (len(buff) != 4):
+        ser.close()
+        print('Catalog Failed')
+        return
+
+    count = int.from_bytes(buff, "little")
+    print(f'{count} sweeps found')
+
+    # sweep number, head record ID, number of records, then the metadata (time, temp, numPoints)
+    for i in range(count):
+        buff = ser.read(24)
+        if (len(buff) != 24):
+            print('Catalog Failed')
+            break
+
+        (num, record_id, parts, time, temp, points) = struct.unpack('<2IH2xIh2xI', buff)
+        # -32768 (TEMP_UNKNOWN) if the temperature could not be read
+        tempText = 'unknown temperature' if temp == -32768 else f'{temp} C'
+        print(f'Sweep #{num}: time {time}, {tempText}, {points} points in {parts} records')
+
+    ser.close()
+
+# deletes the oldest sweeps kept on flash up to last (all of them by default) and prints how much flash the
+# device got back. The range must start at the oldest sweep kept, and the numbers of deleted sweeps are not used again
+def delete_sweeps(first=0, last=0xFFFFFFFF):
+    ser = open_usb()
+    if not ser:
+        return
 
+    ser.write(bytes([10]) + struct.pack('<2I', first, last))
+    result = ser.read(1)
+    buff = ser.read(24)
     ser.close()
 
-    return num_saved
+    if (len(result) != 1 or len(buff) != 24):
+        print('Delete Failed')
+        return
+
+    (first, last, sweeps, firstKept, reclaimed, elapsed) = struct.unpack('<6I', buff)
+
+    if (result[0] != 2):
+        print(f'Delete Failed after {sweeps} sweeps')
+    elif (sweeps == 0):
+        print('No sweeps to delete')
+    else:
+        print(f'Deleted sweeps #{first} to #{last} ({sweeps} sweeps) in {elapsed} ms, reclaiming {reclaimed} bytes in the background')
+
+    print(f'Oldest sweep kept: #{firstKept}')
 
 # Executes a sweep that is then saved to flash on the nrf
 def execute_sweep():
-    # get the number of sweeps currently saved on flash
-    numSaved = get_num_saved()
+    # get the number of the newest sweep on flash
+    numSaved = get_saved_range()[0]
     print(f'Executing Sweep #{numSaved + 1}')
 
     # open usb connection and check if success
@@ -142,6 +279,8 @@ def execute_sweep():
 # returns a list of tuples with each element a data point in the sweep
 # By default, this gets the next sweep from flash
 # If False is passed, it will execute and get data from a sweep immedietly
+# The data is as measured, auto ranged points are not scaled to range 1 and gain 1 since the raw points do not
+# carry their setting, use get_coded_sweep or get_calibrated_sweep for auto ranged sweeps
 def get_sweep(fromFlash=True):
     # open usb connection and check if success
     ser = open_usb()
@@ -188,6 +327,122 @@ def get_sweep(fromFlash=True):
 
     return data
 
+# returns the next sweep from flash in the same format as get_sweep, sent coded by prototypeCode/sweepCodec.c
+# so it takes a fraction of the bytes (and of the usb writes) of get_sweep
+def get_coded_sweep():
+    ser = open_usb()
+    if not (ser):
+        return
+
+    # send the get coded sweep command, should read 5 or 6 back
+    ser.write(bytes([7]))
+
+    buff = ser.read(1)
+    start = int.from_bytes(buff, "little")
+    if (start != 5 and start != 6):
+        print("Sweep Start Failed")
+        ser.close()
+        return
+
+    coded = bytearray()
+    points = []
+    numPoints = 0
+
+    if (start == 6):
+        # a saved sweep comes straight from flash, one coded stream per record. Each has a header of its
+        # number of bytes and points (2 bytes each) then the bytes, a header of 0 bytes ends the sweep
+        while (True):
+            buff = ser.read(4)
+            if (len(buff) < 4):
+                print("Sweep Read Timed Out")
+                ser.close()
+                return
+            (numBytes, segmentPoints) = struct.unpack('<2H', buff)
+            if (numBytes == 0):
+                break
+            segment = ser.read(numBytes)
+            if (len(segment) < numBytes):
+                print("Sweep Read Timed Out")
+                ser.close()
+                return
+            coded += segment
+            points += sweepCodec.decode(segment, segmentPoints)
+            numPoints += segmentPoints
+    else:
+        # the coded bytes come in writes of a length byte and the bytes, a length of 0 ends the sweep
+        while (True):
+            buff = ser.read(1)
+            if (len(buff) == 0):
+                print("Sweep Read Timed Out")
+                ser.close()
+                return
+            if (buff[0] == 0):
+                break
+            coded += ser.read(buff[0])
+
+        # then the number of points
+        numPoints = int.from_bytes(ser.read(4), "little", signed=False)
+        points = sweepCodec.decode(coded, numPoints)
+
+    ser.close()
+
+    data = []
+    for (freq, real, imag) in points:
+        # scale the data the same as get_sweep
+        scale = setting_scale(freq >> 24)
+        data.append((freq & 0xFFFFFF, real / scale, imag / scale))
+
+    print(f'{numPoints} points in {len(coded)} bytes ({8 * numPoints} bytes uncoded)')
+
+    return data
+
+# returns a list of tuples (frequency, impedance, phase) of the next sweep from flash, converted by the
+# calibration on the device, or None if the device has no calibration
+def get_calibrated_sweep():
+    ser = open_usb()
+    if not (ser):
+        return
+
+    # send the get calibrated sweep command, should read 3 back
+    ser.write(bytes([6]))
+
+    buff = ser.read(1)
+    if (int.from_bytes(buff, "little") != 3):
+        ser.close()
+        return
+
+    data = []
+
+    # each point is the frequency, |Z| in ohms with 8 fraction bits and the phase in 0.01 degree
+    while (True):
+        buff = ser.read(10)
+
+        freq = int.from_bytes(buff[0:4], "little", signed=False)
+        if (freq == 0):
+            break
+
+        mag = int.from_bytes(buff[4:8], "little", signed=False) / 256
+        phase = int.from_bytes(buff[8:10], "little", signed=True) / 100
+
+        data.append((freq, mag, phase))
+
+    ser.close()
+
+    return data
+
+# returns how much larger the data of a point is than at range 1 and gain 1 given the setting byte of the point
+# bit 7 is set if the setting was recorded, bits 2:1 are the range and bit 0 is the gain (0 for gain 5)
+def setting_scale(setting):
+    if not (setting & 0x80):
+        return 1
+
+    # output ranges 2 V, 200 mV, 400 mV, 1 V p-p
+    scale = [1, 0.1, 0.2, 0.5][(setting >> 1) & 0x03]
+    if not (setting & 0x01):
+        scale = scale * 5
+
+    return scale
+
 # sends the current sweep over usb
 def send_sweep(sweep):
     # open a usb connection
@@ -410,8 +665,13 @@ def print_commands():
              p - print the current sweep
              e - edit the current sweep
              c - check if device is connected
+             f - print the flash usage of the device
+             l - list the sweeps kept on the device
+             d - delete the sweeps kept on the device
              s - send the sweep to the sensor
              a - set the number of sweeps to average
              g - calculate multi-point gain factor
+             k - calibrate the device, so it can convert sweeps itself
              x - execute the sweep on the sensor (must send the sweep with "s" first)
-             o - output the impedance data to csv''')
+             o - output the impedance data to csv
+             z - output the impedance data converted by the device to csv''')
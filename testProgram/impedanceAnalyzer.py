@@ -43,10 +43,26 @@ while(1):
         if (num_saved >= 0):
             print(f'Sweeps on flash: {num_saved}')
 
+    elif (cmd == 'f'):
+        af.print_flash_stats()
+
+    elif (cmd == 'l'):
+        af.print_catalog()
+
+    elif (cmd == 'd'):
+        if (input('Delete every sweep kept on the device? (y/n): ') == 'y'):
+            af.delete_sweeps()
+
     elif (cmd == 'o'):
         if (gotGain):
             af.save_sweeps(gain)
 
+    elif (cmd == 'z'):
+        af.save_calibrated_sweeps()
+
+    elif (cmd == 'k'):
+        af.calibrate_device()
+
     elif (cmd == 'a'):
         num_ave = af.set_ave()
 
@@ -0,0 +1,132 @@
+'''
+Decoder for the coded sweeps of prototypeCode/sweepCodec.c, sent by the sensor over USB (command 7)
+and BLE. Each point is coded as its difference from what the last points predict, the frequency from
+a straight line through the last two and the real and imaginary samples from the last ones. The
+differences are zigzag mapped and Rice coded in blocks of BLOCK points, each block starting with the
+Rice parameter of each channel. The last block may be shorter, so the number of points must be known.
+'''
+
+BLOCK = 16        # points in each block
+ESCAPE = 16       # a quotient this large is followed by the raw residual
+K_BITS = 5        # bits of each Rice parameter
+FREQ_BITS = 32    # bits of a raw frequency residual
+SAMPLE_BITS = 16  # bits of a raw real or imaginary residual
+
+
+class StreamEnd(Exception):
+    '''
+        Raised when a block runs past the bytes received so far.
+    '''
+    pass
+
+
+class SweepDecoder:
+    '''
+        Decodes a coded sweep as its bytes come in. feed() returns the points of every block that is
+        complete, a block cut off at the end of the bytes is decoded once the rest arrives.
+    '''
+
+    def __init__(self, num_points):
+        self.data = bytearray()
+        self.bit = 0                 # next bit of data to read
+        self.remaining = num_points  # points not decoded yet
+        self.count = 0               # points decoded
+        self.freq = [0, 0]           # the last two frequencies, freq[0] is the last
+        self.prev = [0, 0]           # the last real and imaginary samples
+
+    def feed(self, data):
+        '''
+            Adds coded bytes and returns a list of (frequency, real, imaginary) tuples of the points they finish.
+        '''
+        self.data += data
+        points = []
+
+        while self.remaining > 0:
+            state = (self.bit, self.freq[:], self.prev[:])
+            try:
+                block = self.decode_block()
+            except StreamEnd:
+                # wait for the rest of the block
+                self.bit, self.freq, self.prev = state
+                break
+            points += block
+
+        return points
+
+    def done(self):
+        return self.remaining == 0
+
+    def get_bits(self, num_bits):
+        if self.bit + num_bits > len(self.data) * 8:
+            raise StreamEnd()
+
+        value = 0
+        for _ in range(num_bits):
+            byte = self.data[self.bit >> 3]
+            value = (value << 1) | ((byte >> (7 - (self.bit & 7))) & 1)
+            self.bit += 1
+
+        return value
+
+    def get_residual(self, k, raw_bits):
+        quotient = 0
+        while quotient < ESCAPE and self.get_bits(1):
+            quotient += 1
+
+        if quotient == ESCAPE:
+            return self.get_bits(raw_bits)
+
+        return ((quotient << k) | self.get_bits(k)) & ((1 << raw_bits) - 1)
+
+    def decode_block(self):
+        count = min(self.remaining, BLOCK)
+        header = self.get_bits(3 * K_BITS)
+        mask = (1 << K_BITS) - 1
+        k = [(header >> (2 * K_BITS)) & mask, (header >> K_BITS) & mask, header & mask]
+
+        if k[1] >= SAMPLE_BITS or k[2] >= SAMPLE_BITS:
+            raise ValueError('Damaged sweep stream')
+
+        freqs = []
+        for i in range(count):
+            residual = unzigzag(self.get_residual(k[0], FREQ_BITS))
+            freq = (2 * self.freq[0] - self.freq[1] + residual) & 0xFFFFFFFF
+
+            # the line through the first point alone is flat
+            self.freq[1] = freq if self.count + i == 0 else self.freq[0]
+            self.freq[0] = freq
+            freqs.append(freq)
+
+        samples = [[], []]
+        for channel in range(2):
+            for i in range(count):
+                residual = unzigzag(self.get_residual(k[channel + 1], SAMPLE_BITS))
+                self.prev[channel] = to_int16(self.prev[channel] + residual)
+                samples[channel].append(self.prev[channel])
+
+        self.remaining -= count
+        self.count += count
+
+        return list(zip(freqs, samples[0], samples[1]))
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def to_int16(value):
+    value &= 0xFFFF
+    return value - 0x10000 if value & 0x8000 else value
+
+
+def decode(data, num_points):
+    '''
+        Decodes a whole coded sweep, returns a list of (frequency, real, imaginary) tuples.
+    '''
+    decoder = SweepDecoder(num_points)
+    points = decoder.feed(data)
+
+    if not decoder.done():
+        raise ValueError(f'Sweep stream ended after {len(points)} of {num_points} points')
+
+    return points